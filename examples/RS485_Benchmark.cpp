@@ -0,0 +1,32 @@
+/**
+ *  Modbus benchmark example:
+ *  The purpose of this example is to time the frame path of the library
+ *  (CRC, query encoding, reception, validation, decoding and slave
+ *  processing) without any Modbus device attached.
+ *  The engines run on simulated ports, so no RS485 wiring is needed.
+ *
+ *  Results are printed through USB as CSV:
+ *  bench,fct,frame_bytes,iterations,ns_per_frame,bytes_per_s
+ *  In a Linux box, run
+ *  "cat /dev/ttyACM0 > bench.csv" and compare runs with any CSV tool.
+ *  The same suite runs on a host with the CMake build:
+ *  "cmake -S . -B build && cmake --build build && build/modbus_bench".
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusBench.h"
+
+ModbusBench bench( &Serial, 1000 ); // 1000 runs per result
+
+void setup() {
+  Serial.begin(115200);
+  while(!Serial.available());
+
+  bench.run();
+}
+
+void loop() {
+}
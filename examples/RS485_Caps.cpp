@@ -0,0 +1,82 @@
+/**
+ *  Modbus master capability cache example:
+ *  The purpose of this example is to poll slaves that refuse large reads
+ *  or have unmapped registers, without knowing their limits beforehand.
+ *  The plan merges the meter registers into one 92-register read; the
+ *  cache learns from the exceptions the meter answers, probes the read
+ *  for the largest size it accepts and its unmapped registers, and the
+ *  plan splits its reads accordingly. What was learned is kept in EEPROM,
+ *  so after a restart the right reads are sent from the first poll.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+#include "ModbusPlan.h"
+#include "ModbusCaps.h"
+
+#define TXEN_PIN A2
+#define EEPROM_CAPS 0 // EEPROM address of the cache: size (2 bytes), then binary form
+
+char szPlan[] =
+  "device 1 ABCD 20       # meter, gaps up to 20 registers read through\n"
+  "holding 0 uint16*28 1000 status\n"
+  "holding 42 uint16*50 1000 measure\n";
+
+modbus_point_t aPoints[96];
+modbus_batch_t aBatches[16];
+uint16_t au16data[128];
+modbus_caps_t aCaps[4];
+modbus_hole_t aHoles[8];
+uint8_t au8caps[8 + 4 * 24 + 8 * 7];
+
+Modbus master(0, 1, TXEN_PIN);
+ModbusPlan plan(&master, aPoints, 96, aBatches, 16, au16data, 128);
+ModbusCaps caps(aCaps, 4, aHoles, 8);
+int16_t i16saved;
+unsigned long u32wait;
+
+void setup() {
+  Serial.begin( 9600 );
+  master.begin( 19200 );
+  master.setTimeOut( 200 );
+
+  // what was learned before the restart
+  uint16_t u16size = word( EEPROM.read( EEPROM_CAPS + 1 ), EEPROM.read( EEPROM_CAPS ));
+  if (u16size <= sizeof( au8caps )) {
+    for (uint16_t i = 0; i < u16size; i++) au8caps[ i ] = EEPROM.read( EEPROM_CAPS + 2 + i );
+    Serial.printlnf( "%d slaves known", caps.load( au8caps, u16size ));
+  }
+
+  plan.load( szPlan );
+  plan.setCaps( &caps );
+  i16saved = caps.save( au8caps, sizeof( au8caps ));
+  u32wait = millis() + 1000;
+}
+
+void loop() {
+  plan.poll();
+
+  if (millis() > u32wait) {
+    u32wait += 1000;
+    Serial.printlnf( "%u reads, meter reads up to %u registers, %u holes",
+      plan.getBatches(), caps.getMaxRead( 0, 1, MB_FC_READ_REGISTERS ), caps.getHoles() );
+
+    // keep the cache once it changed and no probe runs
+    uint8_t au8now[sizeof( au8caps )];
+    int16_t i16size = caps.save( au8now, sizeof( au8now ));
+    if (!caps.isProbing() && i16size > 0 &&
+      (i16size != i16saved || memcmp( au8now, au8caps, i16size ) != 0)) {
+      memcpy( au8caps, au8now, i16size );
+      i16saved = i16size;
+      EEPROM.write( EEPROM_CAPS, lowByte( i16size ));
+      EEPROM.write( EEPROM_CAPS + 1, highByte( i16size ));
+      for (int16_t i = 0; i < i16size; i++) EEPROM.write( EEPROM_CAPS + 2 + i, au8caps[ i ] );
+    }
+  }
+}
@@ -0,0 +1,56 @@
+/**
+ *  Modbus report-by-exception example:
+ *  The purpose of this example is to print only the registers that
+ *  changed, instead of the whole data array after each query.
+ *  A filter watches the data array; registers 0..3 carry noisy analog
+ *  values and move less than their deadband are ignored.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ *
+ *  In a Linux box, run
+ *  "./diagslave /dev/ttyUSB0 -b 19200 -d 8 -s 1 -p none -m rtu -a 1"
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+
+#define TXEN_PIN A2
+#define RXEN_PIN DAC
+Modbus master(0, 1, TXEN_PIN, RXEN_PIN);
+
+#define DATA_LENGTH 40
+uint16_t au16data[DATA_LENGTH];
+const uint16_t au16deadband[DATA_LENGTH] = { 10, 10, 10, 10 }; // others report any change
+uint16_t au16changed[(DATA_LENGTH + 15) / 16];
+modbus_filter_t filter = { au16data, DATA_LENGTH, false, au16deadband, au16changed };
+
+modbus_t telegram[2] = {
+  { 1, MB_FC_READ_REGISTERS, 0, 20, au16data },
+  { 1, MB_FC_READ_INPUT_REGISTER, 0, 20, au16data + 20 }
+};
+uint8_t u8query;
+
+void setup() {
+  Serial.begin( 9600 );
+  master.begin( 19200 );
+  master.setTimeOut( 1000 );
+  master.addFilter( &filter );
+  u8query = 0;
+  master.query( telegram[ u8query ] );
+}
+
+void loop() {
+  master.poll();
+  if (master.getState() != COM_IDLE) return;
+
+  for (int32_t n = master.nextChange( &filter ); n >= 0; n = master.nextChange( &filter, n )) {
+    Serial.printlnf( "au16data[%ld] = %u", n, au16data[ n ] );
+  }
+
+  u8query = (u8query + 1) % 2;
+  master.query( telegram[ u8query ] );
+}
@@ -0,0 +1,72 @@
+/**
+ *  Modbus shared register image example:
+ *  The purpose of this example is to poll register blocks once and let
+ *  several application threads read them. loop() owns the bus and
+ *  publishes each block into a ModbusImage; the HMI and historian threads
+ *  take consistent snapshots without locking and without waiting for the
+ *  bus, and the historian skips the blocks that were not published again.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ *
+ *  In a Linux box, run
+ *  "./diagslave /dev/ttyUSB0 -b 19200 -d 8 -s 1 -p none -m rtu -a 1"
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+SYSTEM_THREAD(ENABLED);
+
+#include "ModbusImage.h"
+
+#define TXEN_PIN A2
+#define RXEN_PIN DAC
+Modbus master(0, 1, TXEN_PIN, RXEN_PIN);
+ModbusImage image( &master );
+
+int8_t i8process; // fast changing values
+int8_t i8counters; // slow changing values
+
+void hmi() {
+  uint16_t au16temp[ 2 ];
+
+  while (true) {
+    uint8_t u8quality = image.read( i8process, 4, 2, au16temp );
+    if (u8quality == IMAGE_GOOD) Log.info( "temp %u %u", au16temp[ 0 ], au16temp[ 1 ] );
+    else Log.warn( "temp unavailable" );
+    delay( 200 );
+  }
+}
+
+void historian() {
+  uint16_t au16data[ 20 ];
+  uint32_t u32seq = 0;
+  uint32_t u32stamp;
+
+  while (true) {
+    if (image.getSeq( i8counters ) != u32seq) {
+      u32seq = image.getSeq( i8counters );
+      if (image.read( i8counters, 100, 20, au16data, &u32stamp ) == IMAGE_GOOD) {
+        Log.info( "counters at %lu: %u ...", u32stamp, au16data[ 0 ] );
+      }
+    }
+    delay( 1000 );
+  }
+}
+
+Thread *hmiThread;
+Thread *historianThread;
+
+void setup() {
+  master.begin( 19200 );
+  master.setTimeOut( 1000 );
+  i8process = image.addBlock( 1, MB_FC_READ_REGISTERS, 0, 10, 100 );
+  i8counters = image.addBlock( 1, MB_FC_READ_INPUT_REGISTER, 100, 20, 5000 );
+  hmiThread = new Thread( "hmi", hmi );
+  historianThread = new Thread( "historian", historian );
+}
+
+void loop() {
+  image.poll();
+}
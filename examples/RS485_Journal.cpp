@@ -0,0 +1,55 @@
+/**
+ *  Modbus slave write journal example:
+ *  The purpose of this example is to act on the setpoints a master writes
+ *  without comparing the whole register map at every loop. The slave
+ *  journals each write it applies; loop() only handles what changed.
+ *  Registers 0..99 are setpoints: the write log goes to Serial, then
+ *  each written register is applied once.
+ *
+ *  Recommended Modbus Master: QModbus
+ *  http://qmodbus.sourceforge.net/
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+
+#define TXEN_PIN D4
+
+#define DATA_LENGTH 100
+uint16_t au16data[DATA_LENGTH];
+uint16_t au16dirty[(DATA_LENGTH + 15) / 16];
+modbus_change_t aChanges[8];
+modbus_journal_t journal = { au16dirty, DATA_LENGTH, aChanges, 8 };
+
+Modbus slave(1, 0, TXEN_PIN);
+
+void applySetpoint( uint16_t u16reg, uint16_t u16value ) {
+  // drive the process with the new value
+}
+
+void setup() {
+  Serial.begin( 9600 );
+  slave.setJournal( &journal );
+  slave.begin( 19200 );
+}
+
+void loop() {
+  slave.poll( au16data, DATA_LENGTH );
+
+  modbus_change_t change;
+  while (slave.consumeChanges( &change, 1 ) > 0) {
+    Serial.printlnf( "%lu: fc %u wrote %u from %u", change.u32stamp, change.u8fct,
+      change.u16CoilsNo, change.u16RegAdd );
+  }
+  if (journal.u16lost > 0) {
+    Serial.printlnf( "%u writes not logged", journal.u16lost );
+    journal.u16lost = 0;
+  }
+
+  for (int32_t n = slave.nextWrite(); n >= 0; n = slave.nextWrite( n )) {
+    applySetpoint( n, au16data[ n ] );
+  }
+}
@@ -0,0 +1,59 @@
+/**
+ *  Modbus full-size frames example:
+ *  The purpose of this example is to move the largest blocks the protocol
+ *  allows in a single query: 125 holding registers read, 123 registers
+ *  written, 2000 coils read and 1968 coils written. Every answer or
+ *  request is 255 bytes long on the line. query() refuses one more
+ *  register or coil with -4.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ *
+ *  In a Linux box, run
+ *  "./diagslave /dev/ttyUSB0 -b 19200 -d 8 -s 1 -p none -m rtu -a 1"
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+
+#define TXEN_PIN A2
+#define RXEN_PIN DAC
+Modbus master(0, 1, TXEN_PIN, RXEN_PIN);
+
+uint16_t au16regs[MB_MAX_READ_REGISTERS];
+uint16_t au16coils[(MB_MAX_READ_COILS + 15) / 16];
+
+modbus_t telegram[4] = {
+  { 1, MB_FC_READ_REGISTERS, 0, MB_MAX_READ_REGISTERS, au16regs },
+  { 1, MB_FC_WRITE_MULTIPLE_REGISTERS, 200, MB_MAX_WRITE_REGISTERS, au16regs },
+  { 1, MB_FC_READ_COILS, 0, MB_MAX_READ_COILS, au16coils },
+  { 1, MB_FC_WRITE_MULTIPLE_COILS, 2000, MB_MAX_WRITE_COILS, au16coils }
+};
+uint8_t u8query;
+
+void setup() {
+  Serial.begin( 9600 );
+  master.begin( 19200 );
+  master.setTimeOut( 2000 );
+
+  modbus_t tooLarge = telegram[ 0 ];
+  tooLarge.u16CoilsNo++;
+  Serial.printlnf( "%u registers: query %d", tooLarge.u16CoilsNo, master.query( tooLarge ));
+
+  u8query = 0;
+  master.query( telegram[ u8query ] );
+}
+
+void loop() {
+  master.poll();
+  if (master.getState() != COM_IDLE) return;
+
+  Serial.printlnf( "fc %u, %u points: error %u", telegram[ u8query ].u8fct,
+    telegram[ u8query ].u16CoilsNo, master.getLastError() );
+
+  u8query = (u8query + 1) % 4;
+  master.query( telegram[ u8query ] );
+}
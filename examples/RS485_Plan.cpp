@@ -0,0 +1,73 @@
+/**
+ *  Modbus master poll plan example:
+ *  The purpose of this example is to poll a site described by a
+ *  configuration instead of telegram assignments. The plan below reads a
+ *  power meter (slave 1, low word first) and an I/O module (slave 2);
+ *  load() compiles it into the fewest reads, and poll() reads each one at
+ *  its period. On a Linux host the same text is loaded from a file and
+ *  save() turns it into the binary form, small enough for flash.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+#include "ModbusPlan.h"
+
+#define TXEN_PIN A2
+
+char szPlan[] =
+  "device 1 CDAB 4        # power meter\n"
+  "holding 3000 float*3 1000 voltage\n"
+  "holding 3006 float*3 1000 current\n"
+  "holding 3100 uint64 60000 energy\n"
+  "holding 5000 string*8 60000 serial\n"
+  "device 2               # I/O module\n"
+  "coil 0 bit*8 200 relay\n"
+  "input 0 int16*4 500 temperature\n";
+
+modbus_point_t aPoints[32];
+modbus_batch_t aBatches[8];
+uint16_t au16data[64];
+
+Modbus master(0, 1, TXEN_PIN);
+ModbusPlan plan(&master, aPoints, 32, aBatches, 8, au16data, 64);
+unsigned long u32wait;
+
+void setup() {
+  Serial.begin( 9600 );
+  master.begin( 19200 );
+  master.setTimeOut( 200 );
+
+  int16_t i16points = plan.load( szPlan );
+  if (i16points < 0) {
+    Serial.printlnf( "plan error %d at line %u", i16points, plan.getErrorAt() );
+  } else {
+    Serial.printlnf( "%d points in %u reads", i16points, plan.getBatches() );
+  }
+  u32wait = millis() + 1000;
+}
+
+void loop() {
+  plan.poll();
+
+  if (millis() > u32wait) {
+    u32wait += 1000;
+    int16_t i16voltage = plan.find( "voltage" );
+    if (i16voltage >= 0 && plan.isValid( i16voltage )) {
+      for (uint8_t i = 0; i < 3; i++) {
+        Serial.printlnf( "L%u: %.1f V", i + 1, plan.get( plan.find( 1, MB_FC_READ_REGISTERS, 3000 + 2 * i )));
+      }
+    }
+    int16_t i16serial = plan.find( "serial" );
+    if (i16serial >= 0 && plan.isValid( i16serial )) {
+      char szSerial[17];
+      plan.getString( i16serial, szSerial, sizeof( szSerial ));
+      Serial.printlnf( "meter %s", szSerial );
+    }
+  }
+}
@@ -0,0 +1,84 @@
+/**
+ *  Modbus master task example:
+ *  The purpose of this example is to write sequential master logic as
+ *  straight code. A recipe download reads the current set points, writes
+ *  the new ones and reads them back to verify them, while a monitor task
+ *  keeps reading the process values on the same bus.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ *
+ *  In a Linux box, run
+ *  "./diagslave /dev/ttyUSB0 -b 19200 -d 8 -s 1 -p none -m rtu -a 1"
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusTask.h"
+
+#define TXEN_PIN A2
+#define RXEN_PIN DAC
+Modbus master(0, 1, TXEN_PIN, RXEN_PIN);
+ModbusSequencer sequencer( &master );
+
+/**
+ * Download 10 set points to slave 1 at address 100 and verify them
+ */
+class Recipe : public ModbusTask {
+  uint16_t au16old[ 10 ], au16new[ 10 ], au16check[ 10 ];
+  uint8_t i;
+
+  uint8_t run() {
+    TASK_BEGIN();
+    TASK_AWAIT( readHolding( 1, 100, 10, au16old ));
+    if (result.u8status != RESULT_OK) TASK_EXIT();
+
+    for (i = 0; i < 10; i++) au16new[ i ] = au16old[ i ] + 1;
+    TASK_AWAIT( writeMultiple( 1, 100, 10, au16new ));
+    TASK_AWAIT( readHolding( 1, 100, 10, au16check ));
+
+    if (result.u8status == RESULT_OK && memcmp( au16new, au16check, sizeof( au16new )) == 0) {
+      Serial.println( "recipe verified" );
+    } else {
+      Serial.printlnf( "recipe failed: status %u exception %u", result.u8status, result.u8exception );
+    }
+    TASK_END();
+  }
+};
+
+/**
+ * Read the process values every second
+ */
+class Monitor : public ModbusTask {
+  uint16_t au16values[ 4 ];
+  uint32_t u32next;
+
+  uint8_t run() {
+    TASK_BEGIN();
+    while (true) {
+      TASK_AWAIT( readInput( 1, 0, 4, au16values ));
+      if (result.u8status == RESULT_OK) Serial.printlnf( "value %u", au16values[ 0 ] );
+
+      u32next = millis() + 1000;
+      TASK_WAIT_UNTIL( millis() >= u32next );
+    }
+    TASK_END();
+  }
+};
+
+Recipe recipe;
+Monitor monitor;
+
+void setup() {
+  Serial.begin( 115200 );
+  master.begin( 19200 );
+  master.setTimeOut( 1000 );
+  sequencer.add( &recipe );
+  sequencer.add( &monitor );
+}
+
+void loop() {
+  sequencer.poll();
+}
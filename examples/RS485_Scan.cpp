@@ -0,0 +1,56 @@
+/**
+ *  Modbus master address discovery example:
+ *  The purpose of this example is to list the slaves of a new segment.
+ *  Every address from 1 to 247 is probed with a one-register read and a
+ *  time-out derived from the baud rate; each responder is then asked
+ *  which read functions it supports and how large a read it accepts.
+ *  What is found goes to a capability cache, which a poll plan can
+ *  consult with ModbusPlan::setCaps().
+ *  At 115200 bps the whole segment is scanned in about 5 s; lower the
+ *  inter-frame silence with setT35() to go faster on a clean line.
+ *  Several ports can be added with addPort(), they are scanned at once.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+#include "ModbusScan.h"
+
+#define TXEN_PIN A2
+
+Modbus master(0, 1, TXEN_PIN);
+modbus_caps_t aCaps[32];
+modbus_hole_t aHoles[16];
+ModbusCaps caps(aCaps, 32, aHoles, 16);
+ModbusScan scan(&caps);
+boolean bScanning;
+unsigned long u32start;
+
+void setup() {
+  Serial.begin( 9600 );
+  master.begin( 115200 );
+  scan.addPort( &master );
+
+  u32start = millis();
+  scan.begin();
+  bScanning = true;
+}
+
+void loop() {
+  if (!bScanning) return;
+  if (scan.poll()) return;
+
+  bScanning = false;
+  Serial.printlnf( "%u slaves found in %lu ms", scan.getFound(), millis() - u32start );
+  for (uint16_t i = 0; i < caps.getCount(); i++) {
+    const modbus_caps_t *slave = caps.get( i );
+    Serial.printlnf( "slave %u: functions %02X, reads up to %u coils %u inputs %u holding %u input registers, %lu us",
+      slave->u8id, slave->u8fcts, slave->au16maxRead[ 0 ], slave->au16maxRead[ 1 ],
+      slave->au16maxRead[ 2 ], slave->au16maxRead[ 3 ], slave->u32latency );
+  }
+}
@@ -0,0 +1,55 @@
+/**
+ *  Modbus slave snapshot example:
+ *  The purpose of this example is to publish 32-bit values from another
+ *  thread without a master ever reading half of one. The acquisition
+ *  thread writes a float (registers 0..1) and a counter (registers 2..3)
+ *  between beginUpdate() and endUpdate(); a read overlapping an update
+ *  is copied again, so every answer holds the values of one update.
+ *
+ *  Recommended Modbus Master: QModbus
+ *  http://qmodbus.sourceforge.net/
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+SYSTEM_THREAD(ENABLED);
+
+#include "ModbusRtu.h"
+
+#define TXEN_PIN D4
+#define SENSOR_PIN A0
+
+uint16_t au16data[16];
+Modbus slave(1, 0, TXEN_PIN);
+
+void acquisition() {
+  uint32_t u32samples = 0;
+
+  while (true) {
+    float fVolts = analogRead( SENSOR_PIN ) * 3.3f / 4095;
+    uint32_t u32bits;
+    memcpy( &u32bits, &fVolts, sizeof( u32bits ));
+    u32samples++;
+
+    slave.beginUpdate();
+    au16data[ 0 ] = u32bits >> 16;
+    au16data[ 1 ] = u32bits & 0xFFFF;
+    au16data[ 2 ] = u32samples >> 16;
+    au16data[ 3 ] = u32samples & 0xFFFF;
+    slave.endUpdate();
+
+    delay( 10 );
+  }
+}
+
+Thread *acquisitionThread;
+
+void setup() {
+  slave.begin( 19200 );
+  acquisitionThread = new Thread( "acquisition", acquisition );
+}
+
+void loop() {
+  slave.poll( au16data, 16 );
+}
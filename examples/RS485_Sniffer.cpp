@@ -0,0 +1,42 @@
+/**
+ *  Modbus sniffer example:
+ *  The purpose of this example is to record all the traffic of an
+ *  RS485 bus without taking part in it.
+ *  Frames are timestamped in us, requests are paired with their answers
+ *  and the capture is streamed through USB as a pcap file.
+ *
+ *  In a Linux box, run
+ *  "cat /dev/ttyACM0 > bus.pcap" and open bus.pcap with Wireshark
+ *  (DLT_USER0 frames).
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+
+/**
+ *  Modbus object declaration
+ *  u8id : MODBUS_SNIFFER, the transceiver is never switched to transmit
+ *  u8serno : serial port (use 0 for Serial)
+ *  u8txenpin : 0 for RS-232 and USB-FTDI
+ *               or any pin number > 1 for RS-485
+ *  u8rxenpin : 0 for RS-232 and USB-FTDI
+ *               or any pin number > 1 for RS-485
+ */
+#define TXEN_PIN A2
+#define RXEN_PIN DAC
+Modbus sniffer(MODBUS_SNIFFER, 1, TXEN_PIN, RXEN_PIN);
+
+void setup() {
+  Serial.begin(115200);
+  while(!Serial.available());
+
+  sniffer.begin( 115200 ); // baud-rate of the bus under test
+  sniffer.setCapture( &Serial, CAPTURE_PCAP );
+}
+
+void loop() {
+  sniffer.sniff(); // keep loop() short, the UART buffer holds 64 bytes only
+}
@@ -0,0 +1,46 @@
+/**
+ *  Modbus slave stress example:
+ *  The purpose of this example is to measure how fast the slave engine
+ *  turns requests around under load, without any Modbus master attached.
+ *  A load generator fires a mix of reads and writes, some of them for
+ *  another slave address, first back to back then at an offered rate.
+ *
+ *  Results are printed through USB as CSV:
+ *  requests,answered,foreign,late,lost,p50_us,p90_us,p99_us,max_us,req_per_s
+ *  The first runs keep the 5 ms inter-frame silence of a real line, the
+ *  last one sets it to 0 to show the processing time alone.
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusStress.h"
+
+// data array for modbus network sharing
+uint16_t au16data[ 128 ];
+
+ModbusLoopback port;
+Modbus slave( 1, &port ); // slave 1 on a simulated port
+ModbusStress stress( &slave, &port, au16data, 128 );
+
+void setup() {
+  Serial.begin(115200);
+  while(!Serial.available());
+
+  // FC1, 3, 6 and 16, up to 32 registers, 10% for slave 2
+  stress.setMix( (1 << 1) | (1 << 3) | (1 << 6) | (1 << 16), 32, 10 );
+
+  stress.run( 200 ); // back to back
+  stress.report( &Serial );
+
+  stress.run( 200, 20000 ); // one request every 20 ms
+  stress.report( &Serial );
+
+  slave.setT35( 0 );
+  stress.run( 1000 );
+  stress.report( &Serial );
+}
+
+void loop() {
+}
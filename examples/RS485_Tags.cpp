@@ -0,0 +1,88 @@
+/**
+ *  Modbus master typed data example:
+ *  The purpose of this example is to read the typed points of a power
+ *  meter without decoding register pairs by hand. The meter sends its
+ *  values low word first (ORDER_CDAB): voltages and currents as floats,
+ *  the energy as a 64-bit counter and its serial number as a string.
+ *  The tag map declares them once; each answer is decoded in one pass.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+#include "ModbusTags.h"
+
+#define TXEN_PIN A2
+
+#define DATA_LENGTH 24
+uint16_t au16data[DATA_LENGTH];
+
+const modbus_tag_t meterTags[] = {
+  { "voltage L1", 0, TAG_FLOAT, 0 },
+  { "voltage L2", 2, TAG_FLOAT, 0 },
+  { "voltage L3", 4, TAG_FLOAT, 0 },
+  { "current L1", 6, TAG_FLOAT, 0 },
+  { "current L2", 8, TAG_FLOAT, 0 },
+  { "current L3", 10, TAG_FLOAT, 0 },
+  { "energy Wh", 12, TAG_UINT64, 0 },
+  { "status", 16, TAG_UINT16, 0 },
+  { "serial", 17, TAG_STRING, 6 }
+};
+#define METER_TAGS (sizeof( meterTags ) / sizeof( meterTags[ 0 ] ))
+
+ModbusTags meter( meterTags, METER_TAGS, ORDER_CDAB );
+double adValues[METER_TAGS];
+
+Modbus master(0, 1, TXEN_PIN);
+modbus_t telegram;
+uint8_t u8state;
+unsigned long u32wait;
+
+void setup() {
+  Serial.begin( 9600 );
+
+  telegram.u8id = 1; // slave address
+  telegram.u8fct = 3; // function code (this one is registers read)
+  telegram.u16RegAdd = 0; // start address in slave
+  telegram.u16CoilsNo = DATA_LENGTH - 1; // every register of the tag map
+  telegram.au16reg = au16data; // pointer to a memory array in the Arduino
+
+  master.begin( 19200 );
+  master.setTimeOut( 2000 );
+  u32wait = millis() + 1000;
+  u8state = 0;
+}
+
+void loop() {
+  switch( u8state ) {
+  case 0:
+    if (millis() > u32wait) u8state++; // wait state
+    break;
+  case 1:
+    master.query( telegram );
+    u8state++;
+    break;
+  case 2:
+    master.poll();
+    if (master.getState() == COM_IDLE) {
+      u8state = 0;
+      u32wait = millis() + 1000;
+
+      if (master.getLastError() == 0) {
+        meter.decode( au16data, adValues );
+        for (uint8_t i = 0; i < METER_TAGS - 1; i++) {
+          Serial.printlnf( "%s: %.2f", meterTags[ i ].szName, adValues[ i ] );
+        }
+        char szSerial[13];
+        meter.getString( au16data, meter.find( "serial" ), szSerial, sizeof( szSerial ));
+        Serial.printlnf( "serial: %s", szSerial );
+      }
+    }
+    break;
+  }
+}
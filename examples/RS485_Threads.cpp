@@ -0,0 +1,72 @@
+/**
+ *  Modbus multi-thread master example:
+ *  The purpose of this example is to share one master between several
+ *  application threads. Each thread submits its own requests to a
+ *  ModbusQueue and waits for their completion; loop() owns the bus and
+ *  is the only one to drive the master.
+ *
+ *  Recommended Modbus slave:
+ *  diagslave http://www.modbusdriver.com/diagslave.html
+ *
+ *  In a Linux box, run
+ *  "./diagslave /dev/ttyUSB0 -b 19200 -d 8 -s 1 -p none -m rtu -a 1"
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+SYSTEM_THREAD(ENABLED);
+
+#include "ModbusQueue.h"
+
+#define TXEN_PIN A2
+#define RXEN_PIN DAC
+Modbus master(0, 1, TXEN_PIN, RXEN_PIN);
+ModbusQueue queue( &master );
+
+/**
+ * Submit a request and wait for it. Other threads keep running meanwhile.
+ */
+uint8_t transact( modbus_request_t *request ) {
+  while (queue.submit( request ) != QUEUE_OK) delay( 1 );
+  while (!queue.isDone( request )) delay( 1 );
+  return request->u8error;
+}
+
+void historian() {
+  uint16_t au16data[ 10 ];
+  modbus_request_t request;
+  request.u8state = REQUEST_FREE;
+  request.telegram = { 1, MB_FC_READ_REGISTERS, 0, 10, au16data };
+
+  while (true) {
+    if (transact( &request ) == 0) Log.info( "historian %u", au16data[ 0 ] );
+    delay( 1000 );
+  }
+}
+
+void alarms() {
+  uint16_t u16alarm;
+  modbus_request_t request;
+  request.u8state = REQUEST_FREE;
+  request.telegram = { 1, MB_FC_READ_REGISTERS, 20, 1, &u16alarm };
+
+  while (true) {
+    if (transact( &request ) == 0 && u16alarm != 0) Log.warn( "alarm %u", u16alarm );
+    delay( 100 );
+  }
+}
+
+Thread *historianThread;
+Thread *alarmsThread;
+
+void setup() {
+  master.begin( 19200 );
+  master.setTimeOut( 1000 );
+  historianThread = new Thread( "historian", historian );
+  alarmsThread = new Thread( "alarms", alarms );
+}
+
+void loop() {
+  queue.poll();
+}
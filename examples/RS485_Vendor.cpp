@@ -0,0 +1,54 @@
+/**
+ *  Modbus slave user function codes example:
+ *  The purpose of this example is to serve function codes the library
+ *  does not implement, without changing it. setHandler() adds them to
+ *  the dispatch table of the slave:
+ *  - FC8 sub-function 0 (Return Query Data) echoes the request;
+ *  - vendor code 65 answers the firmware version as a string.
+ *  Any other code is still answered with exception 01.
+ *
+ *  Recommended Modbus Master: QModbus
+ *  http://qmodbus.sourceforge.net/
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+
+#define TXEN_PIN D4
+
+uint16_t au16data[16];
+Modbus slave(1, 0, TXEN_PIN);
+
+#define FC_DIAGNOSTICS 8
+#define FC_VENDOR_VERSION 65
+
+uint8_t diagnostics( modbus_pdu_t *pdu, void *context ) {
+  // sub-function 0: the answer is the request itself
+  if (pdu->u16size < 3 || word( pdu->pdu[ 1 ], pdu->pdu[ 2 ] ) != 0) return EXC_FUNC_CODE;
+  return 0;
+}
+
+uint8_t version( modbus_pdu_t *pdu, void *context ) {
+  const char *version = (const char *) context;
+  uint8_t u8len = strlen( version );
+
+  if (pdu->u16size != 1) return EXC_REGS_QUANT;
+  if (2 + u8len > pdu->u16room) return EXC_EXECUTE;
+  pdu->pdu[ 1 ] = u8len;
+  memcpy( &pdu->pdu[ 2 ], version, u8len );
+  pdu->u16size = 2 + u8len;
+  return 0;
+}
+
+void setup() {
+  slave.setHandler( FC_DIAGNOSTICS, diagnostics );
+  slave.setHandler( FC_VENDOR_VERSION, version, (void *) "1.20" );
+  slave.begin( 19200 );
+}
+
+void loop() {
+  slave.poll( au16data, 16 );
+}
@@ -0,0 +1,50 @@
+/**
+ *  Modbus slave virtual registers example:
+ *  The purpose of this example is to expose derived values without
+ *  computing them at every loop. Registers 0..1 hold the uptime in
+ *  seconds and register 2 the temperature in tenths of degree: they are
+ *  computed only when a master reads them. Register 10 is a setpoint,
+ *  applied as soon as a master writes it, and refused out of 0..1000.
+ *
+ *  Recommended Modbus Master: QModbus
+ *  http://qmodbus.sourceforge.net/
+ */
+
+#include "application.h"
+
+SYSTEM_MODE(MANUAL); // no need for cell connection in this fw
+
+#include "ModbusRtu.h"
+
+#define TXEN_PIN D4
+#define SENSOR_PIN A0
+
+uint16_t au16data[16];
+Modbus slave(1, 0, TXEN_PIN);
+
+uint8_t readMeasures( uint16_t *regs, uint16_t u16add, uint16_t u16no, void *context ) {
+  uint32_t u32uptime = millis() / 1000;
+  regs[ 0 ] = u32uptime >> 16;
+  regs[ 1 ] = u32uptime & 0xFFFF;
+  if (u16add + u16no > 2) regs[ 2 ] = (int16_t) (analogRead( SENSOR_PIN ) * 3300L / 4095 - 500);
+  return 0;
+}
+
+uint8_t writeSetpoint( uint16_t *regs, uint16_t u16add, uint16_t u16no, void *context ) {
+  if (regs[ 10 ] > 1000) return EXC_EXECUTE;
+  analogWrite( DAC, regs[ 10 ] * 4095L / 1000 );
+  return 0;
+}
+
+modbus_binding_t measures = { 0, 3, readMeasures, nullptr };
+modbus_binding_t setpoint = { 10, 1, nullptr, writeSetpoint };
+
+void setup() {
+  slave.addBinding( &measures );
+  slave.addBinding( &setpoint );
+  slave.begin( 19200 );
+}
+
+void loop() {
+  slave.poll( au16data, 16 );
+}
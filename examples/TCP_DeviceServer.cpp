@@ -0,0 +1,45 @@
+/**
+ *  Modbus RTU over TCP example:
+ *  The purpose of this example is to query a slave behind an Ethernet
+ *  serial device server that tunnels raw RTU frames over TCP.
+ *  The master engine is the same as on a local RS485 port; only the
+ *  stream it talks to changes.
+ *
+ *  For RTU over UDP, replace the TCP tunnel by
+ *    UDP udp;
+ *    ModbusUdpTunnel tunnel( &udp, server, 4001 );
+ *  and call udp.begin( 4001 ) in setup().
+ */
+
+#include "application.h"
+
+#include "ModbusTunnel.h"
+
+IPAddress server( 192, 168, 1, 50 ); // device server, raw TCP port 4001
+TCPClient client;
+ModbusTcpTunnel tunnel( &client, TUNNEL_MASTER );
+Modbus master( 0, &tunnel );
+
+uint16_t au16data[ 10 ];
+modbus_t telegram = { 1, MB_FC_READ_REGISTERS, 0, 10, au16data };
+uint32_t u32next;
+
+void setup() {
+  master.setT35( 0 ); // TCP frames are delimited by the tunnel, not by silence
+  master.setTimeOut( 500 );
+}
+
+void loop() {
+  if (!client.connected()) {
+    tunnel.clear();
+    client.connect( server, 4001 );
+    return;
+  }
+
+  master.poll();
+  if (master.getState() == COM_IDLE && millis() >= u32next) {
+    if (master.getLastError() == 0) Log.info( "register 0 = %u", au16data[ 0 ] );
+    master.query( telegram );
+    u32next = millis() + 1000;
+  }
+}
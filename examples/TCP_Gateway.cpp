@@ -0,0 +1,64 @@
+/**
+ *  Modbus TCP gateway example:
+ *  The purpose of this example is to share an RS485 segment with several
+ *  Modbus TCP clients (SCADA, HMI, engineering tools).
+ *  Requests for unit ids 1 to 247 are forwarded to the RS485 bus; reads
+ *  asked by several clients at once are done only once on the bus.
+ *  The first client to connect gets priority over the others.
+ *
+ *  In a Linux box, run
+ *  "mbpoll -m tcp -a 1 -r 1 -c 10 <device ip>"
+ *  Clients are told apart by their address: one connection per host.
+ */
+
+#include "application.h"
+
+#include "ModbusGateway.h"
+
+#define TXEN_PIN A2
+#define RXEN_PIN DAC
+Modbus master(0, 1, TXEN_PIN, RXEN_PIN);
+ModbusGateway gateway;
+
+TCPServer server( 502 );
+TCPClient clients[ MODBUS_GW_LINKS ];
+int8_t ai8links[ MODBUS_GW_LINKS ];
+
+void setup() {
+  master.begin( 19200 );
+  master.setTimeOut( 500 );
+  gateway.addBus( &master );
+
+  for (uint8_t i = 0; i < MODBUS_GW_LINKS; i++) ai8links[ i ] = -1;
+  server.begin();
+}
+
+void loop() {
+  // server.available() hands back the last connection until a new one is accepted
+  TCPClient client = server.available();
+  if (client.connected()) {
+    int8_t i8free = -1;
+    boolean bKnown = false;
+    for (uint8_t i = 0; i < MODBUS_GW_LINKS; i++) {
+      if (ai8links[ i ] < 0) {
+        if (i8free < 0) i8free = i;
+      } else if (clients[ i ].remoteIP() == client.remoteIP()) {
+        bKnown = true;
+      }
+    }
+    if (!bKnown && i8free >= 0) {
+      clients[ i8free ] = client;
+      ai8links[ i8free ] = gateway.attach( &clients[ i8free ], (i8free == 0) ? 0 : 1 );
+    }
+  }
+
+  for (uint8_t i = 0; i < MODBUS_GW_LINKS; i++) {
+    if (ai8links[ i ] >= 0 && !clients[ i ].connected()) {
+      gateway.detach( ai8links[ i ] );
+      clients[ i ].stop();
+      ai8links[ i ] = -1;
+    }
+  }
+
+  gateway.poll();
+}
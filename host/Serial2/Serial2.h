@@ -0,0 +1 @@
+// Serial2.h: host stand-in, the library only uses Serial1
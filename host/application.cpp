@@ -0,0 +1,111 @@
+// application.cpp
+
+#include "application.h"
+#include <chrono>
+#include <thread>
+
+USBSerial Serial;
+USARTSerial Serial1;
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+uint32_t micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ).count();
+}
+
+uint32_t millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void delay( uint32_t u32ms ) {
+  std::this_thread::sleep_for( std::chrono::milliseconds( u32ms ));
+}
+
+void delayMicroseconds( uint32_t u32us ) {
+  std::this_thread::sleep_for( std::chrono::microseconds( u32us ));
+}
+
+void pinMode( uint16_t u16pin, int mode ) {
+}
+
+void digitalWrite( uint16_t u16pin, uint8_t u8value ) {
+}
+
+size_t Print::write( const uint8_t *buffer, size_t size ) {
+  size_t n = 0;
+  while (size--) n += write( *buffer++ );
+  return n;
+}
+
+size_t Print::print( const char *sz ) {
+  return write( (const uint8_t *) sz, strlen( sz ));
+}
+
+size_t Print::print( char c ) {
+  return write( (uint8_t) c );
+}
+
+size_t Print::print( int value, int base ) {
+  return printf( base == HEX ? "%X" : "%d", value );
+}
+
+size_t Print::print( unsigned int value, int base ) {
+  return printf( base == HEX ? "%X" : "%u", value );
+}
+
+size_t Print::print( long value, int base ) {
+  return printf( base == HEX ? "%lX" : "%ld", value );
+}
+
+size_t Print::print( unsigned long value, int base ) {
+  return printf( base == HEX ? "%lX" : "%lu", value );
+}
+
+size_t Print::println() {
+  return print( "\r\n" );
+}
+
+size_t Print::printf( const char *format, ... ) {
+  char sz[ 256 ];
+  va_list args;
+  va_start( args, format );
+  vsnprintf( sz, sizeof( sz ), format, args );
+  va_end( args );
+  return print( sz );
+}
+
+size_t Print::printlnf( const char *format, ... ) {
+  char sz[ 256 ];
+  va_list args;
+  va_start( args, format );
+  vsnprintf( sz, sizeof( sz ), format, args );
+  va_end( args );
+  return print( sz ) + println();
+}
+
+int USARTSerial::read() {
+  if (rx.empty()) return -1;
+  uint8_t u8byte = rx.front();
+  rx.pop_front();
+  return u8byte;
+}
+
+size_t USARTSerial::take( uint8_t *dest, size_t size ) {
+  size_t n = 0;
+  while (n < size && !tx.empty()) {
+    dest[ n++ ] = tx.front();
+    tx.pop_front();
+  }
+  return n;
+}
+
+int UDP::parsePacket() {
+  if (inq.empty()) return 0;
+  from = inq.front().first;
+  cur = inq.front().second;
+  inq.pop_front();
+  pos = 0;
+  return cur.size();
+}
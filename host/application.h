@@ -0,0 +1,189 @@
+#ifndef HOST_APPLICATION_H
+#define HOST_APPLICATION_H
+
+/**
+ * @file 		application.h
+ *
+ * @description
+ *  Host stand-in for the Particle Device OS header.
+ *  Provides just what the library uses, so that it builds and runs on a
+ *  Linux or macOS host for benchmarks and tests: time keeping over the
+ *  host steady clock, no-op GPIO and logging, a Print/Stream hierarchy,
+ *  a USB Serial writing to stdout and a fake USARTSerial whose receive
+ *  and transmit queues are fed and collected by the test, and in-memory
+ *  IPAddress/UDP for the RTU over UDP transport.
+ *
+ * @defgroup host Host Build
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <deque>
+#include <vector>
+
+#define PLATFORM_ID 3 //!< gcc platform: no device warning in ModbusRtu.h
+
+typedef bool boolean;
+
+#define SERIAL_8N1 0
+#define OUTPUT 1
+#define INPUT 0
+#define LOW 0
+#define HIGH 1
+#define HEX 16
+#define DEC 10
+#define D7 7
+#define A2 12
+
+#define SYSTEM_MODE(mode) //!< examples build unchanged, the mode means nothing here
+
+uint32_t millis();
+uint32_t micros();
+void delay( uint32_t u32ms );
+void delayMicroseconds( uint32_t u32us );
+void pinMode( uint16_t u16pin, int mode );
+void digitalWrite( uint16_t u16pin, uint8_t u8value );
+
+/**
+ * @class Print
+ * @brief
+ * Formatted output over write(), as in Device OS
+ */
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write( uint8_t u8byte ) = 0;
+  virtual size_t write( const uint8_t *buffer, size_t size );
+  size_t print( const char *sz );
+  size_t print( char c );
+  size_t print( int value, int base = DEC );
+  size_t print( unsigned int value, int base = DEC );
+  size_t print( long value, int base = DEC );
+  size_t print( unsigned long value, int base = DEC );
+  size_t println();
+  template<typename T> size_t println( T value ) { size_t size = print( value ); return size + println(); }
+  size_t printf( const char *format, ... );
+  size_t printlnf( const char *format, ... );
+};
+
+/**
+ * @class Stream
+ * @brief
+ * Byte input on top of Print
+ */
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+};
+
+/**
+ * @class USARTSerial
+ * @brief
+ * Fake hardware UART: bytes given to inject() are read as if they came
+ * from the line, bytes written are kept until take() collects them
+ */
+class USARTSerial : public Stream {
+private:
+  std::deque<uint8_t> rx, tx;
+  unsigned long u32baud;
+
+public:
+  USARTSerial() : u32baud( 0 ) {}
+  void begin( unsigned long u32baud, uint32_t u32config = SERIAL_8N1 ) { this->u32baud = u32baud; }
+  int available() { return rx.size(); }
+  int read();
+  int peek() { return rx.empty() ? -1 : rx.front(); }
+  void flush() {}
+  size_t write( uint8_t u8byte ) { tx.push_back( u8byte ); return 1; }
+  using Print::write;
+
+  unsigned long getBaud() { return u32baud; } //!<rate given to begin()
+  void inject( const uint8_t *data, size_t size ) { rx.insert( rx.end(), data, data + size ); } //!<queue bytes to read
+  size_t take( uint8_t *dest, size_t size ); //!<collect written bytes
+};
+
+/**
+ * @class USBSerial
+ * @brief
+ * USB console: output goes to stdout, nothing is ever received
+ */
+class USBSerial : public Stream {
+public:
+  void begin( unsigned long u32baud = 9600 ) {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  void flush() { fflush( stdout ); }
+  size_t write( uint8_t u8byte ) { putchar( u8byte ); return 1; }
+  using Print::write;
+  bool isConnected() { return true; }
+};
+
+extern USBSerial Serial;
+extern USARTSerial Serial1;
+
+/**
+ * @class Logger
+ * @brief
+ * Log category: messages are dropped on the host
+ */
+class Logger {
+public:
+  Logger( const char *szName ) {}
+  void trace( const char *format, ... ) {}
+  void info( const char *format, ... ) {}
+  void warn( const char *format, ... ) {}
+  void error( const char *format, ... ) {}
+};
+
+/**
+ * @class IPAddress
+ * @brief
+ * IPv4 address
+ */
+class IPAddress {
+private:
+  uint32_t u32address;
+
+public:
+  IPAddress() : u32address( 0 ) {}
+  IPAddress( uint8_t a, uint8_t b, uint8_t c, uint8_t d ) : u32address( ((uint32_t) a << 24) | ((uint32_t) b << 16) | ((uint32_t) c << 8) | d ) {}
+  bool operator==( const IPAddress &other ) const { return u32address == other.u32address; }
+  bool operator!=( const IPAddress &other ) const { return u32address != other.u32address; }
+};
+
+/**
+ * @class UDP
+ * @brief
+ * In-memory UDP socket: the test queues datagrams in inq and finds the
+ * datagrams sent in sent
+ */
+class UDP : public Stream {
+public:
+  std::deque<std::pair<IPAddress, std::vector<uint8_t> > > inq; //!< datagrams to receive, with their sender
+  std::vector<std::vector<uint8_t> > sent; //!< datagrams sent
+
+  int parsePacket();
+  int available() { return cur.size() - pos; }
+  int read() { return pos < cur.size() ? cur[ pos++ ] : -1; }
+  int peek() { return pos < cur.size() ? cur[ pos ] : -1; }
+  void flush() {}
+  IPAddress remoteIP() { return from; }
+  int beginPacket( IPAddress remote, uint16_t u16port ) { out.clear(); return 1; }
+  int endPacket() { sent.push_back( out ); return 1; }
+  size_t write( uint8_t u8byte ) { out.push_back( u8byte ); return 1; }
+  size_t write( const uint8_t *buffer, size_t size ) { out.insert( out.end(), buffer, buffer + size ); return size; }
+
+private:
+  std::vector<uint8_t> cur, out;
+  size_t pos = 0;
+  IPAddress from;
+};
+
+#endif
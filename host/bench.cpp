@@ -0,0 +1,30 @@
+/**
+ *  Host benchmark:
+ *  Runs the frame path microbenchmarks of ModbusBench on the host and
+ *  prints their CSV results to stdout:
+ *  bench,fct,frame_bytes,iterations,ns_per_frame,bytes_per_s
+ *
+ *  Usage: modbus_bench [iterations]   (1000 by default)
+ *  e.g. "modbus_bench 10000 > bench.csv" to gate an optimization on numbers.
+ */
+
+#include <stdlib.h>
+#include "application.h"
+#include "ModbusBench.h"
+
+#ifndef MODBUS_BENCH
+#error "ModbusBench needs both roles and MAX_BUFFER >= 256"
+#endif
+
+int main( int argc, char **argv ) {
+  long iterations = (argc > 1) ? atol( argv[ 1 ] ) : 1000;
+  if (iterations < 1 || iterations > 65535) {
+    fprintf( stderr, "usage: %s [iterations 1..65535]\n", argv[ 0 ] );
+    return 2;
+  }
+
+  static ModbusBench bench( &Serial, iterations );
+  bench.run();
+  Serial.flush();
+  return 0;
+}
@@ -0,0 +1 @@
+// globals.h: host stand-in, the library needs nothing from it
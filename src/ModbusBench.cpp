@@ -0,0 +1,309 @@
+// ModbusBench.cpp
+
+#include "ModbusBench.h"
+
+#ifdef MODBUS_BENCH
+
+// the last sizes are the protocol limits: 255-byte frames, writes stopping at theirs
+static const uint16_t au16RegSizes[] = { 1, 16, 64, 123, 125 }; //!< registers per frame
+static const uint16_t au16CoilSizes[] = { 8, 128, 512, 1968, 2000 }; //!< coils per frame
+static const uint16_t au16CrcSizes[] = { 8, 64, 128, 255, 256 }; //!< bytes per CRC run
+
+/**
+ * @brief
+ * Whether a request of u16no coils or registers is within the protocol
+ * limits of its function
+ */
+static boolean isValidSize( uint8_t u8fct, uint16_t u16no ) {
+  if (u8fct == MB_FC_WRITE_MULTIPLE_COILS) return u16no <= MB_MAX_WRITE_COILS;
+  if (u8fct == MB_FC_WRITE_MULTIPLE_REGISTERS) return u16no <= MB_MAX_WRITE_REGISTERS;
+  return true;
+}
+
+static volatile uint32_t u32sink; //!< keeps results alive under optimization
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of the benchmark suite
+ *
+ * @param out  where the CSV results are printed
+ * @param u16iterations  number of runs timed for each result
+ * @ingroup bench
+ */
+ModbusBench::ModbusBench( Print *out, uint16_t u16iterations )
+  : master( 0, (Stream *) &masterPort ), slave( 1, (Stream *) &slavePort ) {
+  this->out = out;
+  this->u16iterations = u16iterations;
+  for (uint16_t i = 0; i < BENCH_REGS; i++) au16regs[ i ] = i * 257;
+}
+
+/**
+ * @brief
+ * Run every benchmark and print one CSV line per result
+ *
+ * @ingroup bench
+ */
+void ModbusBench::run() {
+  master.begin( 115200 );
+  slave.begin( 115200 );
+  master.setT35( 0 );
+  slave.setT35( 0 );
+  slave.au16regs = au16regs;
+  slave.u16regsize = BENCH_REGS;
+
+  out->println( "bench,fct,frame_bytes,iterations,ns_per_frame,bytes_per_s" );
+  benchCRC();
+  benchQuery();
+  benchReceive();
+  benchValidate();
+  benchDecode();
+  benchProcess();
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Copy a frame head into au8Frame and append its CRC
+ *
+ * @ingroup bench
+ */
+void ModbusBench::buildFrame( const uint8_t *head, uint16_t u16size ) {
+  memcpy( master.au8Buffer, head, u16size );
+  uint16_t u16crc = master.calcCRC( u16size );
+  memcpy( au8Frame, head, u16size );
+  au8Frame[ u16size ] = u16crc >> 8;
+  au8Frame[ u16size + 1 ] = u16crc & 0x00ff;
+  u16FrameSize = u16size + CHECKSUM_SIZE;
+}
+
+/**
+ * @brief
+ * Build in au8Frame the request a master sends for u16no coils or registers
+ *
+ * @ingroup bench
+ */
+void ModbusBench::buildRequest( uint8_t u8fct, uint16_t u16no ) {
+  uint8_t au8Head[ MAX_BUFFER ] = { 1, u8fct, 0, 0, (uint8_t) highByte( u16no ), (uint8_t) lowByte( u16no ) };
+  uint8_t u8size = RESPONSE_SIZE;
+
+  switch( u8fct ) {
+  case MB_FC_WRITE_COIL:
+    au8Head[ ADD_LO ] = 1;
+    au8Head[ NB_HI ] = 0xff;
+    au8Head[ NB_LO ] = 0;
+    break;
+  case MB_FC_WRITE_REGISTER:
+    au8Head[ ADD_LO ] = 1;
+    au8Head[ NB_HI ] = 0x12;
+    au8Head[ NB_LO ] = 0x34;
+    break;
+  case MB_FC_WRITE_MULTIPLE_COILS:
+    au8Head[ BYTE_CNT ] = (u16no + 7) / 8;
+    for (uint8_t i = 0; i < au8Head[ BYTE_CNT ]; i++) au8Head[ BYTE_CNT + 1 + i ] = 0xa5;
+    u8size = BYTE_CNT + 1 + au8Head[ BYTE_CNT ];
+    break;
+  case MB_FC_WRITE_MULTIPLE_REGISTERS:
+    au8Head[ BYTE_CNT ] = u16no * 2;
+    for (uint8_t i = 0; i < au8Head[ BYTE_CNT ]; i++) au8Head[ BYTE_CNT + 1 + i ] = i;
+    u8size = BYTE_CNT + 1 + au8Head[ BYTE_CNT ];
+    break;
+  }
+  buildFrame( au8Head, u8size );
+}
+
+/**
+ * @brief
+ * Build in au8Frame the answer of a slave to a read of u16no coils or registers
+ *
+ * @ingroup bench
+ */
+void ModbusBench::buildAnswer( uint8_t u8fct, uint16_t u16no ) {
+  uint8_t au8Head[ MAX_BUFFER ] = { 1, u8fct };
+  boolean bCoils = (u8fct == MB_FC_READ_COILS) || (u8fct == MB_FC_READ_DISCRETE_INPUT);
+
+  au8Head[ 2 ] = bCoils ? (u16no + 7) / 8 : u16no * 2;
+  for (uint8_t i = 0; i < au8Head[ 2 ]; i++) au8Head[ 3 + i ] = i;
+  buildFrame( au8Head, 3 + au8Head[ 2 ] );
+}
+
+/**
+ * @brief
+ * Print one CSV result
+ *
+ * @param name  benchmarked method
+ * @param u8fct  function code, 0 if not relevant
+ * @param u16bytes  frame length handled by each run
+ * @param u32us  time taken by all the runs
+ * @ingroup bench
+ */
+void ModbusBench::result( const char *name, uint8_t u8fct, uint16_t u16bytes, uint32_t u32us ) {
+  if (u32us == 0) u32us = 1;
+  unsigned long u32ns = (uint64_t) u32us * 1000 / u16iterations;
+  unsigned long u32rate = (uint64_t) u16bytes * u16iterations * 1000000 / u32us;
+  out->printlnf( "%s,%u,%u,%u,%lu,%lu", name, u8fct, u16bytes, u16iterations, u32ns, u32rate );
+}
+
+void ModbusBench::benchCRC() {
+  for (uint8_t i = 0; i < sizeof( au16CrcSizes ) / sizeof( au16CrcSizes[0] ); i++) {
+    uint16_t u16size = au16CrcSizes[ i ];
+    for (uint16_t j = 0; j < u16size; j++) master.au8Buffer[ j ] = j;
+
+    uint32_t u32start = micros();
+    for (uint16_t n = 0; n < u16iterations; n++) u32sink = master.calcCRC( u16size );
+    result( "calcCRC", 0, u16size, micros() - u32start );
+  }
+}
+
+void ModbusBench::benchQuery() {
+  const uint8_t au8Fct[] = {
+    MB_FC_READ_COILS, MB_FC_READ_DISCRETE_INPUT, MB_FC_READ_REGISTERS, MB_FC_READ_INPUT_REGISTER,
+    MB_FC_WRITE_COIL, MB_FC_WRITE_REGISTER, MB_FC_WRITE_MULTIPLE_COILS, MB_FC_WRITE_MULTIPLE_REGISTERS
+  };
+  modbus_t telegram;
+  telegram.u8id = 1;
+  telegram.u16RegAdd = 0;
+  telegram.au16reg = au16regs;
+
+  for (uint8_t f = 0; f < sizeof( au8Fct ); f++) {
+    for (uint8_t i = 0; i < sizeof( au16RegSizes ) / sizeof( au16RegSizes[0] ); i++) {
+      telegram.u8fct = au8Fct[ f ];
+      telegram.u16CoilsNo = au16RegSizes[ i ];
+      if (!isValidSize( telegram.u8fct, telegram.u16CoilsNo )) continue;
+
+      uint16_t u16bytes = 0;
+      uint32_t u32start = micros();
+      for (uint16_t n = 0; n < u16iterations; n++) {
+        master.query( telegram );
+        master.u8state = COM_IDLE;
+        u16bytes = masterPort.take( nullptr, MODBUS_LOOPBACK_SIZE );
+      }
+      result( "query", telegram.u8fct, u16bytes, micros() - u32start );
+    }
+  }
+}
+
+void ModbusBench::benchReceive() {
+  for (uint8_t i = 0; i < sizeof( au16RegSizes ) / sizeof( au16RegSizes[0] ); i++) {
+    buildAnswer( MB_FC_READ_REGISTERS, au16RegSizes[ i ] );
+
+    uint32_t u32start = micros();
+    for (uint16_t n = 0; n < u16iterations; n++) {
+      masterPort.inject( au8Frame, u16FrameSize );
+      u32sink = master.getRxBuffer();
+    }
+    result( "getRxBuffer", MB_FC_READ_REGISTERS, u16FrameSize, micros() - u32start );
+  }
+
+  // a full 256-byte ADU, as a user function may send
+  uint8_t au8Head[ MAX_BUFFER ] = { 1, 100 };
+  buildFrame( au8Head, MAX_BUFFER - CHECKSUM_SIZE );
+  uint32_t u32start = micros();
+  for (uint16_t n = 0; n < u16iterations; n++) {
+    masterPort.inject( au8Frame, u16FrameSize );
+    u32sink = master.getRxBuffer();
+  }
+  result( "getRxBuffer", 100, u16FrameSize, micros() - u32start );
+}
+
+void ModbusBench::benchValidate() {
+  for (uint8_t i = 0; i < sizeof( au16RegSizes ) / sizeof( au16RegSizes[0] ); i++) {
+    uint32_t u32start;
+    if (isValidSize( MB_FC_WRITE_MULTIPLE_REGISTERS, au16RegSizes[ i ] )) {
+      buildRequest( MB_FC_WRITE_MULTIPLE_REGISTERS, au16RegSizes[ i ] );
+      memcpy( slave.au8Buffer, au8Frame, u16FrameSize );
+      slave.u16BufferSize = u16FrameSize;
+
+      u32start = micros();
+      for (uint16_t n = 0; n < u16iterations; n++) u32sink = slave.validateRequest();
+      result( "validateRequest", MB_FC_WRITE_MULTIPLE_REGISTERS, u16FrameSize, micros() - u32start );
+    }
+
+    buildAnswer( MB_FC_READ_REGISTERS, au16RegSizes[ i ] );
+    memcpy( master.au8Buffer, au8Frame, u16FrameSize );
+    master.u16BufferSize = u16FrameSize;
+    master.pending = { 1, MB_FC_READ_REGISTERS, 0, au16RegSizes[ i ], au16regs }; // the answer is checked against it
+
+    u32start = micros();
+    for (uint16_t n = 0; n < u16iterations; n++) u32sink = master.validateAnswer();
+    result( "validateAnswer", MB_FC_READ_REGISTERS, u16FrameSize, micros() - u32start );
+  }
+}
+
+void ModbusBench::benchDecode() {
+  uint16_t au16dest[ BENCH_REGS ];
+  master.au16regs = au16dest;
+
+  for (uint8_t i = 0; i < sizeof( au16RegSizes ) / sizeof( au16RegSizes[0] ); i++) {
+    buildAnswer( MB_FC_READ_REGISTERS, au16RegSizes[ i ] );
+    memcpy( master.au8Buffer, au8Frame, u16FrameSize );
+    master.u16BufferSize = u16FrameSize;
+    master.pending = { 1, MB_FC_READ_REGISTERS, 0, au16RegSizes[ i ], au16dest }; // bounds the decode
+
+    uint32_t u32start = micros();
+    for (uint16_t n = 0; n < u16iterations; n++) master.get_FC3();
+    result( "get_FC3", MB_FC_READ_REGISTERS, u16FrameSize, micros() - u32start );
+
+    buildAnswer( MB_FC_READ_COILS, au16CoilSizes[ i ] );
+    memcpy( master.au8Buffer, au8Frame, u16FrameSize );
+    master.u16BufferSize = u16FrameSize;
+    master.pending = { 1, MB_FC_READ_COILS, 0, au16CoilSizes[ i ], au16dest };
+
+    u32start = micros();
+    for (uint16_t n = 0; n < u16iterations; n++) master.get_FC1();
+    result( "get_FC1", MB_FC_READ_COILS, u16FrameSize, micros() - u32start );
+  }
+  master.au16regs = nullptr;
+}
+
+void ModbusBench::benchProcess() {
+  const uint8_t au8Fct[] = {
+    MB_FC_READ_COILS, MB_FC_READ_REGISTERS, MB_FC_WRITE_COIL,
+    MB_FC_WRITE_REGISTER, MB_FC_WRITE_MULTIPLE_COILS, MB_FC_WRITE_MULTIPLE_REGISTERS
+  };
+
+  for (uint8_t f = 0; f < sizeof( au8Fct ); f++) {
+    uint8_t u8fct = au8Fct[ f ];
+    boolean bCoils = (u8fct == MB_FC_READ_COILS) || (u8fct == MB_FC_WRITE_MULTIPLE_COILS);
+
+    for (uint8_t i = 0; i < sizeof( au16RegSizes ) / sizeof( au16RegSizes[0] ); i++) {
+      uint16_t u16no = bCoils ? au16CoilSizes[ i ] : au16RegSizes[ i ];
+      if (!isValidSize( u8fct, u16no )) continue;
+      buildRequest( u8fct, u16no );
+
+      uint16_t u16bytes = 0;
+      uint32_t u32start = micros();
+      for (uint16_t n = 0; n < u16iterations; n++) {
+        memcpy( slave.au8Buffer, au8Frame, u16FrameSize );
+        slave.u16BufferSize = u16FrameSize;
+        switch( u8fct ) {
+        case MB_FC_READ_COILS:
+          slave.process_FC1( au16regs, BENCH_REGS );
+          break;
+        case MB_FC_READ_REGISTERS:
+          slave.process_FC3( au16regs, BENCH_REGS );
+          break;
+        case MB_FC_WRITE_COIL:
+          slave.process_FC5( au16regs, BENCH_REGS );
+          break;
+        case MB_FC_WRITE_REGISTER:
+          slave.process_FC6( au16regs, BENCH_REGS );
+          break;
+        case MB_FC_WRITE_MULTIPLE_COILS:
+          slave.process_FC15( au16regs, BENCH_REGS );
+          break;
+        case MB_FC_WRITE_MULTIPLE_REGISTERS:
+          slave.process_FC16( au16regs, BENCH_REGS );
+          break;
+        }
+        u16bytes = slavePort.take( nullptr, MODBUS_LOOPBACK_SIZE );
+      }
+      // request and answer are both handled by the slave
+      result( "process", u8fct, u16FrameSize + u16bytes, micros() - u32start );
+    }
+  }
+}
+
+#endif
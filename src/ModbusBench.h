@@ -0,0 +1,63 @@
+#ifndef MODBUS_BENCH_H
+#define MODBUS_BENCH_H
+
+/**
+ * @file 		ModbusBench.h
+ *
+ * @description
+ *  Microbenchmarks of the Modbus frame path.
+ *  Times calcCRC, query encoding for every function code, getRxBuffer,
+ *  validateRequest/validateAnswer, get_FC1/get_FC3 and process_FC1..16
+ *  across frame sizes, on engines wired to ModbusLoopback ports.
+ *  Results are printed as CSV lines so that runs can be compared by scripts:
+ *  bench,fct,frame_bytes,iterations,ns_per_frame,bytes_per_s
+ *  where frame_bytes counts every byte handled by one run (request and
+ *  answer for process_FC*).
+ *
+ * @defgroup bench Modbus Benchmarks
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusLoopback.h"
+
+// full-size frames through the master and the slave paths, the stock build only
+#if (MODBUS_ROLES & MODBUS_ROLE_MASTER) && (MODBUS_ROLES & MODBUS_ROLE_SLAVE) && MAX_BUFFER >= 256
+#define MODBUS_BENCH 1 //!< ModbusBench is available in this configuration
+
+#define BENCH_REGS 128	//!< register map size of the benchmarked slave
+
+/**
+ * @class ModbusBench
+ * @brief
+ * Runs the microbenchmarks and prints their CSV results.
+ */
+class ModbusBench {
+private:
+  Print *out;
+  uint16_t u16iterations;
+  ModbusLoopback masterPort, slavePort;
+  Modbus master, slave;
+  uint16_t au16regs[BENCH_REGS];
+  uint8_t au8Frame[MAX_BUFFER];
+  uint16_t u16FrameSize;
+
+  void buildFrame( const uint8_t *head, uint16_t u16size );
+  void buildRequest( uint8_t u8fct, uint16_t u16no );
+  void buildAnswer( uint8_t u8fct, uint16_t u16no );
+  void result( const char *name, uint8_t u8fct, uint16_t u16bytes, uint32_t u32us );
+
+  void benchCRC();
+  void benchQuery();
+  void benchReceive();
+  void benchValidate();
+  void benchDecode();
+  void benchProcess();
+
+public:
+  ModbusBench( Print *out, uint16_t u16iterations = 1000 );
+  void run(); //!<run every benchmark
+};
+
+#endif // MODBUS_BENCH
+
+#endif
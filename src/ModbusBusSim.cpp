@@ -0,0 +1,249 @@
+// ModbusBusSim.cpp
+
+#include "ModbusBusSim.h"
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of an empty bus
+ *
+ * @param u32baud  line speed used for the wire time of each byte
+ * @ingroup simulation
+ */
+ModbusBusSim::ModbusBusSim( uint32_t u32baud ) {
+  u8nodes = 0;
+  u16WireHead = u16WireCnt = 0;
+  u32charUs = 11000000UL / u32baud;
+  u32wireFree = 0;
+  i8talker = -1;
+  u32latency = u32switchUs = 0;
+  u32bytes = u32dropped = u32corrupted = u32collisions = 0;
+  clock = ModbusClock::hardware();
+  setFaults( 0, 0 );
+}
+
+/**
+ * @brief
+ * Add a node driven by the application, typically the master under test
+ *
+ * @param port  loopback of the node engine
+ * @return node index, -1 if the bus is full
+ * @ingroup simulation
+ */
+int8_t ModbusBusSim::attach( ModbusLoopback *port ) {
+  return addSlave( nullptr, port, nullptr, 0 );
+}
+
+/**
+ * @brief
+ * Add a simulated slave. Its engine is polled by the bus with its own
+ * register map, so the application only has to call ModbusBusSim::poll().
+ *
+ * @param slave  slave engine built on port, nullptr for an application node
+ * @param port  loopback of the slave engine
+ * @param regs  slave register map
+ * @param u16size  slave register map size
+ * @return node index, -1 if the bus is full
+ * @ingroup simulation
+ */
+int8_t ModbusBusSim::addSlave( Modbus *slave, ModbusLoopback *port, uint16_t *regs, uint16_t u16size ) {
+  if (u8nodes >= MODBUS_SIM_NODES) return -1;
+
+  modbus_node_t *node = &aNodes[ u8nodes ];
+  node->port = port;
+  node->slave = slave;
+  node->regs = regs;
+  node->u16regsize = u16size;
+  node->bTxSeen = false;
+  return u8nodes++;
+}
+
+/**
+ * @brief
+ * Time a simulated slave takes before its answer starts
+ *
+ * @ingroup simulation
+ */
+void ModbusBusSim::setLatency( uint32_t u32us ) {
+  u32latency = u32us;
+}
+
+/**
+ * @brief
+ * Silence added when another node takes the wire, as the RS485
+ * transceivers switch direction
+ *
+ * @ingroup simulation
+ */
+void ModbusBusSim::setSwitchTime( uint32_t u32us ) {
+  u32switchUs = u32us;
+}
+
+/**
+ * @brief
+ * Line faults. Damaged bytes get one bit flipped, so the frame CRC fails.
+ * The same seed always produces the same faults.
+ *
+ * @param u16dropRate  bytes lost per 10000 bytes
+ * @param u16corruptRate  bytes damaged per 10000 bytes
+ * @param u32seed  seed of the fault generator, not 0
+ * @ingroup simulation
+ */
+void ModbusBusSim::setFaults( uint16_t u16dropRate, uint16_t u16corruptRate, uint32_t u32seed ) {
+  this->u16dropRate = u16dropRate;
+  this->u16corruptRate = u16corruptRate;
+  this->u32seed = (u32seed != 0) ? u32seed : 1;
+}
+
+/**
+ * @brief
+ * Time source of the wire. Give the same clock to every engine on the bus.
+ *
+ * @param clock  time source, nullptr restores the device clock
+ * @ingroup simulation
+ */
+void ModbusBusSim::setClock( ModbusClock *clock ) {
+  this->clock = (clock != nullptr) ? clock : ModbusClock::hardware();
+}
+
+/**
+ * @brief
+ * Move the bus forward: deliver the bytes whose wire time has elapsed,
+ * put newly written bytes on the wire and poll the simulated slaves.
+ * Call it at least as often as the engines are polled.
+ *
+ * @ingroup simulation
+ */
+void ModbusBusSim::poll() {
+  uint32_t u32now = clock->micros();
+
+  while (u16WireCnt > 0) {
+    modbus_wire_t *wire = &aWire[ u16WireHead ];
+    if ((int32_t) (u32now - wire->u32due) < 0) break;
+
+    deliver( wire );
+    u16WireHead = (u16WireHead + 1) % MODBUS_SIM_WIRE;
+    u16WireCnt--;
+  }
+
+  for (uint8_t i = 0; i < u8nodes; i++) {
+    modbus_node_t *node = &aNodes[ i ];
+    if (node->port->txAvailable() == 0) continue;
+
+    if (!node->bTxSeen) {
+      node->bTxSeen = true;
+      node->u32txSeen = u32now;
+    }
+    if (node->slave != nullptr && u32now - node->u32txSeen < u32latency) continue;
+
+    transmit( i, u32now );
+    node->bTxSeen = false;
+  }
+
+  for (uint8_t i = 0; i < u8nodes; i++) {
+    modbus_node_t *node = &aNodes[ i ];
+    if (node->slave != nullptr) node->slave->poll( node->regs, node->u16regsize );
+  }
+}
+
+/**
+ * @brief
+ * Check that the wire is silent and no node has bytes waiting
+ *
+ * @ingroup simulation
+ */
+boolean ModbusBusSim::isIdle() {
+  if (u16WireCnt > 0) return false;
+  for (uint8_t i = 0; i < u8nodes; i++) {
+    if (aNodes[ i ].port->txAvailable() > 0) return false;
+  }
+  return true;
+}
+
+uint32_t ModbusBusSim::getBytes() {
+  return u32bytes;
+}
+
+uint32_t ModbusBusSim::getDropped() {
+  return u32dropped;
+}
+
+uint32_t ModbusBusSim::getCorrupted() {
+  return u32corrupted;
+}
+
+uint32_t ModbusBusSim::getCollisions() {
+  return u32collisions;
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Draw a number between 0 and 9999 (xorshift32)
+ *
+ * @ingroup simulation
+ */
+uint16_t ModbusBusSim::chance() {
+  u32seed ^= u32seed << 13;
+  u32seed ^= u32seed >> 17;
+  u32seed ^= u32seed << 5;
+  return u32seed % 10000;
+}
+
+/**
+ * @brief
+ * Put the bytes written by a node on the wire, one character time apart.
+ * A node starting while another one still drives the wire collides:
+ * its bytes are damaged.
+ *
+ * @param u8node  index of the talking node
+ * @param u32now  current time (us)
+ * @ingroup simulation
+ */
+void ModbusBusSim::transmit( uint8_t u8node, uint32_t u32now ) {
+  boolean bBusy = (int32_t) (u32wireFree - u32now) > 0;
+  boolean bCollision = bBusy && (i8talker != u8node);
+  if (bCollision) u32collisions++;
+
+  uint32_t u32due = bBusy ? u32wireFree : u32now;
+  if (i8talker != u8node) u32due += u32switchUs;
+  i8talker = u8node;
+
+  uint8_t u8byte;
+  while (u16WireCnt < MODBUS_SIM_WIRE && aNodes[ u8node ].port->take( &u8byte, 1 ) == 1) {
+    u32due += u32charUs;
+
+    modbus_wire_t *wire = &aWire[ (u16WireHead + u16WireCnt) % MODBUS_SIM_WIRE ];
+    wire->u32due = u32due;
+    wire->u8byte = bCollision ? u8byte ^ 0x55 : u8byte;
+    wire->u8src = u8node;
+    u16WireCnt++;
+    u32bytes++;
+  }
+  u32wireFree = u32due;
+}
+
+/**
+ * @brief
+ * Hand a byte that reached the end of the wire to every other node
+ *
+ * @ingroup simulation
+ */
+void ModbusBusSim::deliver( const modbus_wire_t *wire ) {
+  if (u16dropRate > 0 && chance() < u16dropRate) {
+    u32dropped++;
+    return;
+  }
+
+  uint8_t u8byte = wire->u8byte;
+  if (u16corruptRate > 0 && chance() < u16corruptRate) {
+    u8byte ^= 1 << (chance() % 8);
+    u32corrupted++;
+  }
+
+  for (uint8_t i = 0; i < u8nodes; i++) {
+    if (i != wire->u8src) aNodes[ i ].port->inject( &u8byte, 1 );
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef MODBUS_BUSSIM_H
+#define MODBUS_BUSSIM_H
+
+/**
+ * @file 		ModbusBusSim.h
+ *
+ * @description
+ *  Virtual multi-drop RS485 bus.
+ *  Every node talks through a ModbusLoopback. Bytes written by a node are put
+ *  on the wire one character time apart at the configured baud rate and are
+ *  delivered to all the other nodes, as on a real half-duplex bus.
+ *  Simulated slaves are ordinary Modbus slave engines, polled by the bus.
+ *  Slave latency, direction switching time, dropped bytes and corrupted
+ *  bytes can be configured, so master throughput, scheduling or timing
+ *  changes can be measured without any hardware. With a ModbusVirtualClock
+ *  shared by the bus and its engines, simulated time runs as fast as the CPU.
+ *
+ * @ingroup simulation
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusLoopback.h"
+
+#ifndef MODBUS_SIM_NODES
+#define MODBUS_SIM_NODES 8	//!< maximum nodes on a simulated bus
+#endif
+#ifndef MODBUS_SIM_WIRE
+#define MODBUS_SIM_WIRE 300	//!< bytes that can be in flight on the wire
+#endif
+
+/**
+ * @struct modbus_node_t
+ * @brief
+ * Node of the simulated bus: a port and, for simulated slaves, its engine.
+ */
+typedef struct {
+  ModbusLoopback *port;  /*!< Port the node engine reads and writes */
+  Modbus *slave;         /*!< Slave engine polled by the bus, nullptr for the master */
+  uint16_t *regs;        /*!< Slave register map */
+  uint16_t u16regsize;   /*!< Slave register map size */
+  uint32_t u32txSeen;    /*!< When pending tx bytes were first seen (us) */
+  boolean bTxSeen;       /*!< u32txSeen is valid */
+}
+modbus_node_t;
+
+/**
+ * @struct modbus_wire_t
+ * @brief
+ * Byte travelling on the simulated wire
+ */
+typedef struct {
+  uint32_t u32due;       /*!< When its last bit reaches the receivers (us) */
+  uint8_t u8byte;        /*!< Character on the wire */
+  uint8_t u8src;         /*!< Index of the talking node */
+}
+modbus_wire_t;
+
+/**
+ * @class ModbusBusSim
+ * @brief
+ * In-process RS485 bus linking a master with simulated slaves.
+ */
+class ModbusBusSim {
+private:
+  modbus_node_t aNodes[MODBUS_SIM_NODES];
+  modbus_wire_t aWire[MODBUS_SIM_WIRE];
+  uint8_t u8nodes;
+  uint16_t u16WireHead, u16WireCnt;
+  uint32_t u32charUs; //!< time of one 11 bit character
+  uint32_t u32wireFree; //!< end of the last character on the wire
+  int8_t i8talker; //!< last node that drove the wire
+  uint32_t u32latency, u32switchUs;
+  uint16_t u16dropRate, u16corruptRate; //!< per 10000 bytes
+  uint32_t u32seed;
+  ModbusClock *clock;
+  uint32_t u32bytes, u32dropped, u32corrupted, u32collisions;
+
+  uint16_t chance();
+  void transmit( uint8_t u8node, uint32_t u32now );
+  void deliver( const modbus_wire_t *wire );
+
+public:
+  ModbusBusSim( uint32_t u32baud = 19200 );
+  int8_t attach( ModbusLoopback *port ); //!<add a node driven by the application, e.g. the master
+  int8_t addSlave( Modbus *slave, ModbusLoopback *port, uint16_t *regs, uint16_t u16size ); //!<add a simulated slave
+  void setLatency( uint32_t u32us ); //!<slave processing time before it answers
+  void setSwitchTime( uint32_t u32us ); //!<transceiver direction switching time
+  void setFaults( uint16_t u16dropRate, uint16_t u16corruptRate, uint32_t u32seed = 1 ); //!<per 10000 bytes
+  void setClock( ModbusClock *clock ); //!<time source of the wire, share it with the engines
+  void poll(); //!<move the wire forward and poll the simulated slaves
+  boolean isIdle(); //!<nothing on the wire or waiting to be sent
+  uint32_t getBytes(); //!<bytes put on the wire
+  uint32_t getDropped(); //!<bytes lost on the wire
+  uint32_t getCorrupted(); //!<bytes damaged on the wire
+  uint32_t getCollisions(); //!<transmissions started while another node was talking
+};
+
+#endif
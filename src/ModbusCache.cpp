@@ -0,0 +1,248 @@
+// ModbusCache.cpp
+
+#include "ModbusCache.h"
+
+#define CACHE_NO_AGE 0xFFFFFFFF //!< u32maxAge of a block nobody is waiting for
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a cache in front of a master
+ *
+ * @param master  Modbus master (u8id = 0) already started with begin()
+ * @ingroup cache
+ */
+ModbusCache::ModbusCache( Modbus *master ) {
+  this->master = master;
+  this->i8busy = -1;
+  this->u32reads = 0;
+  invalidate( 0 );
+}
+
+/**
+ * @brief
+ * Read a range of registers on behalf of a consumer.
+ * If the cached block is younger than u32maxAge the registers are copied to dest
+ * straight away. Otherwise a bus read is scheduled and the consumer must ask again
+ * after a few poll() calls. Ranges that overlap or touch a block of the same slave
+ * and table are merged into it, so they are refreshed by one transaction; the
+ * registers the block held are served meanwhile.
+ *
+ * @param u8id  slave address between 1 and 247
+ * @param u8fct  MB_FC_READ_REGISTERS or MB_FC_READ_INPUT_REGISTER
+ * @param u16add  address of the first register
+ * @param u16no  number of registers, up to MODBUS_CACHE_REGS
+ * @param dest  destination of the registers
+ * @param u32maxAge  oldest data accepted by the consumer (ms)
+ * @param pu32age  if not null, receives the age of the copied data (ms)
+ * @return CACHE_HIT, CACHE_PENDING or a negative CACHE_RESULT
+ * @ingroup cache
+ */
+int8_t ModbusCache::read( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no,
+  uint16_t *dest, uint32_t u32maxAge, uint32_t *pu32age ) {
+
+  if ((u8fct != MB_FC_READ_REGISTERS) && (u8fct != MB_FC_READ_INPUT_REGISTER)) return CACHE_BAD_REQUEST;
+  if ((u8id == 0) || (u8id > 247)) return CACHE_BAD_REQUEST;
+  if ((u16no == 0) || (u16no > MODBUS_CACHE_REGS)) return CACHE_BAD_REQUEST;
+
+  modbus_block_t *block = findBlock( u8id, u8fct, u16add, u16no );
+  if (block == nullptr) return CACHE_FULL;
+  block->u32used = ++u32reads;
+
+  uint32_t u32age = master->getClock()->millis() - block->u32stamp;
+  boolean bValid = (block->u16ValidNo > 0) && (u16add >= block->u16ValidAdd) &&
+    ((uint32_t) u16add + u16no <= (uint32_t) block->u16ValidAdd + block->u16ValidNo);
+  if (bValid && u32age <= u32maxAge) {
+    memcpy( dest, &block->au16data[ u16add - block->u16RegAdd ], u16no * sizeof( uint16_t ));
+    if (pu32age != nullptr) *pu32age = u32age;
+    return CACHE_HIT;
+  }
+
+  // report a failed refresh once, the next call schedules a new one
+  if (block->u8lastError != 0) {
+    block->u8lastError = 0;
+    return CACHE_FAILED;
+  }
+
+  if (u32maxAge < block->u32maxAge) block->u32maxAge = u32maxAge;
+  return CACHE_PENDING;
+}
+
+/**
+ * @brief
+ * Drive the master: complete the read in flight or start the next one.
+ * Blocks are refreshed tightest staleness bound first.
+ * This method must be called only at loop section.
+ *
+ * @return CACHE_HIT when a block was refreshed, CACHE_FAILED when a read failed,
+ * CACHE_PENDING otherwise
+ * @ingroup cache
+ */
+int8_t ModbusCache::poll() {
+  if (i8busy >= 0) {
+    master->poll();
+    if (master->getState() != COM_IDLE) return CACHE_PENDING;
+
+    modbus_block_t *block = &aBlocks[ i8busy ];
+    i8busy = -1;
+    block->u32maxAge = CACHE_NO_AGE;
+    block->u8lastError = master->getLastError();
+    if (block->u8lastError != 0) return CACHE_FAILED;
+
+    block->u16ValidAdd = block->u16RegAdd;
+    block->u16ValidNo = block->u16CoilsNo;
+    block->u32stamp = master->getClock()->millis();
+    return CACHE_HIT;
+  }
+
+  int8_t i8next = nextBlock();
+  if (i8next < 0) return CACHE_PENDING;
+
+  modbus_block_t *block = &aBlocks[ i8next ];
+  telegram.u8id = block->u8id;
+  telegram.u8fct = block->u8fct;
+  telegram.u16RegAdd = block->u16RegAdd;
+  telegram.u16CoilsNo = block->u16CoilsNo;
+  telegram.au16reg = block->au16data; // the master decodes straight into the block, never past u16CoilsNo
+
+  if (master->query( telegram ) != 0) {
+    block->u32maxAge = CACHE_NO_AGE;
+    block->u8lastError = NO_REPLY;
+    return CACHE_FAILED;
+  }
+  i8busy = i8next;
+  return CACHE_PENDING;
+}
+
+/**
+ * @brief
+ * Forget the cached blocks of a slave, e.g. after it has been replaced.
+ *
+ * @param u8id  slave address, 0 = every slave
+ * @ingroup cache
+ */
+void ModbusCache::invalidate( uint8_t u8id ) {
+  for (uint8_t i = 0; i < MODBUS_CACHE_BLOCKS; i++) {
+    modbus_block_t *block = &aBlocks[ i ];
+    if ((u8id != 0) && (block->u8id != u8id)) continue;
+
+    block->u16ValidNo = 0;
+    if (i == i8busy) continue; // keep the block the master is writing into
+    block->u8id = 0;
+    block->u32maxAge = CACHE_NO_AGE;
+    block->u8lastError = 0;
+  }
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Find the block holding a range, growing a neighbouring block of the
+ * same slave and table or taking another one when needed.
+ *
+ * @return block holding the range, nullptr if there is no room
+ * @ingroup cache
+ */
+modbus_block_t *ModbusCache::findBlock( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ) {
+  uint32_t u32end = (uint32_t) u16add + u16no;
+
+  for (uint8_t i = 0; i < MODBUS_CACHE_BLOCKS; i++) {
+    modbus_block_t *block = &aBlocks[ i ];
+    if ((block->u8id != u8id) || (block->u8fct != u8fct)) continue;
+
+    uint32_t u32blockEnd = (uint32_t) block->u16RegAdd + block->u16CoilsNo;
+    if ((u16add >= block->u16RegAdd) && (u32end <= u32blockEnd)) return block;
+  }
+
+  // merge with an overlapping or adjacent block when the union still fits
+  for (uint8_t i = 0; i < MODBUS_CACHE_BLOCKS; i++) {
+    modbus_block_t *block = &aBlocks[ i ];
+    if ((block->u8id != u8id) || (block->u8fct != u8fct) || (i == i8busy)) continue;
+
+    uint32_t u32blockEnd = (uint32_t) block->u16RegAdd + block->u16CoilsNo;
+    if ((u32end < block->u16RegAdd) || (u16add > u32blockEnd)) continue;
+
+    uint16_t u16start = (u16add < block->u16RegAdd) ? u16add : block->u16RegAdd;
+    uint32_t u32stop = (u32end > u32blockEnd) ? u32end : u32blockEnd;
+    if (u32stop - u16start > MODBUS_CACHE_REGS) continue;
+
+    grow( block, u16start, (uint16_t) (u32stop - u16start));
+    return block;
+  }
+
+  modbus_block_t *block = takeBlock();
+  if (block != nullptr) {
+    block->u8id = u8id;
+    block->u8fct = u8fct;
+    block->u16RegAdd = u16add;
+    block->u16CoilsNo = u16no;
+    block->u32maxAge = CACHE_NO_AGE;
+    block->u16ValidNo = 0;
+    block->u8lastError = 0;
+  }
+  return block;
+}
+
+/**
+ * @brief
+ * Take a free block or, when there is none, reuse the one read least
+ * recently by a consumer among those neither on the bus nor waited for.
+ *
+ * @return block to fill, nullptr if every block is in use
+ * @ingroup cache
+ */
+modbus_block_t *ModbusCache::takeBlock() {
+  modbus_block_t *oldest = nullptr;
+
+  for (uint8_t i = 0; i < MODBUS_CACHE_BLOCKS; i++) {
+    modbus_block_t *block = &aBlocks[ i ];
+    if (block->u8id == 0) return block;
+    if ((i == i8busy) || (block->u32maxAge != CACHE_NO_AGE)) continue;
+    if ((oldest == nullptr) || (u32reads - block->u32used > u32reads - oldest->u32used)) oldest = block;
+  }
+  return oldest;
+}
+
+/**
+ * @brief
+ * Extend a block to a range holding it. The registers it holds stay
+ * where they are in the register image, and are served until the next
+ * read of the whole block.
+ *
+ * @param u16start  first register of the grown block
+ * @param u16no  registers of the grown block
+ * @ingroup cache
+ */
+void ModbusCache::grow( modbus_block_t *block, uint16_t u16start, uint16_t u16no ) {
+  uint16_t u16shift = block->u16RegAdd - u16start;
+  if (u16shift > 0 && block->u16ValidNo > 0) {
+    memmove( &block->au16data[ u16shift ], block->au16data, block->u16CoilsNo * sizeof( uint16_t ));
+  }
+  block->u16RegAdd = u16start;
+  block->u16CoilsNo = u16no;
+}
+
+/**
+ * @brief
+ * Choose the next block to read: the one a consumer waits for with the
+ * tightest staleness bound.
+ *
+ * @return block index, -1 if nobody is waiting
+ * @ingroup cache
+ */
+int8_t ModbusCache::nextBlock() {
+  int8_t i8next = -1;
+  uint32_t u32tightest = CACHE_NO_AGE;
+
+  for (uint8_t i = 0; i < MODBUS_CACHE_BLOCKS; i++) {
+    modbus_block_t *block = &aBlocks[ i ];
+    if ((block->u8id == 0) || (block->u32maxAge == CACHE_NO_AGE)) continue;
+    if ((i8next < 0) || (block->u32maxAge < u32tightest)) {
+      i8next = i;
+      u32tightest = block->u32maxAge;
+    }
+  }
+  return i8next;
+}
@@ -0,0 +1,88 @@
+#ifndef MODBUS_CACHE_H
+#define MODBUS_CACHE_H
+
+/**
+ * @file 		ModbusCache.h
+ *
+ * @description
+ *  Master read-through register cache.
+ *  Several application modules share one Modbus master through a
+ *  ModbusCache. Each consumer states how old a value it accepts; the bus is
+ *  only read when the cached block is older than the tightest bound asked
+ *  for, and overlapping requests for the same slave and table are merged
+ *  into a single FC3/FC4 transaction. When every block is in use, the one
+ *  read least recently by a consumer, and not waited for, is reused.
+ *
+ * @defgroup cache Modbus Master Register Cache
+ */
+
+#include "ModbusRtu.h"
+
+#ifndef MODBUS_CACHE_BLOCKS
+#define MODBUS_CACHE_BLOCKS 8	//!< number of register blocks kept by the master cache
+#endif
+#ifndef MODBUS_CACHE_REGS
+#define MODBUS_CACHE_REGS 64	//!< maximum registers held by one cached block
+#endif
+
+/**
+ * @enum CACHE_RESULT
+ * @brief
+ * Return values of ModbusCache::read()
+ */
+enum CACHE_RESULT {
+  CACHE_HIT                     = 1,  //!< data copied, fresh enough for the consumer
+  CACHE_PENDING                 = 0,  //!< a bus read is scheduled, ask again later
+  CACHE_FAILED                  = -1, //!< the last bus read of the block failed
+  CACHE_FULL                    = -2, //!< every block is being read or waited for
+  CACHE_BAD_REQUEST             = -3  //!< function code or range not cacheable
+};
+
+/**
+ * @struct modbus_block_t
+ * @brief
+ * Cached register block of one slave table.
+ */
+typedef struct {
+  uint8_t u8id;          /*!< Slave address, 0 = free block */
+  uint8_t u8fct;         /*!< Table read: MB_FC_READ_REGISTERS or MB_FC_READ_INPUT_REGISTER */
+  uint16_t u16RegAdd;    /*!< Address of the first cached register */
+  uint16_t u16CoilsNo;   /*!< Number of cached registers */
+  uint32_t u32stamp;     /*!< Master clock (ms) when the block was last read from the bus */
+  uint32_t u32maxAge;    /*!< Tightest age bound of a waiting consumer, 0xFFFFFFFF = none */
+  uint32_t u32used;      /*!< Consumer read count when the block was last read by one */
+  uint16_t u16ValidAdd;  /*!< First register of the last complete read */
+  uint16_t u16ValidNo;   /*!< Registers of the last complete read, 0 = none */
+  uint8_t u8lastError;   /*!< Master error of the last failed read, 0 = none */
+  uint16_t au16data[MODBUS_CACHE_REGS]; /*!< Register image, filled by the master */
+}
+modbus_block_t;
+
+/**
+ * @class ModbusCache
+ * @brief
+ * Read-through cache sitting between application consumers and a Modbus master.
+ * The cache owns the master: nobody else should query() it while the cache is polled.
+ */
+class ModbusCache {
+private:
+  Modbus *master;
+  modbus_block_t aBlocks[MODBUS_CACHE_BLOCKS];
+  modbus_t telegram; //!< query in flight
+  int8_t i8busy; //!< index of the block being read, -1 when the bus is free
+  uint32_t u32reads; //!< consumer reads, orders the blocks by last use
+
+  modbus_block_t *findBlock( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no );
+  modbus_block_t *takeBlock();
+  void grow( modbus_block_t *block, uint16_t u16start, uint16_t u16no );
+  int8_t nextBlock();
+
+public:
+  ModbusCache( Modbus *master );
+  int8_t read( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no,
+    uint16_t *dest, uint32_t u32maxAge, uint32_t *pu32age = nullptr ); //!<consumer read with staleness bound
+  int8_t poll(); //!<cyclic poll, drives the master
+  void invalidate( uint8_t u8id ); //!<forget every block of a slave, 0 = all slaves
+};
+
+#endif
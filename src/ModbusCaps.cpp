@@ -0,0 +1,642 @@
+// ModbusCaps.cpp
+
+#include "ModbusCaps.h"
+
+/**
+ * Largest reads of the protocol, or less if the buffers are smaller
+ */
+#define CAPS_LIMIT(max, fit) ((max) < (fit) ? (max) : (fit))
+#define CAPS_MAX_READ_REGS  CAPS_LIMIT( MB_MAX_READ_REGISTERS, (MAX_BUFFER - 5) / 2 )
+#define CAPS_MAX_READ_COILS CAPS_LIMIT( MB_MAX_READ_COILS, (MAX_BUFFER - 5) * 8 )
+
+#define CAPS_HEADER_SIZE 8 //!< bytes of the binary header
+#define CAPS_RECORD_SIZE 24 //!< bytes of a binary record
+#define CAPS_HOLE_SIZE 7 //!< bytes of a binary hole
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of an empty cache over storage given by the application
+ *
+ * @param caps  room for the records, one per slave
+ * @param u16caps  number of records it can hold
+ * @param holes  room for the holes
+ * @param u16holes  number of holes it can hold
+ * @ingroup caps
+ */
+ModbusCaps::ModbusCaps( modbus_caps_t *caps, uint16_t u16caps, modbus_hole_t *holes, uint16_t u16holes ) {
+  this->aCaps = caps;
+  this->u16maxCaps = u16caps;
+  this->aHoles = holes;
+  this->u16maxHoles = u16holes;
+  this->master = nullptr;
+  this->u8ranges = 0;
+  this->bBusy = false;
+  clear();
+}
+
+/**
+ * @brief
+ * Forget every record and every hole
+ *
+ * @ingroup caps
+ */
+void ModbusCaps::clear() {
+  u16caps = 0;
+  u16holes = 0;
+}
+
+/**
+ * @brief
+ * Record of a slave, created empty if the slave is new
+ *
+ * @return record, nullptr if the records are full
+ * @ingroup caps
+ */
+modbus_caps_t *ModbusCaps::add( uint8_t u8port, uint8_t u8id ) {
+  modbus_caps_t *caps = find( u8port, u8id );
+  if (caps != nullptr) return caps;
+  if (u16caps >= u16maxCaps) return nullptr;
+
+  caps = &aCaps[ u16caps++ ];
+  memset( caps, 0, sizeof( modbus_caps_t ));
+  caps->u8port = u8port;
+  caps->u8id = u8id;
+  return caps;
+}
+
+/**
+ * @brief
+ * Record of a slave
+ *
+ * @return record, nullptr if the slave is unknown
+ * @ingroup caps
+ */
+modbus_caps_t *ModbusCaps::find( uint8_t u8port, uint8_t u8id ) {
+  for (uint16_t i = 0; i < u16caps; i++) {
+    if (aCaps[ i ].u8port == u8port && aCaps[ i ].u8id == u8id) return &aCaps[ i ];
+  }
+  return nullptr;
+}
+
+/**
+ * @brief
+ * Drop a slave and its holes, e.g. when it no longer answers a scan.
+ * The other records keep their order.
+ *
+ * @ingroup caps
+ */
+void ModbusCaps::forget( uint8_t u8port, uint8_t u8id ) {
+  modbus_caps_t *caps = find( u8port, u8id );
+  if (caps != nullptr) {
+    uint16_t u16index = caps - aCaps;
+    memmove( caps, caps + 1, (u16caps - u16index - 1) * sizeof( modbus_caps_t ));
+    u16caps--;
+  }
+  for (uint16_t i = 0; i < u16holes; ) {
+    if (aHoles[ i ].u8port == u8port && aHoles[ i ].u8id == u8id) aHoles[ i ] = aHoles[ --u16holes ];
+    else i++;
+  }
+}
+
+/**
+ * @brief
+ * Number of records
+ *
+ * @ingroup caps
+ */
+uint16_t ModbusCaps::getCount() {
+  return u16caps;
+}
+
+/**
+ * @brief
+ * Record of the cache
+ *
+ * @return record, nullptr if out of range
+ * @ingroup caps
+ */
+const modbus_caps_t *ModbusCaps::get( uint16_t u16caps ) {
+  return (u16caps < this->u16caps) ? &aCaps[ u16caps ] : nullptr;
+}
+
+/**
+ * @brief
+ * Number of holes
+ *
+ * @ingroup caps
+ */
+uint16_t ModbusCaps::getHoles() {
+  return u16holes;
+}
+
+/**
+ * @brief
+ * Hole of the cache
+ *
+ * @return hole, nullptr if out of range
+ * @ingroup caps
+ */
+const modbus_hole_t *ModbusCaps::getHole( uint16_t u16hole ) {
+  return (u16hole < u16holes) ? &aHoles[ u16hole ] : nullptr;
+}
+
+/**
+ * @brief
+ * Learn from a completed read of a master, e.g. in its completion
+ * handler. A read answered raises the limit of its table and maps its
+ * addresses; EXC_REGS_QUANT lowers the limit; EXC_ADDR_RANGE on a single
+ * element is a hole; EXC_FUNC_CODE tells the table is not supported.
+ * EXC_ADDR_RANGE on a larger read is ambiguous, probe() resolves it.
+ *
+ * @param u8port  port of the master, as numbered by the application
+ * @param result  completion of a read (FC1 to FC4), others are ignored
+ * @return true if the limits, the holes or the functions changed
+ * @ingroup caps
+ */
+boolean ModbusCaps::learn( uint8_t u8port, const modbus_result_t *result ) {
+  const modbus_t *telegram = &result->telegram;
+  uint8_t u8fct = telegram->u8fct;
+  uint16_t u16no = telegram->u16CoilsNo;
+
+  if (u8fct < MB_FC_READ_COILS || u8fct > MB_FC_READ_INPUT_REGISTER) return false;
+  if (result->u8status != RESULT_OK && result->u8status != RESULT_EXCEPTION) return false;
+
+  modbus_caps_t *caps = add( u8port, telegram->u8id );
+  if (caps == nullptr) return false;
+
+  modbus_caps_t before = *caps;
+  boolean bHoles = false;
+  uint8_t u8bit = 1 << u8fct;
+  uint16_t *pu16max = &caps->au16maxRead[ u8fct - 1 ];
+  uint16_t *pu16refused = &caps->au16refused[ u8fct - 1 ];
+
+  caps->u8tested |= u8bit;
+  caps->u8fcts |= u8bit;
+  if (result->u8status == RESULT_OK) {
+    if (u16no > *pu16max) *pu16max = u16no;
+    if (*pu16refused != 0 && *pu16refused <= u16no) *pu16refused = 0; // the slave changed
+    bHoles = clearHoles( u8port, telegram->u8id, u8fct, telegram->u16RegAdd, u16no );
+  } else {
+    switch( result->u8exception ) {
+    case EXC_FUNC_CODE:
+      caps->u8fcts &= ~u8bit;
+      break;
+    case EXC_REGS_QUANT:
+      if (u16no > *pu16max && (*pu16refused == 0 || u16no < *pu16refused)) *pu16refused = u16no;
+      break;
+    case EXC_ADDR_RANGE:
+      if (u16no == 1) bHoles = addHole( u8port, telegram->u8id, u8fct, telegram->u16RegAdd, 1 );
+      break;
+    }
+  }
+  return bHoles || memcmp( &before, caps, sizeof( modbus_caps_t )) != 0;
+}
+
+/**
+ * @brief
+ * Largest read of a table known to be legal: the largest one answered
+ * once a size was refused, the protocol limit as long as none was.
+ *
+ * @param u8port  port of the slave
+ * @param u8id  slave address
+ * @param u8fct  read function code, 1..4
+ * @return number of registers or coils
+ * @ingroup caps
+ */
+uint16_t ModbusCaps::getMaxRead( uint8_t u8port, uint8_t u8id, uint8_t u8fct ) {
+  uint16_t u16limit = maxRead( u8fct );
+  modbus_caps_t *caps = find( u8port, u8id );
+  if (caps == nullptr || u8fct < MB_FC_READ_COILS || u8fct > MB_FC_READ_INPUT_REGISTER) return u16limit;
+
+  uint16_t u16max = caps->au16maxRead[ u8fct - 1 ];
+  uint16_t u16refused = caps->au16refused[ u8fct - 1 ];
+  if (u16refused == 0) return u16limit;
+  if (u16max > 0) return u16max;
+  return (u16refused > 1) ? u16refused / 2 : 1;
+}
+
+/**
+ * @brief
+ * Legal part of a read: cut to the limit of the table and before the
+ * first hole. Planners split their reads there.
+ *
+ * @param u8port  port of the slave
+ * @param u8id  slave address
+ * @param u8fct  read function code, 1..4
+ * @param u16add  first address of the read
+ * @param u16no  number of registers or coils wanted
+ * @return number that can be read from u16add, 0 if u16add is a hole
+ * @ingroup caps
+ */
+uint16_t ModbusCaps::fitRead( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ) {
+  uint16_t u16max = getMaxRead( u8port, u8id, u8fct );
+  return clipHoles( u8port, u8id, u8fct, u16add, (u16no < u16max) ? u16no : u16max );
+}
+
+/**
+ * @brief
+ * Start probing a range of a table, e.g. after a read of it was refused.
+ * The probe reads the range with sizes bisecting the limit of the table;
+ * a read refused for its addresses is split in halves, down to the
+ * single addresses that are holes. Drive it with poll().
+ *
+ * @param master  master of the port, owned by the probe until it is over
+ * @param u8port  port of the master, as numbered by the application
+ * @param u8id  slave address between 1 and 247
+ * @param u8fct  read function code, 1..4
+ * @param u16add  first address of the range
+ * @param u16no  number of registers or coils of the range
+ * @return CAPS_OK, CAPS_BUSY or CAPS_BAD_REQUEST
+ * @ingroup caps
+ */
+int8_t ModbusCaps::probe( Modbus *master, uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ) {
+  if (this->master != nullptr) return CAPS_BUSY;
+  if (u8id < 1 || u8id > 247 || u8fct < MB_FC_READ_COILS || u8fct > MB_FC_READ_INPUT_REGISTER) return CAPS_BAD_REQUEST;
+  if (u16no == 0 || (uint32_t) u16add + u16no > 0x10000) return CAPS_BAD_REQUEST;
+
+  this->master = master;
+  u8probePort = u8port;
+  u8probeId = u8id;
+  u8probeFct = u8fct;
+  u8ranges = 0;
+  bBusy = false;
+  push( u16add, u16no );
+  return CAPS_OK;
+}
+
+/**
+ * @brief
+ * Drive the probe: take the read in flight, then send the next one.
+ * This method must be called only at loop section, from the thread that
+ * owns the master.
+ *
+ * @return true while the probe runs
+ * @ingroup caps
+ */
+boolean ModbusCaps::poll() {
+  if (master == nullptr) return false;
+
+  master->poll(); // completion calls onResult()
+  if (bBusy) return true;
+  if (u8ranges == 0) {
+    master = nullptr;
+    return false;
+  }
+
+  // skip the addresses already known as holes
+  modbus_range_t *range = &aRanges[ u8ranges - 1 ];
+  const modbus_hole_t *hole = findHole( u8probePort, u8probeId, u8probeFct, range->u16RegAdd );
+  if (hole != nullptr) {
+    uint32_t u32skip = (uint32_t) hole->u16RegAdd + hole->u16CoilsNo - range->u16RegAdd;
+    if (u32skip >= range->u16CoilsNo) u8ranges--;
+    else {
+      range->u16RegAdd += u32skip;
+      range->u16CoilsNo -= u32skip;
+    }
+    return true;
+  }
+
+  uint16_t u16no = probeSize();
+  modbus_t telegram;
+  telegram.u8id = u8probeId;
+  telegram.u8fct = u8probeFct;
+  telegram.u16RegAdd = range->u16RegAdd;
+  telegram.u16CoilsNo = clipHoles( u8probePort, u8probeId, u8probeFct, range->u16RegAdd,
+    (u16no < range->u16CoilsNo) ? u16no : range->u16CoilsNo );
+  telegram.au16reg = au16data;
+
+  bBusy = true;
+  if (master->query( telegram, onResult, this ) != 0) {
+    bBusy = false;
+    master = nullptr; // the master is not free, give up
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief
+ * Tell if a probe runs: the master must be left to it
+ *
+ * @ingroup caps
+ */
+boolean ModbusCaps::isProbing() {
+  return master != nullptr;
+}
+
+/**
+ * @brief
+ * Write the binary form of the cache, see ModbusCaps.h
+ *
+ * @param dest  destination
+ * @param u16room  bytes dest can hold
+ * @return bytes written, or CAPS_FULL if dest is too small
+ * @ingroup caps
+ */
+int16_t ModbusCaps::save( uint8_t *dest, uint16_t u16room ) {
+  uint32_t u32size = CAPS_HEADER_SIZE + (uint32_t) u16caps * CAPS_RECORD_SIZE + (uint32_t) u16holes * CAPS_HOLE_SIZE;
+  if (u32size > u16room || u32size > 0x7FFF) return CAPS_FULL;
+
+  uint16_t u16pos = 0;
+  dest[ u16pos++ ] = 'M';
+  dest[ u16pos++ ] = 'B';
+  dest[ u16pos++ ] = 'C';
+  dest[ u16pos++ ] = CAPS_VERSION;
+  dest[ u16pos++ ] = lowByte( u16caps );
+  dest[ u16pos++ ] = highByte( u16caps );
+  dest[ u16pos++ ] = lowByte( u16holes );
+  dest[ u16pos++ ] = highByte( u16holes );
+
+  for (uint16_t i = 0; i < u16caps; i++) {
+    const modbus_caps_t *caps = &aCaps[ i ];
+    dest[ u16pos++ ] = caps->u8port;
+    dest[ u16pos++ ] = caps->u8id;
+    dest[ u16pos++ ] = caps->u8fcts;
+    dest[ u16pos++ ] = caps->u8tested;
+    for (uint8_t f = 0; f < 4; f++) {
+      dest[ u16pos++ ] = lowByte( caps->au16maxRead[ f ] );
+      dest[ u16pos++ ] = highByte( caps->au16maxRead[ f ] );
+    }
+    for (uint8_t f = 0; f < 4; f++) {
+      dest[ u16pos++ ] = lowByte( caps->au16refused[ f ] );
+      dest[ u16pos++ ] = highByte( caps->au16refused[ f ] );
+    }
+    for (uint8_t b = 0; b < 4; b++) dest[ u16pos++ ] = (caps->u32latency >> (8 * b)) & 0xFF;
+  }
+  for (uint16_t i = 0; i < u16holes; i++) {
+    const modbus_hole_t *hole = &aHoles[ i ];
+    dest[ u16pos++ ] = hole->u8port;
+    dest[ u16pos++ ] = hole->u8id;
+    dest[ u16pos++ ] = hole->u8fct;
+    dest[ u16pos++ ] = lowByte( hole->u16RegAdd );
+    dest[ u16pos++ ] = highByte( hole->u16RegAdd );
+    dest[ u16pos++ ] = lowByte( hole->u16CoilsNo );
+    dest[ u16pos++ ] = highByte( hole->u16CoilsNo );
+  }
+  return u16pos;
+}
+
+/**
+ * @brief
+ * Load the binary form of a cache, replacing the records and holes
+ *
+ * @param src  binary form, e.g. read back from EEPROM
+ * @param u16size  bytes of the binary form
+ * @return number of records, or CAPS_FORMAT or CAPS_FULL; the cache is
+ * empty on error
+ * @ingroup caps
+ */
+int16_t ModbusCaps::load( const uint8_t *src, uint16_t u16size ) {
+  clear();
+  if (u16size < CAPS_HEADER_SIZE || src[ 0 ] != 'M' || src[ 1 ] != 'B' || src[ 2 ] != 'C' || src[ 3 ] != CAPS_VERSION) return CAPS_FORMAT;
+
+  uint16_t u16records = word( src[ 5 ], src[ 4 ] );
+  uint16_t u16gaps = word( src[ 7 ], src[ 6 ] );
+  if (CAPS_HEADER_SIZE + (uint32_t) u16records * CAPS_RECORD_SIZE + (uint32_t) u16gaps * CAPS_HOLE_SIZE != u16size) return CAPS_FORMAT;
+  if (u16records > u16maxCaps || u16gaps > u16maxHoles) return CAPS_FULL;
+
+  uint16_t u16pos = CAPS_HEADER_SIZE;
+  for (uint16_t i = 0; i < u16records; i++) {
+    modbus_caps_t *caps = &aCaps[ i ];
+    caps->u8port = src[ u16pos++ ];
+    caps->u8id = src[ u16pos++ ];
+    caps->u8fcts = src[ u16pos++ ];
+    caps->u8tested = src[ u16pos++ ];
+    for (uint8_t f = 0; f < 4; f++, u16pos += 2) caps->au16maxRead[ f ] = word( src[ u16pos + 1 ], src[ u16pos ] );
+    for (uint8_t f = 0; f < 4; f++, u16pos += 2) caps->au16refused[ f ] = word( src[ u16pos + 1 ], src[ u16pos ] );
+    caps->u32latency = 0;
+    for (uint8_t b = 0; b < 4; b++) caps->u32latency |= (uint32_t) src[ u16pos++ ] << (8 * b);
+  }
+  for (uint16_t i = 0; i < u16gaps; i++) {
+    modbus_hole_t *hole = &aHoles[ i ];
+    hole->u8port = src[ u16pos++ ];
+    hole->u8id = src[ u16pos++ ];
+    hole->u8fct = src[ u16pos++ ];
+    hole->u16RegAdd = word( src[ u16pos + 1 ], src[ u16pos ] );
+    hole->u16CoilsNo = word( src[ u16pos + 3 ], src[ u16pos + 2 ] );
+    u16pos += 4;
+  }
+  u16caps = u16records;
+  u16holes = u16gaps;
+  return u16caps;
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Hole holding an address
+ *
+ * @return hole, nullptr if the address is not known as a hole
+ * @ingroup caps
+ */
+const modbus_hole_t *ModbusCaps::findHole( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add ) {
+  for (uint16_t i = 0; i < u16holes; i++) {
+    const modbus_hole_t *hole = &aHoles[ i ];
+    if (hole->u8port != u8port || hole->u8id != u8id || hole->u8fct != u8fct) continue;
+    if (u16add >= hole->u16RegAdd && (uint32_t) u16add < (uint32_t) hole->u16RegAdd + hole->u16CoilsNo) return hole;
+  }
+  return nullptr;
+}
+
+/**
+ * @brief
+ * Cut a read before the first hole it would span
+ *
+ * @return number that can be read from u16add, 0 if u16add is a hole
+ * @ingroup caps
+ */
+uint16_t ModbusCaps::clipHoles( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ) {
+  for (uint16_t i = 0; i < u16holes; i++) {
+    const modbus_hole_t *hole = &aHoles[ i ];
+    if (hole->u8port != u8port || hole->u8id != u8id || hole->u8fct != u8fct) continue;
+    if (hole->u16RegAdd <= u16add) {
+      if ((uint32_t) hole->u16RegAdd + hole->u16CoilsNo > u16add) return 0;
+    } else if ((uint32_t) hole->u16RegAdd < (uint32_t) u16add + u16no) {
+      u16no = hole->u16RegAdd - u16add;
+    }
+  }
+  return u16no;
+}
+
+/**
+ * @brief
+ * Record a hole, merged with the holes it touches
+ *
+ * @return true if the holes changed
+ * @ingroup caps
+ */
+boolean ModbusCaps::addHole( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ) {
+  uint32_t u32start = u16add, u32end = (uint32_t) u16add + u16no;
+
+  for (uint16_t i = 0; i < u16holes; ) {
+    modbus_hole_t *hole = &aHoles[ i ];
+    uint32_t u32holeEnd = (uint32_t) hole->u16RegAdd + hole->u16CoilsNo;
+    if (hole->u8port != u8port || hole->u8id != u8id || hole->u8fct != u8fct ||
+      hole->u16RegAdd > u32end || u32holeEnd < u32start) {
+      i++;
+      continue;
+    }
+    if (hole->u16RegAdd <= u32start && u32holeEnd >= u32end) return false; // known already
+    if (hole->u16RegAdd < u32start) u32start = hole->u16RegAdd;
+    if (u32holeEnd > u32end) u32end = u32holeEnd;
+    *hole = aHoles[ --u16holes ];
+  }
+  if (u16holes >= u16maxHoles) return false;
+
+  modbus_hole_t *hole = &aHoles[ u16holes++ ];
+  hole->u8port = u8port;
+  hole->u8id = u8id;
+  hole->u8fct = u8fct;
+  hole->u16RegAdd = u32start;
+  hole->u16CoilsNo = u32end - u32start;
+  return true;
+}
+
+/**
+ * @brief
+ * Forget the holes a successful read proved mapped
+ *
+ * @return true if the holes changed
+ * @ingroup caps
+ */
+boolean ModbusCaps::clearHoles( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ) {
+  uint32_t u32end = (uint32_t) u16add + u16no;
+  boolean bChanged = false;
+
+  for (uint16_t i = 0; i < u16holes; ) {
+    modbus_hole_t *hole = &aHoles[ i ];
+    uint32_t u32holeEnd = (uint32_t) hole->u16RegAdd + hole->u16CoilsNo;
+    if (hole->u8port != u8port || hole->u8id != u8id || hole->u8fct != u8fct ||
+      hole->u16RegAdd >= u32end || u32holeEnd <= u16add) {
+      i++;
+      continue;
+    }
+    bChanged = true;
+    if (hole->u16RegAdd < u16add && u32holeEnd > u32end) {
+      // the read sits inside the hole: keep both ends
+      if (u16holes < u16maxHoles) {
+        modbus_hole_t *tail = &aHoles[ u16holes++ ];
+        *tail = *hole;
+        tail->u16RegAdd = u32end;
+        tail->u16CoilsNo = u32holeEnd - u32end;
+      }
+      hole->u16CoilsNo = u16add - hole->u16RegAdd;
+      i++;
+    } else if (hole->u16RegAdd < u16add) {
+      hole->u16CoilsNo = u16add - hole->u16RegAdd;
+      i++;
+    } else if (u32holeEnd > u32end) {
+      hole->u16CoilsNo = u32holeEnd - u32end;
+      hole->u16RegAdd = u32end;
+      i++;
+    } else {
+      *hole = aHoles[ --u16holes ];
+    }
+  }
+  return bChanged;
+}
+
+/**
+ * @brief
+ * Put a range on the probe stack
+ *
+ * @return false if the stack is full
+ * @ingroup caps
+ */
+boolean ModbusCaps::push( uint16_t u16add, uint16_t u16no ) {
+  if (u8ranges >= MODBUS_CAPS_PROBE_DEPTH) return false;
+  aRanges[ u8ranges ].u16RegAdd = u16add;
+  aRanges[ u8ranges ].u16CoilsNo = u16no;
+  u8ranges++;
+  return true;
+}
+
+/**
+ * @brief
+ * Size of the next probe read: half way between the largest read
+ * answered and the smallest one refused, the protocol limit if none was
+ *
+ * @ingroup caps
+ */
+uint16_t ModbusCaps::probeSize() {
+  modbus_caps_t *caps = find( u8probePort, u8probeId );
+  uint16_t u16limit = maxRead( u8probeFct );
+  if (caps == nullptr) return u16limit;
+
+  uint16_t u16max = caps->au16maxRead[ u8probeFct - 1 ];
+  uint16_t u16refused = caps->au16refused[ u8probeFct - 1 ];
+  if (u16refused == 0) return u16limit;
+  if (u16max == 0) return (u16refused > 1) ? u16refused / 2 : 1;
+  return u16max + (u16refused - u16max) / 2;
+}
+
+/**
+ * @brief
+ * Take the outcome of a probe read: move on in its range, or split it
+ *
+ * @ingroup caps
+ */
+void ModbusCaps::probeResult( const modbus_result_t *result ) {
+  uint16_t u16add = result->telegram.u16RegAdd;
+  uint16_t u16no = result->telegram.u16CoilsNo;
+  modbus_range_t range = aRanges[ u8ranges - 1 ];
+
+  bBusy = false;
+  boolean bLearned = learn( u8probePort, result );
+
+  if (result->u8status == RESULT_OK ||
+    (result->u8status == RESULT_EXCEPTION && result->u8exception == EXC_ADDR_RANGE && u16no == 1)) {
+    // answered, or a hole: go on with the rest of the range
+    u8ranges--;
+    if (range.u16CoilsNo > u16no) push( u16add + u16no, range.u16CoilsNo - u16no );
+    return;
+  }
+  if (result->u8status == RESULT_EXCEPTION && result->u8exception == EXC_REGS_QUANT && u16no > 1) {
+    if (!bLearned) {
+      // a size answered before is refused now, e.g. the limit depends on
+      // the address: lower the limit below it, or the same read goes again
+      modbus_caps_t *caps = find( u8probePort, u8probeId );
+      if (caps == nullptr) {
+        u8ranges = 0;
+        return;
+      }
+      caps->au16refused[ u8probeFct - 1 ] = u16no;
+      if (caps->au16maxRead[ u8probeFct - 1 ] >= u16no) caps->au16maxRead[ u8probeFct - 1 ] = u16no / 2;
+    }
+    return; // the limit went down, the range is read again with smaller reads
+  }
+  if (result->u8status == RESULT_EXCEPTION && result->u8exception == EXC_ADDR_RANGE) {
+    // a hole is somewhere in the read: split it in halves, left one first
+    u8ranges--;
+    if ((range.u16CoilsNo > u16no && !push( u16add + u16no, range.u16CoilsNo - u16no )) ||
+      !push( u16add + u16no / 2, u16no - u16no / 2 ) || !push( u16add, u16no / 2 )) {
+      u8ranges = 0; // too many pending ranges, give up
+    }
+    return;
+  }
+  u8ranges = 0; // no answer, or a refusal the probe cannot narrow
+}
+
+/**
+ * @brief
+ * Largest read of a table the protocol and the buffers allow
+ *
+ * @ingroup caps
+ */
+uint16_t ModbusCaps::maxRead( uint8_t u8fct ) {
+  if (u8fct == MB_FC_READ_COILS || u8fct == MB_FC_READ_DISCRETE_INPUT) return CAPS_MAX_READ_COILS;
+  return CAPS_MAX_READ_REGS;
+}
+
+/**
+ * @brief
+ * Completion handler of the master: a probe read is over
+ *
+ * @ingroup caps
+ */
+void ModbusCaps::onResult( const modbus_result_t *result, void *context ) {
+  ((ModbusCaps *) context)->probeResult( result );
+}
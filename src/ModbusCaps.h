@@ -0,0 +1,142 @@
+#ifndef MODBUS_CAPS_H
+#define MODBUS_CAPS_H
+
+/**
+ * @file 		ModbusCaps.h
+ *
+ * @description
+ *  Slave capability cache.
+ *  Many slaves refuse reads larger than some vendor limit, or reads that
+ *  span unmapped addresses, answering EXC_REGS_QUANT or EXC_ADDR_RANGE.
+ *  The cache learns those limits from the answers a master gets: feed it
+ *  every completed read with learn(). A refused size narrows the limit
+ *  of the table; a refused single element is an address hole. When a
+ *  larger read is refused for its addresses, probe() finds the holes and
+ *  the limit with targeted reads: it splits the refused range until every
+ *  part reads or is a hole. Request planners ask fitRead() for the
+ *  largest legal read, and save() keeps the knowledge, e.g. in EEPROM, so
+ *  that the next start issues the largest legal reads right away.
+ *
+ *  Binary form: "MBC" then the version (1), the number of records and of
+ *  holes (uint16_t each), the records, then the holes. All integers are
+ *  little endian.
+ *    record: port, slave, u8fcts, u8tested, au16maxRead[4],
+ *            au16refused[4], u32latency
+ *    hole:   port, slave, function code, address, number of addresses
+ *
+ * @defgroup caps Modbus Slave Capabilities
+ */
+
+#include "ModbusRtu.h"
+
+#ifndef MODBUS_CAPS_PROBE_DEPTH
+#define MODBUS_CAPS_PROBE_DEPTH 32	//!< ranges waiting to be probed
+#endif
+
+#define CAPS_VERSION 1 //!< version of the binary form
+
+/**
+ * @enum CAPS_RESULT
+ * @brief
+ * Errors of ModbusCaps::probe(), save() and load()
+ */
+enum CAPS_RESULT {
+  CAPS_OK                       = 0,
+  CAPS_FULL                     = -1, //!< more records or holes than the storage, or dest too small
+  CAPS_FORMAT                   = -2, //!< binary form: bad header or size
+  CAPS_BUSY                     = -3, //!< a probe already runs
+  CAPS_BAD_REQUEST              = -4  //!< slave, function code or range not probeable
+};
+
+/**
+ * @struct modbus_caps_t
+ * @brief
+ * Capabilities of a slave. Read function codes 1..4 are bits 1..4 of
+ * the masks, and entries 0..3 of the arrays.
+ */
+typedef struct {
+  uint8_t u8port;        /*!< Port the slave answers on */
+  uint8_t u8id;          /*!< Slave address */
+  uint8_t u8fcts;        /*!< Read function codes answered, exceptions other than EXC_FUNC_CODE included */
+  uint8_t u8tested;      /*!< Read function codes that got an answer, supported or not */
+  uint16_t au16maxRead[4]; /*!< Largest read answered, 0 = none */
+  uint16_t au16refused[4]; /*!< Smallest read refused for its size, 0 = none */
+  uint32_t u32latency;   /*!< Answer time of the scan probe (us), 0 if not scanned */
+}
+modbus_caps_t;
+
+/**
+ * @struct modbus_hole_t
+ * @brief
+ * Addresses of a slave table that are not mapped
+ */
+typedef struct {
+  uint8_t u8port;        /*!< Port of the slave */
+  uint8_t u8id;          /*!< Slave address */
+  uint8_t u8fct;         /*!< Read function code, 1..4 */
+  uint16_t u16RegAdd;    /*!< First unmapped address */
+  uint16_t u16CoilsNo;   /*!< Number of unmapped addresses */
+}
+modbus_hole_t;
+
+/**
+ * @struct modbus_range_t
+ * @brief
+ * Range of addresses waiting to be probed
+ */
+typedef struct {
+  uint16_t u16RegAdd;
+  uint16_t u16CoilsNo;
+}
+modbus_range_t;
+
+/**
+ * @class ModbusCaps
+ * @brief
+ * Capabilities of the slaves of one or more ports, over storage given by
+ * the application. While probe() runs the cache owns the master.
+ */
+class ModbusCaps {
+private:
+  modbus_caps_t *aCaps;
+  modbus_hole_t *aHoles;
+  uint16_t u16maxCaps, u16maxHoles;
+  uint16_t u16caps, u16holes;
+  Modbus *master; //!< master of the probe, nullptr when no probe runs
+  uint8_t u8probePort, u8probeId, u8probeFct;
+  modbus_range_t aRanges[MODBUS_CAPS_PROBE_DEPTH]; //!< probe stack, the last one goes first
+  uint8_t u8ranges;
+  boolean bBusy; //!< probe read in flight
+  uint16_t au16data[MAX_BUFFER / 2]; //!< data of the probe reads
+
+  const modbus_hole_t *findHole( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add );
+  uint16_t clipHoles( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no );
+  boolean addHole( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no );
+  boolean clearHoles( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no );
+  boolean push( uint16_t u16add, uint16_t u16no );
+  uint16_t probeSize();
+  void probeResult( const modbus_result_t *result );
+  static uint16_t maxRead( uint8_t u8fct );
+  static void onResult( const modbus_result_t *result, void *context );
+
+public:
+  ModbusCaps( modbus_caps_t *caps, uint16_t u16caps, modbus_hole_t *holes, uint16_t u16holes );
+  void clear(); //!<forget everything
+  modbus_caps_t *add( uint8_t u8port, uint8_t u8id ); //!<record of a slave, created if needed, nullptr if full
+  modbus_caps_t *find( uint8_t u8port, uint8_t u8id ); //!<record of a slave, nullptr if unknown
+  void forget( uint8_t u8port, uint8_t u8id ); //!<drop a slave and its holes
+  uint16_t getCount(); //!<number of records
+  const modbus_caps_t *get( uint16_t u16caps ); //!<record, nullptr if out of range
+  uint16_t getHoles(); //!<number of holes
+  const modbus_hole_t *getHole( uint16_t u16hole ); //!<hole, nullptr if out of range
+  boolean learn( uint8_t u8port, const modbus_result_t *result ); //!<take a completed read, true if the knowledge changed
+  uint16_t getMaxRead( uint8_t u8port, uint8_t u8id, uint8_t u8fct ); //!<largest read known to be legal
+  uint16_t fitRead( uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ); //!<legal part of a read, 0 if it starts in a hole
+  int8_t probe( Modbus *master, uint8_t u8port, uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no ); //!<find the limit and the holes of a range
+  boolean poll(); //!<drive the probe, false once it is over
+  boolean isProbing(); //!<a probe runs
+  int16_t save( uint8_t *dest, uint16_t u16room ); //!<binary form, returns its size
+  int16_t load( const uint8_t *src, uint16_t u16size ); //!<binary form, returns the number of records
+};
+
+#endif
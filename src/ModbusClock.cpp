@@ -0,0 +1,69 @@
+// ModbusClock.cpp
+
+#include "ModbusClock.h"
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+uint32_t ModbusClock::millis() {
+  return ::millis();
+}
+
+uint32_t ModbusClock::micros() {
+  return ::micros();
+}
+
+void ModbusClock::delay( uint32_t u32ms ) {
+  ::delay( u32ms );
+}
+
+void ModbusClock::delayMicroseconds( uint32_t u32us ) {
+  ::delayMicroseconds( u32us );
+}
+
+/**
+ * @brief
+ * Device clock shared by every engine that has no other clock
+ *
+ * @ingroup setup
+ */
+ModbusClock *ModbusClock::hardware() {
+  static ModbusClock clock;
+  return &clock;
+}
+
+/**
+ * @brief
+ * Constructor of a virtual clock starting at 0
+ *
+ * @ingroup setup
+ */
+ModbusVirtualClock::ModbusVirtualClock() {
+  u64now = 0;
+}
+
+uint32_t ModbusVirtualClock::millis() {
+  return (uint32_t) (u64now / 1000);
+}
+
+uint32_t ModbusVirtualClock::micros() {
+  return (uint32_t) u64now;
+}
+
+void ModbusVirtualClock::delay( uint32_t u32ms ) {
+  u64now += (uint64_t) u32ms * 1000;
+}
+
+void ModbusVirtualClock::delayMicroseconds( uint32_t u32us ) {
+  u64now += u32us;
+}
+
+/**
+ * @brief
+ * Move the clock forward
+ *
+ * @param u32us  elapsed time (us)
+ * @ingroup setup
+ */
+void ModbusVirtualClock::advance( uint32_t u32us ) {
+  u64now += u32us;
+}
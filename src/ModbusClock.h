@@ -0,0 +1,53 @@
+#ifndef MODBUS_CLOCK_H
+#define MODBUS_CLOCK_H
+
+/**
+ * @file 		ModbusClock.h
+ *
+ * @description
+ *  Time source of the Modbus engines.
+ *  Every timing decision (T3.5, time-outs, turnaround, RS485 switching)
+ *  reads a ModbusClock. The default one is the device clock; a
+ *  ModbusVirtualClock only moves when it is told to, so simulations and
+ *  soak tests run as fast as the CPU allows and always behave the same.
+ *
+ * @ingroup setup
+ */
+
+#include "application.h"
+
+/**
+ * @class ModbusClock
+ * @brief
+ * Device clock: millis(), micros(), delay() and delayMicroseconds().
+ */
+class ModbusClock {
+public:
+  virtual ~ModbusClock() {}
+  virtual uint32_t millis();
+  virtual uint32_t micros();
+  virtual void delay( uint32_t u32ms );
+  virtual void delayMicroseconds( uint32_t u32us );
+
+  static ModbusClock *hardware(); //!<device clock, default of every engine
+};
+
+/**
+ * @class ModbusVirtualClock
+ * @brief
+ * Manually advanced clock. Delays return at once and move the clock forward.
+ */
+class ModbusVirtualClock : public ModbusClock {
+private:
+  uint64_t u64now; //!< current time (us)
+
+public:
+  ModbusVirtualClock();
+  uint32_t millis();
+  uint32_t micros();
+  void delay( uint32_t u32ms );
+  void delayMicroseconds( uint32_t u32us );
+  void advance( uint32_t u32us ); //!<move the clock forward
+};
+
+#endif
@@ -0,0 +1,567 @@
+// ModbusGateway.cpp
+
+#include "ModbusGateway.h"
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a gateway without buses nor clients
+ *
+ * @ingroup gateway
+ */
+ModbusGateway::ModbusGateway() {
+  for (uint8_t i = 0; i < MODBUS_GW_LINKS; i++) aLinks[ i ].link = nullptr;
+  for (uint8_t i = 0; i < MODBUS_GW_BUSES; i++) aBuses[ i ].master = nullptr;
+  for (uint8_t i = 0; i < MODBUS_GW_PENDING; i++) aReqs[ i ].u8state = GW_FREE;
+  u32seq = 0;
+  u16requests = u16merged = u16rejected = 0;
+}
+
+/**
+ * @brief
+ * Route a range of unit ids to a serial bus.
+ * Buses are searched in the order they were added.
+ *
+ * @param master  Modbus master (u8id = 0) already started with begin()
+ * @param u8firstId  first unit id of the bus
+ * @param u8lastId  last unit id of the bus
+ * @return bus index, -1 if MODBUS_GW_BUSES are already in use
+ * @ingroup gateway
+ */
+int8_t ModbusGateway::addBus( Modbus *master, uint8_t u8firstId, uint8_t u8lastId ) {
+  for (uint8_t i = 0; i < MODBUS_GW_BUSES; i++) {
+    modbus_gwbus_t *bus = &aBuses[ i ];
+    if (bus->master != nullptr) continue;
+
+    bus->master = master;
+    bus->u8firstId = u8firstId;
+    bus->u8lastId = u8lastId;
+    bus->i8active = -1;
+    bus->u8served = 0;
+    bus->gateway = this;
+    return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief
+ * Serve a new Modbus TCP client
+ *
+ * @param link  client connection, it must stay valid until detach()
+ * @param u8priority  0 is served first, clients of the same priority take turns
+ * @return link index, -1 if MODBUS_GW_LINKS clients are already served
+ * @ingroup gateway
+ */
+int8_t ModbusGateway::attach( Stream *link, uint8_t u8priority ) {
+  for (uint8_t i = 0; i < MODBUS_GW_LINKS; i++) {
+    if (aLinks[ i ].link != nullptr) continue;
+
+    aLinks[ i ].link = link;
+    aLinks[ i ].u8priority = u8priority;
+    aLinks[ i ].u16RxSize = 0;
+    return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief
+ * Stop serving a client, e.g. when its connection closed.
+ * Its queued requests are dropped, unless other clients wait for the same
+ * read; answers of its requests already on a bus are discarded.
+ *
+ * @ingroup gateway
+ */
+void ModbusGateway::detach( int8_t i8link ) {
+  if (i8link < 0 || i8link >= MODBUS_GW_LINKS) return;
+  aLinks[ i8link ].link = nullptr;
+
+  for (int8_t i = 0; i < MODBUS_GW_PENDING; i++) {
+    modbus_gwreq_t *request = &aReqs[ i ];
+    if (request->u8state == GW_FREE || request->u8link != i8link) continue;
+    request->u8link = GW_NO_LINK;
+
+    if (request->u8state == GW_FOLLOW) {
+      request->u8state = GW_FREE;
+    } else if (request->u8state == GW_QUEUED) {
+      boolean bFollowed = false;
+      for (uint8_t j = 0; j < MODBUS_GW_PENDING; j++) {
+        if (aReqs[ j ].u8state == GW_FOLLOW && aReqs[ j ].i8leader == i) bFollowed = true;
+      }
+      if (!bFollowed) request->u8state = GW_FREE;
+    }
+  }
+}
+
+/**
+ * @brief
+ * Check whether a connection is already served
+ *
+ * @ingroup gateway
+ */
+boolean ModbusGateway::isAttached( Stream *link ) {
+  for (uint8_t i = 0; i < MODBUS_GW_LINKS; i++) {
+    if (aLinks[ i ].link == link) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief
+ * Receive the client requests, complete the bus transactions and start
+ * the next ones. This method must be called only at loop section.
+ *
+ * @ingroup gateway
+ */
+void ModbusGateway::poll() {
+  for (uint8_t i = 0; i < MODBUS_GW_LINKS; i++) {
+    if (aLinks[ i ].link != nullptr) receive( i );
+  }
+
+  for (uint8_t i = 0; i < MODBUS_GW_BUSES; i++) {
+    modbus_gwbus_t *bus = &aBuses[ i ];
+    if (bus->master == nullptr) continue;
+
+    bus->master->poll(); // completion calls onResult()
+    if (bus->i8active < 0) startNext( i );
+  }
+}
+
+uint16_t ModbusGateway::getRequests() {
+  return u16requests;
+}
+
+uint16_t ModbusGateway::getMerged() {
+  return u16merged;
+}
+
+uint16_t ModbusGateway::getRejected() {
+  return u16rejected;
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Collect the bytes of a client and dispatch each complete request.
+ * A header that cannot be Modbus TCP drops what was received.
+ *
+ * @ingroup gateway
+ */
+void ModbusGateway::receive( uint8_t u8link ) {
+  modbus_link_t *link = &aLinks[ u8link ];
+
+  while (link->link->available() > 0) {
+    link->au8Rx[ link->u16RxSize++ ] = link->link->read();
+    if (link->u16RxSize < MBAP_HEADER) continue;
+
+    uint16_t u16length = word( link->au8Rx[ 4 ], link->au8Rx[ 5 ] );
+    if (word( link->au8Rx[ 2 ], link->au8Rx[ 3 ] ) != 0 || u16length < 2 || u16length > MBAP_SIZE - 6) {
+      link->u16RxSize = 0; // not Modbus
+      continue;
+    }
+    if (link->u16RxSize < 6 + u16length) continue;
+
+    dispatch( u8link, link->au8Rx, link->u16RxSize );
+    link->u16RxSize = 0;
+  }
+}
+
+/**
+ * @brief
+ * Check a request and queue it for its bus, or answer it with an exception
+ *
+ * @param u8link  client of the request
+ * @param adu  MBAP header and PDU
+ * @param u16size  ADU length
+ * @ingroup gateway
+ */
+void ModbusGateway::dispatch( uint8_t u8link, const uint8_t *adu, uint16_t u16size ) {
+  uint16_t u16tid = word( adu[ 0 ], adu[ 1 ] );
+  uint8_t u8unit = adu[ 6 ];
+  const uint8_t *pdu = &adu[ MBAP_HEADER ];
+  uint16_t u16pdu = u16size - MBAP_HEADER;
+  uint8_t u8fct = pdu[ 0 ];
+  u16requests++;
+
+  int8_t i8bus = findBus( u8unit );
+  if (i8bus < 0) {
+    answerException( u8link, u16tid, u8unit, u8fct, EXC_GW_PATH );
+    return;
+  }
+
+  modbus_gwreq_t *request = nullptr;
+  int8_t i8request;
+  for (i8request = 0; i8request < MODBUS_GW_PENDING; i8request++) {
+    if (aReqs[ i8request ].u8state == GW_FREE) {
+      request = &aReqs[ i8request ];
+      break;
+    }
+  }
+  if (request == nullptr) {
+    answerException( u8link, u16tid, u8unit, u8fct, EXC_SLAVE_BUSY );
+    return;
+  }
+
+  modbus_t *telegram = &request->telegram;
+  telegram->u8id = u8unit;
+  telegram->u8fct = u8fct;
+  telegram->au16reg = request->au16data;
+  if (u16pdu >= 5) {
+    telegram->u16RegAdd = word( pdu[ 1 ], pdu[ 2 ] );
+    telegram->u16CoilsNo = word( pdu[ 3 ], pdu[ 4 ] );
+  }
+
+  // check the PDU as the slave would, so that bus time is not wasted
+  uint8_t u8exception = 0;
+  uint16_t u16bytes;
+  switch( u8fct ) {
+  case MB_FC_READ_COILS:
+  case MB_FC_READ_DISCRETE_INPUT:
+    if (u16pdu != 5) u8exception = EXC_REGS_QUANT;
+    else if (telegram->u16CoilsNo == 0 || telegram->u16CoilsNo > MB_MAX_READ_COILS ||
+      telegram->u16CoilsNo > MODBUS_GW_REGS * 16 ||
+      (telegram->u16CoilsNo + 7) / 8 > MAX_BUFFER - 5) u8exception = EXC_REGS_QUANT;
+    break;
+  case MB_FC_READ_REGISTERS:
+  case MB_FC_READ_INPUT_REGISTER:
+    if (u16pdu != 5) u8exception = EXC_REGS_QUANT;
+    else if (telegram->u16CoilsNo == 0 || telegram->u16CoilsNo > MB_MAX_READ_REGISTERS ||
+      telegram->u16CoilsNo > MODBUS_GW_REGS ||
+      telegram->u16CoilsNo * 2 > MAX_BUFFER - 5) u8exception = EXC_REGS_QUANT;
+    break;
+  case MB_FC_WRITE_COIL:
+    if (u16pdu != 5 || (telegram->u16CoilsNo != 0xFF00 && telegram->u16CoilsNo != 0)) u8exception = EXC_REGS_QUANT;
+    request->au16data[ 0 ] = (telegram->u16CoilsNo == 0xFF00);
+    telegram->u16CoilsNo = 1;
+    break;
+  case MB_FC_WRITE_REGISTER:
+    if (u16pdu != 5) u8exception = EXC_REGS_QUANT;
+    request->au16data[ 0 ] = telegram->u16CoilsNo;
+    telegram->u16CoilsNo = 1;
+    break;
+  case MB_FC_WRITE_MULTIPLE_COILS:
+    u16bytes = (telegram->u16CoilsNo + 7) / 8;
+    if (u16pdu < 6 || telegram->u16CoilsNo == 0 || pdu[ 5 ] != u16bytes || u16pdu != 6 + u16bytes ||
+      telegram->u16CoilsNo > MB_MAX_WRITE_COILS || telegram->u16CoilsNo > MODBUS_GW_REGS * 16 ||
+      u16bytes > MAX_BUFFER - 9) {
+      u8exception = EXC_REGS_QUANT;
+      break;
+    }
+    for (uint16_t i = 0; i < u16bytes; i++) {
+      if (i % 2) {
+        request->au16data[ i / 2 ] |= (uint16_t) pdu[ 6 + i ] << 8;
+      } else {
+        request->au16data[ i / 2 ] = pdu[ 6 + i ];
+      }
+    }
+    break;
+  case MB_FC_WRITE_MULTIPLE_REGISTERS:
+    if (u16pdu < 6 || telegram->u16CoilsNo == 0 || pdu[ 5 ] != telegram->u16CoilsNo * 2 ||
+      u16pdu != 6 + telegram->u16CoilsNo * 2 || telegram->u16CoilsNo > MB_MAX_WRITE_REGISTERS ||
+      telegram->u16CoilsNo > MODBUS_GW_REGS || telegram->u16CoilsNo * 2 > MAX_BUFFER - 9) {
+      u8exception = EXC_REGS_QUANT;
+      break;
+    }
+    for (uint16_t i = 0; i < telegram->u16CoilsNo; i++) {
+      request->au16data[ i ] = word( pdu[ 6 + i * 2 ], pdu[ 7 + i * 2 ] );
+    }
+    break;
+  default:
+    u8exception = EXC_FUNC_CODE;
+    break;
+  }
+  if (u8exception != 0) {
+    answerException( u8link, u16tid, u8unit, u8fct, u8exception );
+    return;
+  }
+
+  request->u8link = u8link;
+  request->u8bus = i8bus;
+  request->u8unit = u8unit;
+  request->u16tid = u16tid;
+  request->u32seq = u32seq++;
+  request->i8leader = findLeader( request );
+  if (request->i8leader >= 0) {
+    request->u8state = GW_FOLLOW;
+    u16merged++;
+  } else {
+    request->u8state = GW_QUEUED;
+  }
+}
+
+/**
+ * @brief
+ * Bus serving a unit id
+ *
+ * @return bus index, -1 if none
+ * @ingroup gateway
+ */
+int8_t ModbusGateway::findBus( uint8_t u8unit ) {
+  for (uint8_t i = 0; i < MODBUS_GW_BUSES; i++) {
+    modbus_gwbus_t *bus = &aBuses[ i ];
+    if (bus->master != nullptr && u8unit >= bus->u8firstId && u8unit <= bus->u8lastId) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief
+ * Find a queued or running transaction reading exactly what a new read asks for.
+ * A transaction older than a write to the same unit still waiting or on the
+ * bus may read what the write changes: the new read must see the write.
+ *
+ * @return index of that request, -1 if none or if the new request is not a read
+ * @ingroup gateway
+ */
+int8_t ModbusGateway::findLeader( const modbus_gwreq_t *request ) {
+  const modbus_t *telegram = &request->telegram;
+  if (telegram->u8fct > MB_FC_READ_INPUT_REGISTER) return -1;
+
+  for (int8_t i = 0; i < MODBUS_GW_PENDING; i++) {
+    const modbus_gwreq_t *leader = &aReqs[ i ];
+    if (leader == request) continue;
+    if (leader->u8state != GW_QUEUED && leader->u8state != GW_ACTIVE) continue;
+    if (leader->u8bus == request->u8bus &&
+      leader->telegram.u8id == telegram->u8id &&
+      leader->telegram.u8fct == telegram->u8fct &&
+      leader->telegram.u16RegAdd == telegram->u16RegAdd &&
+      leader->telegram.u16CoilsNo == telegram->u16CoilsNo &&
+      !isWrittenAfter( leader )) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief
+ * Check whether a write to the unit of a request came after it and is
+ * still queued or on the bus
+ *
+ * @ingroup gateway
+ */
+boolean ModbusGateway::isWrittenAfter( const modbus_gwreq_t *request ) {
+  for (uint8_t i = 0; i < MODBUS_GW_PENDING; i++) {
+    const modbus_gwreq_t *write = &aReqs[ i ];
+    if (write->u8state != GW_QUEUED && write->u8state != GW_ACTIVE) continue;
+    if (write->telegram.u8fct <= MB_FC_READ_INPUT_REGISTER) continue;
+    if (write->u8bus == request->u8bus && write->telegram.u8id == request->telegram.u8id &&
+      write->u32seq > request->u32seq) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief
+ * Priority a queued request is served at: the best one of its link and of
+ * the links of the reads following it. A request whose client left has
+ * the lowest one, 0xFF, unless others wait for it.
+ *
+ * @ingroup gateway
+ */
+uint8_t ModbusGateway::priority( int8_t i8request ) {
+  const modbus_gwreq_t *request = &aReqs[ i8request ];
+  uint8_t u8priority = (request->u8link != GW_NO_LINK) ? aLinks[ request->u8link ].u8priority : 0xFF;
+
+  for (uint8_t i = 0; i < MODBUS_GW_PENDING; i++) {
+    const modbus_gwreq_t *follower = &aReqs[ i ];
+    if (follower->u8state != GW_FOLLOW || follower->i8leader != i8request || follower->u8link == GW_NO_LINK) continue;
+    if (aLinks[ follower->u8link ].u8priority < u8priority) u8priority = aLinks[ follower->u8link ].u8priority;
+  }
+  return u8priority;
+}
+
+/**
+ * @brief
+ * Put the next request on an idle bus: lowest priority value first, a
+ * merged read taking the best one of its clients, then the links take
+ * turns, oldest request of a link first
+ *
+ * @ingroup gateway
+ */
+void ModbusGateway::startNext( uint8_t u8bus ) {
+  modbus_gwbus_t *bus = &aBuses[ u8bus ];
+
+  // best priority waiting
+  int16_t i16priority = -1;
+  for (uint8_t i = 0; i < MODBUS_GW_PENDING; i++) {
+    modbus_gwreq_t *request = &aReqs[ i ];
+    if (request->u8state != GW_QUEUED || request->u8bus != u8bus) continue;
+    uint8_t u8priority = priority( i );
+    if (i16priority < 0 || u8priority < i16priority) i16priority = u8priority;
+  }
+  if (i16priority < 0) return;
+
+  int8_t i8next = -1;
+  for (uint8_t k = 1; k <= MODBUS_GW_LINKS + 1 && i8next < 0; k++) {
+    // GW_NO_LINK is served once every other link had its turn
+    uint8_t u8link = (k == MODBUS_GW_LINKS + 1) ? GW_NO_LINK : (bus->u8served + k) % MODBUS_GW_LINKS;
+
+    for (int8_t i = 0; i < MODBUS_GW_PENDING; i++) {
+      modbus_gwreq_t *request = &aReqs[ i ];
+      if (request->u8state != GW_QUEUED || request->u8bus != u8bus || request->u8link != u8link) continue;
+      if (priority( i ) != i16priority) continue;
+      if (i8next < 0 || request->u32seq < aReqs[ i8next ].u32seq) i8next = i;
+    }
+    if (i8next >= 0 && u8link != GW_NO_LINK) bus->u8served = u8link;
+  }
+  if (i8next < 0) return;
+
+  modbus_gwreq_t *request = &aReqs[ i8next ];
+  request->u8state = GW_ACTIVE;
+  bus->i8active = i8next;
+  if (bus->master->query( request->telegram, onResult, bus ) != 0) {
+    modbus_result_t result;
+    result.u8status = RESULT_REJECTED;
+    result.u8exception = 0;
+    result.telegram = request->telegram;
+    result.u32latency = 0;
+    complete( bus, &result );
+  }
+}
+
+/**
+ * @brief
+ * Completion handler of a bus master
+ *
+ * @ingroup gateway
+ */
+void ModbusGateway::onResult( const modbus_result_t *result, void *context ) {
+  modbus_gwbus_t *bus = (modbus_gwbus_t *) context;
+  bus->gateway->complete( bus, result );
+}
+
+/**
+ * @brief
+ * Answer the request on the bus and the duplicate reads waiting for it,
+ * then free them all
+ *
+ * @ingroup gateway
+ */
+void ModbusGateway::complete( modbus_gwbus_t *bus, const modbus_result_t *result ) {
+  int8_t i8leader = bus->i8active;
+  modbus_gwreq_t *leader = &aReqs[ i8leader ];
+  bus->i8active = -1;
+
+  for (uint8_t i = 0; i < MODBUS_GW_PENDING; i++) {
+    modbus_gwreq_t *request = &aReqs[ i ];
+    if (request->u8state != GW_FOLLOW || request->i8leader != i8leader) continue;
+    answer( request, result, leader->au16data );
+    request->u8state = GW_FREE;
+  }
+  answer( leader, result, leader->au16data );
+  leader->u8state = GW_FREE;
+}
+
+/**
+ * @brief
+ * Build the Modbus TCP answer of a request from the bus transaction result
+ *
+ * @param request  request to answer
+ * @param result  outcome of the bus transaction
+ * @param data  registers or coils read by the transaction
+ * @ingroup gateway
+ */
+void ModbusGateway::answer( const modbus_gwreq_t *request, const modbus_result_t *result, const uint16_t *data ) {
+  if (request->u8link == GW_NO_LINK) return;
+
+  const modbus_t *telegram = &request->telegram;
+  switch( result->u8status ) {
+  case RESULT_OK:
+    break;
+  case RESULT_EXCEPTION:
+    answerException( request->u8link, request->u16tid, request->u8unit, telegram->u8fct, result->u8exception );
+    return;
+  case RESULT_REJECTED:
+    answerException( request->u8link, request->u16tid, request->u8unit, telegram->u8fct, EXC_GW_PATH );
+    return;
+  default:
+    answerException( request->u8link, request->u16tid, request->u8unit, telegram->u8fct, EXC_GW_TARGET );
+    return;
+  }
+
+  uint8_t au8Adu[ MBAP_SIZE ];
+  au8Adu[ 0 ] = highByte( request->u16tid );
+  au8Adu[ 1 ] = lowByte( request->u16tid );
+  au8Adu[ 6 ] = request->u8unit;
+  uint8_t *pdu = &au8Adu[ MBAP_HEADER ];
+  pdu[ 0 ] = telegram->u8fct;
+  uint16_t u16pdu;
+
+  switch( telegram->u8fct ) {
+  case MB_FC_READ_COILS:
+  case MB_FC_READ_DISCRETE_INPUT:
+    pdu[ 1 ] = (telegram->u16CoilsNo + 7) / 8;
+    for (uint8_t i = 0; i < pdu[ 1 ]; i++) {
+      pdu[ 2 + i ] = (i % 2) ? highByte( data[ i / 2 ] ) : lowByte( data[ i / 2 ] );
+    }
+    u16pdu = 2 + pdu[ 1 ];
+    break;
+  case MB_FC_READ_REGISTERS:
+  case MB_FC_READ_INPUT_REGISTER:
+    pdu[ 1 ] = telegram->u16CoilsNo * 2;
+    for (uint8_t i = 0; i < telegram->u16CoilsNo; i++) {
+      pdu[ 2 + i * 2 ] = highByte( data[ i ] );
+      pdu[ 3 + i * 2 ] = lowByte( data[ i ] );
+    }
+    u16pdu = 2 + pdu[ 1 ];
+    break;
+  case MB_FC_WRITE_COIL:
+  case MB_FC_WRITE_REGISTER: {
+    // echo of the request
+    uint16_t u16value = (telegram->u8fct == MB_FC_WRITE_COIL) ? (data[ 0 ] ? 0xFF00 : 0) : data[ 0 ];
+    pdu[ 1 ] = highByte( telegram->u16RegAdd );
+    pdu[ 2 ] = lowByte( telegram->u16RegAdd );
+    pdu[ 3 ] = highByte( u16value );
+    pdu[ 4 ] = lowByte( u16value );
+    u16pdu = 5;
+    break;
+  }
+  default:
+    pdu[ 1 ] = highByte( telegram->u16RegAdd );
+    pdu[ 2 ] = lowByte( telegram->u16RegAdd );
+    pdu[ 3 ] = highByte( telegram->u16CoilsNo );
+    pdu[ 4 ] = lowByte( telegram->u16CoilsNo );
+    u16pdu = 5;
+    break;
+  }
+  send( request->u8link, au8Adu, u16pdu );
+}
+
+/**
+ * @brief
+ * Answer a request with an exception
+ *
+ * @ingroup gateway
+ */
+void ModbusGateway::answerException( uint8_t u8link, uint16_t u16tid, uint8_t u8unit, uint8_t u8fct, uint8_t u8exception ) {
+  if (u8exception == EXC_GW_PATH || u8exception == EXC_GW_TARGET || u8exception == EXC_SLAVE_BUSY) u16rejected++;
+
+  uint8_t au8Adu[ MBAP_HEADER + 2 ];
+  au8Adu[ 0 ] = highByte( u16tid );
+  au8Adu[ 1 ] = lowByte( u16tid );
+  au8Adu[ 6 ] = u8unit;
+  au8Adu[ MBAP_HEADER ] = u8fct | 0x80;
+  au8Adu[ MBAP_HEADER + 1 ] = u8exception;
+  send( u8link, au8Adu, 2 );
+}
+
+/**
+ * @brief
+ * Complete the MBAP header of an answer and send it to its client
+ *
+ * @param adu  answer, transaction id, unit id and PDU already set
+ * @param u16pdu  PDU length
+ * @ingroup gateway
+ */
+void ModbusGateway::send( uint8_t u8link, uint8_t *adu, uint16_t u16pdu ) {
+  Stream *link = aLinks[ u8link ].link;
+  if (link == nullptr) return;
+
+  adu[ 2 ] = 0; // protocol id
+  adu[ 3 ] = 0;
+  adu[ 4 ] = highByte( u16pdu + 1 );
+  adu[ 5 ] = lowByte( u16pdu + 1 );
+  link->write( adu, MBAP_HEADER + u16pdu );
+}
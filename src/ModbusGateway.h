@@ -0,0 +1,150 @@
+#ifndef MODBUS_GATEWAY_H
+#define MODBUS_GATEWAY_H
+
+/**
+ * @file 		ModbusGateway.h
+ *
+ * @description
+ *  Modbus TCP to RTU gateway.
+ *  Modbus TCP clients are attached as links, any Stream such as a TCPClient
+ *  accepted by a TCPServer. Their MBAP requests are routed by unit id to
+ *  the master of a serial bus and queued per bus. Links with a lower
+ *  priority value are served first; links of the same priority take turns,
+ *  so one busy client cannot starve the others. A read identical to one
+ *  already queued or on the bus is answered by that same transaction,
+ *  unless a write to the same unit came in between.
+ *  Each answer goes back to its link with the transaction id of its request.
+ *
+ * @defgroup gateway Modbus TCP Gateway
+ */
+
+#include "ModbusRtu.h"
+
+#ifndef MODBUS_GW_LINKS
+#define MODBUS_GW_LINKS 4	//!< Modbus TCP clients served at once
+#endif
+#ifndef MODBUS_GW_BUSES
+#define MODBUS_GW_BUSES 2	//!< serial buses behind the gateway
+#endif
+#ifndef MODBUS_GW_PENDING
+#define MODBUS_GW_PENDING 16	//!< requests queued or on the buses, all links together
+#endif
+#ifndef MODBUS_GW_REGS
+#define MODBUS_GW_REGS 125	//!< largest register block of a request
+#endif
+
+#define MBAP_HEADER 7	//!< transaction id, protocol id, length, unit id
+#define MBAP_SIZE 260	//!< largest Modbus TCP ADU
+
+/**
+ * @enum GW_EXCEPTIONS
+ * @brief
+ * Exception codes the gateway answers by itself
+ */
+enum GW_EXCEPTIONS {
+  EXC_GW_PATH                   = 0x0A, //!< no bus serves the unit id
+  EXC_GW_TARGET                 = 0x0B  //!< the slave did not answer, or answered garbage
+};
+
+/**
+ * @enum GW_STATES
+ * @brief
+ * State of a gateway request
+ */
+enum GW_STATES {
+  GW_FREE                       = 0,
+  GW_QUEUED                     = 1, //!< waiting for its bus
+  GW_ACTIVE                     = 2, //!< on the bus
+  GW_FOLLOW                     = 3  //!< duplicate read, answered by its leader transaction
+};
+
+#define GW_NO_LINK 0xFF	//!< u8link of a request whose client left
+
+/**
+ * @struct modbus_link_t
+ * @brief
+ * Modbus TCP client of the gateway
+ */
+typedef struct {
+  Stream *link;          /*!< Client connection, nullptr = free slot */
+  uint8_t u8priority;    /*!< 0 is served first */
+  uint16_t u16RxSize;    /*!< Bytes of the request being received */
+  uint8_t au8Rx[MBAP_SIZE]; /*!< Request being received */
+}
+modbus_link_t;
+
+class ModbusGateway;
+
+/**
+ * @struct modbus_gwbus_t
+ * @brief
+ * Serial bus behind the gateway
+ */
+typedef struct {
+  Modbus *master;        /*!< Master of the bus, nullptr = free slot */
+  uint8_t u8firstId;     /*!< First unit id routed to the bus */
+  uint8_t u8lastId;      /*!< Last unit id routed to the bus */
+  int8_t i8active;       /*!< Request on the bus, -1 when idle */
+  uint8_t u8served;      /*!< Link served last, the next one goes first */
+  ModbusGateway *gateway; /*!< Owner, for the completion handler */
+}
+modbus_gwbus_t;
+
+/**
+ * @struct modbus_gwreq_t
+ * @brief
+ * Request received from a link
+ */
+typedef struct {
+  uint8_t u8state;       /*!< GW_STATES */
+  uint8_t u8link;        /*!< Link to answer, GW_NO_LINK once it left */
+  uint8_t u8bus;         /*!< Bus serving the unit id */
+  uint8_t u8unit;        /*!< Unit id, echoed in the answer */
+  uint16_t u16tid;       /*!< MBAP transaction id, echoed in the answer */
+  int8_t i8leader;       /*!< GW_FOLLOW: request whose transaction answers this one */
+  uint32_t u32seq;       /*!< Arrival order */
+  modbus_t telegram;     /*!< Bus transaction, au16reg points to au16data */
+  uint16_t au16data[MODBUS_GW_REGS]; /*!< Registers or coils, 16 coils per word */
+}
+modbus_gwreq_t;
+
+/**
+ * @class ModbusGateway
+ * @brief
+ * Multiplexes Modbus TCP clients onto RTU masters.
+ * The gateway owns the masters: nobody else should query() them.
+ */
+class ModbusGateway {
+private:
+  modbus_link_t aLinks[MODBUS_GW_LINKS];
+  modbus_gwbus_t aBuses[MODBUS_GW_BUSES];
+  modbus_gwreq_t aReqs[MODBUS_GW_PENDING];
+  uint32_t u32seq;
+  uint16_t u16requests, u16merged, u16rejected;
+
+  void receive( uint8_t u8link );
+  void dispatch( uint8_t u8link, const uint8_t *adu, uint16_t u16size );
+  int8_t findBus( uint8_t u8unit );
+  int8_t findLeader( const modbus_gwreq_t *request );
+  boolean isWrittenAfter( const modbus_gwreq_t *request );
+  uint8_t priority( int8_t i8request );
+  void startNext( uint8_t u8bus );
+  void answer( const modbus_gwreq_t *request, const modbus_result_t *result, const uint16_t *data );
+  void answerException( uint8_t u8link, uint16_t u16tid, uint8_t u8unit, uint8_t u8fct, uint8_t u8exception );
+  void send( uint8_t u8link, uint8_t *adu, uint16_t u16pdu );
+  void complete( modbus_gwbus_t *bus, const modbus_result_t *result );
+  static void onResult( const modbus_result_t *result, void *context );
+
+public:
+  ModbusGateway();
+  int8_t addBus( Modbus *master, uint8_t u8firstId = 1, uint8_t u8lastId = 247 ); //!<route unit ids to a master
+  int8_t attach( Stream *link, uint8_t u8priority = 0 ); //!<new client, returns its link index
+  void detach( int8_t i8link ); //!<client left, its answers are dropped
+  boolean isAttached( Stream *link ); //!<client already has a link
+  void poll(); //!<cyclic poll: receive requests, drive the masters
+  uint16_t getRequests(); //!<requests received
+  uint16_t getMerged(); //!<reads answered by another request's transaction
+  uint16_t getRejected(); //!<requests answered with a gateway exception
+};
+
+#endif
@@ -0,0 +1,303 @@
+// ModbusImage.cpp
+
+#include "ModbusImage.h"
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of an empty image fed by a master
+ *
+ * @param master  Modbus master (u8id = 0) already started with begin(),
+ * nullptr if the blocks are only published with publish()
+ * @ingroup image
+ */
+ModbusImage::ModbusImage( Modbus *master ) {
+  this->master = master;
+  header = &localHeader;
+  blocks = aBlocks;
+  registers = au16regs;
+  header->u32magic = MODBUS_IMAGE_MAGIC;
+  header->u16version = MODBUS_IMAGE_VERSION;
+  header->u16blockSize = sizeof( modbus_image_t );
+  header->u16maxBlocks = MODBUS_IMAGE_BLOCKS;
+  header->u16maxRegs = MODBUS_IMAGE_REGS;
+  header->u32blocks.store( 0, std::memory_order_relaxed );
+  u16used = 0;
+  i8busy = -1;
+  bAttached = false;
+}
+
+/**
+ * @brief
+ * Size of an image in caller storage
+ *
+ * @param u8blocks  entries of the block table
+ * @param u16regs  registers of all the blocks together
+ * @return bytes the segment handed to format() must hold
+ * @ingroup image
+ */
+uint32_t ModbusImage::getSegmentSize( uint8_t u8blocks, uint16_t u16regs ) {
+  return sizeof( modbus_image_header_t ) + u8blocks * sizeof( modbus_image_t ) + u16regs * sizeof( uint16_t );
+}
+
+/**
+ * @brief
+ * Lay the image out in storage supplied by the caller, e.g. a shared
+ * memory segment, instead of the object. Call it before addBlock(); the
+ * blocks added so far are dropped. The segment must be 4-byte aligned,
+ * hold getSegmentSize() bytes and stay mapped while the image is used.
+ *
+ * @param segment  storage of the image
+ * @param u8blocks  entries of the block table, up to 127
+ * @param u16regs  registers of all the blocks together
+ * @return 0 if OK, -1 if the sizes are wrong or the atomics are not lock-free
+ * @ingroup image
+ */
+int8_t ModbusImage::format( void *segment, uint8_t u8blocks, uint16_t u16regs ) {
+  modbus_image_header_t *head = (modbus_image_header_t *) segment;
+  if (segment == nullptr || u8blocks == 0 || u8blocks > 127) return -1;
+  if (!head->u32blocks.is_lock_free()) return -1; // processes cannot share a lock
+
+  head->u32magic = 0;
+  head->u16version = MODBUS_IMAGE_VERSION;
+  head->u16blockSize = sizeof( modbus_image_t );
+  head->u16maxBlocks = u8blocks;
+  head->u16maxRegs = u16regs;
+  head->u32blocks.store( 0, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+  head->u32magic = MODBUS_IMAGE_MAGIC;
+
+  header = head;
+  blocks = (modbus_image_t *) (head + 1);
+  registers = (uint16_t *) (blocks + u8blocks);
+  u16used = 0;
+  i8busy = -1;
+  bAttached = false;
+  return 0;
+}
+
+/**
+ * @brief
+ * Read an image another process formatted and feeds. Only find(), read()
+ * and getSeq() may be used afterwards.
+ *
+ * @param segment  storage of the image, mapped by this process
+ * @return 0 if OK, -1 if it is not an image of this version and layout
+ * @ingroup image
+ */
+int8_t ModbusImage::attach( void *segment ) {
+  modbus_image_header_t *head = (modbus_image_header_t *) segment;
+  if (segment == nullptr || head->u32magic != MODBUS_IMAGE_MAGIC) return -1;
+  std::atomic_thread_fence( std::memory_order_acquire );
+  if (head->u16version != MODBUS_IMAGE_VERSION || head->u16blockSize != sizeof( modbus_image_t )) return -1;
+
+  header = head;
+  blocks = (modbus_image_t *) (head + 1);
+  registers = (uint16_t *) (blocks + head->u16maxBlocks);
+  master = nullptr;
+  bAttached = true;
+  return 0;
+}
+
+/**
+ * @brief
+ * Add a register block to the image, before the reader threads start
+ *
+ * @param u8id  slave address between 1 and 247
+ * @param u8fct  MB_FC_READ_REGISTERS or MB_FC_READ_INPUT_REGISTER
+ * @param u16add  address of the first register
+ * @param u16no  number of registers, up to one read
+ * @param u32period  poll period (ms)
+ * @return block index, -1 if the request is wrong or the image full
+ * @ingroup image
+ */
+int8_t ModbusImage::addBlock( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no, uint32_t u32period ) {
+  if ((u8fct != MB_FC_READ_REGISTERS) && (u8fct != MB_FC_READ_INPUT_REGISTER)) return -1;
+  if ((u16no == 0) || (u16no > (MAX_BUFFER - 5) / 2)) return -1;
+  uint8_t u8blocks = getBlocks();
+  if (bAttached || u8blocks >= header->u16maxBlocks || u16used + u16no > header->u16maxRegs) return -1;
+
+  modbus_image_t *block = &blocks[ u8blocks ];
+  block->u32seq.store( 0, std::memory_order_relaxed );
+  block->u32stamp = 0;
+  block->u8quality = IMAGE_UNKNOWN;
+  block->u8id = u8id;
+  block->u8fct = u8fct;
+  block->u16RegAdd = u16add;
+  block->u16CoilsNo = u16no;
+  block->u16offset = u16used;
+  block->u32period = u32period;
+  block->u32polled = 0;
+  memset( &registers[ u16used ], 0, u16no * sizeof( uint16_t ));
+  u16used += u16no;
+  header->u32blocks.store( u8blocks + 1, std::memory_order_release );
+  return u8blocks;
+}
+
+/**
+ * @brief
+ * Find the block holding a register
+ *
+ * @return block index, -1 if no block holds it
+ * @ingroup image
+ */
+int8_t ModbusImage::find( uint8_t u8id, uint8_t u8fct, uint16_t u16add ) {
+  uint8_t u8blocks = getBlocks();
+  for (uint8_t i = 0; i < u8blocks; i++) {
+    modbus_image_t *block = &blocks[ i ];
+    if (block->u8id == u8id && block->u8fct == u8fct &&
+      u16add >= block->u16RegAdd && u16add < block->u16RegAdd + block->u16CoilsNo) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief
+ * Drive the master: publish the read in flight once done, then read the
+ * block most overdue. This method must be called only at loop section,
+ * from the thread that owns the master.
+ *
+ * @ingroup image
+ */
+void ModbusImage::poll() {
+  if (master == nullptr) return;
+
+  master->poll(); // completion calls onResult()
+  if (i8busy >= 0) return;
+
+  uint32_t u32now = master->getClock()->millis();
+  int8_t i8next = -1;
+  uint32_t u32late = 0;
+  uint8_t u8blocks = getBlocks();
+  for (uint8_t i = 0; i < u8blocks; i++) {
+    modbus_image_t *block = &blocks[ i ];
+    uint32_t u32since = u32now - block->u32polled;
+    if (block->u8quality != IMAGE_UNKNOWN && u32since < block->u32period) continue;
+
+    uint32_t u32overdue = (block->u8quality == IMAGE_UNKNOWN) ? 0xFFFFFFFF : u32since - block->u32period;
+    if (i8next < 0 || u32overdue > u32late) {
+      i8next = i;
+      u32late = u32overdue;
+    }
+  }
+  if (i8next < 0) return;
+
+  modbus_image_t *block = &blocks[ i8next ];
+  modbus_t telegram;
+  telegram.u8id = block->u8id;
+  telegram.u8fct = block->u8fct;
+  telegram.u16RegAdd = block->u16RegAdd;
+  telegram.u16CoilsNo = block->u16CoilsNo;
+  telegram.au16reg = au16scratch;
+
+  block->u32polled = u32now;
+  i8busy = i8next;
+  if (master->query( telegram, onResult, this ) != 0) {
+    i8busy = -1;
+    publish( i8next, nullptr, IMAGE_BAD );
+  }
+}
+
+/**
+ * @brief
+ * Publish a block. Readers never see it half written: the sequence is odd
+ * during the copy and moves by 2 once it is over.
+ * Call it only from the thread that owns the master.
+ *
+ * @param i8block  block index
+ * @param data  registers read, nullptr to keep the last good ones
+ * @param u8quality  IMAGE_QUALITY of the registers
+ * @ingroup image
+ */
+void ModbusImage::publish( int8_t i8block, const uint16_t *data, uint8_t u8quality ) {
+  if (bAttached || i8block < 0 || i8block >= getBlocks()) return;
+  modbus_image_t *block = &blocks[ i8block ];
+
+  uint32_t u32seq = block->u32seq.load( std::memory_order_relaxed );
+  block->u32seq.store( u32seq + 1, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+
+  if (data != nullptr) memcpy( &registers[ block->u16offset ], data, block->u16CoilsNo * sizeof( uint16_t ));
+  block->u8quality = u8quality;
+  block->u32stamp = (master != nullptr) ? master->getClock()->millis() : millis();
+
+  block->u32seq.store( u32seq + 2, std::memory_order_release );
+}
+
+/**
+ * @brief
+ * Copy registers of a block as published at one instant. Safe from any
+ * thread; it retries if the block was published during the copy.
+ *
+ * @param i8block  block index
+ * @param u16add  address of the first register, within the block
+ * @param u16no  number of registers
+ * @param dest  destination of the registers
+ * @param pu32stamp  if not null, receives the time of the publication (ms)
+ * @return IMAGE_QUALITY of the copied registers, IMAGE_UNKNOWN for a wrong range
+ * @ingroup image
+ */
+uint8_t ModbusImage::read( int8_t i8block, uint16_t u16add, uint16_t u16no, uint16_t *dest, uint32_t *pu32stamp ) {
+  if (i8block < 0 || i8block >= getBlocks()) return IMAGE_UNKNOWN;
+  modbus_image_t *block = &blocks[ i8block ];
+  if (u16add < block->u16RegAdd || u16add + u16no > block->u16RegAdd + block->u16CoilsNo) return IMAGE_UNKNOWN;
+
+  const uint16_t *regs = &registers[ block->u16offset + u16add - block->u16RegAdd ];
+  uint8_t u8quality;
+  uint32_t u32stamp, u32seq;
+  do {
+    u32seq = block->u32seq.load( std::memory_order_acquire );
+    if (u32seq & 1) continue; // being published
+
+    memcpy( dest, regs, u16no * sizeof( uint16_t ));
+    u8quality = block->u8quality;
+    u32stamp = block->u32stamp;
+    std::atomic_thread_fence( std::memory_order_acquire );
+  } while ((u32seq & 1) || u32seq != block->u32seq.load( std::memory_order_relaxed ));
+
+  if (pu32stamp != nullptr) *pu32stamp = u32stamp;
+  return u8quality;
+}
+
+/**
+ * @brief
+ * Sequence of a block. A reader holding the value of its last read can
+ * skip the block as long as it did not change.
+ *
+ * @ingroup image
+ */
+uint32_t ModbusImage::getSeq( int8_t i8block ) {
+  if (i8block < 0 || i8block >= getBlocks()) return 0;
+  return blocks[ i8block ].u32seq.load( std::memory_order_acquire );
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Blocks added so far, their table entries being complete
+ *
+ * @ingroup image
+ */
+uint8_t ModbusImage::getBlocks() {
+  return header->u32blocks.load( std::memory_order_acquire );
+}
+
+/**
+ * @brief
+ * Completion handler of the master: publish the block just read
+ *
+ * @ingroup image
+ */
+void ModbusImage::onResult( const modbus_result_t *result, void *context ) {
+  ModbusImage *image = (ModbusImage *) context;
+  int8_t i8block = image->i8busy;
+  image->i8busy = -1;
+
+  if (result->u8status == RESULT_OK) {
+    image->publish( i8block, image->au16scratch, IMAGE_GOOD );
+  } else {
+    image->publish( i8block, nullptr, IMAGE_BAD );
+  }
+}
@@ -0,0 +1,121 @@
+#ifndef MODBUS_IMAGE_H
+#define MODBUS_IMAGE_H
+
+/**
+ * @file 		ModbusImage.h
+ *
+ * @description
+ *  Shared register image.
+ *  The master polls register blocks and publishes each one into a single
+ *  image in RAM. Every block carries a sequence counter, the time of its
+ *  last read and its quality. Reader threads (HMI, historian, alarms) take
+ *  torn-free snapshots with a seqlock: no lock and no message, the reader
+ *  only retries in the rare case the block was being published meanwhile.
+ *  Nothing is copied until a reader asks for the registers it needs, and
+ *  a block whose sequence did not move can be skipped altogether.
+ *  The image lives in the object, for threads, unless format() lays it out
+ *  in storage the caller supplies, e.g. a shared memory segment the host
+ *  maps: a header, the block table and the registers, linked by offsets
+ *  only. Another process maps the same segment and attach()es to it to
+ *  read the blocks.
+ *
+ * @defgroup image Modbus Shared Register Image
+ */
+
+#include <atomic>
+#include "ModbusRtu.h"
+
+#ifndef MODBUS_IMAGE_BLOCKS
+#define MODBUS_IMAGE_BLOCKS 16	//!< register blocks in the image
+#endif
+#ifndef MODBUS_IMAGE_REGS
+#define MODBUS_IMAGE_REGS 512	//!< registers of all the blocks together
+#endif
+
+#define MODBUS_IMAGE_MAGIC 0x4D42494D	//!< "MBIM", header of a formatted image
+#define MODBUS_IMAGE_VERSION 1	//!< layout of the header and of modbus_image_t
+
+/**
+ * @enum IMAGE_QUALITY
+ * @brief
+ * Quality of a published block
+ */
+enum IMAGE_QUALITY {
+  IMAGE_UNKNOWN                 = 0, //!< never read
+  IMAGE_GOOD                    = 1, //!< last read succeeded
+  IMAGE_BAD                     = 2  //!< last read failed, registers are from the last good one
+};
+
+/**
+ * @struct modbus_image_t
+ * @brief
+ * Register block of the image
+ */
+typedef struct {
+  std::atomic<uint32_t> u32seq; /*!< Odd while being published, +2 at each publication */
+  uint32_t u32stamp;     /*!< Master clock (ms) of the publication */
+  uint8_t u8quality;     /*!< IMAGE_QUALITY */
+  uint8_t u8id;          /*!< Slave address */
+  uint8_t u8fct;         /*!< MB_FC_READ_REGISTERS or MB_FC_READ_INPUT_REGISTER */
+  uint16_t u16RegAdd;    /*!< Address of the first register */
+  uint16_t u16CoilsNo;   /*!< Number of registers */
+  uint16_t u16offset;    /*!< First register in au16regs */
+  uint32_t u32period;    /*!< Poll period (ms) */
+  uint32_t u32polled;    /*!< Master clock (ms) of the last poll */
+}
+modbus_image_t;
+
+/**
+ * @struct modbus_image_header_t
+ * @brief
+ * Head of an image in caller storage, followed by u16maxBlocks
+ * modbus_image_t and u16maxRegs registers
+ */
+typedef struct {
+  uint32_t u32magic;     /*!< MODBUS_IMAGE_MAGIC once formatted */
+  uint16_t u16version;   /*!< MODBUS_IMAGE_VERSION */
+  uint16_t u16blockSize; /*!< sizeof( modbus_image_t ) of the writer */
+  uint16_t u16maxBlocks; /*!< Entries of the block table */
+  uint16_t u16maxRegs;   /*!< Registers after the block table */
+  std::atomic<uint32_t> u32blocks; /*!< Blocks added, the table entries before it are complete */
+}
+modbus_image_header_t;
+
+/**
+ * @class ModbusImage
+ * @brief
+ * Register image written by one master thread, read by any thread or, in
+ * caller storage, by any process. Blocks are added before the readers start.
+ */
+class ModbusImage {
+private:
+  Modbus *master;
+  modbus_image_header_t *header; //!< header of the image in use
+  modbus_image_t *blocks; //!< block table of the image in use
+  uint16_t *registers; //!< registers of every block
+  modbus_image_header_t localHeader; //!< default image, for threads
+  modbus_image_t aBlocks[MODBUS_IMAGE_BLOCKS];
+  uint16_t au16regs[MODBUS_IMAGE_REGS];
+  uint16_t au16scratch[MAX_BUFFER / 2]; //!< read in flight
+  uint16_t u16used; //!< registers given to blocks
+  int8_t i8busy; //!< block being read, -1 when the bus is free
+  boolean bAttached; //!< image written by another process, read only
+
+  uint8_t getBlocks();
+
+  static void onResult( const modbus_result_t *result, void *context );
+
+public:
+  ModbusImage( Modbus *master );
+  static uint32_t getSegmentSize( uint8_t u8blocks, uint16_t u16regs ); //!<bytes format() needs
+  int8_t format( void *segment, uint8_t u8blocks, uint16_t u16regs ); //!<writer: lay the image out in caller storage, before addBlock()
+  int8_t attach( void *segment ); //!<reader: use an image another process formatted
+  int8_t addBlock( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no, uint32_t u32period ); //!<returns the block index
+  int8_t find( uint8_t u8id, uint8_t u8fct, uint16_t u16add ); //!<block holding a register, -1 if none
+  void poll(); //!<master thread: read the blocks that are due and publish them
+  void publish( int8_t i8block, const uint16_t *data, uint8_t u8quality ); //!<master thread: publish a block read elsewhere
+  uint8_t read( int8_t i8block, uint16_t u16add, uint16_t u16no, uint16_t *dest, uint32_t *pu32stamp = nullptr ); //!<any thread: snapshot, returns its IMAGE_QUALITY
+  uint32_t getSeq( int8_t i8block ); //!<any thread: changes at each publication
+};
+
+#endif
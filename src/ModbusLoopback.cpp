@@ -0,0 +1,165 @@
+// ModbusLoopback.cpp
+
+#include "ModbusLoopback.h"
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of an empty loopback
+ *
+ * @ingroup simulation
+ */
+ModbusLoopback::ModbusLoopback() {
+  u16dropCnt = 0;
+  clear();
+}
+
+/**
+ * @brief
+ * Number of injected bytes not read yet by the engine
+ *
+ * @ingroup simulation
+ */
+int ModbusLoopback::available() {
+  return u16RxCnt;
+}
+
+/**
+ * @brief
+ * Read one injected byte
+ *
+ * @return next byte, -1 if there is none
+ * @ingroup simulation
+ */
+int ModbusLoopback::read() {
+  if (u16RxCnt == 0) return -1;
+
+  uint8_t u8byte = au8Rx[ u16RxHead ];
+  u16RxHead = (u16RxHead + 1) % MODBUS_LOOPBACK_SIZE;
+  u16RxCnt--;
+  return u8byte;
+}
+
+/**
+ * @brief
+ * Look at the next injected byte without reading it
+ *
+ * @return next byte, -1 if there is none
+ * @ingroup simulation
+ */
+int ModbusLoopback::peek() {
+  if (u16RxCnt == 0) return -1;
+  return au8Rx[ u16RxHead ];
+}
+
+/**
+ * @brief
+ * Nothing to wait for: written bytes are in the transmit queue already
+ *
+ * @ingroup simulation
+ */
+void ModbusLoopback::flush() {
+}
+
+/**
+ * @brief
+ * Keep one byte written by the engine
+ *
+ * @return 1 if kept, 0 if the transmit queue is full
+ * @ingroup simulation
+ */
+size_t ModbusLoopback::write( uint8_t u8byte ) {
+  if (u16TxCnt >= MODBUS_LOOPBACK_SIZE) {
+    u16dropCnt++;
+    return 0;
+  }
+  au8Tx[ (u16TxHead + u16TxCnt) % MODBUS_LOOPBACK_SIZE ] = u8byte;
+  u16TxCnt++;
+  return 1;
+}
+
+/**
+ * @brief
+ * Keep a frame written by the engine
+ *
+ * @return number of bytes kept
+ * @ingroup simulation
+ */
+size_t ModbusLoopback::write( const uint8_t *buffer, size_t size ) {
+  size_t written = 0;
+  while (written < size && write( buffer[ written ] ) == 1) written++;
+  return written;
+}
+
+/**
+ * @brief
+ * Queue bytes as if they had been received from the line
+ *
+ * @param data  bytes to be read by the engine
+ * @param u16size  number of bytes
+ * @return number of bytes queued
+ * @ingroup simulation
+ */
+uint16_t ModbusLoopback::inject( const uint8_t *data, uint16_t u16size ) {
+  uint16_t i;
+  for (i = 0; i < u16size; i++) {
+    if (u16RxCnt >= MODBUS_LOOPBACK_SIZE) {
+      u16dropCnt += u16size - i;
+      break;
+    }
+    au8Rx[ (u16RxHead + u16RxCnt) % MODBUS_LOOPBACK_SIZE ] = data[ i ];
+    u16RxCnt++;
+  }
+  return i;
+}
+
+/**
+ * @brief
+ * Number of bytes written by the engine and not collected yet
+ *
+ * @ingroup simulation
+ */
+uint16_t ModbusLoopback::txAvailable() {
+  return u16TxCnt;
+}
+
+/**
+ * @brief
+ * Collect bytes written by the engine
+ *
+ * @param dest  destination, nullptr to discard them
+ * @param u16max  maximum number of bytes to collect
+ * @return number of bytes collected
+ * @ingroup simulation
+ */
+uint16_t ModbusLoopback::take( uint8_t *dest, uint16_t u16max ) {
+  uint16_t i;
+  for (i = 0; i < u16max && u16TxCnt > 0; i++) {
+    if (dest != nullptr) dest[ i ] = au8Tx[ u16TxHead ];
+    u16TxHead = (u16TxHead + 1) % MODBUS_LOOPBACK_SIZE;
+    u16TxCnt--;
+  }
+  return i;
+}
+
+/**
+ * @brief
+ * Bytes lost because the receive or transmit queue was full
+ *
+ * @ingroup simulation
+ */
+uint16_t ModbusLoopback::getDropCnt() {
+  return u16dropCnt;
+}
+
+/**
+ * @brief
+ * Empty both directions
+ *
+ * @ingroup simulation
+ */
+void ModbusLoopback::clear() {
+  u16RxHead = u16RxCnt = 0;
+  u16TxHead = u16TxCnt = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef MODBUS_LOOPBACK_H
+#define MODBUS_LOOPBACK_H
+
+/**
+ * @file 		ModbusLoopback.h
+ *
+ * @description
+ *  Simulated serial port for a Modbus engine.
+ *  Bytes given to inject() are read by the engine as if they came from the
+ *  line, and bytes written by the engine are kept until take() collects them.
+ *  Use it with Modbus(u8id, &loopback) to replay, benchmark or simulate a bus
+ *  without any hardware.
+ *
+ * @defgroup simulation Modbus Simulated Ports and Buses
+ */
+
+#include "application.h"
+
+#ifndef MODBUS_LOOPBACK_SIZE
+#define MODBUS_LOOPBACK_SIZE 512	//!< bytes held in each direction of a loopback
+#endif
+
+/**
+ * @class ModbusLoopback
+ * @brief
+ * Stream with an injected receive queue and a captured transmit queue.
+ */
+class ModbusLoopback : public Stream {
+private:
+  uint8_t au8Rx[MODBUS_LOOPBACK_SIZE]; //!< bytes waiting to be read by the engine
+  uint8_t au8Tx[MODBUS_LOOPBACK_SIZE]; //!< bytes written by the engine
+  uint16_t u16RxHead, u16RxCnt;
+  uint16_t u16TxHead, u16TxCnt;
+  uint16_t u16dropCnt;
+
+public:
+  ModbusLoopback();
+
+  // Stream, as seen by the engine
+  int available();
+  int read();
+  int peek();
+  void flush();
+  size_t write( uint8_t u8byte );
+  size_t write( const uint8_t *buffer, size_t size );
+  using Print::write;
+
+  // test side
+  uint16_t inject( const uint8_t *data, uint16_t u16size ); //!<queue bytes for the engine to read
+  uint16_t txAvailable(); //!<number of bytes written by the engine
+  uint16_t take( uint8_t *dest, uint16_t u16max ); //!<collect bytes written by the engine
+  uint16_t getDropCnt(); //!<bytes lost because a queue was full
+  void clear(); //!<empty both directions
+};
+
+#endif
@@ -0,0 +1,673 @@
+// ModbusPlan.cpp
+
+#include "ModbusPlan.h"
+#include <stdlib.h>
+
+/**
+ * Largest reads of the protocol, or less if the buffers are smaller
+ */
+#define PLAN_LIMIT(max, fit) ((max) < (fit) ? (max) : (fit))
+#define PLAN_MAX_READ_REGS  PLAN_LIMIT( MB_MAX_READ_REGISTERS, (MAX_BUFFER - 5) / 2 )
+#define PLAN_MAX_READ_COILS PLAN_LIMIT( MB_MAX_READ_COILS, (MAX_BUFFER - 5) * 8 )
+
+#define PLAN_TOKENS 6 //!< most tokens of a text statement
+#define PLAN_DEVICE_SIZE 4 //!< bytes of a binary device record
+#define PLAN_POINT_SIZE 9 //!< bytes of a binary point record
+
+static const char *aszTables[] = { "coil", "discrete", "holding", "input" };
+static const char *aszTypes[] = { "uint16", "int16", "uint32", "int32", "float",
+  "uint64", "int64", "double", "string", "bit" };
+static const char *aszOrders[] = { "ABCD", "CDAB", "BADC", "DCBA" };
+
+/**
+ * Index of a word in a list, -1 if absent
+ */
+static int8_t findWord( const char *szWord, const char **aszList, uint8_t u8size ) {
+  for (uint8_t i = 0; i < u8size; i++) {
+    if (strcmp( szWord, aszList[ i ] ) == 0) return i;
+  }
+  return -1;
+}
+
+/**
+ * Decimal or 0x hexadecimal number, false if the word is something else
+ */
+static boolean parseNumber( const char *szWord, uint32_t *pu32value ) {
+  char *szEnd;
+  boolean bHex = (szWord[ 0 ] == '0' && (szWord[ 1 ] == 'x' || szWord[ 1 ] == 'X'));
+
+  if (szWord[ 0 ] < '0' || szWord[ 0 ] > '9') return false;
+  *pu32value = strtoul( szWord, &szEnd, bHex ? 16 : 10 );
+  return *szEnd == 0;
+}
+
+/**
+ * Split a line in place at blanks, up to u8max tokens
+ *
+ * @return number of tokens, u8max + 1 if there are more
+ */
+static uint8_t splitTokens( char *szLine, char **aszTokens, uint8_t u8max ) {
+  uint8_t u8tokens = 0;
+
+  while (true) {
+    while (*szLine == ' ' || *szLine == '\t' || *szLine == '\r') *szLine++ = 0;
+    if (*szLine == 0) return u8tokens;
+    if (u8tokens == u8max) return u8max + 1;
+    aszTokens[ u8tokens++ ] = szLine;
+    while (*szLine != 0 && *szLine != ' ' && *szLine != '\t' && *szLine != '\r') szLine++;
+  }
+}
+
+/**
+ * Points sorted the way batches are compiled: period, slave, table, address
+ */
+static int comparePoints( const void *a, const void *b ) {
+  const modbus_point_t *pa = (const modbus_point_t *) a;
+  const modbus_point_t *pb = (const modbus_point_t *) b;
+
+  if (pa->u32period != pb->u32period) return (pa->u32period > pb->u32period) ? 1 : -1;
+  if (pa->u8id != pb->u8id) return pa->u8id - pb->u8id;
+  if (pa->u8fct != pb->u8fct) return pa->u8fct - pb->u8fct;
+  return (int) pa->u16RegAdd - (int) pb->u16RegAdd;
+}
+
+/**
+ * Addresses a point takes in its slave table: registers, or 1 coil
+ */
+static uint8_t pointSpan( const modbus_point_t *point ) {
+  return (point->tag.u8type == TAG_BIT) ? 1 : ModbusTags::sizeOf( &point->tag );
+}
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of an empty plan over storage given by the application
+ *
+ * @param master  Modbus master (u8id = 0) already started with begin()
+ * @param points  room for the points
+ * @param u16points  number of points it can hold
+ * @param batches  room for the batches
+ * @param u16batches  number of batches it can hold
+ * @param data  data array receiving the reads
+ * @param u16regs  registers of the data array
+ * @ingroup plan
+ */
+ModbusPlan::ModbusPlan( Modbus *master, modbus_point_t *points, uint16_t u16points,
+  modbus_batch_t *batches, uint16_t u16batches, uint16_t *data, uint16_t u16regs ) {
+  this->master = master;
+  this->aPoints = points;
+  this->u16maxPoints = u16points;
+  this->aBatches = batches;
+  this->u16maxBatches = u16batches;
+  this->au16data = data;
+  this->u16maxRegs = u16regs;
+  this->u16points = 0;
+  this->u16batches = 0;
+  this->i16busy = -1;
+  this->u16errorAt = 0;
+  this->caps = nullptr;
+  this->u8port = 0;
+  this->bReplan = false;
+}
+
+/**
+ * @brief
+ * Load a plan in text form, see ModbusPlan.h, and compile it.
+ * The text is split in place; it must stay alive since point names
+ * point into it. The plan loaded before is dropped, even on error.
+ *
+ * @param szText  configuration, NUL terminated
+ * @return number of points, or a negative PLAN_RESULT and getErrorAt()
+ * tells the line
+ * @ingroup plan
+ */
+int16_t ModbusPlan::load( char *szText ) {
+  modbus_point_t point;
+  char *aszTokens[ PLAN_TOKENS ];
+  uint16_t u16line = 0;
+  int8_t i8result = PLAN_OK;
+
+  u16points = 0;
+  u16batches = 0;
+  i16busy = -1;
+  memset( &point, 0, sizeof( point ));
+
+  while (szText != nullptr && *szText != 0) {
+    char *szLine = szText;
+    u16line++;
+    szText = strchr( szLine, '\n' );
+    if (szText != nullptr) *szText++ = 0;
+    char *szComment = strchr( szLine, '#' );
+    if (szComment != nullptr) *szComment = 0;
+
+    uint8_t u8tokens = splitTokens( szLine, aszTokens, PLAN_TOKENS );
+    uint32_t u32value;
+    if (u8tokens == 0) continue;
+    if (u8tokens > PLAN_TOKENS) i8result = PLAN_SYNTAX;
+
+    // device <slave> [order] [gap]
+    else if (strcmp( aszTokens[ 0 ], "device" ) == 0) {
+      if (u8tokens < 2 || u8tokens > 4) i8result = PLAN_SYNTAX;
+      else if (!parseNumber( aszTokens[ 1 ], &u32value )) i8result = PLAN_SYNTAX;
+      else if (u32value < 1 || u32value > 247) i8result = PLAN_RANGE;
+      else {
+        point.u8id = u32value;
+        point.u8order = ORDER_ABCD;
+        point.u8gap = 0;
+        for (uint8_t i = 2; i < u8tokens && i8result == PLAN_OK; i++) {
+          int8_t i8order = findWord( aszTokens[ i ], aszOrders, 4 );
+          if (i8order >= 0) point.u8order = i8order;
+          else if (!parseNumber( aszTokens[ i ], &u32value )) i8result = PLAN_SYNTAX;
+          else if (u32value > 255) i8result = PLAN_RANGE;
+          else point.u8gap = u32value;
+        }
+      }
+    }
+
+    // <table> <address> <type>[*<count>] <period> [name]
+    else if (u8tokens < 4 || u8tokens > 5) i8result = PLAN_SYNTAX;
+    else {
+      int8_t i8table = findWord( aszTokens[ 0 ], aszTables, 4 );
+      uint32_t u32count = 1;
+      char *szCount = strchr( aszTokens[ 2 ], '*' );
+      if (szCount != nullptr) *szCount++ = 0;
+      int8_t i8type = findWord( aszTokens[ 2 ], aszTypes, 10 );
+
+      if (i8table < 0 && parseNumber( aszTokens[ 0 ], &u32value ) && u32value >= 1 && u32value <= 4) {
+        i8table = u32value - 1;
+      }
+      if (i8table < 0 || i8type < 0 || point.u8id == 0) i8result = PLAN_SYNTAX;
+      else if (!parseNumber( aszTokens[ 1 ], &u32value )) i8result = PLAN_SYNTAX;
+      else if (u32value > 0xFFFF) i8result = PLAN_RANGE;
+      else {
+        point.u8fct = i8table + 1;
+        point.u16RegAdd = u32value;
+        point.tag.u8type = i8type;
+        point.tag.szName = (u8tokens == 5) ? aszTokens[ 4 ] : nullptr;
+        if (szCount != nullptr && !parseNumber( szCount, &u32count )) i8result = PLAN_SYNTAX;
+        else if (!parseNumber( aszTokens[ 3 ], &point.u32period )) i8result = PLAN_SYNTAX;
+        else if (u32count < 1 || u32count > 255) i8result = PLAN_RANGE;
+        else if (i8type == TAG_STRING) {
+          point.tag.u8size = u32count;
+          i8result = addPoints( &point, 1 );
+        }
+        else {
+          point.tag.u8size = 0;
+          i8result = addPoints( &point, u32count );
+        }
+      }
+    }
+
+    if (i8result != PLAN_OK) {
+      u16errorAt = u16line;
+      u16points = 0;
+      return i8result;
+    }
+  }
+
+  u16errorAt = 0;
+  i8result = compile();
+  if (i8result != PLAN_OK) {
+    u16points = 0;
+    u16batches = 0;
+    return i8result;
+  }
+  return u16points;
+}
+
+/**
+ * @brief
+ * Load a plan in binary form, see ModbusPlan.h, and compile it.
+ * The plan loaded before is dropped, even on error.
+ *
+ * @param plan  binary form, e.g. in flash
+ * @param u16size  bytes of the binary form
+ * @return number of points, or a negative PLAN_RESULT and getErrorAt()
+ * tells the byte of the faulty record
+ * @ingroup plan
+ */
+int16_t ModbusPlan::load( const uint8_t *plan, uint16_t u16size ) {
+  modbus_point_t point;
+  uint16_t u16pos = 4;
+  int8_t i8result = PLAN_OK;
+
+  u16points = 0;
+  u16batches = 0;
+  i16busy = -1;
+  memset( &point, 0, sizeof( point ));
+
+  if (u16size < 4 || plan[ 0 ] != 'M' || plan[ 1 ] != 'B' || plan[ 2 ] != 'P' || plan[ 3 ] != PLAN_VERSION) {
+    u16errorAt = 0;
+    return PLAN_FORMAT;
+  }
+
+  while (u16pos < u16size) {
+    const uint8_t *record = &plan[ u16pos ];
+    if (record[ 0 ] == 0) {
+      if (u16pos + PLAN_DEVICE_SIZE > u16size) i8result = PLAN_FORMAT;
+      else if (record[ 1 ] < 1 || record[ 1 ] > 247 || record[ 2 ] > ORDER_DCBA) i8result = PLAN_RANGE;
+      else {
+        point.u8id = record[ 1 ];
+        point.u8order = record[ 2 ];
+        point.u8gap = record[ 3 ];
+      }
+      u16pos += PLAN_DEVICE_SIZE;
+    }
+    else {
+      if (u16pos + PLAN_POINT_SIZE > u16size) i8result = PLAN_FORMAT;
+      else if (point.u8id == 0 || record[ 0 ] > MB_FC_READ_INPUT_REGISTER || record[ 3 ] > TAG_BIT) i8result = PLAN_FORMAT;
+      else if (record[ 4 ] == 0) i8result = PLAN_RANGE;
+      else {
+        point.u8fct = record[ 0 ];
+        point.u16RegAdd = word( record[ 2 ], record[ 1 ] );
+        point.tag.u8type = record[ 3 ];
+        point.tag.u8size = (record[ 3 ] == TAG_STRING) ? record[ 4 ] : 0;
+        point.u32period = record[ 5 ] | ((uint32_t) record[ 6 ] << 8) |
+          ((uint32_t) record[ 7 ] << 16) | ((uint32_t) record[ 8 ] << 24);
+        i8result = addPoints( &point, (record[ 3 ] == TAG_STRING) ? 1 : record[ 4 ] );
+      }
+      u16pos += PLAN_POINT_SIZE;
+    }
+
+    if (i8result != PLAN_OK) {
+      u16errorAt = record - plan;
+      u16points = 0;
+      return i8result;
+    }
+  }
+
+  u16errorAt = 0;
+  i8result = compile();
+  if (i8result != PLAN_OK) {
+    u16points = 0;
+    u16batches = 0;
+    return i8result;
+  }
+  return u16points;
+}
+
+/**
+ * @brief
+ * Write the binary form of the loaded plan, e.g. on a Linux host to
+ * turn a text configuration into a flash image. Names are not kept.
+ *
+ * @param dest  destination
+ * @param u16room  bytes dest can hold
+ * @return bytes written, or PLAN_FULL if dest is too small
+ * @ingroup plan
+ */
+int16_t ModbusPlan::save( uint8_t *dest, uint16_t u16room ) {
+  uint16_t u16pos = 4;
+  const modbus_point_t *device = nullptr;
+
+  if (u16room < 4) return PLAN_FULL;
+  dest[ 0 ] = 'M';
+  dest[ 1 ] = 'B';
+  dest[ 2 ] = 'P';
+  dest[ 3 ] = PLAN_VERSION;
+
+  for (uint16_t i = 0; i < u16points; i++) {
+    const modbus_point_t *point = &aPoints[ i ];
+    if (device == nullptr || device->u8id != point->u8id ||
+      device->u8order != point->u8order || device->u8gap != point->u8gap) {
+      if (u16pos + PLAN_DEVICE_SIZE > u16room) return PLAN_FULL;
+      dest[ u16pos++ ] = 0;
+      dest[ u16pos++ ] = point->u8id;
+      dest[ u16pos++ ] = point->u8order;
+      dest[ u16pos++ ] = point->u8gap;
+      device = point;
+    }
+
+    if (u16pos + PLAN_POINT_SIZE > u16room) return PLAN_FULL;
+    dest[ u16pos++ ] = point->u8fct;
+    dest[ u16pos++ ] = lowByte( point->u16RegAdd );
+    dest[ u16pos++ ] = highByte( point->u16RegAdd );
+    dest[ u16pos++ ] = point->tag.u8type;
+    dest[ u16pos++ ] = (point->tag.u8type == TAG_STRING) ? point->tag.u8size : 1;
+    for (uint8_t b = 0; b < 4; b++) dest[ u16pos++ ] = (point->u32period >> (8 * b)) & 0xFF;
+  }
+  return u16pos;
+}
+
+/**
+ * @brief
+ * Where the last load() failed
+ *
+ * @return line of the text form, or byte of the binary form
+ * @ingroup plan
+ */
+uint16_t ModbusPlan::getErrorAt() {
+  return u16errorAt;
+}
+
+/**
+ * @brief
+ * Consult a capability cache: the plan is compiled again at once with
+ * batches no larger than the slaves accept and cut at their address
+ * holes, and every reply is fed to the cache from now on
+ *
+ * @param caps  cache, nullptr to stop consulting it
+ * @param u8port  port of the master, as numbered in the cache
+ * @ingroup plan
+ */
+void ModbusPlan::setCaps( ModbusCaps *caps, uint8_t u8port ) {
+  this->caps = caps;
+  this->u8port = u8port;
+  bReplan = (u16points > 0);
+}
+
+/**
+ * @brief
+ * Drive the master: read the batch most overdue. Batches never read go
+ * first, in schedule order. This method must be called only at loop
+ * section, from the thread that owns the master.
+ *
+ * @ingroup plan
+ */
+void ModbusPlan::poll() {
+  master->poll(); // completion calls onResult()
+  if (i16busy >= 0) return;
+  if (caps != nullptr && caps->poll()) return; // the cache probes a slave
+  if (bReplan) {
+    bReplan = false;
+    u16batches = 0;
+    if (compile() != PLAN_OK) u16batches = 0;
+  }
+
+  uint32_t u32now = master->getClock()->millis();
+  int16_t i16next = -1;
+  uint32_t u32late = 0;
+  for (uint16_t i = 0; i < u16batches; i++) {
+    modbus_batch_t *batch = &aBatches[ i ];
+    uint32_t u32since = u32now - batch->u32polled;
+    if (batch->bPolled && u32since < batch->u32period) continue;
+
+    uint32_t u32overdue = batch->bPolled ? u32since - batch->u32period : 0xFFFFFFFF;
+    if (i16next < 0 || u32overdue > u32late) {
+      i16next = i;
+      u32late = u32overdue;
+    }
+  }
+  if (i16next < 0) return;
+
+  modbus_batch_t *batch = &aBatches[ i16next ];
+  batch->u32polled = u32now;
+  batch->bPolled = true;
+  i16busy = i16next;
+  if (master->query( batch->telegram, onResult, this ) != 0) {
+    i16busy = -1;
+    batch->u8status = RESULT_REJECTED;
+    batch->u8exception = 0;
+  }
+}
+
+/**
+ * @brief
+ * Number of points of the plan
+ *
+ * @ingroup plan
+ */
+uint16_t ModbusPlan::getPoints() {
+  return u16points;
+}
+
+/**
+ * @brief
+ * Number of batches of the plan, that is of reads per round of polls
+ *
+ * @ingroup plan
+ */
+uint16_t ModbusPlan::getBatches() {
+  return u16batches;
+}
+
+/**
+ * @brief
+ * Point of the plan. Points are sorted by period, slave and address
+ * once compiled, their index is not the one of the configuration.
+ *
+ * @return point, nullptr if out of range
+ * @ingroup plan
+ */
+const modbus_point_t *ModbusPlan::getPoint( uint16_t u16point ) {
+  return (u16point < u16points) ? &aPoints[ u16point ] : nullptr;
+}
+
+/**
+ * @brief
+ * Batch of the plan, e.g. to check its last read
+ *
+ * @return batch, nullptr if out of range
+ * @ingroup plan
+ */
+const modbus_batch_t *ModbusPlan::getBatch( uint16_t u16batch ) {
+  return (u16batch < u16batches) ? &aBatches[ u16batch ] : nullptr;
+}
+
+/**
+ * @brief
+ * Find a point by its name. Repeated points share their name, the first
+ * address is found.
+ *
+ * @return point index, -1 if no point has this name
+ * @ingroup plan
+ */
+int16_t ModbusPlan::find( const char *szName ) {
+  int16_t i16found = -1;
+  for (uint16_t i = 0; i < u16points; i++) {
+    const modbus_point_t *point = &aPoints[ i ];
+    if (point->tag.szName == nullptr || strcmp( point->tag.szName, szName ) != 0) continue;
+    if (i16found < 0 || point->u16RegAdd < aPoints[ i16found ].u16RegAdd) i16found = i;
+  }
+  return i16found;
+}
+
+/**
+ * @brief
+ * Find a point by its address
+ *
+ * @param u8id  slave address
+ * @param u8fct  read function code, 1..4
+ * @param u16add  first register or coil of the point
+ * @return point index, -1 if no point starts there
+ * @ingroup plan
+ */
+int16_t ModbusPlan::find( uint8_t u8id, uint8_t u8fct, uint16_t u16add ) {
+  for (uint16_t i = 0; i < u16points; i++) {
+    const modbus_point_t *point = &aPoints[ i ];
+    if (point->u8id == u8id && point->u8fct == u8fct && point->u16RegAdd == u16add) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief
+ * Tell if a point holds a value read from its slave
+ *
+ * @ingroup plan
+ */
+boolean ModbusPlan::isValid( uint16_t u16point ) {
+  if (u16point >= u16points) return false;
+  return aBatches[ aPoints[ u16point ].u16batch ].bValid;
+}
+
+/**
+ * @brief
+ * Value of a numeric point, decoded with the order of its slave
+ *
+ * @return value of the point, 0 for a string or an unknown point
+ * @ingroup plan
+ */
+double ModbusPlan::get( uint16_t u16point ) {
+  if (u16point >= u16points) return 0;
+  const modbus_point_t *point = &aPoints[ u16point ];
+  return ModbusTags::getValue( au16data, &point->tag, point->u8order );
+}
+
+/**
+ * @brief
+ * Text of a string point
+ *
+ * @param u16point  point index
+ * @param dest  destination, always terminated
+ * @param u8size  size of dest
+ * @return length of the text
+ * @ingroup plan
+ */
+uint8_t ModbusPlan::getString( uint16_t u16point, char *dest, uint8_t u8size ) {
+  if (u16point >= u16points) {
+    if (u8size > 0) dest[ 0 ] = 0;
+    return 0;
+  }
+  const modbus_point_t *point = &aPoints[ u16point ];
+  return ModbusTags::getText( au16data, &point->tag, point->u8order, dest, u8size );
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Validate a point and add it, repeated over the next addresses
+ *
+ * @return PLAN_OK or a negative PLAN_RESULT
+ * @ingroup plan
+ */
+int8_t ModbusPlan::addPoints( const modbus_point_t *point, uint8_t u8count ) {
+  boolean bBits = (point->u8fct == MB_FC_READ_COILS || point->u8fct == MB_FC_READ_DISCRETE_INPUT);
+  uint8_t u8span = pointSpan( point );
+
+  if (bBits != (point->tag.u8type == TAG_BIT)) return PLAN_SYNTAX;
+  if (point->u32period == 0 || u8span == 0) return PLAN_RANGE;
+  if (!bBits && u8span > PLAN_MAX_READ_REGS) return PLAN_RANGE;
+  if ((uint32_t) point->u16RegAdd + (uint32_t) u8span * u8count > 0x10000) return PLAN_RANGE;
+  if (u16points + u8count > u16maxPoints) return PLAN_FULL;
+
+  for (uint8_t i = 0; i < u8count; i++) {
+    modbus_point_t *added = &aPoints[ u16points++ ];
+    *added = *point;
+    added->u16RegAdd = point->u16RegAdd + i * u8span;
+  }
+  return PLAN_OK;
+}
+
+/**
+ * @brief
+ * Compile the loaded points: sort them in schedule order, then merge in
+ * one pass the points of a slave, table and period into batches as long
+ * as the read stays legal, within the limits and holes the capability
+ * cache knows, and skips at most u8gap addresses. Each batch gets its
+ * slice of the data array and its query.
+ *
+ * @return PLAN_OK or PLAN_FULL
+ * @ingroup plan
+ */
+int8_t ModbusPlan::compile() {
+  modbus_batch_t *batch = nullptr;
+  uint32_t u32end = 0; //!< first address after the batch
+  uint16_t u16used = 0; //!< registers of the data array given to batches
+
+  qsort( aPoints, u16points, sizeof( modbus_point_t ), comparePoints );
+
+  for (uint16_t i = 0; i <= u16points; i++) {
+    modbus_point_t *point = (i < u16points) ? &aPoints[ i ] : nullptr;
+    boolean bBits = (point != nullptr) &&
+      (point->u8fct == MB_FC_READ_COILS || point->u8fct == MB_FC_READ_DISCRETE_INPUT);
+    uint32_t u32pointEnd = (point != nullptr) ? (uint32_t) point->u16RegAdd + pointSpan( point ) : 0;
+
+    if (batch != nullptr && point != nullptr &&
+      point->u8id == batch->telegram.u8id && point->u8fct == batch->telegram.u8fct &&
+      point->u32period == batch->u32period &&
+      point->u16RegAdd <= u32end + point->u8gap) {
+      uint32_t u32newEnd = (u32pointEnd > u32end) ? u32pointEnd : u32end;
+      uint32_t u32span = u32newEnd - batch->telegram.u16RegAdd;
+      if (u32span <= (bBits ? PLAN_MAX_READ_COILS : PLAN_MAX_READ_REGS) &&
+        (caps == nullptr || caps->fitRead( u8port, point->u8id, point->u8fct, batch->telegram.u16RegAdd, u32span ) >= u32span)) {
+        u32end = u32newEnd;
+        batch->telegram.u16CoilsNo = u32span;
+        point->u16batch = batch - aBatches;
+        continue;
+      }
+    }
+
+    // close the batch, then open one for the point
+    if (batch != nullptr) {
+      boolean bBatchBits = (batch->telegram.u8fct == MB_FC_READ_COILS || batch->telegram.u8fct == MB_FC_READ_DISCRETE_INPUT);
+      uint16_t u16words = bBatchBits ? (batch->telegram.u16CoilsNo + 15) / 16 : batch->telegram.u16CoilsNo;
+      if (u16used + u16words > u16maxRegs) return PLAN_FULL;
+      batch->telegram.au16reg = &au16data[ u16used ];
+      memset( batch->telegram.au16reg, 0, u16words * sizeof( uint16_t ));
+      u16used += u16words;
+    }
+    if (point == nullptr) break;
+    if (u16batches >= u16maxBatches) return PLAN_FULL;
+
+    batch = &aBatches[ u16batches++ ];
+    batch->telegram.u8id = point->u8id;
+    batch->telegram.u8fct = point->u8fct;
+    batch->telegram.u16RegAdd = point->u16RegAdd;
+    batch->telegram.u16CoilsNo = u32pointEnd - point->u16RegAdd;
+    batch->u32period = point->u32period;
+    batch->u32polled = 0;
+    batch->u32stamp = 0;
+    batch->bPolled = false;
+    batch->bValid = false;
+    batch->u8status = RESULT_OK;
+    batch->u8exception = 0;
+    u32end = u32pointEnd;
+    point->u16batch = u16batches - 1;
+  }
+
+  // place every point in the slice of its batch
+  for (uint16_t i = 0; i < u16points; i++) {
+    modbus_point_t *point = &aPoints[ i ];
+    batch = &aBatches[ point->u16batch ];
+    uint16_t u16base = batch->telegram.au16reg - au16data;
+    uint16_t u16delta = point->u16RegAdd - batch->telegram.u16RegAdd;
+    if (point->tag.u8type == TAG_BIT) {
+      point->tag.u16offset = u16base + u16delta / 16;
+      point->tag.u8size = u16delta % 16;
+    } else {
+      point->tag.u16offset = u16base + u16delta;
+    }
+  }
+  return PLAN_OK;
+}
+
+/**
+ * @brief
+ * Completion handler of the master: the reply is already decoded in the
+ * slice of the batch
+ *
+ * @ingroup plan
+ */
+void ModbusPlan::onResult( const modbus_result_t *result, void *context ) {
+  ModbusPlan *plan = (ModbusPlan *) context;
+  int16_t i16batch = plan->i16busy;
+  if (i16batch < 0) return; // plan loaded again meanwhile
+  plan->i16busy = -1;
+
+  modbus_batch_t *batch = &plan->aBatches[ i16batch ];
+  batch->u8status = result->u8status;
+  batch->u8exception = result->u8exception;
+  if (result->u8status == RESULT_OK) {
+    batch->bValid = true;
+    batch->u32stamp = plan->master->getClock()->millis();
+  }
+
+  ModbusCaps *caps = plan->caps;
+  if (caps == nullptr) return;
+  boolean bLearned = caps->learn( plan->u8port, result );
+  if (bLearned) plan->bReplan = true;
+
+  // a size or an address of the batch was refused, and the cache either
+  // just learned it or cannot tell why: let it probe the batch for the
+  // limit and the holes
+  const modbus_t *telegram = &result->telegram;
+  if (result->u8status != RESULT_EXCEPTION || telegram->u16CoilsNo < 2) return;
+  if (result->u8exception != EXC_REGS_QUANT && result->u8exception != EXC_ADDR_RANGE) return;
+  if (bLearned || caps->fitRead( plan->u8port, telegram->u8id, telegram->u8fct, telegram->u16RegAdd, telegram->u16CoilsNo ) >= telegram->u16CoilsNo) {
+    if (caps->probe( plan->master, plan->u8port, telegram->u8id, telegram->u8fct,
+      telegram->u16RegAdd, telegram->u16CoilsNo ) == CAPS_OK) plan->bReplan = true;
+  }
+}
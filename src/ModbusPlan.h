@@ -0,0 +1,147 @@
+#ifndef MODBUS_PLAN_H
+#define MODBUS_PLAN_H
+
+/**
+ * @file 		ModbusPlan.h
+ *
+ * @description
+ *  Declarative poll plan.
+ *  The points a master polls are listed in a configuration instead of
+ *  code, so a site change needs no new firmware. The configuration comes
+ *  as text, for Linux hosts and humans, or in a compact binary form for
+ *  flash; load() validates it and compiles it at once into read batches:
+ *  points of a slave and period are merged into the fewest reads, each
+ *  batch gets its query ready to send, and batches are ordered fastest
+ *  period first. Replies are decoded straight into the data array, where
+ *  the typed value of every point is read through the tag layer.
+ *
+ *  Text form, one statement per line, '#' starts a comment:
+ *
+ *    device <slave> [ABCD|CDAB|BADC|DCBA] [gap]
+ *    <table> <address> <type>[*<count>] <period ms> [name]
+ *
+ *  table is coil, discrete, holding or input (or 1..4). type is bit,
+ *  uint16, int16, uint32, int32, float, uint64, int64, double or string;
+ *  *count repeats the point over the next addresses, for a string it is
+ *  its number of registers. gap is the number of unused registers (or
+ *  coils) a batch may read to merge two points, 0 by default since some
+ *  slaves refuse reads over unmapped addresses.
+ *
+ *    device 1 CDAB 4
+ *    holding 3000 float*3 1000 voltage
+ *    holding 3100 uint64 60000 energy
+ *    coil 0 bit*8 200 relays
+ *
+ *  Binary form: "MBP" then the version (1), then records. All integers
+ *  are little endian.
+ *    device: 0x00, slave, TAG_ORDER, gap
+ *    point:  function code (1..4), address (uint16_t), TAG_TYPE,
+ *            count, period in ms (uint32_t)
+ *  Names are not kept in the binary form, points are found by address.
+ *
+ *  With setCaps(), batches are cut to the read limits and address holes
+ *  a ModbusCaps cache knows of the slaves, and the plan feeds the cache
+ *  every reply: when it learns a new limit or hole, or probes a range a
+ *  slave refused, the plan is compiled again with what it learned.
+ *
+ * @defgroup plan Modbus Poll Plan
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusTags.h"
+#include "ModbusCaps.h"
+
+#define PLAN_VERSION 1 //!< version of the binary form
+
+/**
+ * @enum PLAN_RESULT
+ * @brief
+ * Errors of ModbusPlan::load() and ModbusPlan::save()
+ */
+enum PLAN_RESULT {
+  PLAN_OK                       = 0,
+  PLAN_SYNTAX                   = -1, //!< unknown statement, table, type or order
+  PLAN_RANGE                    = -2, //!< slave, address, count or period out of range
+  PLAN_FULL                     = -3, //!< more points, batches or registers than the storage
+  PLAN_FORMAT                   = -4  //!< binary form: bad header or truncated record
+};
+
+/**
+ * @struct modbus_point_t
+ * @brief
+ * Typed point of the plan
+ */
+typedef struct {
+  modbus_tag_t tag;      /*!< Name, type and place of the point in the data array */
+  uint8_t u8id;          /*!< Slave address */
+  uint8_t u8fct;         /*!< Read function code, 1..4 */
+  uint8_t u8order;       /*!< TAG_ORDER of the slave */
+  uint8_t u8gap;         /*!< Unused addresses a batch may read to merge it */
+  uint16_t u16RegAdd;    /*!< Address in the slave: first register, or the coil */
+  uint32_t u32period;    /*!< Poll period (ms) */
+  uint16_t u16batch;     /*!< Batch reading it, once compiled */
+}
+modbus_point_t;
+
+/**
+ * @struct modbus_batch_t
+ * @brief
+ * Read merging the points of a slave and period
+ */
+typedef struct {
+  modbus_t telegram;     /*!< Query, its au16reg is a slice of the data array */
+  uint32_t u32period;    /*!< Poll period (ms) */
+  uint32_t u32polled;    /*!< Master clock (ms) of the last poll */
+  uint32_t u32stamp;     /*!< Master clock (ms) of the last good read */
+  boolean bPolled;       /*!< Polled at least once */
+  boolean bValid;        /*!< The data array holds a good read */
+  uint8_t u8status;      /*!< RESULT_STATUS of the last read */
+  uint8_t u8exception;   /*!< Exception code of the last read, 0 if none */
+}
+modbus_batch_t;
+
+/**
+ * @class ModbusPlan
+ * @brief
+ * Poll plan of a master, over storage given by the application.
+ * The plan owns the master: nobody else should query() it while the plan is polled.
+ */
+class ModbusPlan {
+private:
+  Modbus *master;
+  modbus_point_t *aPoints;
+  modbus_batch_t *aBatches;
+  uint16_t *au16data;
+  uint16_t u16maxPoints, u16maxBatches, u16maxRegs;
+  uint16_t u16points, u16batches;
+  int16_t i16busy; //!< batch being read, -1 when the bus is free
+  ModbusCaps *caps; //!< read limits of the slaves, nullptr if none
+  uint8_t u8port; //!< port of the master in caps
+  boolean bReplan; //!< caps learned something: compile again
+  uint16_t u16errorAt; //!< line or byte of the last load() error
+
+  int8_t addPoints( const modbus_point_t *point, uint8_t u8count );
+  int8_t compile();
+  static void onResult( const modbus_result_t *result, void *context );
+
+public:
+  ModbusPlan( Modbus *master, modbus_point_t *points, uint16_t u16points,
+    modbus_batch_t *batches, uint16_t u16batches, uint16_t *data, uint16_t u16regs );
+  int16_t load( char *szText ); //!<text form, split in place: names point into it
+  int16_t load( const uint8_t *plan, uint16_t u16size ); //!<binary form
+  int16_t save( uint8_t *dest, uint16_t u16room ); //!<binary form of the loaded plan, returns its size
+  uint16_t getErrorAt(); //!<line (text) or byte (binary) where load() failed
+  void setCaps( ModbusCaps *caps, uint8_t u8port = 0 ); //!<cut batches to the slave limits, learn from the replies
+  void poll(); //!<read the batches that are due
+  uint16_t getPoints(); //!<number of points
+  uint16_t getBatches(); //!<number of batches
+  const modbus_point_t *getPoint( uint16_t u16point );
+  const modbus_batch_t *getBatch( uint16_t u16batch );
+  int16_t find( const char *szName ); //!<point index, -1 if none
+  int16_t find( uint8_t u8id, uint8_t u8fct, uint16_t u16add ); //!<point index, -1 if none
+  boolean isValid( uint16_t u16point ); //!<the point was read at least once
+  double get( uint16_t u16point ); //!<value of a numeric point
+  uint8_t getString( uint16_t u16point, char *dest, uint8_t u8size ); //!<text of a string point
+};
+
+#endif
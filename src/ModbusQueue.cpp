@@ -0,0 +1,171 @@
+// ModbusQueue.cpp
+
+#include "ModbusQueue.h"
+
+#define QUEUE_MASK (MODBUS_QUEUE_SIZE - 1)
+
+#if (MODBUS_QUEUE_SIZE & QUEUE_MASK) != 0
+#error "MODBUS_QUEUE_SIZE must be a power of 2"
+#endif
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a queue in front of a master
+ *
+ * @param master  Modbus master (u8id = 0) already started with begin()
+ * @ingroup queue
+ */
+ModbusQueue::ModbusQueue( Modbus *master ) {
+  this->master = master;
+  this->active = nullptr;
+  u32head = 0;
+  u32tail.store( 0, std::memory_order_relaxed );
+  for (uint32_t i = 0; i < MODBUS_QUEUE_SIZE; i++) {
+    aSlots[ i ].u32seq.store( i, std::memory_order_relaxed );
+    aSlots[ i ].request = nullptr;
+  }
+}
+
+/**
+ * @brief
+ * Queue a request for the bus. Safe from any thread and from several
+ * threads at once; it never waits for the bus or for another producer.
+ *
+ * @param request  request to send, it belongs to the queue until isDone()
+ * @return QUEUE_OK, QUEUE_FULL or QUEUE_IN_FLIGHT
+ * @ingroup queue
+ */
+int8_t ModbusQueue::submit( modbus_request_t *request ) {
+  return submit( request, nullptr, nullptr );
+}
+
+/**
+ * @brief
+ * Queue a request like submit(modbus_request_t*) and call a handler when it
+ * completes. The handler is called from poll(), on the bus owner thread,
+ * with the modbus_result_t of the master, before isDone() turns true: it
+ * may submit other requests, but must not query() the master itself.
+ * A request the master refuses gets RESULT_REJECTED.
+ *
+ * @param request  request to send, it belongs to the queue until isDone()
+ * @param handler  completion handler, nullptr = none
+ * @param context  passed to the handler as is
+ * @return QUEUE_OK, QUEUE_FULL or QUEUE_IN_FLIGHT
+ * @ingroup queue
+ */
+int8_t ModbusQueue::submit( modbus_request_t *request, modbus_handler_t handler, void *context ) {
+  uint8_t u8state = request->u8state.load( std::memory_order_acquire );
+  if (u8state == REQUEST_QUEUED || u8state == REQUEST_ACTIVE) return QUEUE_IN_FLIGHT;
+
+  // claim a position: the slot must be free for this lap of the ring
+  modbus_slot_t *slot;
+  uint32_t u32pos = u32tail.load( std::memory_order_relaxed );
+  while (true) {
+    slot = &aSlots[ u32pos & QUEUE_MASK ];
+    int32_t i32lap = (int32_t) (slot->u32seq.load( std::memory_order_acquire ) - u32pos);
+    if (i32lap < 0) return QUEUE_FULL;
+    if (i32lap == 0) {
+      if (u32tail.compare_exchange_weak( u32pos, u32pos + 1, std::memory_order_relaxed )) break;
+    } else {
+      u32pos = u32tail.load( std::memory_order_relaxed ); // another producer took it
+    }
+  }
+
+  request->u8error = 0;
+  request->handler = handler;
+  request->context = context;
+  request->u8state.store( REQUEST_QUEUED, std::memory_order_relaxed );
+  slot->request = request;
+  slot->u32seq.store( u32pos + 1, std::memory_order_release ); // publish
+  return QUEUE_OK;
+}
+
+/**
+ * @brief
+ * Check whether a submitted request is completed. u8error and the
+ * telegram registers may be read once it returns true.
+ *
+ * @ingroup queue
+ */
+boolean ModbusQueue::isDone( modbus_request_t *request ) {
+  return request->u8state.load( std::memory_order_acquire ) >= REQUEST_DONE;
+}
+
+/**
+ * @brief
+ * Drive the master: complete the request on the bus, then start the next
+ * one in the same call, so that the bus does not idle for a poll().
+ * Call it from a single thread, the bus owner, as often as the master poll().
+ *
+ * @return requests completed or rejected by this call
+ * @ingroup queue
+ */
+int8_t ModbusQueue::poll() {
+  int8_t i8done = 0;
+  if (active != nullptr) {
+    master->poll(); // calls the handler of the request
+    if (master->getState() != COM_IDLE) return 0;
+
+    active->u8error = master->getLastError();
+    active->u8state.store( REQUEST_DONE, std::memory_order_release );
+    active = nullptr;
+    i8done++;
+  }
+
+  modbus_request_t *request;
+  while ((request = take()) != nullptr) {
+    if (start( request )) break;
+    i8done++;
+  }
+  return i8done;
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Take the oldest published request and hand its slot to the next lap
+ *
+ * @return request, nullptr if none is published
+ * @ingroup queue
+ */
+modbus_request_t *ModbusQueue::take() {
+  modbus_slot_t *slot = &aSlots[ u32head & QUEUE_MASK ];
+  if (slot->u32seq.load( std::memory_order_acquire ) != u32head + 1) return nullptr;
+
+  modbus_request_t *request = slot->request;
+  slot->u32seq.store( u32head + MODBUS_QUEUE_SIZE, std::memory_order_release );
+  u32head++;
+  return request;
+}
+
+/**
+ * @brief
+ * Put a request on the bus, or reject it if the master refuses it
+ *
+ * @return true if it is on the bus
+ * @ingroup queue
+ */
+boolean ModbusQueue::start( modbus_request_t *request ) {
+  request->u8state.store( REQUEST_ACTIVE, std::memory_order_relaxed );
+  int8_t i8result = (request->handler != nullptr) ?
+    master->query( request->telegram, request->handler, request->context ) :
+    master->query( request->telegram );
+  if (i8result == 0) {
+    active = request;
+    return true;
+  }
+
+  if (request->handler != nullptr) {
+    modbus_result_t result;
+    result.u8status = RESULT_REJECTED;
+    result.u8exception = 0;
+    result.telegram = request->telegram;
+    result.u32latency = 0;
+    request->handler( &result, request->context );
+  }
+  request->u8state.store( REQUEST_REJECTED, std::memory_order_release );
+  return false;
+}
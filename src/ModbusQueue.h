@@ -0,0 +1,103 @@
+#ifndef MODBUS_QUEUE_H
+#define MODBUS_QUEUE_H
+
+/**
+ * @file 		ModbusQueue.h
+ *
+ * @description
+ *  Thread-safe master front-end.
+ *  Any thread may submit a request; a single bus owner thread drains the
+ *  submissions into the master with poll(). Submission is a bounded
+ *  multi-producer single-consumer ring without locks: producers only race
+ *  on one atomic index, so they never hold up the bus owner and there is
+ *  no mutex around the serial port. Completion is published in the request
+ *  itself, the submitter checks isDone() or waits for it, or is handed to
+ *  a completion handler called by poll() on the bus owner thread.
+ *
+ * @defgroup queue Modbus Master Request Queue
+ */
+
+#include <atomic>
+#include "ModbusRtu.h"
+
+#ifndef MODBUS_QUEUE_SIZE
+#define MODBUS_QUEUE_SIZE 16	//!< requests waiting for the bus, a power of 2
+#endif
+
+/**
+ * @enum REQUEST_STATES
+ * @brief
+ * Life of a modbus_request_t
+ */
+enum REQUEST_STATES {
+  REQUEST_FREE                  = 0, //!< never submitted
+  REQUEST_QUEUED                = 1, //!< waiting for the bus
+  REQUEST_ACTIVE                = 2, //!< on the bus
+  REQUEST_DONE                  = 3, //!< completed, u8error tells how
+  REQUEST_REJECTED              = 4  //!< the master refused the telegram (address or function)
+};
+
+/**
+ * @enum QUEUE_RESULT
+ * @brief
+ * Return values of ModbusQueue::submit()
+ */
+enum QUEUE_RESULT {
+  QUEUE_OK                      = 0,
+  QUEUE_FULL                    = -1, //!< MODBUS_QUEUE_SIZE requests already waiting
+  QUEUE_IN_FLIGHT               = -2  //!< the request was submitted and is not completed yet
+};
+
+/**
+ * @struct modbus_request_t
+ * @brief
+ * Request owned by the submitting thread. It must stay in place, and the
+ * telegram registers untouched, until the request is done.
+ */
+typedef struct {
+  modbus_t telegram;             /*!< Query; au16reg receives read data */
+  std::atomic<uint8_t> u8state;  /*!< REQUEST_STATES, set by the bus owner once submitted */
+  uint8_t u8error;               /*!< When done: 0, exception code or NO_REPLY */
+  modbus_handler_t handler;      /*!< Completion handler given to submit(), nullptr = none */
+  void *context;                 /*!< Passed to the handler as is */
+}
+modbus_request_t;
+
+/**
+ * @struct modbus_slot_t
+ * @brief
+ * Cell of the submission ring. u32seq tells which lap of the ring may use it.
+ */
+typedef struct {
+  std::atomic<uint32_t> u32seq;  /*!< Position it accepts a request for, +1 once filled */
+  modbus_request_t *request;     /*!< Submitted request */
+}
+modbus_slot_t;
+
+/**
+ * @class ModbusQueue
+ * @brief
+ * Multi-producer request queue in front of a Modbus master.
+ * The queue owns the master: only the bus owner thread calls poll(), nobody
+ * else should query() the master.
+ */
+class ModbusQueue {
+private:
+  Modbus *master;
+  modbus_slot_t aSlots[MODBUS_QUEUE_SIZE];
+  std::atomic<uint32_t> u32tail; //!< next position to fill, shared by the producers
+  uint32_t u32head; //!< next position to drain, bus owner only
+  modbus_request_t *active; //!< request on the bus
+
+  modbus_request_t *take();
+  boolean start( modbus_request_t *request );
+
+public:
+  ModbusQueue( Modbus *master );
+  int8_t submit( modbus_request_t *request ); //!<any thread, returns a QUEUE_RESULT
+  int8_t submit( modbus_request_t *request, modbus_handler_t handler, void *context = nullptr ); //!<any thread, handler called by poll() on completion
+  boolean isDone( modbus_request_t *request ); //!<any thread, completed or rejected
+  int8_t poll(); //!<bus owner thread only, drives the master
+};
+
+#endif
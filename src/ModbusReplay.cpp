@@ -0,0 +1,300 @@
+// ModbusReplay.cpp
+
+#include "ModbusReplay.h"
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a replay harness
+ *
+ * @param engine  Modbus engine built on the loopback, master or slave
+ * @param port  loopback the engine reads and writes
+ * @ingroup replay
+ */
+ModbusReplay::ModbusReplay( Modbus *engine, ModbusLoopback *port ) {
+  this->engine = engine;
+  this->port = port;
+  this->capture = nullptr;
+  this->regs = nullptr;
+  this->u16regsize = 0;
+  this->report = nullptr;
+  this->u8state = REPLAY_IDLE;
+}
+
+/**
+ * @brief
+ * Start replaying a capture.
+ * REPLAY_FAST also sets the engine inter-frame silence to 0, as the
+ * loopback hands over whole frames, until the end of the replay.
+ *
+ * @param capture  native capture, as written by Modbus::setCapture()
+ * @param u32size  capture length in bytes
+ * @param u8mode  REPLAY_SLAVE or REPLAY_MASTER
+ * @param u8speed  REPLAY_REALTIME or REPLAY_FAST
+ * @return 0 if OK, -1 if this is not a native capture of the current version
+ * @ingroup replay
+ */
+int8_t ModbusReplay::begin( const uint8_t *capture, uint32_t u32size, uint8_t u8mode, uint8_t u8speed ) {
+  if (u32size < 10 || memcmp( capture, "MBCP", 4 ) != 0) return -1;
+  if (capture[ 4 ] != MODBUS_CAPTURE_VERSION) return -1;
+
+  this->capture = capture;
+  this->u32captureSize = u32size;
+  this->u32offset = 10;
+  this->u8mode = u8mode;
+  this->u8speed = u8speed;
+  u16frames = u16diverged = 0;
+  u32maxProcess = u32maxTurnaround = 0;
+
+  if (u8speed == REPLAY_FAST) {
+    u8T35 = engine->getT35();
+    engine->setT35( 0 );
+  }
+  port->clear();
+
+  loadRequest();
+  u32first = request.u32stamp;
+  u32start = engine->getClock()->micros();
+  return 0;
+}
+
+/**
+ * @brief
+ * Register map handed to a slave engine at each poll
+ *
+ * @ingroup replay
+ */
+void ModbusReplay::setRegs( uint16_t *regs, uint16_t u16size ) {
+  this->regs = regs;
+  this->u16regsize = u16size;
+}
+
+/**
+ * @brief
+ * Where the per request CSV report is printed, nullptr for none
+ *
+ * @ingroup replay
+ */
+void ModbusReplay::setReport( Print *sink ) {
+  this->report = sink;
+}
+
+/**
+ * @brief
+ * Advance the replay. Call it from loop() until it returns REPLAY_DONE.
+ *
+ * @return current REPLAY_STATES
+ * @ingroup replay
+ */
+int8_t ModbusReplay::poll() {
+  switch( u8state ) {
+  case REPLAY_WAIT:
+    if (!isDue( &request )) break;
+
+    port->clear();
+    if (u8mode == REPLAY_MASTER) {
+      sendRequest();
+      u8state = bAnswer ? REPLAY_ANSWER : REPLAY_RUN; // no answer: wait for the time-out
+      u32injected = engine->getClock()->micros();
+    } else {
+      port->inject( request.frame, request.u16size );
+      u32injected = engine->getClock()->micros();
+      u8state = REPLAY_RUN;
+    }
+    break;
+
+  case REPLAY_ANSWER:
+    if (!isDue( &answer )) break;
+
+    port->inject( answer.frame, answer.u16size );
+    u32injected = engine->getClock()->micros();
+    u8state = REPLAY_RUN;
+    break;
+
+  case REPLAY_RUN: {
+    // processing is CPU time, turnaround is engine time
+    uint32_t u32begin = micros();
+    if (u8mode == REPLAY_MASTER) {
+      engine->poll();
+    } else {
+      engine->poll( regs, u16regsize );
+    }
+    uint32_t u32process = micros() - u32begin;
+
+    // a slave is done once it has taken the frame, a master once it is idle again
+    boolean bDone = (u8mode == REPLAY_MASTER) ? engine->getState() == COM_IDLE : port->available() == 0;
+    if (bDone) finish( u32process, engine->getClock()->micros() - u32injected );
+    break;
+  }
+
+  default:
+    break;
+  }
+  return u8state;
+}
+
+uint16_t ModbusReplay::getFrames() {
+  return u16frames;
+}
+
+uint16_t ModbusReplay::getDiverged() {
+  return u16diverged;
+}
+
+uint32_t ModbusReplay::getMaxProcess() {
+  return u32maxProcess;
+}
+
+uint32_t ModbusReplay::getMaxTurnaround() {
+  return u32maxTurnaround;
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Read the next record of the capture
+ *
+ * @return false at the end of the capture
+ * @ingroup replay
+ */
+boolean ModbusReplay::nextRecord( modbus_record_t *record ) {
+  if (u32offset + 7 > u32captureSize) return false;
+
+  const uint8_t *header = &capture[ u32offset ];
+  record->u32stamp = (uint32_t) header[0] | ((uint32_t) header[1] << 8) |
+    ((uint32_t) header[2] << 16) | ((uint32_t) header[3] << 24);
+  record->u8flags = header[4];
+  record->u16size = word( header[6], header[5] );
+  record->frame = header + 7;
+  if (u32offset + 7 + record->u16size > u32captureSize) return false;
+
+  u32offset += 7 + record->u16size;
+  return true;
+}
+
+/**
+ * @brief
+ * Load the next request and its answer, if it was recorded
+ *
+ * @ingroup replay
+ */
+void ModbusReplay::loadRequest() {
+  do {
+    if (!nextRecord( &request )) {
+      if (u8speed == REPLAY_FAST) engine->setT35( u8T35 );
+      u8state = REPLAY_DONE;
+      return;
+    }
+  } while ((request.u8flags & CAPTURE_REQUEST) == 0);
+
+  uint32_t u32next = u32offset;
+  bAnswer = nextRecord( &answer ) && (answer.u8flags & CAPTURE_RESPONSE) != 0;
+  if (!bAnswer) u32offset = u32next; // keep it as the next request
+  u8state = REPLAY_WAIT;
+}
+
+/**
+ * @brief
+ * Check whether the recorded time of a frame has come
+ *
+ * @ingroup replay
+ */
+boolean ModbusReplay::isDue( const modbus_record_t *record ) {
+  if (u8speed == REPLAY_FAST) return true;
+  return (engine->getClock()->micros() - u32start) >= (record->u32stamp - u32first);
+}
+
+/**
+ * @brief
+ * Compare a frame emitted by the engine with a recorded one
+ *
+ * @ingroup replay
+ */
+boolean ModbusReplay::isRecorded( const modbus_record_t *record, const uint8_t *frame, uint16_t u16size ) {
+  return (record->u16size == u16size) && (memcmp( record->frame, frame, u16size ) == 0);
+}
+
+/**
+ * @brief
+ * Master mode: rebuild the telegram of the recorded request and let the
+ * master send it, then check that it encoded the same frame.
+ *
+ * @ingroup replay
+ */
+void ModbusReplay::sendRequest() {
+  const uint8_t *frame = request.frame;
+  bDiverged = true;
+  if (request.u16size < 8) return;
+
+  modbus_t telegram;
+  telegram.u8id = frame[ ID ];
+  telegram.u8fct = frame[ FUNC ];
+  telegram.u16RegAdd = word( frame[ ADD_HI ], frame[ ADD_LO ] );
+  telegram.u16CoilsNo = word( frame[ NB_HI ], frame[ NB_LO ] );
+  telegram.au16reg = au16scratch;
+
+  switch( telegram.u8fct ) {
+  case MB_FC_WRITE_COIL:
+    au16scratch[ 0 ] = (frame[ NB_HI ] == 0xff);
+    break;
+  case MB_FC_WRITE_REGISTER:
+    au16scratch[ 0 ] = word( frame[ NB_HI ], frame[ NB_LO ] );
+    break;
+  case MB_FC_WRITE_MULTIPLE_COILS:
+    // coil n is bit n%16 of au16scratch[n/16], the first byte being the low one
+    for (uint16_t i = 0; i < frame[ BYTE_CNT ] && (BYTE_CNT + 1 + i) < request.u16size; i++) {
+      if (i % 2 == 0) au16scratch[ i / 2 ] = frame[ BYTE_CNT + 1 + i ];
+      else au16scratch[ i / 2 ] |= (uint16_t) frame[ BYTE_CNT + 1 + i ] << 8;
+    }
+    break;
+  case MB_FC_WRITE_MULTIPLE_REGISTERS:
+    for (uint16_t i = 0; i < telegram.u16CoilsNo && (BYTE_CNT + 2 + i * 2) < request.u16size; i++) {
+      au16scratch[ i ] = word( frame[ BYTE_CNT + 1 + i * 2 ], frame[ BYTE_CNT + 2 + i * 2 ] );
+    }
+    break;
+  }
+
+  if (engine->query( telegram ) != 0) return;
+
+  uint8_t au8Sent[ MAX_BUFFER ];
+  uint16_t u16sent = port->take( au8Sent, sizeof( au8Sent ));
+  bDiverged = !isRecorded( &request, au8Sent, u16sent );
+}
+
+/**
+ * @brief
+ * Account and report the request just handled, then load the next one
+ *
+ * @param u32process  duration of the poll() call that completed the request (us)
+ * @param u32turnaround  time from injection to completion (us)
+ * @ingroup replay
+ */
+void ModbusReplay::finish( uint32_t u32process, uint32_t u32turnaround ) {
+  boolean bMatch;
+  if (u8mode == REPLAY_MASTER) {
+    bMatch = !bDiverged;
+  } else {
+    // broadcasts and requests of the other slaves of the bus are not answered
+    uint8_t au8Out[ MAX_BUFFER ];
+    uint16_t u16out = port->take( au8Out, sizeof( au8Out ));
+    if (bAnswer && request.frame[ ID ] == engine->getID()) {
+      bMatch = isRecorded( &answer, au8Out, u16out );
+    } else {
+      bMatch = (u16out == 0);
+    }
+  }
+
+  u16frames++;
+  if (!bMatch) u16diverged++;
+  if (u32process > u32maxProcess) u32maxProcess = u32process;
+  if (u32turnaround > u32maxTurnaround) u32maxTurnaround = u32turnaround;
+
+  if (report != nullptr) {
+    report->printlnf( "%u,%lu,%u,%lu,%lu,%u", u16frames, (unsigned long) request.u32stamp,
+      request.frame[ FUNC ], (unsigned long) u32process, (unsigned long) u32turnaround, bMatch );
+  }
+
+  loadRequest();
+}
@@ -0,0 +1,113 @@
+#ifndef MODBUS_REPLAY_H
+#define MODBUS_REPLAY_H
+
+/**
+ * @file 		ModbusReplay.h
+ *
+ * @description
+ *  Record-and-replay harness.
+ *  Plays a native sniffer capture (CAPTURE_NATIVE) into a Modbus engine
+ *  through a ModbusLoopback, keeping the recorded timing or as fast as
+ *  possible. A slave engine receives the recorded requests and its answers
+ *  are compared with the recorded ones, requests to the other slaves of a
+ *  multi-drop capture and broadcasts being left unanswered; a master
+ *  engine sends the recorded requests itself and receives the recorded
+ *  answers.
+ *  For each request it reports the time spent in the poll() call that
+ *  handled the frame, the turnaround and whether the engine diverged from
+ *  the capture.
+ *  Recorded timing follows the engine clock: with a ModbusVirtualClock
+ *  advanced from loop(), a long capture replays at its own pace in a
+ *  fraction of the real time.
+ *
+ * @defgroup replay Modbus Capture Replay
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusLoopback.h"
+
+/**
+ * @enum REPLAY_MODE
+ * @brief
+ * Role of the engine under replay
+ */
+enum REPLAY_MODE {
+  REPLAY_SLAVE                  = 0, //!< recorded requests are fed to a slave
+  REPLAY_MASTER                 = 1  //!< recorded answers are fed to a master
+};
+
+/**
+ * @enum REPLAY_SPEED
+ * @brief
+ * Replay pace
+ */
+enum REPLAY_SPEED {
+  REPLAY_REALTIME               = 0, //!< frames are injected at their recorded time
+  REPLAY_FAST                   = 1  //!< frames are injected as soon as the engine is ready
+};
+
+enum REPLAY_STATES {
+  REPLAY_IDLE                   = 0,
+  REPLAY_WAIT                   = 1, //!< waiting for the time of the next request
+  REPLAY_ANSWER                 = 2, //!< master mode: waiting for the time of the answer
+  REPLAY_RUN                    = 3, //!< engine is handling the frame
+  REPLAY_DONE                   = 4
+};
+
+/**
+ * @struct modbus_record_t
+ * @brief
+ * One frame of a native capture
+ */
+typedef struct {
+  uint32_t u32stamp;     /*!< Time of the first byte (us) */
+  uint8_t u8flags;       /*!< CAPTURE_FLAGS */
+  uint16_t u16size;      /*!< Frame length, CRC included */
+  const uint8_t *frame;  /*!< Frame bytes, inside the capture */
+}
+modbus_record_t;
+
+/**
+ * @class ModbusReplay
+ * @brief
+ * Feeds a capture into a Modbus engine and measures how it copes.
+ */
+class ModbusReplay {
+private:
+  Modbus *engine;
+  ModbusLoopback *port;
+  const uint8_t *capture;
+  uint32_t u32captureSize, u32offset;
+  uint8_t u8mode, u8speed, u8state;
+  uint8_t u8T35; //!< inter-frame silence of the engine, restored after REPLAY_FAST
+  uint16_t *regs; //!< slave register map
+  uint16_t u16regsize;
+  uint16_t au16scratch[MAX_BUFFER / 2]; //!< master telegram data
+  modbus_record_t request, answer;
+  boolean bAnswer; //!< the current request has a recorded answer
+  boolean bDiverged; //!< the master sent something else than the recorded request
+  uint32_t u32first, u32start, u32injected;
+  Print *report;
+  uint16_t u16frames, u16diverged;
+  uint32_t u32maxProcess, u32maxTurnaround;
+
+  boolean nextRecord( modbus_record_t *record );
+  void loadRequest();
+  boolean isDue( const modbus_record_t *record );
+  boolean isRecorded( const modbus_record_t *record, const uint8_t *frame, uint16_t u16size );
+  void sendRequest();
+  void finish( uint32_t u32process, uint32_t u32turnaround );
+
+public:
+  ModbusReplay( Modbus *engine, ModbusLoopback *port );
+  int8_t begin( const uint8_t *capture, uint32_t u32size, uint8_t u8mode, uint8_t u8speed = REPLAY_REALTIME );
+  void setRegs( uint16_t *regs, uint16_t u16size ); //!<register map of a slave engine
+  void setReport( Print *sink ); //!<one CSV line per request: seq,stamp,fct,process_us,turnaround_us,match
+  int8_t poll(); //!<cyclic poll, returns the REPLAY_STATES
+  uint16_t getFrames(); //!<requests replayed
+  uint16_t getDiverged(); //!<requests where the engine diverged from the capture
+  uint32_t getMaxProcess(); //!<longest poll() handling a frame (us)
+  uint32_t getMaxTurnaround(); //!<longest injection to answer time (us)
+};
+
+#endif
@@ -13,6 +13,26 @@
   Logger logModbusRtu("RTU");  
 #endif
 
+#define MB_FC_KIND(fct, kind) (MB_FC_SUPPORTED(fct) ? (kind) : FCT_NONE)
+
+/**
+ * Dispatch table of the built-in function codes, indexed by code: their
+ * family, FCT_NONE if not compiled in. Shared by every engine; handlers
+ * registered with setHandler() are looked up before it.
+ */
+static const uint8_t au8Builtin[ MB_FC_WRITE_MULTIPLE_REGISTERS + 1 ] = {
+  FCT_NONE,
+  MB_FC_KIND( 1, FCT_READ_BITS ),   // MB_FC_READ_COILS
+  MB_FC_KIND( 2, FCT_READ_BITS ),   // MB_FC_READ_DISCRETE_INPUT
+  MB_FC_KIND( 3, FCT_READ_REGS ),   // MB_FC_READ_REGISTERS
+  MB_FC_KIND( 4, FCT_READ_REGS ),   // MB_FC_READ_INPUT_REGISTER
+  MB_FC_KIND( 5, FCT_WRITE_BIT ),   // MB_FC_WRITE_COIL
+  MB_FC_KIND( 6, FCT_WRITE_REG ),   // MB_FC_WRITE_REGISTER
+  FCT_NONE, FCT_NONE, FCT_NONE, FCT_NONE, FCT_NONE, FCT_NONE, FCT_NONE, FCT_NONE,
+  MB_FC_KIND( 15, FCT_WRITE_BITS ), // MB_FC_WRITE_MULTIPLE_COILS
+  MB_FC_KIND( 16, FCT_WRITE_REGS )  // MB_FC_WRITE_MULTIPLE_REGISTERS
+};
+
 /* _____PUBLIC FUNCTIONS_____________________________________________________ */
 
 /**
@@ -22,11 +42,24 @@
  * @ingroup setup
  */
 Modbus::Modbus() {
-  init(0, 0, 0, 0, nullptr);
+  init(0, 0, 0, 0, nullptr, nullptr);
 }
 
 Modbus::Modbus(uint8_t u8id, USARTSerial* serial) {
-  init(u8id, 0, 0, 0, serial);
+  init(u8id, 0, 0, 0, serial, nullptr);
+}
+
+/**
+ * @brief
+ * Constructor for a Master/Slave/Sniffer over any Stream
+ * The stream is not started by begin(), e.g. a simulated port or a socket.
+ *
+ * @param u8id   node address 0=master, 1..247=slave
+ * @param stream  stream carrying the RTU frames
+ * @ingroup setup
+ */
+Modbus::Modbus(uint8_t u8id, Stream* stream) {
+  init(u8id, 0, 0, 0, nullptr, stream);
 }
 
 /**
@@ -40,7 +73,7 @@ Modbus::Modbus(uint8_t u8id, USARTSerial* serial) {
  * @overload Modbus::Modbus()
  */
 Modbus::Modbus(uint8_t u8id, uint8_t u8serno) {
-  init(u8id, u8serno, 0, 0, nullptr);
+  init(u8id, u8serno, 0, 0, nullptr, nullptr);
 }
 
 /**
@@ -56,7 +89,7 @@ Modbus::Modbus(uint8_t u8id, uint8_t u8serno) {
  * @overload Modbus::Modbus()
  */
 Modbus::Modbus(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin) {
-  init(u8id, u8serno, u8txenpin, 0, nullptr);
+  init(u8id, u8serno, u8txenpin, 0, nullptr, nullptr);
 }
 
 /**
@@ -73,7 +106,7 @@ Modbus::Modbus(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin) {
  * @overload Modbus::Modbus()
  */
 Modbus::Modbus(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin, uint8_t u8rxenpin) {
-  init(u8id, u8serno, u8txenpin, u8rxenpin, nullptr);
+  init(u8id, u8serno, u8txenpin, u8rxenpin, nullptr, nullptr);
 }
 
 /**
@@ -93,18 +126,20 @@ void Modbus::begin(long u32speed, long configuration) {
   if (port == nullptr) {
     switch( u8serno ) {
     case 1:
-      port = &Serial1;
+      serial = &Serial1;
       break;
 
     case 0:
     default:
-      port = &Serial1;
+      serial = &Serial1;
       break;
     }
+    port = serial;
   }
 
   // port->begin(u32speed, u8config);
-  port->begin(u32speed, configuration);
+  if (serial != nullptr) serial->begin(u32speed, configuration);
+  u32baud = u32speed;
   if (u8txenpin > 1 && u8rxenpin > 1) { // pin 0 & pin 1 are reserved for RX/TX
     // return RS485 transceiver to transmit mode
     pinMode(u8txenpin, OUTPUT);
@@ -113,7 +148,7 @@ void Modbus::begin(long u32speed, long configuration) {
   }
 
   port->flush();
-  u8lastRec = u8BufferSize = 0;
+  u16lastRec = u16BufferSize = 0;
   u16InCnt = u16OutCnt = u16errCnt = 0;
 }
 
@@ -127,6 +162,7 @@ void Modbus::begin(long u32speed, long configuration) {
 void Modbus::setID( uint8_t u8id) {
   if (( u8id != 0) && (u8id <= 247)) {
     this->u8id = u8id;
+    invalidateCache(); // cached answers carry the old address
   }
 }
 
@@ -141,6 +177,220 @@ uint8_t Modbus::getID() {
   return this->u8id;
 }
 
+/**
+ * @brief
+ * Method to tell the slave that the application changed its register map
+ *
+ * Bumps the register map generation, so every cached read answer is
+ * encoded again from the registers the next time it is requested.
+ * Call it after writing into the array passed to poll( regs, size ).
+ *
+ * @ingroup setup
+ */
+void Modbus::invalidateCache() {
+#if MODBUS_CACHE_ENTRIES > 0
+  u32cacheGen++;
+#endif
+}
+
+/**
+ * @brief
+ * Bind a register range of a slave to callbacks
+ *
+ * Derived values (scaled measures, uptime, counters) no longer need to be
+ * recomputed into the register map at every loop: the read callback fills
+ * the part of the range a request reads, just before it is answered, and
+ * nothing is computed for registers no master asks for. The write callback
+ * sees the registers a request just wrote; if it answers an exception the
+ * registers get their old values back before poll() returns, and the
+ * write is not journaled. Answers touching a bound range are never taken
+ * from the response cache.
+ *
+ * @param binding  binding filled in by the application, it must stay alive
+ * @ingroup setup
+ */
+void Modbus::addBinding( modbus_binding_t *binding ) {
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
+  binding->next = bindings;
+  bindings = binding;
+  invalidateCache();
+#endif
+}
+
+/**
+ * @brief
+ * Record the writes a master applies to the slave register map
+ *
+ * Setpoint handling then costs the number of writes, not the size of the
+ * map: the application takes the writes in order with consumeChanges(),
+ * or the written registers with nextWrite(), instead of comparing the
+ * whole map at every loop. Both may be used, each consumes its own part.
+ *
+ * @param journal  journal filled in by the application, it must stay
+ * alive; nullptr stops the recording
+ * @ingroup setup
+ */
+void Modbus::setJournal( modbus_journal_t *journal ) {
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
+  this->journal = journal;
+  if (journal == nullptr) return;
+
+  if (journal->au16dirty != nullptr) memset( journal->au16dirty, 0, ((journal->u16size + 15) / 16) * sizeof( uint16_t ));
+  journal->u16dirty = 0;
+  journal->u8first = 0;
+  journal->u8count = 0;
+  journal->u16lost = 0;
+#endif
+}
+
+/**
+ * @brief
+ * Take the oldest writes of the journal, in the order they were applied
+ *
+ * @param changes  destination of the writes
+ * @param u8max  size of changes
+ * @return number of writes copied, 0 if none is left
+ * @ingroup loop
+ */
+uint8_t Modbus::consumeChanges( modbus_change_t *changes, uint8_t u8max ) {
+#if !(MODBUS_ROLES & MODBUS_ROLE_SLAVE)
+  return 0;
+#else
+  if (journal == nullptr || journal->aChanges == nullptr) return 0;
+
+  uint8_t u8taken = 0;
+  while (u8taken < u8max && journal->u8count > 0) {
+    changes[ u8taken++ ] = journal->aChanges[ journal->u8first ];
+    journal->u8first = (journal->u8first + 1) % journal->u8entries;
+    journal->u8count--;
+  }
+  return u8taken;
+#endif
+}
+
+/**
+ * @brief
+ * Take the next register flagged as written, its flag being cleared
+ *
+ * for (int32_t n = slave.nextWrite(); n >= 0; n = slave.nextWrite( n )) ...
+ *
+ * @param u16from  first register to look at
+ * @return written register, -1 if none is left
+ * @ingroup loop
+ */
+int32_t Modbus::nextWrite( uint16_t u16from ) {
+#if !(MODBUS_ROLES & MODBUS_ROLE_SLAVE)
+  return -1;
+#else
+  if (journal == nullptr || journal->au16dirty == nullptr || journal->u16dirty == 0) return -1;
+
+  for (uint16_t u16word = u16from / 16; u16word < (journal->u16size + 15) / 16; u16word++) {
+    uint16_t u16bits = journal->au16dirty[ u16word ];
+    if (u16word == u16from / 16) u16bits &= 0xFFFF << (u16from % 16);
+    if (u16bits == 0) continue;
+
+    uint8_t u8bit = 0;
+    while (bitRead( u16bits, u8bit ) == 0) u8bit++;
+    bitClear( journal->au16dirty[ u16word ], u8bit );
+    journal->u16dirty--;
+    return u16word * 16 + u8bit;
+  }
+  return -1;
+#endif
+}
+
+/**
+ * @brief
+ * Start a bulk update of the slave register map
+ *
+ * Values spanning several registers (32-bit floats and counters) are
+ * never seen torn by a master: a read copies the registers, then copies
+ * again if an update ran meanwhile. The update neither blocks nor waits,
+ * so it may run in another thread or in an interrupt; nothing needs
+ * interrupts disabled. A read still torn after MODBUS_SNAPSHOT_RETRIES
+ * copies is answered with EXC_SLAVE_BUSY and the master retries.
+ * One writer at a time, and no nesting. Registers the master writes are
+ * not covered against the application writing the same ones.
+ *
+ * slave.beginUpdate(); ...write au16regs...; slave.endUpdate();
+ *
+ * @ingroup loop
+ */
+void Modbus::beginUpdate() {
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
+  uint32_t u32seq = u32mapSeq.load( std::memory_order_relaxed );
+  u32mapSeq.store( u32seq + 1, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+#endif
+}
+
+/**
+ * @brief
+ * End a bulk update of the slave register map, see beginUpdate()
+ *
+ * @ingroup loop
+ */
+void Modbus::endUpdate() {
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
+  u32mapSeq.store( u32mapSeq.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+#endif
+}
+
+/**
+ * @brief
+ * Watch a master data array and report its changed points only
+ *
+ * Every answer decoded into the array, or into a part of it, is compared
+ * with the values already there. Changed points are flagged in the filter
+ * bitmap, so the application handles the changes instead of scanning the
+ * whole array after each poll(). A register within its deadband is not
+ * written and keeps the value last reported. Deadbands apply to the 16-bit
+ * difference, signed or unsigned values alike.
+ *
+ * @param filter  filter filled in by the application, it must stay alive
+ * @ingroup setup
+ */
+void Modbus::addFilter( modbus_filter_t *filter ) {
+#if MODBUS_ROLES & MODBUS_ROLE_MASTER
+  memset( filter->au16changed, 0, ((filter->u16size + 15) / 16) * sizeof( uint16_t ));
+  filter->u16changes = 0;
+  filter->next = filters;
+  filters = filter;
+#endif
+}
+
+/**
+ * @brief
+ * Take the next changed point of a filter, its flag being cleared
+ *
+ * for (int32_t n = master.nextChange( &filter ); n >= 0; n = master.nextChange( &filter, n )) ...
+ *
+ * @param filter  filter given to addFilter()
+ * @param u16from  first point to look at
+ * @return changed point (register or coil index in au16reg), -1 if none is left
+ * @ingroup loop
+ */
+int32_t Modbus::nextChange( modbus_filter_t *filter, uint16_t u16from ) {
+#if !(MODBUS_ROLES & MODBUS_ROLE_MASTER)
+  return -1;
+#else
+  if (filter->u16changes == 0) return -1;
+
+  for (uint16_t u16word = u16from / 16; u16word < (filter->u16size + 15) / 16; u16word++) {
+    uint16_t u16bits = filter->au16changed[ u16word ];
+    if (u16word == u16from / 16) u16bits &= 0xFFFF << (u16from % 16);
+    if (u16bits == 0) continue;
+
+    uint8_t u8bit = 0;
+    while (bitRead( u16bits, u8bit ) == 0) u8bit++;
+    bitClear( filter->au16changed[ u16word ], u8bit );
+    filter->u16changes--;
+    return u16word * 16 + u8bit;
+  }
+  return -1;
+#endif
+}
+
 /**
  * @brief
  * Initialize time-out parameter
@@ -156,16 +406,89 @@ void Modbus::setTimeOut( uint16_t u16timeOut) {
   this->u16timeOut = u16timeOut;
 }
 
+/**
+ * @brief
+ * Set the silence that closes an incoming frame
+ *
+ * The default T35 suits serial lines. Streams that hand over complete
+ * frames at once, such as simulated ports or datagram sockets, can use 0:
+ * the frame is then processed as soon as the stream stops growing.
+ *
+ * @param u8t35  silence in ms
+ * @ingroup setup
+ */
+void Modbus::setT35( uint8_t u8t35 ) {
+  this->u8T35 = u8t35;
+}
+
+/**
+ * @brief
+ * Get the time-out parameter
+ *
+ * @return time-out value (ms)
+ * @ingroup setup
+ */
+uint16_t Modbus::getTimeOut() {
+  return u16timeOut;
+}
+
+/**
+ * @brief
+ * Get the silence that closes an incoming frame
+ *
+ * @return silence in ms
+ * @ingroup setup
+ */
+uint8_t Modbus::getT35() {
+  return u8T35;
+}
+
+/**
+ * @brief
+ * Get the line speed, e.g. to derive the time a frame takes
+ *
+ * @return speed given to begin() (bps)
+ * @ingroup setup
+ */
+uint32_t Modbus::getBaud() {
+  return u32baud;
+}
+
+/**
+ * @brief
+ * Set the time source of the engine
+ *
+ * T3.5, time-outs and the RS485 switching delay all read this clock.
+ * A ModbusVirtualClock lets simulations run faster than real time.
+ *
+ * @param clock  time source, nullptr restores the device clock
+ * @ingroup setup
+ */
+void Modbus::setClock( ModbusClock *clock ) {
+  this->clock = (clock != nullptr) ? clock : ModbusClock::hardware();
+}
+
+/**
+ * @brief
+ * Get the time source of the engine
+ *
+ * @return clock in use
+ * @ingroup setup
+ */
+ModbusClock *Modbus::getClock() {
+  return clock;
+}
+
 /**
  * @brief
  * Return communication Watchdog state.
  * It could be usefull to reset outputs if the watchdog is fired.
  *
- * @return TRUE if millis() > u32timeOut
+ * @return TRUE if the clock is past u32timeOut
  * @ingroup loop
  */
 boolean Modbus::getTimeOutState() {
-  return (millis() > u32timeOut);
+  return (clock->millis() > u32timeOut);
 }
 
 /**
@@ -216,8 +539,9 @@ uint8_t Modbus::getState() {
 
 /**
  * Get the last error in the protocol processor
+ * For a master it is updated each time a query completes, 0 meaning success.
  *
- * @returnreturn   NO_REPLY = 255      Time-out
+ * @return   NO_REPLY = 255      Time-out
  * @return   EXC_FUNC_CODE = 1   Function code not available
  * @return   EXC_ADDR_RANGE = 2  Address beyond available space for Modbus registers
  * @return   EXC_REGS_QUANT = 3  Coils or registers number beyond the available space
@@ -236,17 +560,24 @@ uint8_t Modbus::getLastError() {
  *
  * @see modbus_t
  * @param modbus_t  modbus telegram structure (id, fct, ...)
+ * @return 0 if sent, -1 if busy, -2 if not a master, -3 for a bad slave address,
+ * -4 if the function code is not compiled in, the quantity is out of the
+ * protocol limits or the frames do not fit MAX_BUFFER
  * @ingroup loop
- * @todo finish function 15
  */
 int8_t Modbus::query( modbus_t telegram ) {
+#if !(MODBUS_ROLES & MODBUS_ROLE_MASTER)
+  return -2;
+#else
   // empty rx buffer
   while(port->available()) { port->read(); }
   #ifdef LOGGING
     Serial.print("MODBUS> Query");
     Serial.println();
   #endif
-  uint8_t u8regsno, u8bytesno;
+#if MODBUS_FUNCTIONS & MB_FC_BIT(15)
+  uint8_t u8bytesno;
+#endif
   if (u8id!=0) {
     #ifdef LOGGING
       Serial.print("MODBUS> Query Error: No address");
@@ -270,6 +601,33 @@ int8_t Modbus::query( modbus_t telegram ) {
     return -3;
   }
 
+  // the function must be in the dispatch table, the quantity within the
+  // protocol limits, the request and its answer must fit au8Buffer
+  uint8_t u8kind = fctKind( telegram.u8fct );
+  if (u8kind == FCT_NONE) return -4;
+  uint16_t u16max = 1;
+  uint16_t u16frame = RESPONSE_SIZE + CHECKSUM_SIZE;
+  switch( u8kind ) {
+    case FCT_READ_BITS:
+      u16max = MB_MAX_READ_COILS;
+      u16frame = 3 + (telegram.u16CoilsNo + 7) / 8 + CHECKSUM_SIZE;
+      break;
+    case FCT_READ_REGS:
+      u16max = MB_MAX_READ_REGISTERS;
+      u16frame = 3 + telegram.u16CoilsNo * 2 + CHECKSUM_SIZE;
+      break;
+    case FCT_WRITE_BITS:
+      u16max = MB_MAX_WRITE_COILS;
+      u16frame = 7 + (telegram.u16CoilsNo + 7) / 8 + CHECKSUM_SIZE;
+      break;
+    case FCT_WRITE_REGS:
+      u16max = MB_MAX_WRITE_REGISTERS;
+      u16frame = 7 + telegram.u16CoilsNo * 2 + CHECKSUM_SIZE;
+      break;
+  }
+  if (u16max > 1 && (telegram.u16CoilsNo == 0 || telegram.u16CoilsNo > u16max)) return -4;
+  if (u16frame > MAX_BUFFER) return -4;
+
   au16regs = telegram.au16reg;
 
   // telegram header
@@ -278,56 +636,65 @@ int8_t Modbus::query( modbus_t telegram ) {
   au8Buffer[ ADD_HI ]     = highByte(telegram.u16RegAdd );
   au8Buffer[ ADD_LO ]     = lowByte( telegram.u16RegAdd );
 
-  switch( telegram.u8fct ) {
-    case MB_FC_READ_COILS:
-    case MB_FC_READ_DISCRETE_INPUT:
-    case MB_FC_READ_REGISTERS:
-    case MB_FC_READ_INPUT_REGISTER:
+  switch( u8kind ) {
+    case FCT_READ_BITS:
+    case FCT_READ_REGS:
       au8Buffer[ NB_HI ]      = highByte(telegram.u16CoilsNo );
       au8Buffer[ NB_LO ]      = lowByte( telegram.u16CoilsNo );
-      u8BufferSize = 6;
+      u16BufferSize = 6;
       break;
-    case MB_FC_WRITE_COIL:
+#if MODBUS_FUNCTIONS & MB_FC_BIT(5)
+    case FCT_WRITE_BIT:
       au8Buffer[ NB_HI ]      = ((au16regs[0] > 0) ? 0xff : 0);
       au8Buffer[ NB_LO ]      = 0;
-      u8BufferSize = 6;
+      u16BufferSize = 6;
       break;
-    case MB_FC_WRITE_REGISTER:
+#endif
+#if MODBUS_FUNCTIONS & MB_FC_BIT(6)
+    case FCT_WRITE_REG:
       au8Buffer[ NB_HI ]      = highByte(au16regs[0]);
       au8Buffer[ NB_LO ]      = lowByte(au16regs[0]);
-      u8BufferSize = 6;
+      u16BufferSize = 6;
       break;
-    case MB_FC_WRITE_MULTIPLE_COILS: // TODO: implement "sending coils"
-      u8regsno = telegram.u16CoilsNo / 16;
-      u8bytesno = u8regsno * 2;
-      if ((telegram.u16CoilsNo % 16) != 0) {
-        u8bytesno++;
-        u8regsno++;
-      }
+#endif
+#if MODBUS_FUNCTIONS & MB_FC_BIT(15)
+    case FCT_WRITE_BITS:
+      // coil n is bit n%16 of au16regs[n/16], low byte first on the line
+      u8bytesno = (telegram.u16CoilsNo + 7) / 8;
 
       au8Buffer[ NB_HI ]      = highByte(telegram.u16CoilsNo );
       au8Buffer[ NB_LO ]      = lowByte( telegram.u16CoilsNo );
       au8Buffer[ NB_LO+1 ]    = u8bytesno;
-      u8BufferSize = 7;
-
-      u8regsno = u8bytesno = 0; // now auxiliary registers
-      for (uint16_t i = 0; i < telegram.u16CoilsNo; i++) {
-
+      u16BufferSize = 7;
 
+      for (uint8_t i = 0; i < u8bytesno; i++) {
+        au8Buffer[ u16BufferSize ] = (i % 2) ? highByte( au16regs[ i / 2 ] ) : lowByte( au16regs[ i / 2 ] );
+        u16BufferSize++;
       }
       break;
 
-    case MB_FC_WRITE_MULTIPLE_REGISTERS:
+#endif
+#if MODBUS_FUNCTIONS & MB_FC_BIT(16)
+    case FCT_WRITE_REGS:
       au8Buffer[ NB_HI ]      = highByte(telegram.u16CoilsNo );
       au8Buffer[ NB_LO ]      = lowByte( telegram.u16CoilsNo );
       au8Buffer[ NB_LO+1 ]    = (uint8_t) ( telegram.u16CoilsNo * 2 );
-      u8BufferSize = 7;
+      u16BufferSize = 7;
 
       for (uint16_t i=0; i< telegram.u16CoilsNo; i++) {
-        au8Buffer[ u8BufferSize ] = highByte( au16regs[ i ] );
-        u8BufferSize++;
-        au8Buffer[ u8BufferSize ] = lowByte( au16regs[ i ] );
-        u8BufferSize++;
+        au8Buffer[ u16BufferSize ] = highByte( au16regs[ i ] );
+        u16BufferSize++;
+        au8Buffer[ u16BufferSize ] = lowByte( au16regs[ i ] );
+        u16BufferSize++;
+      }
+      break;
+#endif
+    default:
+      {
+        // user function code: the handler writes the request data
+        modbus_pdu_t pdu = { FCT_REQUEST, &au8Buffer[ FUNC ], 1, MAX_BUFFER - 1 - CHECKSUM_SIZE, &telegram, telegram.au16reg, 0 };
+        if (callUser( u8kind, &pdu ) != 0) return -4;
+        u16BufferSize = 1 + pdu.u16size;
       }
       break;
   }
@@ -337,6 +704,9 @@ int8_t Modbus::query( modbus_t telegram ) {
     Serial.println();
   #endif
 
+  pending = telegram;
+  handler = nullptr;
+  u32queryStart = clock->micros();
   sendTxBuffer();
 
   #ifdef LOGGING
@@ -345,6 +715,34 @@ int8_t Modbus::query( modbus_t telegram ) {
   #endif
   u8state = COM_WAITING;
   return 0;
+#endif
+}
+
+/**
+ * @brief
+ * *** Only Modbus Master ***
+ * Generate a query like query(modbus_t) and call a handler when it completes.
+ * The handler is called from poll() with a modbus_result_t: status, exception
+ * code and latency, read data being already decoded in telegram.au16reg.
+ * The master is idle again when the handler runs, so it may chain a new query.
+ *
+ * @param telegram  modbus telegram structure (id, fct, ...)
+ * @param handler  completion handler
+ * @param context  passed to the handler as is
+ * @return 0 if the query was sent, same errors as query(modbus_t) otherwise
+ * @ingroup loop
+ */
+int8_t Modbus::query( modbus_t telegram, modbus_handler_t handler, void *context ) {
+#if !(MODBUS_ROLES & MODBUS_ROLE_MASTER)
+  return -2;
+#else
+  int8_t i8result = query( telegram );
+  if (i8result != 0) return i8result;
+
+  this->handler = handler;
+  this->handlerContext = context;
+  return 0;
+#endif
 }
 
 /**
@@ -361,136 +759,110 @@ int8_t Modbus::query( modbus_t telegram ) {
  * @return errors counter
  * @ingroup loop
  */
-int8_t Modbus::poll() {
+int16_t Modbus::poll() {
+#if !(MODBUS_ROLES & MODBUS_ROLE_MASTER)
+  return ERR_NOT_MASTER;
+#else
+  // nothing expected: stray bytes are flushed by the next query
+  if (u8state != COM_WAITING) return 0;
+
   // check if there is any incoming frame
-  uint8_t u8current = port->available();
+  uint16_t u16current = port->available();
 
-  if (millis() > u32timeOut) {
-    u8state = COM_IDLE;
-    u8lastError = NO_REPLY;
+  if (clock->millis() > u32timeOut) {
     u16errCnt++;
     logModbusRtu.info("NORPLY");
+    complete( RESULT_TIMEOUT, NO_REPLY );
     return 0;
   }
 
-  if (u8current == 0) return 0;
+  if (u16current == 0) return 0;
 
   // check T35 after frame end or still no frame end
-  if (u8current != u8lastRec) {
-    u8lastRec = u8current;
-    u32time = millis() + T35;
+  if (u16current != u16lastRec) {
+    u16lastRec = u16current;
+    u32time = clock->millis() + u8T35;
     return 0;
   }
-  if (millis() < u32time) return 0;
+  if (clock->millis() < u32time) return 0;
 
   // transfer Serial buffer frame to auBuffer
-  u8lastRec = 0;
-  int8_t i8state = getRxBuffer();
+  u16lastRec = 0;
+  int16_t i16state = getRxBuffer();
+  uint8_t u8kind = fctKind( au8Buffer[ FUNC ] );
   if (
-    (i8state < 7 && au8Buffer[ FUNC ] != MB_FC_READ_COILS) ||
-    (i8state < 6 && au8Buffer[ FUNC ] == MB_FC_READ_COILS)
+    (i16state < 5 && (au8Buffer[ FUNC ] & 0x80) != 0) ||
+    (i16state < 4 && (u8kind & FCT_USER)) ||
+    (i16state < 6 && u8kind == FCT_READ_BITS) ||
+    (i16state < 7 && (au8Buffer[ FUNC ] & 0x80) == 0 && u8kind != FCT_READ_BITS && (u8kind & FCT_USER) == 0)
   ) {
-    u8state = COM_IDLE;
     u16errCnt++;
-    logModbusRtu.warn("i8s%i", i8state);
-    return i8state;
+    logModbusRtu.warn("i16s%i", i16state);
+    complete( RESULT_BAD_ANSWER, NO_REPLY ); // too short to be an answer
+    return i16state;
   }
 
   // validate message: id, CRC, FCT, exception
   uint8_t u8exception = validateAnswer();
   if (u8exception != 0) {
-    u8state = COM_IDLE;
     #ifdef LOGGING
       Serial.print("MODBUS> ");
       Serial.print("u8exception: ");
       Serial.print(u8exception);
       Serial.println();
     #endif
+    if (u8exception == (uint8_t) ERR_EXCEPTION) {
+      complete( RESULT_EXCEPTION, au8Buffer[ 2 ] ); // exception code sent by the slave
+    } else {
+      complete( RESULT_BAD_ANSWER, u8exception );
+    }
     return u8exception;
   }
 
   // process answer
-  switch( au8Buffer[ FUNC ] ) {
-    case MB_FC_READ_COILS:
-      get_FC1( );
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_READ_COILS");
-        Serial.println();
-      #endif
-      break;
-    case MB_FC_READ_DISCRETE_INPUT:
-      // call get_FC1 to transfer the incoming message to au16regs buffer
+  #ifdef LOGGING
+    Serial.print("MODBUS> FCT ");
+    Serial.println(au8Buffer[ FUNC ]);
+  #endif
+  switch( u8kind ) {
+#if MODBUS_FUNCTIONS & (MB_FC_BIT(1) | MB_FC_BIT(2))
+    case FCT_READ_BITS:
       get_FC1( );
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_READ_DISCRETE_INPUT");
-        Serial.println();
-      #endif
-      break;
-    case MB_FC_READ_INPUT_REGISTER:
-      // call get_FC3 to transfer the incoming message to au16regs buffer
-      get_FC3( );
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_READ_INPUT_REGISTER");
-        Serial.println();
-      #endif
       break;
-    case MB_FC_READ_REGISTERS :
-      // call get_FC3 to transfer the incoming message to au16regs buffer
+#endif
+#if MODBUS_FUNCTIONS & (MB_FC_BIT(3) | MB_FC_BIT(4))
+    case FCT_READ_REGS:
       get_FC3( );
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_READ_REGISTERS");
-        Serial.println();
-      #endif
-      break;
-    case MB_FC_WRITE_COIL:
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_WRITE_COIL");
-        Serial.println();
-      #endif
-      break;
-    case MB_FC_WRITE_REGISTER :
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_WRITE_REGISTER");
-        Serial.println();
-      #endif
       break;
-    case MB_FC_WRITE_MULTIPLE_COILS:
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_WRITE_MULTIPLE_COILS");
-        Serial.println();
-      #endif
-      break;
-    case MB_FC_WRITE_MULTIPLE_REGISTERS :
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("MB_FC_WRITE_MULTIPLE_REGISTERS");
-        Serial.println();
-      #endif
+#endif
+    case FCT_WRITE_BIT:
+    case FCT_WRITE_REG:
+    case FCT_WRITE_BITS:
+    case FCT_WRITE_REGS:
       // nothing to do
       break;
     default:
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("nothing to do in the au8 func");
-        Serial.println();
-      #endif
+      {
+        modbus_pdu_t pdu = { FCT_ANSWER, &au8Buffer[ FUNC ], (uint16_t) (u16BufferSize - 1 - CHECKSUM_SIZE),
+          MAX_BUFFER - 1 - CHECKSUM_SIZE, &pending, pending.au16reg, 0 };
+        uint8_t u8error = callUser( u8kind, &pdu );
+        if (u8error != 0) {
+          u16errCnt++;
+          complete( RESULT_BAD_ANSWER, u8error );
+          return u8error;
+        }
+      }
       break;
   }
-  u8state = COM_IDLE;
+  complete( RESULT_OK, 0 );
   #ifdef LOGGING
     Serial.print("MODBUS> ");
     Serial.print("poll OK! Buffer size: ");
-    Serial.print(u8BufferSize);
+    Serial.print(u16BufferSize);
     Serial.println();
   #endif
-  return u8BufferSize;
+  return u16BufferSize;
+#endif
 }
 
 /**
@@ -506,27 +878,34 @@ int8_t Modbus::poll() {
  * @return 0 if no query, 1..4 if communication error, >4 if correct query processed
  * @ingroup loop
  */
-int8_t Modbus::poll( uint16_t *regs, uint16_t u16size ) {
+int16_t Modbus::poll( uint16_t *regs, uint16_t u16size ) {
+#if !(MODBUS_ROLES & MODBUS_ROLE_SLAVE)
+  return ERR_NOT_SLAVE;
+#else
 
+  // a different register map makes every cached answer meaningless
+  if (regs != au16regs || u16size != u16regsize) invalidateCache();
   au16regs = regs;
   u16regsize = u16size;
 
   // check if there is any incoming frame
-  uint8_t u8current = port->available();
-  if (u8current == 0) return 0;
+  uint16_t u16current = port->available();
+  if (u16current == 0) return 0;
 
   // check T35 after frame end or still no frame end
-  if (u8current != u8lastRec) {
-    u8lastRec = u8current;
-    u32time = millis() + T35;
+  if (u16current != u16lastRec) {
+    u16lastRec = u16current;
+    u32time = clock->millis() + u8T35;
     return 0;
   }
-  if (millis() < u32time) return 0;
+  if (clock->millis() < u32time) return 0;
 
-  u8lastRec = 0;
-  int8_t i8state = getRxBuffer();
-  u8lastError = i8state;
-  if (i8state < 7) return i8state;
+  u16lastRec = 0;
+  int16_t i16state = getRxBuffer();
+  u8lastError = i16state;
+  // built-in requests are 8 bytes at least, user ones an address, a code and the CRC
+  uint8_t u8kind = fctKind( au8Buffer[ FUNC ] );
+  if (i16state < 4 || (i16state < 7 && u8kind != FCT_NONE && (u8kind & FCT_USER) == 0)) return i16state;
 
   // check slave id
   if (au8Buffer[ ID ] != u8id) return 0;
@@ -542,128 +921,290 @@ int8_t Modbus::poll( uint16_t *regs, uint16_t u16size ) {
     return u8exception;
   }
 
-  u32timeOut = millis() + long(u16timeOut);
+  u32timeOut = clock->millis() + long(u16timeOut);
   u8lastError = 0;
 
+#if MODBUS_CACHE_ENTRIES > 0
+  // repeated reads of an unchanged register map are answered from the cache
+  uint16_t u16cached = sendCached();
+  if (u16cached > 0) return u16cached;
+#endif
+
   // process message
-  switch( au8Buffer[ FUNC ] ) {
-  case MB_FC_READ_COILS:
-  case MB_FC_READ_DISCRETE_INPUT:
-    #ifdef LOGGING
-      Serial.print("MODBUS> ");
-      Serial.print("MB_FC_READ_DISCRETE_INPUT");
-      Serial.println();
-    #endif
-    #ifdef DEBUG_LED
-      pinMode(D7, OUTPUT);
-      digitalWrite(D7, HIGH);
-      delay(20);
-      digitalWrite(D7, LOW);
-    #endif
+  #ifdef LOGGING
+    Serial.print("MODBUS> FCT ");
+    Serial.println(au8Buffer[ FUNC ]);
+  #endif
+  #ifdef DEBUG_LED
+    pinMode(D7, OUTPUT);
+    digitalWrite(D7, HIGH);
+    delay(20);
+    digitalWrite(D7, LOW);
+  #endif
+  switch( u8kind ) {
+#if MODBUS_FUNCTIONS & (MB_FC_BIT(1) | MB_FC_BIT(2))
+  case FCT_READ_BITS:
     return process_FC1( regs, u16size );
-    break;
-  case MB_FC_READ_INPUT_REGISTER:
-  case MB_FC_READ_REGISTERS :
-    #ifdef LOGGING
-      Serial.print("MODBUS> ");
-      Serial.print("MB_FC_READ_REGISTERS");
-      Serial.println();
-    #endif
-    #ifdef DEBUG_LED
-      pinMode(D7, OUTPUT);
-      digitalWrite(D7, HIGH);
-      delay(20);
-      digitalWrite(D7, LOW);
-    #endif
+#endif
+#if MODBUS_FUNCTIONS & (MB_FC_BIT(3) | MB_FC_BIT(4))
+  case FCT_READ_REGS:
     return process_FC3( regs, u16size );
-    break;
-  case MB_FC_WRITE_COIL:
-    #ifdef LOGGING
-      Serial.print("MODBUS> ");
-      Serial.print("MB_FC_WRITE_COIL");
-      Serial.println();
-    #endif
+#endif
+#if MODBUS_FUNCTIONS & MB_FC_BIT(5)
+  case FCT_WRITE_BIT:
     return process_FC5( regs, u16size );
-    break;
-  case MB_FC_WRITE_REGISTER :
-    #ifdef LOGGING
-      Serial.print("MODBUS> ");
-      Serial.print("MB_FC_WRITE_REGISTER");
-      Serial.println();
-    #endif
-    #ifdef DEBUG_LED
-      pinMode(D7, OUTPUT);
-      digitalWrite(D7, HIGH);
-      delay(20);
-      digitalWrite(D7, LOW);
-    #endif
+#endif
+#if MODBUS_FUNCTIONS & MB_FC_BIT(6)
+  case FCT_WRITE_REG:
     return process_FC6( regs, u16size );
-    break;
-  case MB_FC_WRITE_MULTIPLE_COILS:
-    #ifdef LOGGING
-      Serial.print("MODBUS> ");
-      Serial.print("MB_FC_WRITE_MULTIPLE_COILS");
-      Serial.println();
-    #endif
+#endif
+#if MODBUS_FUNCTIONS & MB_FC_BIT(15)
+  case FCT_WRITE_BITS:
     return process_FC15( regs, u16size );
-    break;
-  case MB_FC_WRITE_MULTIPLE_REGISTERS :
-    #ifdef LOGGING
-      Serial.print("MODBUS> ");
-      Serial.print("MB_FC_WRITE_MULTIPLE_REGISTERS");
-      Serial.println();
-    #endif
+#endif
+#if MODBUS_FUNCTIONS & MB_FC_BIT(16)
+  case FCT_WRITE_REGS:
     return process_FC16( regs, u16size );
-    break;
+#endif
   default:
-    #ifdef LOGGING
-      Serial.print("MODBUS> ");
-      Serial.print("nothing to do in the au8 func");
-      Serial.println();
-    #endif
+    if (u8kind & FCT_USER) return process_User( u8kind, regs, u16size );
     break;
   }
 
-  return i8state;
+  return i16state;
+#endif
 }
 
-/* _____PRIVATE FUNCTIONS_____________________________________________________ */
-
-void Modbus::init(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin, uint8_t u8rxenpin, USARTSerial* serial) {
-  this->u8id = u8id;
-  this->u8serno = (u8serno > 3) ? 0 : u8serno;
-  this->u8txenpin = u8txenpin;
-  this->u8rxenpin = u8rxenpin;
-  this->u16timeOut = 1000;
-}
+/**
+ * @brief
+ * *** Only for Modbus Sniffer ***
+ * This method listens to the bus without ever transmitting.
+ * Incoming bytes are drained as soon as they arrive, so the serial buffer
+ * can not overflow at 115200 bps as long as it is called every few ms.
+ * A frame ends after a T3.5 silence; frames that were read together are
+ * split again where a CRC matches, and once they fill au8Buffer the
+ * complete ones are captured to make room for the rest. Each frame is
+ * sent to the capture sink with the time of its first byte, and answers
+ * are paired with requests.
+ * Avoid any delay() function !!!!
+ *
+ * @return number of frames completed, ERR_NOT_SNIFFER if u8id != MODBUS_SNIFFER
+ * @ingroup loop
+ */
+int8_t Modbus::sniff() {
+#if !(MODBUS_ROLES & MODBUS_ROLE_SNIFFER)
+  return ERR_NOT_SNIFFER;
+#else
+  if (u8id != MODBUS_SNIFFER) return ERR_NOT_SNIFFER;
+
+  int8_t i8frames = 0;
+  uint32_t u32now = clock->micros();
+  uint16_t u16read = port->available();
+  if (u16read > 0) {
+    // the oldest byte in the serial buffer arrived u16read characters ago
+    if (u16BufferSize == 0 && !bTruncated) u32frameStart = u32now - (u16read - 1) * charTime();
+    while (port->available()) {
+      // back to back frames fill the buffer: capture the complete ones
+      if (u16BufferSize == MAX_BUFFER && !bTruncated) i8frames += captureBuffer( false );
+
+      uint8_t u8byte = port->read();
+      if (u16BufferSize < MAX_BUFFER) {
+        au8Buffer[ u16BufferSize++ ] = u8byte;
+      } else {
+        bTruncated = true;
+      }
+    }
+    u32lastByte = u32now;
+    return i8frames;
+  }
+
+  if (u16BufferSize == 0) return 0;
+
+  // T3.5 is fixed to 1750 us above 19200 bps
+  uint32_t u32t35 = (u32baud > 19200) ? 1750 : (charTime() * 7) / 2;
+  if (u32now - u32lastByte < u32t35) return 0;
+
+  i8frames = captureBuffer( true );
+  bTruncated = false;
+  return i8frames;
+#endif
+}
+
+/**
+ * @brief
+ * *** Only for Modbus Sniffer ***
+ * Set where captured frames are written and write the capture header.
+ * Any Print works: USB Serial, a TCPClient or a file.
+ *
+ * @param sink  capture destination, nullptr stops the capture
+ * @param u8format  CAPTURE_NATIVE or CAPTURE_PCAP
+ * @ingroup setup
+ */
+void Modbus::setCapture( Print *sink, uint8_t u8format ) {
+#if MODBUS_ROLES & MODBUS_ROLE_SNIFFER
+  capture = sink;
+  u8captureFormat = u8format;
+  u32lastStamp = u32stampWraps = 0;
+  if (capture == nullptr) return;
+
+  if (u8captureFormat == CAPTURE_PCAP) {
+    const uint8_t au8Header[24] = {
+      0xd4, 0xc3, 0xb2, 0xa1,   // magic, us resolution
+      2, 0, 4, 0,               // version 2.4
+      0, 0, 0, 0, 0, 0, 0, 0,   // GMT, accuracy
+      lowByte( MAX_BUFFER ), highByte( MAX_BUFFER ), 0, 0, // snapshot length
+      147, 0, 0, 0              // LINKTYPE_USER0
+    };
+    capture->write( au8Header, sizeof( au8Header ));
+  } else {
+    const uint8_t au8Header[10] = {
+      'M', 'B', 'C', 'P', MODBUS_CAPTURE_VERSION, 0,
+      (uint8_t) u32baud, (uint8_t) (u32baud >> 8), (uint8_t) (u32baud >> 16), (uint8_t) (u32baud >> 24)
+    };
+    capture->write( au8Header, sizeof( au8Header ));
+  }
+#endif
+}
+
+/**
+ * @brief
+ * Register a handler for a function code, e.g. a vendor code (65..72,
+ * 100..110), FC8 diagnostics or FC43 identification. It replaces the
+ * built-in code of the same number, if any.
+ * A slave calls it with FCT_SERVE once the request passed its CRC and
+ * address checks; the handler writes the answer PDU in place.
+ * A master calls it with FCT_REQUEST from query(), to append the request
+ * data after the function code, then with FCT_ANSWER from poll().
+ * ModbusTcpTunnel asks it for the length of a frame with FCT_LENGTH,
+ * see frameLength().
+ *
+ * @param u8fct  function code, 1..127
+ * @param handler  handler, nullptr restores the built-in code or removes it
+ * @param context  passed to the handler as is
+ * @return 0 if done, -1 for a wrong code or no free slot (MODBUS_USER_FUNCTIONS)
+ * @ingroup setup
+ */
+int8_t Modbus::setHandler( uint8_t u8fct, modbus_fct_handler_t handler, void *context ) {
+  if (u8fct == 0 || u8fct >= MB_FCT_CODES) return -1;
+#if MODBUS_USER_FUNCTIONS > 0
+  uint8_t u8kind = fctKind( u8fct );
+  if (u8kind & FCT_USER) aUserFct[ u8kind & ~FCT_USER ] = nullptr;
+  invalidateCache();
+
+  if (handler == nullptr) return 0;
+  for (uint8_t i = 0; i < MODBUS_USER_FUNCTIONS; i++) {
+    if (aUserFct[ i ] != nullptr) continue;
+    aUserFct[ i ] = handler;
+    aUserContext[ i ] = context;
+    au8UserFct[ i ] = u8fct;
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+/**
+ * @brief
+ * Length of a frame of a function code registered with setHandler(),
+ * for transports that cut frames by their length, e.g. ModbusTcpTunnel.
+ * The handler is called with FCT_LENGTH on a copy of the bytes received:
+ * pdu holds u16room bytes and u16size is 0; it sets u16size to the length
+ * of the whole PDU once these bytes tell it. Handlers that do not know the
+ * stage leave it at 0 or return an exception, and the frame is unknown.
+ *
+ * @param frame  bytes received, the address first
+ * @param u16size  number of bytes received
+ * @return frame length CRC included, 0 if unknown
+ * @ingroup buffer
+ */
+uint16_t Modbus::frameLength( const uint8_t *frame, uint16_t u16size ) {
+#if MODBUS_USER_FUNCTIONS > 0
+  if (u16size < 2 || u16size > MAX_BUFFER) return 0;
+  uint8_t u8kind = fctKind( frame[ FUNC ] );
+  if ((u8kind & FCT_USER) == 0) return 0;
+
+  uint8_t au8pdu[ MAX_BUFFER ];
+  memcpy( au8pdu, &frame[ FUNC ], u16size - 1 );
+  modbus_pdu_t pdu = { FCT_LENGTH, au8pdu, 0, (uint16_t) (u16size - 1), nullptr, au16regs, 0 };
+#if MODBUS_ROLES & MODBUS_ROLE_MASTER
+  if (u8id == 0) pdu.telegram = &pending;
+#endif
+  if (callUser( u8kind, &pdu ) != 0 || pdu.u16size == 0) return 0;
+  return 1 + pdu.u16size + CHECKSUM_SIZE;
+#else
+  return 0;
+#endif
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+void Modbus::init(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin, uint8_t u8rxenpin, USARTSerial* serial, Stream* stream) {
+  this->u8id = u8id;
+  this->u8serno = (u8serno > 3) ? 0 : u8serno;
+  this->u8txenpin = u8txenpin;
+  this->u8rxenpin = u8rxenpin;
+  this->serial = serial;
+  this->port = (serial != nullptr) ? serial : stream;
+  this->u8T35 = T35;
+  this->clock = ModbusClock::hardware();
+  this->u8state = COM_IDLE;
+  this->au16regs = nullptr;
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
+  this->u16regsize = 0;
+  this->bindings = nullptr;
+  this->journal = nullptr;
+  this->u32mapSeq.store( 0, std::memory_order_relaxed );
+#endif
+  this->u16timeOut = 1000;
+  this->u32baud = 19200;
+#if MODBUS_USER_FUNCTIONS > 0
+  for (uint8_t i = 0; i < MODBUS_USER_FUNCTIONS; i++) aUserFct[ i ] = nullptr;
+#endif
+#if MODBUS_ROLES & MODBUS_ROLE_SNIFFER
+  this->capture = nullptr;
+  this->bTruncated = false;
+  this->bReqPending = false;
+#endif
+#if MODBUS_ROLES & MODBUS_ROLE_MASTER
+  this->handler = nullptr;
+  this->handlerContext = nullptr;
+  this->filters = nullptr;
+#endif
+#if MODBUS_CACHE_ENTRIES > 0
+  for (uint8_t i = 0; i < MODBUS_CACHE_ENTRIES; i++) aCache[i].u16size = 0;
+  this->u8cacheNext = 0;
+  this->u32cacheGen = 0;
+#endif
+}
 
 /**
  * @brief
  * This method moves Serial buffer data to the Modbus au8Buffer.
  *
- * @return buffer size if OK, ERR_BUFF_OVERFLOW if u8BufferSize >= MAX_BUFFER
+ * @return buffer size if OK, ERR_BUFF_OVERFLOW if u16BufferSize >= MAX_BUFFER
  * @ingroup buffer
  */
-int8_t Modbus::getRxBuffer() {
+int16_t Modbus::getRxBuffer() {
 
   boolean bBuffOverflow = false;
 
   if (u8txenpin > 1 && u8rxenpin > 1) rxTxMode(RXEN);
 
-  u8BufferSize = 0;
+  u16BufferSize = 0;
   #ifdef LOGGING
     Serial.print("MODBUS> getRxbuffer output: ");
   #endif
   while ( port->available() ) {
-    au8Buffer[ u8BufferSize ] = port->read();
+    au8Buffer[ u16BufferSize ] = port->read();
     #ifdef LOGGING
-      Serial.print(au8Buffer[ u8BufferSize ], HEX);
+      Serial.print(au8Buffer[ u16BufferSize ], HEX);
       Serial.print(" ");
     #endif
-    u8BufferSize ++;
+    u16BufferSize ++;
 
-    if (u8BufferSize >= MAX_BUFFER) {
-      bBuffOverflow = true;
+    // a full buffer is a full-size frame, unless more bytes follow
+    if (u16BufferSize >= MAX_BUFFER) {
+      bBuffOverflow = port->available() > 0;
       break;
     };
   }
@@ -683,10 +1224,10 @@ int8_t Modbus::getRxBuffer() {
   }
   #ifdef LOGGING
     Serial.print("MODBUS> Buffer size: ");
-    Serial.print(u8BufferSize);
+    Serial.print(u16BufferSize);
     Serial.println();
   #endif
-  return u8BufferSize;
+  return u16BufferSize;
 }
 
 /**
@@ -709,33 +1250,48 @@ void Modbus::sendTxBuffer() {
   #endif
 
   // append CRC to message
-  uint16_t u16crc = calcCRC( u8BufferSize );
-  au8Buffer[ u8BufferSize ] = u16crc >> 8;
-  u8BufferSize++;
-  au8Buffer[ u8BufferSize ] = u16crc & 0x00ff;
-  u8BufferSize++;
+  uint16_t u16crc = calcCRC( u16BufferSize );
+  au8Buffer[ u16BufferSize ] = u16crc >> 8;
+  u16BufferSize++;
+  au8Buffer[ u16BufferSize ] = u16crc & 0x00ff;
+  u16BufferSize++;
 
   // set RS485 transceiver to transmit mode
   #ifdef LOGGING
     Serial.print("MODBUS> sendTxBuffer -- ");
-    for (uint8_t i = 0; i < u8BufferSize; i++) {
+    for (uint16_t i = 0; i < u16BufferSize; i++) {
       Serial.print(au8Buffer[i], HEX);
       Serial.print(" ");
     }
     Serial.println();
   #endif
 
+  writeFrame( au8Buffer, u16BufferSize );
+  u16BufferSize = 0;
+}
+
+/**
+ * @brief
+ * This method puts a complete frame, CRC included, on the serial line.
+ * Only if u8txenpin != 0, there is a flow handling in order to keep
+ * the RS485 transceiver in output state as long as the message is being sent.
+ *
+ * @param frame   bytes to be sent
+ * @param u16size  number of bytes to be sent
+ * @ingroup buffer
+ */
+void Modbus::writeFrame( const uint8_t *frame, uint16_t u16size ) {
   if (u8txenpin > 1 && u8rxenpin > 1) {
     #ifdef LOGGING
       Serial.print("MODBUS> tx buffer set to transmit");
       Serial.println();
     #endif
     rxTxMode(TXEN);
-    delayMicroseconds(100);
+    clock->delayMicroseconds(100);
   }
 
   // transfer buffer to serial line
-  port->write( au8Buffer, u8BufferSize );
+  port->write( frame, u16size );
 
   // keep RS485 transceiver in transmit mode as long as sending
   port->flush();	//waits for transmittion to complete before returning
@@ -750,10 +1306,9 @@ void Modbus::sendTxBuffer() {
     #endif
   }
   //port->flush();
-  u8BufferSize = 0;
 
   // set time-out for master
-  u32timeOut = millis() + (unsigned long) u16timeOut;
+  u32timeOut = clock->millis() + (unsigned long) u16timeOut;
 
   // increase message counter
   u16OutCnt++;
@@ -766,11 +1321,25 @@ void Modbus::sendTxBuffer() {
  * @return uint16_t calculated CRC value for the message
  * @ingroup buffer
  */
-uint16_t Modbus::calcCRC(uint8_t u8length) {
+uint16_t Modbus::calcCRC(uint16_t u16length) {
+  return crc16( au8Buffer, u16length );
+}
+
+/**
+ * @brief
+ * This method calculates the CRC of any frame, e.g. one built by a test
+ * harness. The high byte of the result is the first one on the line.
+ *
+ * @param data  frame bytes
+ * @param u16length  number of bytes covered by the CRC
+ * @return uint16_t calculated CRC value for the message
+ * @ingroup buffer
+ */
+uint16_t Modbus::crc16(const uint8_t *data, uint16_t u16length) {
   unsigned int temp, temp2, flag;
   temp = 0xFFFF;
-  for (unsigned char i = 0; i < u8length; i++) {
-    temp = temp ^ au8Buffer[i];
+  for (uint16_t i = 0; i < u16length; i++) {
+    temp = temp ^ data[i];
     for (unsigned char j = 1; j <= 8; j++) {
       flag = temp & 0x0001;
       temp >>=1;
@@ -787,6 +1356,99 @@ uint16_t Modbus::calcCRC(uint8_t u8length) {
   return temp;
 }
 
+/**
+ * @brief
+ * Dispatch table lookup: the handlers registered with setHandler() first,
+ * then the built-in codes
+ *
+ * @return MB_FCT_KIND of the function code, FCT_NONE for exception codes
+ * @ingroup buffer
+ */
+uint8_t Modbus::fctKind( uint8_t u8fct ) {
+#if MODBUS_USER_FUNCTIONS > 0
+  for (uint8_t i = 0; i < MODBUS_USER_FUNCTIONS; i++) {
+    if (aUserFct[ i ] != nullptr && au8UserFct[ i ] == u8fct) return FCT_USER | i;
+  }
+#endif
+  return (u8fct < sizeof( au8Builtin )) ? au8Builtin[ u8fct ] : FCT_NONE;
+}
+
+/**
+ * @brief
+ * Call the user handler of a dispatch table entry
+ *
+ * @param u8kind  FCT_USER entry of the dispatch table
+ * @param pdu  PDU to be handled
+ * @return what the handler returns, EXC_FUNC_CODE if there is none
+ * @ingroup buffer
+ */
+uint8_t Modbus::callUser( uint8_t u8kind, modbus_pdu_t *pdu ) {
+#if MODBUS_USER_FUNCTIONS > 0
+  uint8_t u8slot = u8kind & ~FCT_USER;
+  if ((u8kind & FCT_USER) && u8slot < MODBUS_USER_FUNCTIONS && aUserFct[ u8slot ] != nullptr) {
+    return aUserFct[ u8slot ]( pdu, aUserContext[ u8slot ] );
+  }
+#endif
+  return EXC_FUNC_CODE;
+}
+
+#if MODBUS_CACHE_ENTRIES > 0
+/**
+ * @brief
+ * This method answers a read request from the slave response cache.
+ * The request must match a cached function code, address and quantity
+ * encoded under the current register map generation.
+ *
+ * @return answer length if it was sent from the cache, 0 otherwise
+ * @ingroup buffer
+ */
+uint16_t Modbus::sendCached() {
+  uint8_t u8fct = au8Buffer[ FUNC ];
+  if (u8fct < MB_FC_READ_COILS || u8fct > MB_FC_READ_INPUT_REGISTER) return 0;
+
+  uint16_t u16add = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ] );
+  uint16_t u16no = word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ] );
+
+  for (uint8_t i = 0; i < MODBUS_CACHE_ENTRIES; i++) {
+    modbus_resp_t *entry = &aCache[ i ];
+    if (entry->u16size == 0 || entry->u32gen != u32cacheGen) continue;
+    if (entry->u32seq != u32mapSeq.load( std::memory_order_acquire )) continue;
+    if (entry->u8fct != u8fct || entry->u16RegAdd != u16add || entry->u16CoilsNo != u16no) continue;
+
+    u16BufferSize = 0;
+    writeFrame( entry->au8Adu, entry->u16size );
+    return entry->u16size;
+  }
+  return 0;
+}
+
+/**
+ * @brief
+ * This method keeps the answer just sent by process_FC1 or process_FC3.
+ * au8Buffer must still hold the encoded answer with its CRC.
+ *
+ * @param u8fct   function code of the request
+ * @param u16add  start address of the request
+ * @param u16no   number of coils or registers of the request
+ * @param u16size  answer length including CRC
+ * @param u32seq  snapshot sequence the answer was encoded from
+ * @ingroup buffer
+ */
+void Modbus::storeCached( uint8_t u8fct, uint16_t u16add, uint16_t u16no, uint16_t u16size, uint32_t u32seq ) {
+  modbus_resp_t *entry = &aCache[ u8cacheNext ];
+  u8cacheNext = (u8cacheNext + 1) % MODBUS_CACHE_ENTRIES;
+
+  entry->u8fct = u8fct;
+  entry->u16RegAdd = u16add;
+  entry->u16CoilsNo = u16no;
+  entry->u32gen = u32cacheGen;
+  entry->u32seq = u32seq;
+  entry->u16size = u16size;
+  memcpy( entry->au8Adu, au8Buffer, u16size );
+}
+#endif
+
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
 /**
  * @brief
  * This method validates slave incoming messages
@@ -797,100 +1459,82 @@ uint16_t Modbus::calcCRC(uint8_t u8length) {
 uint8_t Modbus::validateRequest() {
   // check message crc vs calculated crc
   uint16_t u16MsgCRC =
-    ((au8Buffer[u8BufferSize - 2] << 8)
-    | au8Buffer[u8BufferSize - 1]); // combine the crc Low & High bytes
-  if ( calcCRC( u8BufferSize-2 ) != u16MsgCRC ) {
+    ((au8Buffer[u16BufferSize - 2] << 8)
+    | au8Buffer[u16BufferSize - 1]); // combine the crc Low & High bytes
+  if ( calcCRC( u16BufferSize-2 ) != u16MsgCRC ) {
     u16errCnt ++;
     return NO_REPLY;
   }
 
   // check fct code
-  boolean isSupported = false;
-  for (uint8_t i = 0; i< sizeof( fctsupported ); i++) {
-    if (fctsupported[i] == au8Buffer[FUNC]) {
-      isSupported = 1;
-      break;
-    }
-  }
-  if (!isSupported) {
+  uint8_t u8kind = fctKind( au8Buffer[ FUNC ] );
+  if (u8kind == FCT_NONE) {
     u16errCnt ++;
     return EXC_FUNC_CODE;
   }
-
-  // check start address & nb range
-  uint16_t u16regs = 0;
-  switch ( au8Buffer[ FUNC ] ) {
-  case MB_FC_READ_COILS:
-  case MB_FC_READ_DISCRETE_INPUT:
-  case MB_FC_WRITE_MULTIPLE_COILS:
-    u16regs = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ]) / 16;
-    u16regs += word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ]) /16;
-    if (u16regs > u16regsize) {
-      #ifdef LOGGING
-        Serial.print("MODBUS> error regs size: u16regs, u16regsize: ");
-        Serial.print(u16regs);
-        Serial.print(" ");
-        Serial.println(u16regsize);
-      #endif
-      return EXC_ADDR_RANGE;
-    }
+  if (u8kind & FCT_USER) return 0; // checked by its handler
+
+  // check quantity, then start address & nb range
+  uint16_t u16add = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ]);
+  uint16_t u16no = word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ]);
+  uint16_t u16max = 1;
+  boolean bOutOfRange = false;
+  switch ( u8kind ) {
+  case FCT_READ_BITS:
+  case FCT_WRITE_BITS:
+    u16max = (u8kind == FCT_WRITE_BITS) ? MB_MAX_WRITE_COILS : MB_MAX_READ_COILS;
+    if (u16no == 0 || u16no > u16max) return EXC_REGS_QUANT;
+    if (u8kind == FCT_WRITE_BITS &&
+      (au8Buffer[ BYTE_CNT ] != (u16no + 7) / 8 || u16BufferSize != au8Buffer[ BYTE_CNT ] + 9)) return EXC_REGS_QUANT;
+    bOutOfRange = (uint32_t) u16add + u16no - 1 >= (uint32_t) u16regsize * 16;
     break;
-  case MB_FC_WRITE_COIL:
-    u16regs = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ]) / 16;
-    if (u16regs > u16regsize) {
-      #ifdef LOGGING
-        Serial.print("MODBUS> error regs size: u16regs, u16regsize: ");
-        Serial.print(u16regs);
-        Serial.print(" ");
-        Serial.println(u16regsize);
-      #endif
-      return EXC_ADDR_RANGE;
-    }
+  case FCT_WRITE_BIT:
+    bOutOfRange = u16add / 16 >= u16regsize;
     break;
-  case MB_FC_WRITE_REGISTER :
-    u16regs = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ]);
-    if (u16regs > u16regsize) {
-      #ifdef LOGGING
-        Serial.print("MODBUS> error regs size: u16regs, u16regsize: ");
-        Serial.print(u16regs);
-        Serial.print(" ");
-        Serial.println(u16regsize);
-      #endif
-      return EXC_ADDR_RANGE;
-    }
+  case FCT_WRITE_REG:
+    bOutOfRange = u16add >= u16regsize;
     break;
-  case MB_FC_READ_REGISTERS :
-  case MB_FC_READ_INPUT_REGISTER :
-  case MB_FC_WRITE_MULTIPLE_REGISTERS :
-    u16regs = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ]);
-    u16regs += word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ]);
-    if (u16regs > u16regsize) {
-      #ifdef LOGGING
-        Serial.print("MODBUS> error regs size: u16regs, u16regsize: ");
-        Serial.print(u16regs);
-        Serial.print(" ");
-        Serial.println(u16regsize);
-      #endif
-      return EXC_ADDR_RANGE;
-    }
+  case FCT_READ_REGS:
+  case FCT_WRITE_REGS:
+    u16max = (u8kind == FCT_WRITE_REGS) ? MB_MAX_WRITE_REGISTERS : MB_MAX_READ_REGISTERS;
+    if (u16no == 0 || u16no > u16max) return EXC_REGS_QUANT;
+    if (u8kind == FCT_WRITE_REGS &&
+      (au8Buffer[ BYTE_CNT ] != u16no * 2 || u16BufferSize != au8Buffer[ BYTE_CNT ] + 9)) return EXC_REGS_QUANT;
+    bOutOfRange = (uint32_t) u16add + u16no > u16regsize;
     break;
   }
+  if (bOutOfRange) {
+    #ifdef LOGGING
+      Serial.print("MODBUS> error regs size: u16add, u16regsize: ");
+      Serial.print(u16add);
+      Serial.print(" ");
+      Serial.println(u16regsize);
+    #endif
+    return EXC_ADDR_RANGE;
+  }
   return 0; // OK, no exception code thrown
 }
+#endif
 
+#if MODBUS_ROLES & MODBUS_ROLE_MASTER
 /**
  * @brief
  * This method validates master incoming messages
  *
+ * The answer must come from the slave of the pending query, for its
+ * function code, and read answers must carry the byte count the query
+ * asked for: a late answer to a previous query, or a corrupted count,
+ * never reaches the decoders.
+ *
  * @return 0 if OK, EXCEPTION if anything fails
  * @ingroup buffer
  */
 uint8_t Modbus::validateAnswer() {
   // check message crc vs calculated crc
   uint16_t u16MsgCRC =
-    ((au8Buffer[u8BufferSize - 2] << 8)
-    | au8Buffer[u8BufferSize - 1]); // combine the crc Low & High bytes
-  if ( calcCRC( u8BufferSize-2 ) != u16MsgCRC ) {
+    ((au8Buffer[u16BufferSize - 2] << 8)
+    | au8Buffer[u16BufferSize - 1]); // combine the crc Low & High bytes
+  if ( calcCRC( u16BufferSize-2 ) != u16MsgCRC ) {
     u16errCnt ++;
     #ifdef LOGGING
       Serial.print("MODBUS> ");
@@ -901,6 +1545,18 @@ uint8_t Modbus::validateAnswer() {
     return NO_REPLY;
   }
 
+  // check the answer belongs to the pending query
+  if (au8Buffer[ ID ] != pending.u8id || (au8Buffer[ FUNC ] & 0x7F) != pending.u8fct) {
+    u16errCnt ++;
+    #ifdef LOGGING
+      Serial.print("MODBUS> ");
+      Serial.print("validateAnswer: unexpected slave or function");
+      Serial.println();
+    #endif
+      logModbusRtu.warn("VALUNEXP");
+    return NO_REPLY;
+  }
+
   // check exception
   if ((au8Buffer[ FUNC ] & 0x80) != 0) {
     u16errCnt ++;
@@ -914,19 +1570,7 @@ uint8_t Modbus::validateAnswer() {
   }
 
   // check fct code
-  boolean isSupported = false;
-  for (uint8_t i = 0; i< sizeof( fctsupported ); i++) {
-    if (fctsupported[i] == au8Buffer[FUNC]) {
-      isSupported = 1;
-      #ifdef LOGGING
-        Serial.print("MODBUS> ");
-        Serial.print("validateAnswer: fctsupported");
-        Serial.println();
-      #endif
-      break;
-    }
-  }
-  if (!isSupported) {
+  if (fctKind( au8Buffer[ FUNC ] ) == FCT_NONE) {
     u16errCnt ++;
     #ifdef LOGGING
       Serial.print("MODBUS> ");
@@ -937,6 +1581,33 @@ uint8_t Modbus::validateAnswer() {
     return EXC_FUNC_CODE;
   }
 
+  // check the size: byte count of a read, echo of a write
+  boolean bSize = true;
+  switch( fctKind( au8Buffer[ FUNC ] )) {
+  case FCT_READ_BITS:
+    bSize = au8Buffer[ 2 ] == (pending.u16CoilsNo + 7) / 8 && u16BufferSize == 5 + au8Buffer[ 2 ];
+    break;
+  case FCT_READ_REGS:
+    bSize = au8Buffer[ 2 ] == 2 * pending.u16CoilsNo && u16BufferSize == 5 + au8Buffer[ 2 ];
+    break;
+  case FCT_WRITE_BIT:
+  case FCT_WRITE_REG:
+  case FCT_WRITE_BITS:
+  case FCT_WRITE_REGS:
+    bSize = u16BufferSize == RESPONSE_SIZE + CHECKSUM_SIZE;
+    break;
+  }
+  if (!bSize) {
+    u16errCnt ++;
+    #ifdef LOGGING
+      Serial.print("MODBUS> ");
+      Serial.print("validateAnswer: bad byte count");
+      Serial.println();
+    #endif
+      logModbusRtu.warn("VALBYTECNT");
+    return NO_REPLY;
+  }
+
   #ifdef LOGGING
     Serial.print("MODBUS> ");
     Serial.print("validateAnswer: no issues");
@@ -946,6 +1617,35 @@ uint8_t Modbus::validateAnswer() {
   return 0; // OK, no exception code thrown
 }
 
+/**
+ * @brief
+ * *** Only for Modbus Master ***
+ * End the query in flight: the master goes back to COM_IDLE and the
+ * completion handler, if any, is called.
+ *
+ * @param u8status  RESULT_STATUS
+ * @param u8error  value of getLastError(): 0, exception code or NO_REPLY
+ * @ingroup loop
+ */
+void Modbus::complete( uint8_t u8status, uint8_t u8error ) {
+  u8state = COM_IDLE;
+  u8lastError = u8error;
+  if (handler == nullptr) return;
+
+  modbus_result_t result;
+  result.u8status = u8status;
+  result.u8exception = (u8status == RESULT_EXCEPTION) ? u8error : 0;
+  result.telegram = pending;
+  result.u32latency = clock->micros() - u32queryStart;
+
+  // the handler may chain a new query
+  modbus_handler_t done = handler;
+  handler = nullptr;
+  done( &result, handlerContext );
+}
+#endif
+
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
 /**
  * @brief
  * This method builds an exception message
@@ -958,7 +1658,194 @@ void Modbus::buildException( uint8_t u8exception ) {
   au8Buffer[ ID ]      = u8id;
   au8Buffer[ FUNC ]    = u8func + 0x80;
   au8Buffer[ 2 ]       = u8exception;
-  u8BufferSize         = EXCEPTION_SIZE;
+  u16BufferSize         = EXCEPTION_SIZE;
+}
+#endif
+
+#if MODBUS_ROLES & MODBUS_ROLE_SNIFFER
+/**
+ * @brief
+ * Time to transfer one character (11 bits) at the current baud rate
+ *
+ * @return character time in us
+ * @ingroup buffer
+ */
+uint32_t Modbus::charTime() {
+  return 11000000UL / u32baud;
+}
+
+/**
+ * @brief
+ * This method finds where the first frame of a sniffed burst ends:
+ * the shortest prefix carrying a valid CRC. The CRC is updated one byte
+ * at a time, so the whole burst is scanned only once.
+ *
+ * @param frame  received bytes
+ * @param u16size  number of received bytes
+ * @param bCrcOk  set to true if the returned frame has a valid CRC
+ * @return length of the first frame, u16size if no CRC matches
+ * @ingroup buffer
+ */
+uint16_t Modbus::splitFrame( const uint8_t *frame, uint16_t u16size, boolean *bCrcOk ) {
+  uint16_t u16crc = 0xFFFF;
+  for (uint16_t i = 0; i + 2 <= u16size; i++) {
+    // smallest frame: id, function and an exception or broadcast payload
+    if (i >= 2 && u16crc == word( frame[ i + 1 ], frame[ i ] )) {
+      *bCrcOk = true;
+      return i + 2;
+    }
+    u16crc ^= frame[ i ];
+    for (uint8_t j = 0; j < 8; j++) {
+      u16crc = (u16crc & 0x0001) ? (u16crc >> 1) ^ 0xA001 : u16crc >> 1;
+    }
+  }
+  *bCrcOk = false;
+  return u16size;
+}
+
+/**
+ * @brief
+ * This method checks whether a sniffed frame has the shape of an answer
+ * to a request with the same address and function code.
+ *
+ * @ingroup buffer
+ */
+boolean Modbus::isAnswer( const uint8_t *frame, uint16_t u16size ) {
+  if ((frame[ FUNC ] & 0x80) != 0) return u16size == EXCEPTION_SIZE + CHECKSUM_SIZE;
+
+  switch( frame[ FUNC ] ) {
+  case MB_FC_READ_COILS:
+  case MB_FC_READ_DISCRETE_INPUT:
+  case MB_FC_READ_REGISTERS:
+  case MB_FC_READ_INPUT_REGISTER:
+    return u16size == frame[ 2 ] + 3 + CHECKSUM_SIZE;
+  case MB_FC_WRITE_COIL:
+  case MB_FC_WRITE_REGISTER:
+  case MB_FC_WRITE_MULTIPLE_COILS:
+  case MB_FC_WRITE_MULTIPLE_REGISTERS:
+    return u16size == RESPONSE_SIZE + CHECKSUM_SIZE;
+  }
+  return true;
+}
+
+/**
+ * @brief
+ * This method captures the sniffed frames held in au8Buffer, split where
+ * a CRC matches, and keeps the bytes left over at its start.
+ *
+ * @param bSilent  true after a T3.5 silence: the bytes left over make a
+ * frame of their own, damaged. Else they are the start of a frame.
+ * @return number of frames captured
+ * @ingroup buffer
+ */
+int8_t Modbus::captureBuffer( boolean bSilent ) {
+  int8_t i8frames = 0;
+  uint16_t u16start = 0;
+  while (u16start < u16BufferSize) {
+    boolean bCrcOk = false;
+    uint16_t u16size = u16BufferSize - u16start;
+    if (!bTruncated) u16size = splitFrame( &au8Buffer[ u16start ], u16size, &bCrcOk );
+    if (!bSilent && !bCrcOk) break;
+
+    captureFrame( &au8Buffer[ u16start ], u16size, u32frameStart, bCrcOk );
+    u32frameStart += u16size * charTime();
+    u16start += u16size;
+    i8frames++;
+  }
+
+  u16BufferSize -= u16start;
+  memmove( au8Buffer, &au8Buffer[ u16start ], u16BufferSize );
+  return i8frames;
+}
+
+/**
+ * @brief
+ * This method pairs a sniffed frame with the pending request and
+ * writes it to the capture sink.
+ *
+ * @param frame  frame bytes, CRC included
+ * @param u16size  frame length
+ * @param u32stamp  time of the first byte (us)
+ * @param bCrcOk  false if the frame CRC is wrong
+ * @ingroup buffer
+ */
+void Modbus::captureFrame( const uint8_t *frame, uint16_t u16size, uint32_t u32stamp, boolean bCrcOk ) {
+  uint8_t u8flags = bCrcOk ? 0 : CAPTURE_BAD_CRC;
+  if (bTruncated) u8flags |= CAPTURE_TRUNCATED;
+
+  u16InCnt++;
+  if (!bCrcOk) u16errCnt++;
+
+  if (bReqPending && u16size > FUNC && frame[ ID ] == u8reqId &&
+    (frame[ FUNC ] & 0x7f) == u8reqFct && isAnswer( frame, u16size )) {
+    u8flags |= CAPTURE_RESPONSE;
+    bReqPending = false;
+  } else {
+    u8flags |= CAPTURE_REQUEST;
+    // broadcasts and damaged frames get no answer
+    bReqPending = bCrcOk && frame[ ID ] != 0;
+    u8reqId = frame[ ID ];
+    u8reqFct = frame[ FUNC ];
+  }
+
+  if (capture == nullptr) return;
+
+  if (u8captureFormat == CAPTURE_PCAP) {
+    if (u32stamp < u32lastStamp) u32stampWraps++;
+    u32lastStamp = u32stamp;
+    uint64_t u64stamp = ((uint64_t) u32stampWraps << 32) | u32stamp;
+    uint32_t u32sec = u64stamp / 1000000UL;
+    uint32_t u32usec = u64stamp % 1000000UL;
+    const uint8_t au8Record[16] = {
+      (uint8_t) u32sec, (uint8_t) (u32sec >> 8), (uint8_t) (u32sec >> 16), (uint8_t) (u32sec >> 24),
+      (uint8_t) u32usec, (uint8_t) (u32usec >> 8), (uint8_t) (u32usec >> 16), (uint8_t) (u32usec >> 24),
+      (uint8_t) lowByte( u16size ), (uint8_t) highByte( u16size ), 0, 0,
+      (uint8_t) lowByte( u16size ), (uint8_t) highByte( u16size ), 0, 0
+    };
+    capture->write( au8Record, sizeof( au8Record ));
+  } else {
+    const uint8_t au8Record[7] = {
+      (uint8_t) u32stamp, (uint8_t) (u32stamp >> 8), (uint8_t) (u32stamp >> 16), (uint8_t) (u32stamp >> 24),
+      u8flags, (uint8_t) lowByte( u16size ), (uint8_t) highByte( u16size )
+    };
+    capture->write( au8Record, sizeof( au8Record ));
+  }
+  capture->write( frame, u16size );
+}
+#endif
+
+#if MODBUS_ROLES & MODBUS_ROLE_MASTER
+/**
+ * @brief
+ * Filter watching a master data array, if any
+ *
+ * @param regs  where the answer is decoded
+ * @param pu16base  receives the word of the filter array regs points to
+ * @return filter, nullptr if regs is not watched
+ * @ingroup register
+ */
+modbus_filter_t *Modbus::findFilter( uint16_t *regs, uint16_t *pu16base ) {
+  for (modbus_filter_t *filter = filters; filter != nullptr; filter = filter->next) {
+    uint16_t u16words = filter->bCoils ? (filter->u16size + 15) / 16 : filter->u16size;
+    if (regs >= filter->au16reg && regs < filter->au16reg + u16words) {
+      *pu16base = regs - filter->au16reg;
+      return filter;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief
+ * Flag a changed point, once until it is taken by nextChange()
+ *
+ * @ingroup register
+ */
+void Modbus::flagChange( modbus_filter_t *filter, uint16_t u16point ) {
+  if (u16point >= filter->u16size) return;
+  if (bitRead( filter->au16changed[ u16point / 16 ], u16point % 16 )) return;
+  bitSet( filter->au16changed[ u16point / 16 ], u16point % 16 );
+  filter->u16changes++;
 }
 
 /**
@@ -970,13 +1857,33 @@ void Modbus::buildException( uint8_t u8exception ) {
  */
 void Modbus::get_FC1() {
   uint8_t u8byte, i;
+  uint16_t u16base = 0;
+  modbus_filter_t *filter = findFilter( au16regs, &u16base );
   u8byte = 3;
 
   #ifdef LOGGING
     Serial.print("MODBUS> FC1: ");
   #endif
-    // only implements reading one byte at a time
-  au16regs[0] = au8Buffer[u8byte];
+  // never write past the words of the query, whatever the byte count says
+  uint8_t u8words = (au8Buffer[ 2 ] + 1) / 2;
+  if (u8words > (pending.u16CoilsNo + 15) / 16) u8words = (pending.u16CoilsNo + 15) / 16;
+
+  // coil n goes to bit n%16 of au16regs[n/16], the first byte being the low one
+  for (i = 0; i < u8words; i++) {
+    uint16_t u16value = au8Buffer[ u8byte ];
+    if (2 * i + 1 < au8Buffer[ 2 ]) u16value |= (uint16_t) au8Buffer[ u8byte + 1 ] << 8;
+
+    if (filter != nullptr) {
+      uint16_t u16diff = au16regs[ i ] ^ u16value;
+      for (uint8_t u8bit = 0; u16diff != 0; u8bit++, u16diff >>= 1) {
+        uint16_t u16coil = i * 16 + u8bit;
+        if (u16coil >= pending.u16CoilsNo) break; // padding bits
+        if (u16diff & 1) flagChange( filter, u16base * 16 + u16coil );
+      }
+    }
+    au16regs[ i ] = u16value;
+    u8byte += 2;
+  }
   #ifdef LOGGING
     Serial.println();
   #endif
@@ -990,19 +1897,37 @@ void Modbus::get_FC1() {
  */
 void Modbus::get_FC3() {
   uint8_t u8byte, i;
+  uint16_t u16base = 0;
+  modbus_filter_t *filter = findFilter( au16regs, &u16base );
   u8byte = 3;
 
   #ifdef LOGGING
     Serial.print("MODBUS> FC3: ");
   #endif
 
-  for (i=0; i< au8Buffer[ 2 ] /2; i++) {
+  // never write past the registers of the query, whatever the byte count says
+  uint8_t u8words = au8Buffer[ 2 ] / 2;
+  if (u8words > pending.u16CoilsNo) u8words = pending.u16CoilsNo;
 
-    au16regs[ i ] = word(
+  for (i=0; i< u8words; i++) {
+
+    uint16_t u16value = word(
       au8Buffer[ u8byte ],
       au8Buffer[ u8byte + 1 ]
     );
 
+    if (filter != nullptr && u16base + i < filter->u16size) {
+      uint16_t u16delta = u16value - au16regs[ i ];
+      if (u16delta > 0x8000) u16delta = -u16delta;
+      uint16_t u16deadband = (filter->au16deadband != nullptr) ? filter->au16deadband[ u16base + i ] : 0;
+      if (u16delta <= u16deadband) {
+        u8byte += 2;
+        continue; // within the deadband, keep the reported value
+      }
+      flagChange( filter, u16base + i );
+    }
+    au16regs[ i ] = u16value;
+
     #ifdef LOGGING
       Serial.print(au16regs[ i ], HEX);
       Serial.print(" ");
@@ -1015,55 +1940,79 @@ void Modbus::get_FC3() {
     Serial.println();
   #endif
 }
+#endif
 
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
 /**
  * @brief
  * This method processes functions 1 & 2
  * This method reads a bit array and transfers it to the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup discrete
  */
-int8_t Modbus::process_FC1( uint16_t *regs, uint16_t u16size ) {
-  uint8_t u8currentRegister, u8currentBit, u8bytesno, u8bitsno;
-  uint8_t u8CopyBufferSize;
+int16_t Modbus::process_FC1( uint16_t *regs, uint16_t u16size ) {
+  uint16_t u16currentRegister;
+  uint8_t u8currentBit, u8bytesno, u8bitsno;
+  uint16_t u16CopyBufferSize;
   uint16_t u16currentCoil, u16coil;
 
   // get the first and last coil from the message
   uint16_t u16StartCoil = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ] );
   uint16_t u16Coilno = word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ] );
 
+  // compute virtual registers holding the coils
+  boolean bBound = false;
+  uint8_t u8exception = accessBindings( false, u16StartCoil / 16,
+    (u16StartCoil + u16Coilno - 1) / 16 - u16StartCoil / 16 + 1, &bBound );
+  if (u8exception != 0) return sendException( u8exception );
+
   // put the number of bytes in the outcoming message
   u8bytesno = (uint8_t) (u16Coilno / 8);
   if (u16Coilno % 8 != 0) u8bytesno ++;
   au8Buffer[ ADD_HI ]  = u8bytesno;
-  u8BufferSize         = ADD_LO;
-
-  // read each coil from the register map and put its value inside the outcoming message
-  u8bitsno = 0;
-
-  for (u16currentCoil = 0; u16currentCoil < u16Coilno; u16currentCoil++) {
-    u16coil = u16StartCoil + u16currentCoil;
-    u8currentRegister = (uint8_t) (u16coil / 16);
-    u8currentBit = (uint8_t) (u16coil % 16);
-
-    bitWrite(
-    au8Buffer[ u8BufferSize ],
-    u8bitsno,
-    bitRead( regs[ u8currentRegister ], u8currentBit ) );
-    u8bitsno ++;
 
-    if (u8bitsno > 7) {
-      u8bitsno = 0;
-      u8BufferSize++;
+  // copy again if the application updated the map meanwhile, see beginUpdate()
+  uint8_t u8tries = 0;
+  uint32_t u32seq;
+  do {
+    if (u8tries++ == MODBUS_SNAPSHOT_RETRIES) return sendException( EXC_SLAVE_BUSY );
+    u32seq = u32mapSeq.load( std::memory_order_acquire );
+    if (u32seq & 1) continue;
+
+    // read each coil from the register map and put its value inside the outcoming message
+    // unused bits of the last byte must be 0, not leftovers of the request
+    u16BufferSize         = ADD_LO;
+    memset( &au8Buffer[ u16BufferSize ], 0, u8bytesno );
+    u8bitsno = 0;
+
+    for (u16currentCoil = 0; u16currentCoil < u16Coilno; u16currentCoil++) {
+      u16coil = u16StartCoil + u16currentCoil;
+      u16currentRegister = u16coil / 16;
+      u8currentBit = (uint8_t) (u16coil % 16);
+
+      bitWrite(
+      au8Buffer[ u16BufferSize ],
+      u8bitsno,
+      bitRead( regs[ u16currentRegister ], u8currentBit ) );
+      u8bitsno ++;
+
+      if (u8bitsno > 7) {
+        u8bitsno = 0;
+        u16BufferSize++;
+      }
     }
-  }
+    std::atomic_thread_fence( std::memory_order_acquire );
+  } while ((u32seq & 1) || u32seq != u32mapSeq.load( std::memory_order_relaxed ));
 
   // send outcoming message
-  if (u16Coilno % 8 != 0) u8BufferSize ++;
-  u8CopyBufferSize = u8BufferSize +2;
+  if (u16Coilno % 8 != 0) u16BufferSize ++;
+  u16CopyBufferSize = u16BufferSize +2;
   sendTxBuffer();
-  return u8CopyBufferSize;
+#if MODBUS_CACHE_ENTRIES > 0
+  if (!bBound) storeCached( au8Buffer[ FUNC ], u16StartCoil, u16Coilno, u16CopyBufferSize, u32seq );
+#endif
+  return u16CopyBufferSize;
 }
 
 /**
@@ -1071,31 +2020,47 @@ int8_t Modbus::process_FC1( uint16_t *regs, uint16_t u16size ) {
  * This method processes functions 3 & 4
  * This method reads a word array and transfers it to the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup register
  */
-int8_t Modbus::process_FC3( uint16_t *regs, uint16_t u16size ) {
+int16_t Modbus::process_FC3( uint16_t *regs, uint16_t u16size ) {
 
   uint16_t u16StartAdd = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ] );
   uint16_t u16regsno = word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ] );
-  uint8_t u8CopyBufferSize;
+  uint16_t u16CopyBufferSize;
   uint16_t i;
 
-  Serial.printlnf(" %u %u %u %u", u16StartAdd, u16regsno, u8CopyBufferSize, i);
+  // compute virtual registers
+  boolean bBound = false;
+  uint8_t u8exception = accessBindings( false, u16StartAdd, u16regsno, &bBound );
+  if (u8exception != 0) return sendException( u8exception );
 
   au8Buffer[ 2 ]       = u16regsno * 2;
-  u8BufferSize         = 3;
 
-  for (i = u16StartAdd; i < u16StartAdd + u16regsno; i++) {
-    au8Buffer[ u8BufferSize ] = highByte(regs[i]);
-    u8BufferSize++;
-    au8Buffer[ u8BufferSize ] = lowByte(regs[i]);
-    u8BufferSize++;
-  }
-  u8CopyBufferSize = u8BufferSize +2;
+  // copy again if the application updated the map meanwhile, see beginUpdate()
+  uint8_t u8tries = 0;
+  uint32_t u32seq;
+  do {
+    if (u8tries++ == MODBUS_SNAPSHOT_RETRIES) return sendException( EXC_SLAVE_BUSY );
+    u32seq = u32mapSeq.load( std::memory_order_acquire );
+    if (u32seq & 1) continue;
+
+    u16BufferSize         = 3;
+    for (i = u16StartAdd; i < u16StartAdd + u16regsno; i++) {
+      au8Buffer[ u16BufferSize ] = highByte(regs[i]);
+      u16BufferSize++;
+      au8Buffer[ u16BufferSize ] = lowByte(regs[i]);
+      u16BufferSize++;
+    }
+    std::atomic_thread_fence( std::memory_order_acquire );
+  } while ((u32seq & 1) || u32seq != u32mapSeq.load( std::memory_order_relaxed ));
+  u16CopyBufferSize = u16BufferSize +2;
   sendTxBuffer();
+#if MODBUS_CACHE_ENTRIES > 0
+  if (!bBound) storeCached( au8Buffer[ FUNC ], u16StartAdd, u16regsno, u16CopyBufferSize, u32seq );
+#endif
 
-  return u8CopyBufferSize;
+  return u16CopyBufferSize;
 }
 
 /**
@@ -1103,31 +2068,37 @@ int8_t Modbus::process_FC3( uint16_t *regs, uint16_t u16size ) {
  * This method processes function 5
  * This method writes a value assigned by the master to a single bit
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup discrete
  */
-int8_t Modbus::process_FC5( uint16_t *regs, uint16_t u16size ) {
-  uint8_t u8currentRegister, u8currentBit;
-  uint8_t u8CopyBufferSize;
+int16_t Modbus::process_FC5( uint16_t *regs, uint16_t u16size ) {
+  uint16_t u16currentRegister;
+  uint8_t u8currentBit;
+  uint16_t u16CopyBufferSize;
   uint16_t u16coil = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ] );
 
   // point to the register and its bit
-  u8currentRegister = (uint8_t) (u16coil / 16);
+  u16currentRegister = u16coil / 16;
   u8currentBit = (uint8_t) (u16coil % 16);
 
   // write to coil
+  uint16_t u16old;
+  stageWrite( u16currentRegister, 1, &u16old );
   bitWrite(
-  regs[ u8currentRegister ],
+  regs[ u16currentRegister ],
   u8currentBit,
   au8Buffer[ NB_HI ] == 0xff );
 
+  uint8_t u8exception = acceptWrite( u16currentRegister, 1, &u16old );
+  if (u8exception != 0) return sendException( u8exception );
+  journalWrite( u16coil, 1 );
 
   // send answer to master
-  u8BufferSize = 6;
-  u8CopyBufferSize = u8BufferSize +2;
+  u16BufferSize = 6;
+  u16CopyBufferSize = u16BufferSize +2;
   sendTxBuffer();
 
-  return u8CopyBufferSize;
+  return u16CopyBufferSize;
 }
 
 /**
@@ -1135,24 +2106,30 @@ int8_t Modbus::process_FC5( uint16_t *regs, uint16_t u16size ) {
  * This method processes function 6
  * This method writes a value assigned by the master to a single word
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup register
  */
-int8_t Modbus::process_FC6( uint16_t *regs, uint16_t u16size ) {
+int16_t Modbus::process_FC6( uint16_t *regs, uint16_t u16size ) {
 
-  uint8_t u8add = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ] );
-  uint8_t u8CopyBufferSize;
+  uint16_t u16add = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ] );
+  uint16_t u16CopyBufferSize;
   uint16_t u16val = word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ] );
 
-  regs[ u8add ] = u16val;
+  uint16_t u16old;
+  stageWrite( u16add, 1, &u16old );
+  regs[ u16add ] = u16val;
+
+  uint8_t u8exception = acceptWrite( u16add, 1, &u16old );
+  if (u8exception != 0) return sendException( u8exception );
+  journalWrite( u16add, 1 );
 
   // keep the same header
-  u8BufferSize         = RESPONSE_SIZE;
+  u16BufferSize         = RESPONSE_SIZE;
 
-  u8CopyBufferSize = u8BufferSize +2;
+  u16CopyBufferSize = u16BufferSize +2;
   sendTxBuffer();
 
-  return u8CopyBufferSize;
+  return u16CopyBufferSize;
 }
 
 /**
@@ -1160,19 +2137,23 @@ int8_t Modbus::process_FC6( uint16_t *regs, uint16_t u16size ) {
  * This method processes function 15
  * This method writes a bit array assigned by the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup discrete
  */
-int8_t Modbus::process_FC15( uint16_t *regs, uint16_t u16size ) {
-  uint8_t u8currentRegister, u8currentBit, u8frameByte, u8bitsno;
-  uint8_t u8CopyBufferSize;
+int16_t Modbus::process_FC15( uint16_t *regs, uint16_t u16size ) {
+  uint16_t u16currentRegister;
+  uint8_t u8currentBit, u8frameByte, u8bitsno;
+  uint16_t u16CopyBufferSize;
   uint16_t u16currentCoil, u16coil;
   boolean bTemp;
 
   // get the first and last coil from the message
   uint16_t u16StartCoil = word( au8Buffer[ ADD_HI ], au8Buffer[ ADD_LO ] );
   uint16_t u16Coilno = word( au8Buffer[ NB_HI ], au8Buffer[ NB_LO ] );
-
+  uint16_t u16first = u16StartCoil / 16;
+  uint16_t u16words = (u16StartCoil + u16Coilno - 1) / 16 - u16first + 1;
+  uint16_t au16old[ MB_MAX_WRITE_REGISTERS + 1 ]; // 1968 coils span 124 registers
+  stageWrite( u16first, u16words, au16old );
 
   // read each coil from the register map and put its value inside the outcoming message
   u8bitsno = 0;
@@ -1180,7 +2161,7 @@ int8_t Modbus::process_FC15( uint16_t *regs, uint16_t u16size ) {
   for (u16currentCoil = 0; u16currentCoil < u16Coilno; u16currentCoil++) {
 
     u16coil = u16StartCoil + u16currentCoil;
-    u8currentRegister = (uint8_t) (u16coil / 16);
+    u16currentRegister = u16coil / 16;
     u8currentBit = (uint8_t) (u16coil % 16);
 
     bTemp = bitRead(
@@ -1188,7 +2169,7 @@ int8_t Modbus::process_FC15( uint16_t *regs, uint16_t u16size ) {
     u8bitsno );
 
     bitWrite(
-    regs[ u8currentRegister ],
+    regs[ u16currentRegister ],
     u8currentBit,
     bTemp );
 
@@ -1201,12 +2182,16 @@ int8_t Modbus::process_FC15( uint16_t *regs, uint16_t u16size ) {
     
   }
 
+  uint8_t u8exception = acceptWrite( u16first, u16words, au16old );
+  if (u8exception != 0) return sendException( u8exception );
+  journalWrite( u16StartCoil, u16Coilno );
+
   // send outcoming message
   // it's just a copy of the incomping frame until 6th byte
-  u8BufferSize         = 6;
-  u8CopyBufferSize = u8BufferSize +2;
+  u16BufferSize         = 6;
+  u16CopyBufferSize = u16BufferSize +2;
   sendTxBuffer();
-  return u8CopyBufferSize;
+  return u16CopyBufferSize;
 }
 
 /**
@@ -1214,36 +2199,184 @@ int8_t Modbus::process_FC15( uint16_t *regs, uint16_t u16size ) {
  * This method processes function 16
  * This method writes a word array assigned by the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup register
  */
-int8_t Modbus::process_FC16( uint16_t *regs, uint16_t u16size ) {
-  uint8_t u8func = au8Buffer[ FUNC ];  // get the original FUNC code
+int16_t Modbus::process_FC16( uint16_t *regs, uint16_t u16size ) {
   uint16_t u16StartAdd = au8Buffer[ ADD_HI ] << 8 | au8Buffer[ ADD_LO ];
-  uint8_t u8regsno = au8Buffer[ NB_HI ] << 8 | au8Buffer[ NB_LO ];
-  uint8_t u8CopyBufferSize;
+  uint16_t u16regsno = au8Buffer[ NB_HI ] << 8 | au8Buffer[ NB_LO ];
+  uint16_t u16CopyBufferSize;
   uint16_t i;
   uint16_t temp;
 
   // build header
-  au8Buffer[ NB_HI ]   = 0;
-  au8Buffer[ NB_LO ]   = u8regsno;
-  u8BufferSize         = RESPONSE_SIZE;
+  au8Buffer[ NB_HI ]   = highByte( u16regsno );
+  au8Buffer[ NB_LO ]   = lowByte( u16regsno );
+  u16BufferSize         = RESPONSE_SIZE;
 
   // write registers
-  for (i = 0; i < u8regsno; i++) {
+  uint16_t au16old[ MB_MAX_WRITE_REGISTERS ];
+  stageWrite( u16StartAdd, u16regsno, au16old );
+  for (i = 0; i < u16regsno; i++) {
     temp = word(
     au8Buffer[ (BYTE_CNT + 1) + i * 2 ],
     au8Buffer[ (BYTE_CNT + 2) + i * 2 ]);
 
     regs[ u16StartAdd + i ] = temp;
   }
-  u8CopyBufferSize = u8BufferSize +2;
+
+  uint8_t u8exception = acceptWrite( u16StartAdd, u16regsno, au16old );
+  if (u8exception != 0) return sendException( u8exception );
+  journalWrite( u16StartAdd, u16regsno );
+  u16CopyBufferSize = u16BufferSize +2;
+  sendTxBuffer();
+
+  return u16CopyBufferSize;
+}
+
+/**
+ * @brief
+ * This method serves a function code registered with setHandler()
+ *
+ * @return u16BufferSize Response to master length, or the exception code
+ * @ingroup buffer
+ */
+int16_t Modbus::process_User( uint8_t u8kind, uint16_t *regs, uint16_t u16size ) {
+  uint16_t u16CopyBufferSize;
+  modbus_pdu_t pdu = { FCT_SERVE, &au8Buffer[ FUNC ], (uint16_t) (u16BufferSize - 1 - CHECKSUM_SIZE),
+    MAX_BUFFER - 1 - CHECKSUM_SIZE, nullptr, regs, u16size };
+
+  uint8_t u8exception = callUser( u8kind, &pdu );
+  if (u8exception != 0) return sendException( u8exception );
+
+  u16BufferSize = 1 + pdu.u16size;
+  u16CopyBufferSize = u16BufferSize +2;
   sendTxBuffer();
 
-  return u8CopyBufferSize;
+  return u16CopyBufferSize;
+}
+
+/**
+ * @brief
+ * Call the bindings overlapping a register range, see addBinding()
+ *
+ * @param bWrite  true for the write callbacks, false for the read ones
+ * @param u16add  first register accessed by the request
+ * @param u16no  number of registers accessed
+ * @param pbBound  if not null, set to true when a callback was called
+ * @return 0, or the exception code of the first callback failing
+ * @ingroup register
+ */
+uint8_t Modbus::accessBindings( boolean bWrite, uint16_t u16add, uint16_t u16no, boolean *pbBound ) {
+  for (modbus_binding_t *binding = bindings; binding != nullptr; binding = binding->next) {
+    modbus_access_t access = bWrite ? binding->write : binding->read;
+    if (access == nullptr) continue;
+
+    // part of the binding within the request
+    uint32_t u32first = (u16add > binding->u16RegAdd) ? u16add : binding->u16RegAdd;
+    uint32_t u32end = (uint32_t) binding->u16RegAdd + binding->u16CoilsNo;
+    if ((uint32_t) u16add + u16no < u32end) u32end = (uint32_t) u16add + u16no;
+    if (u32first >= u32end) continue;
+
+    if (pbBound != nullptr) *pbBound = true;
+    uint8_t u8exception = access( au16regs, u32first, u32end - u32first, binding->context );
+    if (u8exception != 0) return u8exception;
+  }
+  return 0;
+}
+
+/**
+ * @brief
+ * Start writing a request to the register map: keep the registers it
+ * writes, so that acceptWrite() can put them back
+ *
+ * @param u16first  first register written
+ * @param u16words  number of registers written
+ * @param au16old  receives their values, u16words registers
+ * @ingroup register
+ */
+void Modbus::stageWrite( uint16_t u16first, uint16_t u16words, uint16_t *au16old ) {
+  if (bindings != nullptr) memcpy( au16old, &au16regs[ u16first ], u16words * sizeof( uint16_t ));
 }
 
+/**
+ * @brief
+ * End writing a request to the register map: the write callbacks accept
+ * it, or the registers get their old values back
+ *
+ * @param u16first  first register written
+ * @param u16words  number of registers written
+ * @param au16old  their values kept by stageWrite()
+ * @return 0, or the exception code of the first callback failing
+ * @ingroup register
+ */
+uint8_t Modbus::acceptWrite( uint16_t u16first, uint16_t u16words, const uint16_t *au16old ) {
+  uint8_t u8exception = accessBindings( true, u16first, u16words );
+  if (u8exception != 0) {
+    memcpy( &au16regs[ u16first ], au16old, u16words * sizeof( uint16_t ));
+  } else {
+    invalidateCache();
+  }
+  return u8exception;
+}
+
+/**
+ * @brief
+ * Answer the request in au8Buffer with an exception
+ *
+ * @param u8exception  exception code, NO_REPLY to send nothing
+ * @return the exception code
+ * @ingroup buffer
+ */
+int16_t Modbus::sendException( uint8_t u8exception ) {
+  if (u8exception != NO_REPLY) {
+    buildException( u8exception );
+    sendTxBuffer();
+  }
+  u8lastError = u8exception;
+  return u8exception;
+}
+
+/**
+ * @brief
+ * Record the write being applied in the journal, see setJournal()
+ *
+ * @param u16add  first coil or register written, as in the request
+ * @param u16no  number of coils or registers written
+ * @ingroup register
+ */
+void Modbus::journalWrite( uint16_t u16add, uint16_t u16no ) {
+  if (journal == nullptr) return;
+  uint8_t u8fct = au8Buffer[ FUNC ];
+
+  if (journal->au16dirty != nullptr) {
+    // coils flag the registers holding them
+    boolean bCoils = (u8fct == MB_FC_WRITE_COIL || u8fct == MB_FC_WRITE_MULTIPLE_COILS);
+    uint16_t u16first = bCoils ? u16add / 16 : u16add;
+    uint16_t u16last = bCoils ? (u16add + u16no - 1) / 16 : u16add + u16no - 1;
+    for (uint16_t u16reg = u16first; u16reg <= u16last && u16reg < journal->u16size; u16reg++) {
+      if (bitRead( journal->au16dirty[ u16reg / 16 ], u16reg % 16 )) continue;
+      bitSet( journal->au16dirty[ u16reg / 16 ], u16reg % 16 );
+      journal->u16dirty++;
+    }
+  }
+
+  if (journal->aChanges != nullptr && journal->u8entries > 0) {
+    if (journal->u8count == journal->u8entries) {
+      journal->u8first = (journal->u8first + 1) % journal->u8entries;
+      journal->u8count--;
+      journal->u16lost++;
+    }
+    modbus_change_t *change = &journal->aChanges[ (journal->u8first + journal->u8count) % journal->u8entries ];
+    change->u8fct = u8fct;
+    change->u16RegAdd = u16add;
+    change->u16CoilsNo = u16no;
+    change->u32stamp = clock->millis();
+    journal->u8count++;
+  }
+}
+#endif
+
 // this switches between RXEN (0) and TXEN (1) modes
 void Modbus::rxTxMode( uint8_t mode ) {
   if (mode == RXEN) {
@@ -1274,7 +2407,7 @@ bool Modbus::selfTest() {
   port->print("ALTRAC");
   port->flush();
   Modbus::rxTxMode(RXEN);
-  delay(100);
+  clock->delay(100);
   bool result = true;
   Serial.print((char)port->peek());
   if (port->read() != 'A')
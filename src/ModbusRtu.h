@@ -42,7 +42,9 @@
  *
  */
 
+#include <atomic>
 #include "application.h"
+#include "ModbusClock.h"
 
 #define lowByte(w)                     ((w) & 0xFF)
 #define highByte(w)                    (((w) >> 8) & 0xFF)
@@ -77,6 +79,19 @@ typedef struct {
 }
 modbus_t;
 
+/**
+ * @enum MB_LIMITS
+ * @brief
+ * Largest quantities of one request, as set by the Modbus specification.
+ * Each fills a full 256-byte ADU at most.
+ */
+enum MB_LIMITS {
+  MB_MAX_READ_COILS             = 2000, //!< FC1 and FC2
+  MB_MAX_READ_REGISTERS         = 125,  //!< FC3 and FC4
+  MB_MAX_WRITE_COILS            = 1968, //!< FC15
+  MB_MAX_WRITE_REGISTERS        = 123   //!< FC16
+};
+
 enum {
   RESPONSE_SIZE = 6,
   EXCEPTION_SIZE = 3,
@@ -104,7 +119,7 @@ enum MESSAGE {
  * Modbus function codes summary.
  * These are the implement function codes either for Master or for Slave.
  *
- * @see also fctsupported
+ * @see also MODBUS_FUNCTIONS
  * @see also modbus_t
  */
 enum MB_FC {
@@ -129,7 +144,9 @@ enum ERR_LIST {
   ERR_POLLING                   = -2,
   ERR_BUFF_OVERFLOW             = -3,
   ERR_BAD_CRC                   = -4,
-  ERR_EXCEPTION                 = -5
+  ERR_EXCEPTION                 = -5,
+  ERR_NOT_SNIFFER               = -6,
+  ERR_NOT_SLAVE                 = -7
 };
 
 enum {
@@ -137,26 +154,284 @@ enum {
   EXC_FUNC_CODE = 1,
   EXC_ADDR_RANGE = 2,
   EXC_REGS_QUANT = 3,
-  EXC_EXECUTE = 4
+  EXC_EXECUTE = 4,
+  EXC_SLAVE_BUSY = 6
 };
 
-const unsigned char fctsupported[] = {
-  MB_FC_READ_COILS,
-  MB_FC_READ_DISCRETE_INPUT,
-  MB_FC_READ_REGISTERS,
-  MB_FC_READ_INPUT_REGISTER,
-  MB_FC_WRITE_COIL,
-  MB_FC_WRITE_REGISTER,
-  MB_FC_WRITE_MULTIPLE_COILS,
-  MB_FC_WRITE_MULTIPLE_REGISTERS
-};
+/**
+ * Compile-time specialization.
+ * Several ports on a small MCU only pay for what they use: define these
+ * before the build, e.g. -DMODBUS_ROLES=MODBUS_ROLE_SLAVE
+ * -DMODBUS_FUNCTIONS="(MB_FC_BIT(3) | MB_FC_BIT(16))" -DMAX_BUFFER=64.
+ * The state and the code of the roles left out are compiled out; their
+ * public methods stay and fail: query() returns -2, poll() ERR_NOT_MASTER,
+ * poll( regs, size ) ERR_NOT_SLAVE and sniff() ERR_NOT_SNIFFER. Function codes out of MODBUS_FUNCTIONS are answered
+ * with EXC_FUNC_CODE by a slave and refused by query(); nothing calls
+ * their handlers any more and the linker drops them.
+ * Use numbers in MB_FC_BIT(), the preprocessor does not know MB_FC.
+ */
+#define MODBUS_ROLE_MASTER  0x01
+#define MODBUS_ROLE_SLAVE   0x02
+#define MODBUS_ROLE_SNIFFER 0x04
+
+#ifndef MODBUS_ROLES
+#define MODBUS_ROLES (MODBUS_ROLE_MASTER | MODBUS_ROLE_SLAVE | MODBUS_ROLE_SNIFFER)	//!< roles compiled in
+#endif
+
+#define MB_FC_BIT(fct) (1UL << (fct))
+
+#ifndef MODBUS_FUNCTIONS
+#define MODBUS_FUNCTIONS (MB_FC_BIT(1) | MB_FC_BIT(2) | MB_FC_BIT(3) | MB_FC_BIT(4) | \
+  MB_FC_BIT(5) | MB_FC_BIT(6) | MB_FC_BIT(15) | MB_FC_BIT(16))	//!< function codes compiled in
+#endif
+
+#define MB_FC_SUPPORTED(fct) ((fct) < 32 && (MODBUS_FUNCTIONS & MB_FC_BIT(fct)) != 0)
+
+#define MB_FCT_CODES 128	//!< function codes 0..127, the high bit flags an exception
+
+#ifndef MODBUS_USER_FUNCTIONS
+#define MODBUS_USER_FUNCTIONS 4	//!< handlers setHandler() can register, 0 to leave it out
+#endif
 
 #define T35  5
-#define  MAX_BUFFER  255	//!< maximum size for the communication buffer in bytes
+#ifndef MAX_BUFFER
+#define  MAX_BUFFER  256	//!< maximum size for the communication buffer in bytes, a full RTU ADU
+#endif
+
+/**
+ * Slave response cache: answers to repeated FC1..FC4 reads are sent again
+ * without being encoded. Off by default. Once enabled, every change the
+ * application makes to the array given to poll( regs, size ) must go
+ * between beginUpdate() and endUpdate(), or be followed by
+ * invalidateCache(); otherwise stale answers are served. Each slot costs
+ * a full ADU (about 268 bytes) per instance.
+ */
+#ifndef MODBUS_CACHE_ENTRIES
+#define MODBUS_CACHE_ENTRIES 0	//!< slave response cache slots, 0 disables the cache
+#endif
+#if !(MODBUS_ROLES & MODBUS_ROLE_SLAVE)
+#undef MODBUS_CACHE_ENTRIES
+#define MODBUS_CACHE_ENTRIES 0
+#endif
+
+#ifndef MODBUS_SNAPSHOT_RETRIES
+#define MODBUS_SNAPSHOT_RETRIES 4	//!< copies of a read torn by beginUpdate() before answering EXC_SLAVE_BUSY
+#endif
 
 #define RXEN 0
 #define TXEN 1
 
+#define MODBUS_SNIFFER 255	//!< u8id of a listen-only bus sniffer
+#define MODBUS_CAPTURE_VERSION 2	//!< version of the CAPTURE_NATIVE format
+
+/**
+ * @enum CAPTURE_FORMAT
+ * @brief
+ * Output formats of the sniffer capture.
+ * CAPTURE_NATIVE starts with "MBCP", version, 0 and the baud rate (uint32_t),
+ * then one record per frame: start time in us (uint32_t), CAPTURE_FLAGS,
+ * length (uint16_t) and the frame bytes. All integers are little endian.
+ * Version 1 captures had a uint8_t length and are no longer read.
+ * CAPTURE_PCAP is a libpcap file with LINKTYPE_USER0 (147) frames.
+ */
+enum CAPTURE_FORMAT {
+  CAPTURE_NATIVE                = 0,
+  CAPTURE_PCAP                  = 1
+};
+
+/**
+ * @enum CAPTURE_FLAGS
+ * @brief
+ * Flags of a native capture record
+ */
+enum CAPTURE_FLAGS {
+  CAPTURE_REQUEST               = 0x01, //!< frame sent by the master
+  CAPTURE_RESPONSE              = 0x02, //!< answer to the previous request record
+  CAPTURE_BAD_CRC               = 0x04, //!< frame CRC does not match
+  CAPTURE_TRUNCATED             = 0x08  //!< frame longer than MAX_BUFFER, tail dropped
+};
+
+/**
+ * @enum RESULT_STATUS
+ * @brief
+ * How a master query completed, see modbus_result_t
+ */
+enum RESULT_STATUS {
+  RESULT_OK                     = 0, //!< answer received, read data decoded
+  RESULT_EXCEPTION              = 1, //!< slave answered with an exception code
+  RESULT_TIMEOUT                = 2, //!< no answer within the time-out
+  RESULT_BAD_ANSWER             = 3, //!< answer too short, bad CRC, or not for the query: slave, function or byte count
+  RESULT_REJECTED               = 4  //!< query() refused the telegram, nothing was sent
+};
+
+/**
+ * @struct modbus_result_t
+ * @brief
+ * Completion of a master query, handed to its modbus_handler_t.
+ * Read data is already decoded in the telegram registers, nothing is copied.
+ */
+typedef struct {
+  uint8_t u8status;      /*!< RESULT_STATUS */
+  uint8_t u8exception;   /*!< Slave exception code (EXC_FUNC_CODE...), 0 if none */
+  modbus_t telegram;     /*!< The completed query, read data is in telegram.au16reg */
+  uint32_t u32latency;   /*!< Time from query() to completion (us) */
+}
+modbus_result_t;
+
+/**
+ * Completion handler of a master query, called from poll()
+ */
+typedef void (*modbus_handler_t)( const modbus_result_t *result, void *context );
+
+/**
+ * @enum MB_FCT_KIND
+ * @brief
+ * Entry of the function code dispatch table: the family of a built-in
+ * code, or the slot of a handler registered with setHandler()
+ */
+enum MB_FCT_KIND {
+  FCT_NONE                      = 0,   //!< not supported, answered with EXC_FUNC_CODE
+  FCT_READ_BITS                 = 1,   //!< FC1 and FC2
+  FCT_READ_REGS                 = 2,   //!< FC3 and FC4
+  FCT_WRITE_BIT                 = 3,   //!< FC5
+  FCT_WRITE_REG                 = 4,   //!< FC6
+  FCT_WRITE_BITS                = 5,   //!< FC15
+  FCT_WRITE_REGS                = 6,   //!< FC16
+  FCT_USER                      = 0x80 //!< user handler, its slot in the low bits
+};
+
+/**
+ * @enum FCT_STAGE
+ * @brief
+ * Why a user function code handler is called, see modbus_pdu_t
+ */
+enum FCT_STAGE {
+  FCT_REQUEST                   = 0, //!< master: append the request data to the PDU
+  FCT_ANSWER                    = 1, //!< master: decode the answer PDU
+  FCT_SERVE                     = 2, //!< slave: replace the request PDU by the answer PDU
+  FCT_LENGTH                    = 3  //!< tunnel: size the PDU being received, see frameLength()
+};
+
+/**
+ * @struct modbus_pdu_t
+ * @brief
+ * PDU handed to a user function code handler. The handler works in place
+ * in the frame buffer; the engine adds the address and the CRC.
+ */
+typedef struct {
+  uint8_t u8stage;       /*!< FCT_STAGE */
+  uint8_t *pdu;          /*!< Function code then data */
+  uint16_t u16size;      /*!< Bytes of pdu, to be updated when the handler writes it */
+  uint16_t u16room;      /*!< Bytes pdu can hold */
+  modbus_t *telegram;    /*!< Master: the query, nullptr for a slave */
+  uint16_t *regs;        /*!< Slave: register map given to poll(), master: telegram data */
+  uint16_t u16regsize;   /*!< Slave: registers in regs */
+}
+modbus_pdu_t;
+
+/**
+ * Function code handler, see setHandler().
+ * Returns 0, or an exception code: a slave answers it (NO_REPLY for none),
+ * a master refuses the query or reports a bad answer.
+ */
+typedef uint8_t (*modbus_fct_handler_t)( modbus_pdu_t *pdu, void *context );
+
+/**
+ * @struct modbus_filter_t
+ * @brief
+ * Report-by-exception filter of a master data array, see addFilter().
+ * While an answer is decoded into au16reg, a register moving by no more
+ * than its deadband keeps its previous value and is not reported; any
+ * other change is written and flagged in au16changed.
+ */
+typedef struct modbus_filter {
+  uint16_t *au16reg;     /*!< Master data array given to the telegrams */
+  uint16_t u16size;      /*!< Points watched: registers, or coils when bCoils */
+  boolean bCoils;        /*!< Coils are read into au16reg, point n is coil n */
+  const uint16_t *au16deadband; /*!< Deadband of each register, nullptr = report every change */
+  uint16_t *au16changed; /*!< Changed points, bit n%16 of word n/16: (u16size + 15) / 16 words */
+  uint16_t u16changes;   /*!< Number of points flagged in au16changed */
+  struct modbus_filter *next; /*!< Next filter of the master, set by addFilter() */
+}
+modbus_filter_t;
+
+/**
+ * Access to a bound register range of a slave, see modbus_binding_t.
+ * Returns 0, or the exception code the slave answers instead (EXC_EXECUTE...).
+ */
+typedef uint8_t (*modbus_access_t)( uint16_t *regs, uint16_t u16add, uint16_t u16no, void *context );
+
+/**
+ * @struct modbus_binding_t
+ * @brief
+ * Virtual registers of a slave, see addBinding().
+ * The read callback fills regs[ u16add ] .. regs[ u16add + u16no - 1 ]
+ * right before a request reads them; the write callback runs once a
+ * request wrote them, and an exception it returns undoes the write.
+ * Either may be nullptr. Coils are bound through the registers holding them.
+ */
+typedef struct modbus_binding {
+  uint16_t u16RegAdd;    /*!< First register of the range */
+  uint16_t u16CoilsNo;   /*!< Number of registers of the range */
+  modbus_access_t read;  /*!< Computes registers about to be read */
+  modbus_access_t write; /*!< Acts on registers just written, or refuses them */
+  void *context;         /*!< Passed to the callbacks as is */
+  struct modbus_binding *next; /*!< Next binding of the slave, set by addBinding() */
+}
+modbus_binding_t;
+
+/**
+ * @struct modbus_change_t
+ * @brief
+ * Write applied by a slave, see setJournal()
+ */
+typedef struct {
+  uint8_t u8fct;         /*!< Function code of the write: 5, 6, 15 or 16 */
+  uint16_t u16RegAdd;    /*!< First coil or register written */
+  uint16_t u16CoilsNo;   /*!< Number of coils or registers written */
+  uint32_t u32stamp;     /*!< Slave clock (ms) when the write was applied */
+}
+modbus_change_t;
+
+/**
+ * @struct modbus_journal_t
+ * @brief
+ * Write-change journal of a slave register map, see setJournal().
+ * The dirty bitmap flags every register written since it was consumed,
+ * coils through the registers holding them. The ring keeps the writes in
+ * order; once it is full the oldest write is dropped and counted in
+ * u16lost, the bitmap still flags it.
+ */
+typedef struct {
+  uint16_t *au16dirty;   /*!< Written registers, bit n%16 of word n/16, nullptr = no bitmap */
+  uint16_t u16size;      /*!< Registers covered by au16dirty: (u16size + 15) / 16 words */
+  modbus_change_t *aChanges; /*!< Ring of writes, nullptr = no ring */
+  uint8_t u8entries;     /*!< Size of aChanges */
+  uint16_t u16dirty;     /*!< Number of registers flagged in au16dirty */
+  uint8_t u8first;       /*!< Oldest write of the ring */
+  uint8_t u8count;       /*!< Writes in the ring */
+  uint16_t u16lost;      /*!< Writes dropped from the full ring */
+}
+modbus_journal_t;
+
+/**
+ * @struct modbus_resp_t
+ * @brief
+ * Slave response cache entry:
+ * An encoded read answer (CRC included) kept together with the request that
+ * produced it. It is only valid while u32gen matches the register map generation.
+ */
+typedef struct {
+  uint8_t u8fct;         /*!< Function code of the cached read: 1, 2, 3 or 4 */
+  uint16_t u16RegAdd;    /*!< Start address of the cached read */
+  uint16_t u16CoilsNo;   /*!< Number of coils or registers of the cached read */
+  uint32_t u32gen;       /*!< Register map generation the answer was encoded from */
+  uint32_t u32seq;       /*!< Snapshot sequence the answer was encoded from */
+  uint16_t u16size;      /*!< Answer length including CRC, 0 = empty slot */
+  uint8_t au8Adu[MAX_BUFFER]; /*!< Encoded answer ready to be sent */
+}
+modbus_resp_t;
+
 /**
  * @class Modbus
  * @brief
@@ -164,12 +439,15 @@ const unsigned char fctsupported[] = {
  * USB/RS232/485 (via RTU protocol).
  */
 class Modbus {
+  friend class ModbusBench; //!< times the private frame handlers
 private:
 #if (PLATFORM_ID == 0)
-  USARTSerial *port; //!< Pointer to Serial class object
+  USARTSerial *serial; //!< Pointer to Serial class object, nullptr for other streams
 #else
-  USARTSerial *port; //!< Pointer to Serial class object
+  USARTSerial *serial; //!< Pointer to Serial class object, nullptr for other streams
 #endif
+  Stream *port; //!< Stream carrying the frames: the serial port or a simulated one
+  ModbusClock *clock; //!< time source of every timing decision
   uint8_t u8id; //!< 0=master, 1..247=slave number
   uint8_t u8serno; //!< serial port: 0-Serial, 1..3-Serial1..Serial3
   uint8_t u8txenpin; //!< flow control pin: 0=USB or RS-232 mode, >0=RS-485 mode
@@ -177,43 +455,122 @@ private:
   uint8_t u8state;
   uint8_t u8lastError;
   uint8_t au8Buffer[MAX_BUFFER];
-  uint8_t u8BufferSize;
-  uint8_t u8lastRec;
+  uint16_t u16BufferSize;
+  uint16_t u16lastRec;
+  uint8_t u8T35; //!< silence closing a frame (ms)
   uint16_t *au16regs;
   uint16_t u16InCnt, u16OutCnt, u16errCnt;
   uint16_t u16timeOut;
   uint32_t u32time, u32timeOut;
+  uint32_t u32baud; //!< line speed given to begin()
+#if MODBUS_USER_FUNCTIONS > 0
+  modbus_fct_handler_t aUserFct[MODBUS_USER_FUNCTIONS]; //!< registered handlers, nullptr = free slot
+  uint8_t au8UserFct[MODBUS_USER_FUNCTIONS]; //!< function code of each handler
+  void *aUserContext[MODBUS_USER_FUNCTIONS];
+#endif
+#if MODBUS_ROLES & MODBUS_ROLE_SNIFFER
+  Print *capture; //!< sniffer capture sink, nullptr = no capture
+  uint8_t u8captureFormat;
+  boolean bTruncated; //!< sniffer frame overflowed au8Buffer
+  boolean bReqPending; //!< sniffer saw a request still waiting for its answer
+  uint8_t u8reqId, u8reqFct; //!< address and function of the pending request
+  uint32_t u32frameStart, u32lastByte; //!< sniffer frame timing (us)
+  uint32_t u32lastStamp, u32stampWraps; //!< extend micros() for pcap timestamps
+#endif
+#if MODBUS_ROLES & MODBUS_ROLE_MASTER
+  modbus_t pending; //!< master query in flight
+  modbus_handler_t handler; //!< completion handler of the query in flight, nullptr = none
+  void *handlerContext;
+  uint32_t u32queryStart; //!< when the query in flight was issued (us)
+  modbus_filter_t *filters; //!< report-by-exception filters, nullptr = none
+#endif
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
   uint16_t u16regsize;
+  modbus_binding_t *bindings; //!< virtual register ranges, nullptr = none
+  modbus_journal_t *journal; //!< write-change journal, nullptr = none
+  std::atomic<uint32_t> u32mapSeq; //!< odd while the application updates the map, see beginUpdate()
+#endif
+#if MODBUS_CACHE_ENTRIES > 0
+  modbus_resp_t aCache[MODBUS_CACHE_ENTRIES]; //!< encoded answers to repeated reads
+  uint8_t u8cacheNext; //!< next cache slot to be replaced
+  uint32_t u32cacheGen; //!< register map generation, bumped on every write
+#endif
 
-  void init(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin, uint8_t u8rxenpin, USARTSerial* serial);
+  void init(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin, uint8_t u8rxenpin, USARTSerial* serial, Stream* stream);
   void sendTxBuffer();
-  int8_t getRxBuffer();
-  uint16_t calcCRC(uint8_t u8length);
+  void writeFrame( const uint8_t *frame, uint16_t u16size );
+#if MODBUS_CACHE_ENTRIES > 0
+  uint16_t sendCached();
+  void storeCached( uint8_t u8fct, uint16_t u16add, uint16_t u16no, uint16_t u16size, uint32_t u32seq );
+#endif
+  int16_t getRxBuffer();
+  uint16_t calcCRC(uint16_t u16length);
+  uint8_t fctKind( uint8_t u8fct );
+  uint8_t callUser( uint8_t u8kind, modbus_pdu_t *pdu );
+#if MODBUS_ROLES & MODBUS_ROLE_MASTER
   uint8_t validateAnswer();
-  uint8_t validateRequest();
+  modbus_filter_t *findFilter( uint16_t *regs, uint16_t *pu16base );
+  void flagChange( modbus_filter_t *filter, uint16_t u16point );
   void get_FC1();
   void get_FC3();
-  int8_t process_FC1( uint16_t *regs, uint16_t u16size );
-  int8_t process_FC3( uint16_t *regs, uint16_t u16size );
-  int8_t process_FC5( uint16_t *regs, uint16_t u16size );
-  int8_t process_FC6( uint16_t *regs, uint16_t u16size );
-  int8_t process_FC15( uint16_t *regs, uint16_t u16size );
-  int8_t process_FC16( uint16_t *regs, uint16_t u16size );
+  void complete( uint8_t u8status, uint8_t u8error );
+#endif
+#if MODBUS_ROLES & MODBUS_ROLE_SLAVE
+  uint8_t validateRequest();
+  int16_t process_FC1( uint16_t *regs, uint16_t u16size );
+  int16_t process_FC3( uint16_t *regs, uint16_t u16size );
+  int16_t process_FC5( uint16_t *regs, uint16_t u16size );
+  int16_t process_FC6( uint16_t *regs, uint16_t u16size );
+  int16_t process_FC15( uint16_t *regs, uint16_t u16size );
+  int16_t process_FC16( uint16_t *regs, uint16_t u16size );
+  int16_t process_User( uint8_t u8kind, uint16_t *regs, uint16_t u16size );
+  uint8_t accessBindings( boolean bWrite, uint16_t u16add, uint16_t u16no, boolean *pbBound = nullptr );
+  void stageWrite( uint16_t u16first, uint16_t u16words, uint16_t *au16old );
+  uint8_t acceptWrite( uint16_t u16first, uint16_t u16words, const uint16_t *au16old );
+  int16_t sendException( uint8_t u8exception );
+  void journalWrite( uint16_t u16add, uint16_t u16no );
   void buildException( uint8_t u8exception ); // build exception message
+#endif
+#if MODBUS_ROLES & MODBUS_ROLE_SNIFFER
+  uint32_t charTime();
+  uint16_t splitFrame( const uint8_t *frame, uint16_t u16size, boolean *bCrcOk );
+  boolean isAnswer( const uint8_t *frame, uint16_t u16size );
+  void captureFrame( const uint8_t *frame, uint16_t u16size, uint32_t u32stamp, boolean bCrcOk );
+  int8_t captureBuffer( boolean bSilent );
+#endif
 
 public:
   Modbus();
   Modbus(uint8_t u8id, USARTSerial* serial);
+  Modbus(uint8_t u8id, Stream* stream);
   Modbus(uint8_t u8id, uint8_t u8serno);
   Modbus(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin);
   Modbus(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin, uint8_t u8rxenpin);
   void begin(long u32speed = 19200, long configuration = SERIAL_8N1);
   void setTimeOut( uint16_t u16timeout); //!<write communication watch-dog timer
   uint16_t getTimeOut(); //!<get communication watch-dog timer value
+  void setT35( uint8_t u8t35 ); //!<write inter-frame silence, 0 for streams delivering whole frames
+  uint8_t getT35(); //!<get inter-frame silence (ms)
+  uint32_t getBaud(); //!<get line speed given to begin()
+  void setClock( ModbusClock *clock ); //!<time source, e.g. a ModbusVirtualClock for simulations
+  ModbusClock *getClock(); //!<time source in use
   boolean getTimeOutState(); //!<get communication watch-dog timer state
   int8_t query( modbus_t telegram ); //!<only for master
-  int8_t poll(); //!<cyclic poll for master
-  int8_t poll( uint16_t *regs, uint16_t u16size ); //!<cyclic poll for slave
+  int8_t query( modbus_t telegram, modbus_handler_t handler, void *context = nullptr ); //!<only for master, handler called on completion
+  int16_t poll(); //!<cyclic poll for master
+  int16_t poll( uint16_t *regs, uint16_t u16size ); //!<cyclic poll for slave
+  int8_t sniff(); //!<cyclic poll for sniffer
+  void addFilter( modbus_filter_t *filter ); //!<only for master, report changed points of a data array
+  int32_t nextChange( modbus_filter_t *filter, uint16_t u16from = 0 ); //!<consume the next changed point, -1 if none
+  void addBinding( modbus_binding_t *binding ); //!<only for slave, compute registers on read or act on write
+  void setJournal( modbus_journal_t *journal ); //!<only for slave, record the writes of the master
+  uint8_t consumeChanges( modbus_change_t *changes, uint8_t u8max ); //!<take the oldest writes of the journal
+  int32_t nextWrite( uint16_t u16from = 0 ); //!<take the next register flagged as written, -1 if none
+  void beginUpdate(); //!<only for slave, any thread: the application starts changing the register map
+  void endUpdate(); //!<only for slave, any thread: the changes are over, reads see them all at once
+  void setCapture( Print *sink, uint8_t u8format = CAPTURE_NATIVE ); //!<only for sniffer, where frames are written
+  int8_t setHandler( uint8_t u8fct, modbus_fct_handler_t handler, void *context = nullptr ); //!<serve or decode a function code, nullptr restores the built-in one
+  uint16_t frameLength( const uint8_t *frame, uint16_t u16size ); //!<length of a frame of a setHandler() code being received, 0 if unknown
   uint16_t getInCnt(); //!<number of incoming messages
   uint16_t getOutCnt(); //!<number of outcoming messages
   uint16_t getErrCnt(); //!<error counter
@@ -221,11 +578,14 @@ public:
   uint8_t getState();
   uint8_t getLastError(); //!<get last error message
   void setID( uint8_t u8id ); //!<write new ID for the slave
+  void invalidateCache(); //!<register map changed by the application, drop cached answers
   void end(); //!<finish any communication and release serial communication port
 
   void rxTxMode(uint8_t mode); // takes a 0 or 1 for low or high
 
   bool selfTest();
+
+  static uint16_t crc16(const uint8_t *data, uint16_t u16length); //!<CRC of a frame, high byte sent first
 };
 
 #endif
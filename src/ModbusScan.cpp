@@ -0,0 +1,309 @@
+// ModbusScan.cpp
+
+#include "ModbusScan.h"
+
+/**
+ * Tables asked in SCAN_FUNCTIONS, after FC3 answered the presence probe
+ */
+static const uint8_t au8Functions[] = { MB_FC_READ_COILS, MB_FC_READ_DISCRETE_INPUT, MB_FC_READ_INPUT_REGISTER };
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a scan without ports
+ *
+ * @param caps  cache receiving the responders, ports numbered as by addPort()
+ * @ingroup scan
+ */
+ModbusScan::ModbusScan( ModbusCaps *caps ) {
+  this->caps = caps;
+  this->u8ports = 0;
+  this->u16found = 0;
+  this->u16missed = 0;
+  this->u8last = 0;
+  this->u16turnaround = MODBUS_SCAN_TURNAROUND;
+}
+
+/**
+ * @brief
+ * Add a port to scan: its master, already started with begin()
+ *
+ * @return port index, -1 if MODBUS_SCAN_PORTS ports are already added
+ * @ingroup scan
+ */
+int8_t ModbusScan::addPort( Modbus *master ) {
+  if (u8ports >= MODBUS_SCAN_PORTS) return -1;
+
+  modbus_scanport_t *port = &aPorts[ u8ports ];
+  port->master = master;
+  port->scan = this;
+  port->u8port = u8ports;
+  port->u8id = 0;
+  port->u8phase = SCAN_DONE;
+  port->bBusy = false;
+  return u8ports++;
+}
+
+/**
+ * @brief
+ * Start scanning an address range on every port. Slaves already in the
+ * cache keep what was learned about them, unless they are now silent.
+ *
+ * @param u8first  first address, 1 or more
+ * @param u8last  last address, up to 247
+ * @param u16turnaround  time a slave may take to start answering (ms)
+ * @ingroup scan
+ */
+void ModbusScan::begin( uint8_t u8first, uint8_t u8last, uint16_t u16turnaround ) {
+  if (u8first < 1) u8first = 1;
+  if (u8last > 247) u8last = 247;
+  this->u8last = u8last;
+  this->u16turnaround = u16turnaround;
+  u16found = 0;
+  u16missed = 0;
+
+  for (uint8_t i = 0; i < u8ports; i++) {
+    modbus_scanport_t *port = &aPorts[ i ];
+    if (port->u8phase == SCAN_DONE) port->u16timeOut = port->master->getTimeOut();
+    port->u8id = u8first - 1;
+    port->bBusy = false;
+    nextAddress( port );
+  }
+}
+
+/**
+ * @brief
+ * Drive every port: complete the probe in flight, then send the next
+ * one. This method must be called only at loop section.
+ *
+ * @return true while a port is still scanning
+ * @ingroup scan
+ */
+boolean ModbusScan::poll() {
+  boolean bScanning = false;
+
+  for (uint8_t i = 0; i < u8ports; i++) {
+    modbus_scanport_t *port = &aPorts[ i ];
+    if (port->u8phase == SCAN_DONE) continue;
+
+    port->master->poll(); // completion calls onResult()
+    if (!port->bBusy && port->u8phase != SCAN_DONE) send( port );
+    if (port->u8phase != SCAN_DONE) bScanning = true;
+  }
+  return bScanning;
+}
+
+/**
+ * @brief
+ * Progress of a port
+ *
+ * @return address being probed, 0 once the port is done
+ * @ingroup scan
+ */
+uint8_t ModbusScan::getProgress( uint8_t u8port ) {
+  if (u8port >= u8ports || aPorts[ u8port ].u8phase == SCAN_DONE) return 0;
+  return aPorts[ u8port ].u8id;
+}
+
+/**
+ * @brief
+ * Number of responders of the last scan
+ *
+ * @ingroup scan
+ */
+uint16_t ModbusScan::getFound() {
+  return u16found;
+}
+
+/**
+ * @brief
+ * Number of responders that found no free record in the cache
+ *
+ * @ingroup scan
+ */
+uint16_t ModbusScan::getMissed() {
+  return u16missed;
+}
+
+/**
+ * @brief
+ * Time to wait for an answer once the request is sent: the answer on
+ * the line, the silence that closes it, and the slave turnaround.
+ *
+ * @param master  master, started with begin()
+ * @param u16bytes  bytes of the answer
+ * @param u16turnaround  time the slave may take to start answering (ms)
+ * @return time-out (ms)
+ * @ingroup scan
+ */
+uint16_t ModbusScan::replyTime( Modbus *master, uint16_t u16bytes, uint16_t u16turnaround ) {
+  uint32_t u32line = ((uint32_t) u16bytes * 11000UL + master->getBaud() - 1) / master->getBaud();
+  return u32line + master->getT35() + u16turnaround + 1; // +1: the clock ticks in whole ms
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Send the probe of the current phase, with a time-out that fits its answer
+ *
+ * @ingroup scan
+ */
+void ModbusScan::send( modbus_scanport_t *port ) {
+  modbus_t telegram;
+  boolean bBits = (port->u8fct == MB_FC_READ_COILS || port->u8fct == MB_FC_READ_DISCRETE_INPUT);
+
+  telegram.u8id = port->u8id;
+  telegram.u8fct = port->u8fct;
+  telegram.u16RegAdd = 0;
+  telegram.u16CoilsNo = (port->u8phase == SCAN_BLOCKS) ? blockSize( port ) : 1;
+  telegram.au16reg = port->au16data;
+
+  uint16_t u16bytes = 5 + (bBits ? (telegram.u16CoilsNo + 7) / 8 : 2 * telegram.u16CoilsNo);
+  port->master->setTimeOut( replyTime( port->master, u16bytes, u16turnaround ));
+
+  port->bBusy = true;
+  if (port->master->query( telegram, onResult, port ) != 0) {
+    modbus_result_t result;
+    result.u8status = RESULT_REJECTED;
+    result.u8exception = 0;
+    result.telegram = telegram;
+    result.u32latency = 0;
+    port->bBusy = false;
+    advance( port, &result );
+  }
+}
+
+/**
+ * @brief
+ * Take the outcome of a probe and choose the next one
+ *
+ * @ingroup scan
+ */
+void ModbusScan::advance( modbus_scanport_t *port, const modbus_result_t *result ) {
+  boolean bAnswered = (result->u8status == RESULT_OK || result->u8status == RESULT_EXCEPTION);
+
+  // a frame of another slave, e.g. the late answer of the address probed
+  // before: this one may still answer once the line is free, ask it again
+  if (result->u8status == RESULT_BAD_ANSWER && !port->bStale) {
+    port->bStale = true;
+    return;
+  }
+  port->bStale = false;
+
+  if (port->u8phase == SCAN_PRESENCE) {
+    if (!bAnswered) {
+      if (++port->u8tries > MODBUS_SCAN_RETRIES) {
+        caps->forget( port->u8port, port->u8id );
+        nextAddress( port );
+      }
+      return;
+    }
+    modbus_caps_t *record = caps->add( port->u8port, port->u8id );
+    if (record == nullptr) {
+      u16missed++;
+      nextAddress( port );
+      return;
+    }
+    u16found++;
+    record->u32latency = result->u32latency;
+  }
+  caps->learn( port->u8port, result );
+
+  // next table of the phase
+  if (port->u8phase == SCAN_PRESENCE) {
+    port->u8phase = SCAN_FUNCTIONS;
+    port->u8fct = au8Functions[ 0 ];
+    return;
+  }
+  if (port->u8phase == SCAN_FUNCTIONS) {
+    for (uint8_t i = 0; i < sizeof( au8Functions ) - 1; i++) {
+      if (au8Functions[ i ] == port->u8fct) {
+        port->u8fct = au8Functions[ i + 1 ];
+        return;
+      }
+    }
+    port->u8phase = SCAN_BLOCKS;
+    port->u8fct = 0;
+  }
+
+  // a size answered or refused: bisect the table again, else try the next
+  boolean bBisect = (port->u8fct != 0 && (result->u8status == RESULT_OK ||
+    (result->u8status == RESULT_EXCEPTION && result->u8exception == EXC_REGS_QUANT)));
+  if (nextBlock( port, bBisect ? port->u8fct : port->u8fct + 1 )) return;
+  nextAddress( port );
+}
+
+/**
+ * @brief
+ * Move a port to the next address, or end its scan and restore the
+ * time-out of its master
+ *
+ * @ingroup scan
+ */
+void ModbusScan::nextAddress( modbus_scanport_t *port ) {
+  port->u8phase = SCAN_PRESENCE;
+  port->u8fct = MB_FC_READ_REGISTERS;
+  port->u8tries = 0;
+  port->bStale = false;
+  if (port->u8id >= u8last) {
+    port->u8phase = SCAN_DONE;
+    port->master->setTimeOut( port->u16timeOut );
+    return;
+  }
+  port->u8id++;
+}
+
+/**
+ * @brief
+ * Choose the next table whose read size is not settled: it answered a
+ * one-element read, and neither the largest read nor the size between
+ * the largest read answered and the smallest one refused was found yet
+ *
+ * @param u8fct  first function code to consider
+ * @return false if no table is left
+ * @ingroup scan
+ */
+boolean ModbusScan::nextBlock( modbus_scanport_t *port, uint8_t u8fct ) {
+  const modbus_caps_t *record = caps->find( port->u8port, port->u8id );
+  if (record == nullptr) return false;
+
+  for (; u8fct <= MB_FC_READ_INPUT_REGISTER; u8fct++) {
+    uint16_t u16max = record->au16maxRead[ u8fct - 1 ];
+    uint16_t u16refused = record->au16refused[ u8fct - 1 ];
+    if (u16max == 0) continue;
+    if (u16refused == 0 ? u16max < caps->getMaxRead( port->u8port, port->u8id, u8fct ) : u16refused - u16max > 1) {
+      port->u8fct = u8fct;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief
+ * Size of the next block read: the largest read the buffers allow, then
+ * half way between the largest read answered and the smallest refused
+ *
+ * @ingroup scan
+ */
+uint16_t ModbusScan::blockSize( modbus_scanport_t *port ) {
+  const modbus_caps_t *record = caps->find( port->u8port, port->u8id );
+  uint16_t u16max = record->au16maxRead[ port->u8fct - 1 ];
+  uint16_t u16refused = record->au16refused[ port->u8fct - 1 ];
+  if (u16refused == 0) return caps->getMaxRead( port->u8port, port->u8id, port->u8fct );
+  return u16max + (u16refused - u16max) / 2;
+}
+
+/**
+ * @brief
+ * Completion handler of a master: the probe of a port is over
+ *
+ * @ingroup scan
+ */
+void ModbusScan::onResult( const modbus_result_t *result, void *context ) {
+  modbus_scanport_t *port = (modbus_scanport_t *) context;
+  port->bBusy = false;
+  port->scan->advance( port, result );
+}
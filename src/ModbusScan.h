@@ -0,0 +1,107 @@
+#ifndef MODBUS_SCAN_H
+#define MODBUS_SCAN_H
+
+/**
+ * @file 		ModbusScan.h
+ *
+ * @description
+ *  Slave address discovery.
+ *  Commissioning a segment means finding which of the 247 addresses
+ *  answer. A broadcast is never answered, so each address is probed in
+ *  turn with the smallest request there is, a one-register read: it
+ *  changes nothing on the slave, and any answer proves a slave is there,
+ *  an exception included. The wait for an answer is derived from the
+ *  baud rate instead of the time-out of the master, so silent addresses
+ *  cost a few ms each and a segment is scanned in seconds. Ports are
+ *  independent buses: all of them are scanned at once.
+ *
+ *  Each responder is then asked for the read function codes it supports
+ *  and the largest read it accepts, bisecting the sizes it refuses; the
+ *  results go to a ModbusCaps cache, where request planners find them.
+ *  Addresses that stay silent are dropped from the cache.
+ *
+ * @defgroup scan Modbus Address Discovery
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusCaps.h"
+
+#ifndef MODBUS_SCAN_PORTS
+#define MODBUS_SCAN_PORTS 4	//!< ports scanned at once
+#endif
+#ifndef MODBUS_SCAN_TURNAROUND
+#define MODBUS_SCAN_TURNAROUND 10	//!< time a slave may take to start answering (ms)
+#endif
+#ifndef MODBUS_SCAN_RETRIES
+#define MODBUS_SCAN_RETRIES 0	//!< probes sent again to a silent address
+#endif
+
+/**
+ * @enum SCAN_PHASE
+ * @brief
+ * What a port is asking the address it scans
+ */
+enum SCAN_PHASE {
+  SCAN_PRESENCE                 = 0, //!< one-register read: is anybody there?
+  SCAN_FUNCTIONS                = 1, //!< one-element reads of the other tables
+  SCAN_BLOCKS                   = 2, //!< largest reads of the tables that answered
+  SCAN_DONE                     = 3  //!< every address of the range was probed
+};
+
+class ModbusScan;
+
+/**
+ * @struct modbus_scanport_t
+ * @brief
+ * Scan of one port
+ */
+typedef struct {
+  Modbus *master;        /*!< Master of the port */
+  ModbusScan *scan;      /*!< Scan it belongs to, for the completion handler */
+  uint8_t u8port;        /*!< Port index */
+  uint8_t u8id;          /*!< Address being probed */
+  uint8_t u8phase;       /*!< SCAN_PHASE */
+  uint8_t u8fct;         /*!< Function code being probed */
+  uint8_t u8tries;       /*!< Probes sent to a silent address */
+  boolean bStale;        /*!< Probe sent again after a frame not meant for it */
+  boolean bBusy;         /*!< Probe in flight */
+  uint16_t u16timeOut;   /*!< Time-out of the master, restored after the scan */
+  uint16_t au16data[MAX_BUFFER / 2]; /*!< Data of the probes */
+}
+modbus_scanport_t;
+
+/**
+ * @class ModbusScan
+ * @brief
+ * Discovery of the slaves answering on one or more ports.
+ * The scan owns the masters: nobody else should query() them while it runs.
+ */
+class ModbusScan {
+private:
+  modbus_scanport_t aPorts[MODBUS_SCAN_PORTS];
+  uint8_t u8ports;
+  ModbusCaps *caps;
+  uint16_t u16found;
+  uint8_t u8last; //!< last address of the range
+  uint16_t u16turnaround;
+  uint16_t u16missed; //!< responders without a free record
+
+  void send( modbus_scanport_t *port );
+  void advance( modbus_scanport_t *port, const modbus_result_t *result );
+  void nextAddress( modbus_scanport_t *port );
+  boolean nextBlock( modbus_scanport_t *port, uint8_t u8fct );
+  uint16_t blockSize( modbus_scanport_t *port );
+  static void onResult( const modbus_result_t *result, void *context );
+
+public:
+  ModbusScan( ModbusCaps *caps );
+  int8_t addPort( Modbus *master ); //!<master already started with begin(), returns the port index
+  void begin( uint8_t u8first = 1, uint8_t u8last = 247, uint16_t u16turnaround = MODBUS_SCAN_TURNAROUND ); //!<scan every port
+  boolean poll(); //!<drive the scan, false once every port is done
+  uint8_t getProgress( uint8_t u8port ); //!<address being probed, 0 once the port is done
+  uint16_t getFound(); //!<responders of the last scan
+  uint16_t getMissed(); //!<responders found once the cache was full
+  static uint16_t replyTime( Modbus *master, uint16_t u16bytes, uint16_t u16turnaround ); //!<ms to wait for an answer
+};
+
+#endif
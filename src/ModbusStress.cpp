@@ -0,0 +1,330 @@
+// ModbusStress.cpp
+
+#include "ModbusStress.h"
+#include <stdlib.h>
+
+/**
+ * Largest blocks of the protocol, or less if the buffers are smaller:
+ * answers and requests up to MAX_BUFFER bytes
+ */
+#define STRESS_LIMIT(max, fit) ((max) < (fit) ? (max) : (fit))
+#define STRESS_MAX_READ_REGS   STRESS_LIMIT( MB_MAX_READ_REGISTERS, (MAX_BUFFER - 5) / 2 )
+#define STRESS_MAX_WRITE_REGS  STRESS_LIMIT( MB_MAX_WRITE_REGISTERS, (MAX_BUFFER - 9) / 2 )
+#define STRESS_MAX_READ_COILS  STRESS_LIMIT( MB_MAX_READ_COILS, (MAX_BUFFER - 5) * 8 )
+#define STRESS_MAX_WRITE_COILS STRESS_LIMIT( MB_MAX_WRITE_COILS, (MAX_BUFFER - 9) * 8 )
+#define STRESS_COIL_SPACE      0x10000UL //!< coil addresses 0 to 65535
+
+#define STRESS_STEP_US 10	//!< clock step between two slave polls
+
+/**
+ * Function codes the load generator can build, as a mask
+ */
+#define STRESS_FCTS ((1UL << MB_FC_READ_COILS) | (1UL << MB_FC_READ_DISCRETE_INPUT) | \
+  (1UL << MB_FC_READ_REGISTERS) | (1UL << MB_FC_READ_INPUT_REGISTER) | \
+  (1UL << MB_FC_WRITE_COIL) | (1UL << MB_FC_WRITE_REGISTER) | \
+  (1UL << MB_FC_WRITE_MULTIPLE_COILS) | (1UL << MB_FC_WRITE_MULTIPLE_REGISTERS))
+
+static int compareSamples( const void *a, const void *b ) {
+  uint32_t u32a = *(const uint32_t *) a;
+  uint32_t u32b = *(const uint32_t *) b;
+  return (u32a > u32b) - (u32a < u32b);
+}
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a stress harness. The default mix reads 1 to 16 holding
+ * registers, all addressed to the slave.
+ *
+ * @param slave  slave engine built on port
+ * @param port  loopback the slave reads and writes
+ * @param regs  slave register map, written by the FC5, 6, 15 and 16 requests
+ * @param u16size  slave register map size
+ * @ingroup stress
+ */
+ModbusStress::ModbusStress( Modbus *slave, ModbusLoopback *port, uint16_t *regs, uint16_t u16size ) {
+  this->slave = slave;
+  this->port = port;
+  this->regs = regs;
+  this->u16regsize = u16size;
+  u16sampleCnt = u16sampleNext = 0;
+  u16sent = u16answered = u16foreign = u16late = u16lost = 0;
+  u32elapsed = u32maxLatency = 0;
+  setMix( 1UL << MB_FC_READ_REGISTERS, 16, 0 );
+}
+
+/**
+ * @brief
+ * Request mix of the load generator.
+ * Function codes are drawn evenly among the ones in the mask, block sizes
+ * evenly between 1 and u16maxRegs registers (16 times more coils), within
+ * the register map and the frame size.
+ *
+ * @param u32fctMask  bit n set: function code n is generated, e.g. (1 << 3) | (1 << 16)
+ * @param u16maxRegs  largest register block
+ * @param u8foreignPct  percentage of requests addressed to another slave
+ * @param u32seed  seed of the generator, not 0. The same seed replays the same load.
+ * @ingroup stress
+ */
+void ModbusStress::setMix( uint32_t u32fctMask, uint16_t u16maxRegs, uint8_t u8foreignPct, uint32_t u32seed ) {
+  this->u32fctMask = u32fctMask & STRESS_FCTS;
+  if (this->u32fctMask == 0) this->u32fctMask = 1UL << MB_FC_READ_REGISTERS;
+  this->u16maxRegs = (u16maxRegs > 0) ? u16maxRegs : 1;
+  this->u8foreignPct = (u8foreignPct < 100) ? u8foreignPct : 100;
+  this->u32seed = (u32seed != 0) ? u32seed : 1;
+}
+
+/**
+ * @brief
+ * Fire requests at the slave and measure its turnaround: the time from the
+ * last request byte reaching the slave to its answer being written.
+ * The slave engine is polled every STRESS_STEP_US of its own clock, so the
+ * resolution is STRESS_STEP_US and a ModbusVirtualClock runs the load in
+ * simulated time.
+ *
+ * With an interval, a request is offered every u32intervalUs. A request
+ * whose time came while the slave was still busy with the previous one is
+ * counted late and sent at once. Back to back (0) gives the highest rate the
+ * slave sustains.
+ * The loopback hands over whole frames, so the slave inter-frame silence
+ * (setT35) adds to every turnaround: set it to 0 to measure the processing.
+ *
+ * @param u16requests  requests to send
+ * @param u32intervalUs  offered interval between requests, 0 for back to back
+ * @ingroup stress
+ */
+void ModbusStress::run( uint16_t u16requests, uint32_t u32intervalUs ) {
+  ModbusClock *clock = slave->getClock();
+  u16sampleCnt = u16sampleNext = 0;
+  u16sent = u16answered = u16foreign = u16late = u16lost = 0;
+  u32maxLatency = 0;
+  port->clear();
+
+  uint32_t u32start = clock->micros();
+  uint32_t u32next = u32start;
+
+  for (uint16_t n = 0; n < u16requests; n++) {
+    if (u32intervalUs > 0) {
+      if ((int32_t) (clock->micros() - u32next) > 0) u16late++;
+      while ((int32_t) (clock->micros() - u32next) < 0) clock->delayMicroseconds( STRESS_STEP_US );
+      u32next += u32intervalUs;
+    }
+
+    buildRequest();
+    port->inject( au8Frame, u8FrameSize );
+    uint32_t u32injected = clock->micros();
+    u16sent++;
+
+    while (true) {
+      slave->poll( regs, u16regsize );
+
+      // the slave answers in the poll() call that takes the frame
+      if (port->txAvailable() > 0) {
+        addSample( clock->micros() - u32injected );
+        port->take( nullptr, MODBUS_LOOPBACK_SIZE );
+        u16answered++;
+        break;
+      }
+      if (bForeign && port->available() == 0) {
+        u16foreign++;
+        break;
+      }
+      if (clock->micros() - u32injected > STRESS_LOST_US) {
+        port->clear();
+        u16lost++;
+        break;
+      }
+      clock->delayMicroseconds( STRESS_STEP_US );
+    }
+  }
+
+  u32elapsed = clock->micros() - u32start;
+  qsort( au32samples, u16sampleCnt, sizeof( uint32_t ), compareSamples );
+}
+
+/**
+ * @brief
+ * Print the results of the last run as CSV, header first:
+ * requests,answered,foreign,late,lost,p50_us,p90_us,p99_us,max_us,req_per_s
+ *
+ * @ingroup stress
+ */
+void ModbusStress::report( Print *out ) {
+  out->println( "requests,answered,foreign,late,lost,p50_us,p90_us,p99_us,max_us,req_per_s" );
+  out->printlnf( "%u,%u,%u,%u,%u,%lu,%lu,%lu,%lu,%lu", u16sent, u16answered, u16foreign, u16late, u16lost,
+    (unsigned long) percentile( 50 ), (unsigned long) percentile( 90 ), (unsigned long) percentile( 99 ),
+    (unsigned long) u32maxLatency, (unsigned long) getRate() );
+}
+
+/**
+ * @brief
+ * Latency percentile of the last run, over its last MODBUS_STRESS_SAMPLES
+ * answers
+ *
+ * @param u8pct  percentile, 50 for the median
+ * @return latency (us), 0 if nothing was answered
+ * @ingroup stress
+ */
+uint32_t ModbusStress::getPercentile( uint8_t u8pct ) {
+  return percentile( u8pct );
+}
+
+uint32_t ModbusStress::getMaxLatency() {
+  return u32maxLatency;
+}
+
+/**
+ * @brief
+ * Requests handled per second in the last run, foreign ones included
+ *
+ * @ingroup stress
+ */
+uint32_t ModbusStress::getRate() {
+  if (u32elapsed == 0) return 0;
+  return (uint64_t) (u16answered + u16foreign) * 1000000UL / u32elapsed;
+}
+
+uint16_t ModbusStress::getLate() {
+  return u16late;
+}
+
+uint16_t ModbusStress::getLost() {
+  return u16lost;
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Draw a number (xorshift32)
+ *
+ * @ingroup stress
+ */
+uint32_t ModbusStress::random32() {
+  u32seed ^= u32seed << 13;
+  u32seed ^= u32seed >> 17;
+  u32seed ^= u32seed << 5;
+  return u32seed;
+}
+
+/**
+ * @brief
+ * Draw a block size between 1 and the smallest of the bounds
+ *
+ * @param u32mix  largest block of the mix
+ * @param u32map  largest block fitting in the register map
+ * @param u32frame  largest block fitting in a frame
+ * @ingroup stress
+ */
+uint16_t ModbusStress::pick( uint32_t u32mix, uint32_t u32map, uint32_t u32frame ) {
+  uint32_t u32max = u32mix;
+  if (u32map < u32max) u32max = u32map;
+  if (u32frame < u32max) u32max = u32frame;
+  if (u32max <= 1) return 1;
+  return 1 + random32() % u32max;
+}
+
+/**
+ * @brief
+ * Build the next request of the mix in au8Frame, CRC included
+ *
+ * @ingroup stress
+ */
+void ModbusStress::buildRequest() {
+  // function code: the n-th bit set in the mask
+  uint8_t u8fcts = 0;
+  for (uint8_t i = 0; i < 32; i++) if (bitRead( u32fctMask, i )) u8fcts++;
+  uint8_t u8skip = random32() % u8fcts;
+  uint8_t u8fct = 0;
+  for (uint8_t i = 0; i < 32; i++) {
+    if (!bitRead( u32fctMask, i )) continue;
+    if (u8skip-- == 0) {
+      u8fct = i;
+      break;
+    }
+  }
+
+  bForeign = (random32() % 100) < u8foreignPct;
+  uint8_t u8id = slave->getID();
+  if (bForeign) u8id = (u8id < 247) ? u8id + 1 : 1;
+
+  // coils of the map, within the 16-bit coil addresses; pick() keeps
+  // blocks within MB_MAX_READ_COILS and MB_MAX_WRITE_COILS
+  uint32_t u32coils = (uint32_t) u16regsize * 16;
+  if (u32coils > STRESS_COIL_SPACE) u32coils = STRESS_COIL_SPACE;
+  uint16_t u16add, u16no;
+  switch( u8fct ) {
+  case MB_FC_READ_COILS:
+  case MB_FC_READ_DISCRETE_INPUT:
+    u16no = pick( (uint32_t) u16maxRegs * 16, u32coils, STRESS_MAX_READ_COILS );
+    u16add = random32() % (u32coils - u16no + 1);
+    break;
+  case MB_FC_WRITE_MULTIPLE_COILS:
+    u16no = pick( (uint32_t) u16maxRegs * 16, u32coils, STRESS_MAX_WRITE_COILS );
+    u16add = random32() % (u32coils - u16no + 1);
+    break;
+  case MB_FC_WRITE_COIL:
+    u16no = (random32() & 1) ? 0xff00 : 0;
+    u16add = random32() % u32coils;
+    break;
+  case MB_FC_WRITE_REGISTER:
+    u16no = random32();
+    u16add = random32() % u16regsize;
+    break;
+  case MB_FC_WRITE_MULTIPLE_REGISTERS:
+    u16no = pick( u16maxRegs, u16regsize, STRESS_MAX_WRITE_REGS );
+    u16add = random32() % (u16regsize - u16no + 1);
+    break;
+  default:
+    u16no = pick( u16maxRegs, u16regsize, STRESS_MAX_READ_REGS );
+    u16add = random32() % (u16regsize - u16no + 1);
+    break;
+  }
+
+  au8Frame[ ID ] = u8id;
+  au8Frame[ FUNC ] = u8fct;
+  au8Frame[ ADD_HI ] = highByte( u16add );
+  au8Frame[ ADD_LO ] = lowByte( u16add );
+  au8Frame[ NB_HI ] = highByte( u16no );
+  au8Frame[ NB_LO ] = lowByte( u16no );
+  u8FrameSize = 6;
+
+  if (u8fct == MB_FC_WRITE_MULTIPLE_COILS || u8fct == MB_FC_WRITE_MULTIPLE_REGISTERS) {
+    uint8_t u8bytes = (u8fct == MB_FC_WRITE_MULTIPLE_COILS) ? (u16no + 7) / 8 : u16no * 2;
+    au8Frame[ BYTE_CNT ] = u8bytes;
+    u8FrameSize = 7;
+    for (uint8_t i = 0; i < u8bytes; i++) au8Frame[ u8FrameSize++ ] = random32();
+  }
+
+  uint16_t u16crc = Modbus::crc16( au8Frame, u8FrameSize );
+  au8Frame[ u8FrameSize++ ] = highByte( u16crc );
+  au8Frame[ u8FrameSize++ ] = lowByte( u16crc );
+}
+
+/**
+ * @brief
+ * Keep a latency, the oldest one is overwritten once the ring is full
+ *
+ * @ingroup stress
+ */
+void ModbusStress::addSample( uint32_t u32latency ) {
+  au32samples[ u16sampleNext ] = u32latency;
+  u16sampleNext = (u16sampleNext + 1) % MODBUS_STRESS_SAMPLES;
+  if (u16sampleCnt < MODBUS_STRESS_SAMPLES) u16sampleCnt++;
+  if (u32latency > u32maxLatency) u32maxLatency = u32latency;
+}
+
+/**
+ * @brief
+ * Nearest rank percentile of the samples, sorted at the end of run()
+ *
+ * @ingroup stress
+ */
+uint32_t ModbusStress::percentile( uint8_t u8pct ) {
+  if (u16sampleCnt == 0) return 0;
+  uint16_t u16rank = ((uint32_t) u16sampleCnt * u8pct + 99) / 100;
+  if (u16rank > 0) u16rank--;
+  if (u16rank >= u16sampleCnt) u16rank = u16sampleCnt - 1;
+  return au32samples[ u16rank ];
+}
@@ -0,0 +1,69 @@
+#ifndef MODBUS_STRESS_H
+#define MODBUS_STRESS_H
+
+/**
+ * @file 		ModbusStress.h
+ *
+ * @description
+ *  Slave turnaround stress harness.
+ *  A load generator plays a master firing requests at a slave engine through
+ *  a ModbusLoopback, either back to back or at a fixed offered rate. The
+ *  mix of function codes, block sizes and frames addressed to other slaves
+ *  is configurable. It measures the latency from the end of each request to
+ *  the start of its answer (percentiles and maximum) and the request rate
+ *  the slave sustained.
+ *
+ * @defgroup stress Modbus Slave Stress Harness
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusLoopback.h"
+
+#ifndef MODBUS_STRESS_SAMPLES
+#define MODBUS_STRESS_SAMPLES 256	//!< latencies kept for the percentiles (most recent ones)
+#endif
+
+#define STRESS_LOST_US 100000	//!< a request without answer after this time is counted as lost
+
+/**
+ * @class ModbusStress
+ * @brief
+ * Load generator and latency meter for a slave engine.
+ */
+class ModbusStress {
+private:
+  Modbus *slave;
+  ModbusLoopback *port;
+  uint16_t *regs;
+  uint16_t u16regsize;
+  uint32_t u32fctMask; //!< bit n set: function code n is generated
+  uint16_t u16maxRegs; //!< largest register block, coils are 16 times more
+  uint8_t u8foreignPct; //!< percentage of requests sent to another address
+  uint32_t u32seed;
+  uint8_t au8Frame[MAX_BUFFER];
+  uint8_t u8FrameSize;
+  boolean bForeign; //!< the last request was for another slave
+  uint32_t au32samples[MODBUS_STRESS_SAMPLES];
+  uint16_t u16sampleCnt, u16sampleNext;
+  uint16_t u16sent, u16answered, u16foreign, u16late, u16lost;
+  uint32_t u32elapsed, u32maxLatency;
+
+  uint32_t random32();
+  uint16_t pick( uint32_t u32mix, uint32_t u32map, uint32_t u32frame );
+  void buildRequest();
+  void addSample( uint32_t u32latency );
+  uint32_t percentile( uint8_t u8pct );
+
+public:
+  ModbusStress( Modbus *slave, ModbusLoopback *port, uint16_t *regs, uint16_t u16size );
+  void setMix( uint32_t u32fctMask, uint16_t u16maxRegs, uint8_t u8foreignPct, uint32_t u32seed = 1 ); //!<request mix
+  void run( uint16_t u16requests, uint32_t u32intervalUs = 0 ); //!<0 = back to back
+  void report( Print *out ); //!<print the CSV header and results
+  uint32_t getPercentile( uint8_t u8pct ); //!<latency percentile (us)
+  uint32_t getMaxLatency(); //!<worst latency (us)
+  uint32_t getRate(); //!<answered requests per second
+  uint16_t getLate(); //!<offered requests that found the slave still busy
+  uint16_t getLost(); //!<requests never answered
+};
+
+#endif
@@ -0,0 +1,456 @@
+// ModbusTags.cpp
+
+#include "ModbusTags.h"
+
+/**
+ * Register as sent on the line, or with its bytes swapped
+ */
+static inline uint16_t orderWord( uint16_t u16reg, uint8_t u8order ) {
+  return (u8order & TAG_BYTE_SWAP) ? __builtin_bswap16( u16reg ) : u16reg;
+}
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a tag map
+ *
+ * @param tags  typed points, they must stay alive
+ * @param u8tags  number of points
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+ModbusTags::ModbusTags( const modbus_tag_t *tags, uint8_t u8tags, uint8_t u8order ) {
+  this->aTags = tags;
+  this->u8tags = u8tags;
+  this->u8order = u8order;
+}
+
+/**
+ * @brief
+ * Find a tag by its name
+ *
+ * @return tag index, -1 if no tag has this name
+ * @ingroup tags
+ */
+int16_t ModbusTags::find( const char *szName ) {
+  for (uint8_t i = 0; i < u8tags; i++) {
+    if (strcmp( aTags[ i ].szName, szName ) == 0) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief
+ * Number of registers of a tag, e.g. to size a telegram
+ *
+ * @ingroup tags
+ */
+uint8_t ModbusTags::getSize( uint8_t u8tag ) {
+  return sizeOf( &aTags[ u8tag ] );
+}
+
+/**
+ * @brief
+ * Number of registers of a tag of any map
+ *
+ * @ingroup tags
+ */
+uint8_t ModbusTags::sizeOf( const modbus_tag_t *tag ) {
+  switch( tag->u8type ) {
+  case TAG_UINT32:
+  case TAG_INT32:
+  case TAG_FLOAT:
+    return 2;
+  case TAG_UINT64:
+  case TAG_INT64:
+  case TAG_DOUBLE:
+    return 4;
+  case TAG_STRING:
+    return tag->u8size;
+  }
+  return 1;
+}
+
+/**
+ * @brief
+ * Value of a numeric tag, see getValue()
+ *
+ * @param regs  data array of the tag map
+ * @param u8tag  tag index
+ * @return value of the tag, 0 for a string
+ * @ingroup tags
+ */
+double ModbusTags::get( const uint16_t *regs, uint8_t u8tag ) {
+  return getValue( regs, &aTags[ u8tag ], u8order );
+}
+
+/**
+ * @brief
+ * Write a numeric tag, see setValue()
+ *
+ * @param regs  data array of the tag map
+ * @param u8tag  tag index
+ * @param value  value of the tag
+ * @ingroup tags
+ */
+void ModbusTags::set( uint16_t *regs, uint8_t u8tag, double value ) {
+  setValue( regs, &aTags[ u8tag ], value, u8order );
+}
+
+/**
+ * @brief
+ * Text of a string tag, see getText()
+ *
+ * @param regs  data array of the tag map
+ * @param u8tag  tag index
+ * @param dest  destination, always terminated
+ * @param u8size  size of dest
+ * @return length of the text
+ * @ingroup tags
+ */
+uint8_t ModbusTags::getString( const uint16_t *regs, uint8_t u8tag, char *dest, uint8_t u8size ) {
+  return getText( regs, &aTags[ u8tag ], u8order, dest, u8size );
+}
+
+/**
+ * @brief
+ * Write a string tag, see setText()
+ *
+ * @param regs  data array of the tag map
+ * @param u8tag  tag index
+ * @param src  text
+ * @ingroup tags
+ */
+void ModbusTags::setString( uint16_t *regs, uint8_t u8tag, const char *src ) {
+  setText( regs, &aTags[ u8tag ], src, u8order );
+}
+
+/**
+ * @brief
+ * Decode every numeric tag of the map, e.g. after each read
+ *
+ * @param regs  data array of the tag map
+ * @param values  one value per tag, 0 for strings
+ * @ingroup tags
+ */
+void ModbusTags::decode( const uint16_t *regs, double *values ) {
+  for (uint8_t i = 0; i < u8tags; i++) values[ i ] = get( regs, i );
+}
+
+/**
+ * @brief
+ * Value of a numeric tag of any map. 64-bit integers beyond 2^53 lose
+ * their low bits, use getUint64() to keep them.
+ *
+ * @param regs  data array of the tag
+ * @param tag  typed point
+ * @param u8order  TAG_ORDER of the device
+ * @return value of the tag, 0 for a string
+ * @ingroup tags
+ */
+double ModbusTags::getValue( const uint16_t *regs, const modbus_tag_t *tag, uint8_t u8order ) {
+  const uint16_t *point = &regs[ tag->u16offset ];
+  uint32_t u32bits;
+  uint64_t u64bits;
+  float fValue;
+  double dValue;
+
+  switch( tag->u8type ) {
+  case TAG_UINT16:
+    return orderWord( point[ 0 ], u8order );
+  case TAG_INT16:
+    return (int16_t) orderWord( point[ 0 ], u8order );
+  case TAG_UINT32:
+    return getUint32( point, u8order );
+  case TAG_INT32:
+    return (int32_t) getUint32( point, u8order );
+  case TAG_FLOAT:
+    u32bits = getUint32( point, u8order );
+    memcpy( &fValue, &u32bits, sizeof( fValue ));
+    return fValue;
+  case TAG_UINT64:
+    return getUint64( point, u8order );
+  case TAG_INT64:
+    return (int64_t) getUint64( point, u8order );
+  case TAG_DOUBLE:
+    u64bits = getUint64( point, u8order );
+    memcpy( &dValue, &u64bits, sizeof( dValue ));
+    return dValue;
+  case TAG_BIT:
+    return bitRead( point[ 0 ], tag->u8size );
+  }
+  return 0;
+}
+
+/**
+ * @brief
+ * Write a numeric tag of any map, e.g. before a write telegram. The
+ * value is rounded toward 0 and wraps around for integer tags.
+ *
+ * @param regs  data array of the tag
+ * @param tag  typed point
+ * @param value  value of the tag
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+void ModbusTags::setValue( uint16_t *regs, const modbus_tag_t *tag, double value, uint8_t u8order ) {
+  uint16_t *point = &regs[ tag->u16offset ];
+  uint32_t u32bits;
+  uint64_t u64bits;
+  float fValue;
+
+  switch( tag->u8type ) {
+  case TAG_UINT16:
+  case TAG_INT16:
+    point[ 0 ] = orderWord( (uint16_t) (int32_t) value, u8order );
+    break;
+  case TAG_UINT32:
+  case TAG_INT32:
+    setUint32( point, (uint32_t) (int64_t) value, u8order );
+    break;
+  case TAG_FLOAT:
+    fValue = value;
+    memcpy( &u32bits, &fValue, sizeof( u32bits ));
+    setUint32( point, u32bits, u8order );
+    break;
+  case TAG_UINT64:
+    setUint64( point, (uint64_t) value, u8order );
+    break;
+  case TAG_INT64:
+    setUint64( point, (uint64_t) (int64_t) value, u8order );
+    break;
+  case TAG_DOUBLE:
+    memcpy( &u64bits, &value, sizeof( u64bits ));
+    setUint64( point, u64bits, u8order );
+    break;
+  case TAG_BIT:
+    bitWrite( point[ 0 ], tag->u8size, value != 0 );
+    break;
+  }
+}
+
+/**
+ * @brief
+ * Text of a string tag of any map. Two characters per register, the
+ * first one in the high byte unless the profile swaps bytes; the text
+ * ends at the first NUL or at the end of the tag.
+ *
+ * @param regs  data array of the tag
+ * @param tag  typed point
+ * @param u8order  TAG_ORDER of the device
+ * @param dest  destination, always terminated
+ * @param u8size  size of dest
+ * @return length of the text
+ * @ingroup tags
+ */
+uint8_t ModbusTags::getText( const uint16_t *regs, const modbus_tag_t *tag, uint8_t u8order, char *dest, uint8_t u8size ) {
+  uint8_t u8len = 0;
+
+  if (u8size == 0) return 0;
+  for (uint16_t i = 0; i < tag->u8size * 2 && u8len + 1 < u8size; i++) {
+    uint16_t u16reg = orderWord( regs[ tag->u16offset + i / 2 ], u8order );
+    char c = (i % 2) ? lowByte( u16reg ) : highByte( u16reg );
+    if (c == 0) break;
+    dest[ u8len++ ] = c;
+  }
+  dest[ u8len ] = 0;
+  return u8len;
+}
+
+/**
+ * @brief
+ * Write a string tag of any map, cut to its size and padded with NUL
+ *
+ * @param regs  data array of the tag
+ * @param tag  typed point
+ * @param src  text
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+void ModbusTags::setText( uint16_t *regs, const modbus_tag_t *tag, const char *src, uint8_t u8order ) {
+  uint16_t u16len = strlen( src );
+
+  for (uint8_t i = 0; i < tag->u8size; i++) {
+    uint8_t u8high = (i * 2 < u16len) ? src[ i * 2 ] : 0;
+    uint8_t u8low = (i * 2 + 1 < u16len) ? src[ i * 2 + 1 ] : 0;
+    regs[ tag->u16offset + i ] = orderWord( word( u8high, u8low ), u8order );
+  }
+}
+
+/**
+ * @brief
+ * 32-bit value held by 2 registers
+ *
+ * @param regs  first register
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+uint32_t ModbusTags::getUint32( const uint16_t *regs, uint8_t u8order ) {
+  uint16_t u16first = orderWord( regs[ 0 ], u8order );
+  uint16_t u16second = orderWord( regs[ 1 ], u8order );
+  return (u8order & TAG_WORD_SWAP) ? ((uint32_t) u16second << 16) | u16first : ((uint32_t) u16first << 16) | u16second;
+}
+
+/**
+ * @brief
+ * Write a 32-bit value into 2 registers
+ *
+ * @ingroup tags
+ */
+void ModbusTags::setUint32( uint16_t *regs, uint32_t u32value, uint8_t u8order ) {
+  uint16_t u16high = orderWord( u32value >> 16, u8order );
+  uint16_t u16low = orderWord( u32value & 0xFFFF, u8order );
+  regs[ 0 ] = (u8order & TAG_WORD_SWAP) ? u16low : u16high;
+  regs[ 1 ] = (u8order & TAG_WORD_SWAP) ? u16high : u16low;
+}
+
+/**
+ * @brief
+ * 64-bit value held by 4 registers, words reversed by TAG_WORD_SWAP
+ *
+ * @param regs  first register
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+uint64_t ModbusTags::getUint64( const uint16_t *regs, uint8_t u8order ) {
+  uint64_t u64value = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    uint16_t u16reg = orderWord( regs[ (u8order & TAG_WORD_SWAP) ? 3 - i : i ], u8order );
+    u64value = (u64value << 16) | u16reg;
+  }
+  return u64value;
+}
+
+/**
+ * @brief
+ * Write a 64-bit value into 4 registers
+ *
+ * @ingroup tags
+ */
+void ModbusTags::setUint64( uint16_t *regs, uint64_t u64value, uint8_t u8order ) {
+  for (uint8_t i = 0; i < 4; i++) {
+    uint16_t u16reg = orderWord( (u64value >> (48 - 16 * i)) & 0xFFFF, u8order );
+    regs[ (u8order & TAG_WORD_SWAP) ? 3 - i : i ] = u16reg;
+  }
+}
+
+/**
+ * @brief
+ * Decode a block of 2-register values in one pass, e.g. 62 values of a
+ * 125-register read. Each order has its own loop without branches, so
+ * that the compiler vectorizes it.
+ *
+ * @param regs  first register of the block
+ * @param dest  u16count values
+ * @param u16count  number of values
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+void ModbusTags::toUint32( const uint16_t *regs, uint32_t *dest, uint16_t u16count, uint8_t u8order ) {
+  switch( u8order ) {
+  case ORDER_ABCD:
+    for (uint16_t i = 0; i < u16count; i++) dest[ i ] = ((uint32_t) regs[ 2 * i ] << 16) | regs[ 2 * i + 1 ];
+    break;
+  case ORDER_CDAB:
+    for (uint16_t i = 0; i < u16count; i++) dest[ i ] = ((uint32_t) regs[ 2 * i + 1 ] << 16) | regs[ 2 * i ];
+    break;
+  case ORDER_BADC:
+    for (uint16_t i = 0; i < u16count; i++) {
+      dest[ i ] = ((uint32_t) __builtin_bswap16( regs[ 2 * i ] ) << 16) | __builtin_bswap16( regs[ 2 * i + 1 ] );
+    }
+    break;
+  case ORDER_DCBA:
+    for (uint16_t i = 0; i < u16count; i++) {
+      dest[ i ] = ((uint32_t) __builtin_bswap16( regs[ 2 * i + 1 ] ) << 16) | __builtin_bswap16( regs[ 2 * i ] );
+    }
+    break;
+  }
+}
+
+/**
+ * @brief
+ * Encode a block of 2-register values in one pass, e.g. before a write
+ * telegram
+ *
+ * @param src  u16count values
+ * @param regs  first register of the block
+ * @param u16count  number of values
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+void ModbusTags::fromUint32( const uint32_t *src, uint16_t *regs, uint16_t u16count, uint8_t u8order ) {
+  switch( u8order ) {
+  case ORDER_ABCD:
+    for (uint16_t i = 0; i < u16count; i++) {
+      regs[ 2 * i ] = src[ i ] >> 16;
+      regs[ 2 * i + 1 ] = src[ i ] & 0xFFFF;
+    }
+    break;
+  case ORDER_CDAB:
+    for (uint16_t i = 0; i < u16count; i++) {
+      regs[ 2 * i ] = src[ i ] & 0xFFFF;
+      regs[ 2 * i + 1 ] = src[ i ] >> 16;
+    }
+    break;
+  case ORDER_BADC:
+    for (uint16_t i = 0; i < u16count; i++) {
+      regs[ 2 * i ] = __builtin_bswap16( src[ i ] >> 16 );
+      regs[ 2 * i + 1 ] = __builtin_bswap16( src[ i ] & 0xFFFF );
+    }
+    break;
+  case ORDER_DCBA:
+    for (uint16_t i = 0; i < u16count; i++) {
+      regs[ 2 * i ] = __builtin_bswap16( src[ i ] & 0xFFFF );
+      regs[ 2 * i + 1 ] = __builtin_bswap16( src[ i ] >> 16 );
+    }
+    break;
+  }
+}
+
+/**
+ * @brief
+ * Decode a block of floats in one pass
+ *
+ * @param regs  first register of the block
+ * @param dest  u16count floats
+ * @param u16count  number of floats
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+void ModbusTags::toFloat( const uint16_t *regs, float *dest, uint16_t u16count, uint8_t u8order ) {
+  static_assert( sizeof( float ) == sizeof( uint32_t ), "IEEE 754 single expected" );
+  uint32_t au32bits[ MB_MAX_READ_REGISTERS / 2 ];
+
+  while (u16count > 0) {
+    uint16_t u16part = (u16count < MB_MAX_READ_REGISTERS / 2) ? u16count : MB_MAX_READ_REGISTERS / 2;
+    toUint32( regs, au32bits, u16part, u8order );
+    memcpy( dest, au32bits, u16part * sizeof( float ));
+    regs += 2 * u16part;
+    dest += u16part;
+    u16count -= u16part;
+  }
+}
+
+/**
+ * @brief
+ * Encode a block of floats in one pass
+ *
+ * @param src  u16count floats
+ * @param regs  first register of the block
+ * @param u16count  number of floats
+ * @param u8order  TAG_ORDER of the device
+ * @ingroup tags
+ */
+void ModbusTags::fromFloat( const float *src, uint16_t *regs, uint16_t u16count, uint8_t u8order ) {
+  uint32_t au32bits[ MB_MAX_WRITE_REGISTERS / 2 ];
+
+  while (u16count > 0) {
+    uint16_t u16part = (u16count < MB_MAX_WRITE_REGISTERS / 2) ? u16count : MB_MAX_WRITE_REGISTERS / 2;
+    memcpy( au32bits, src, u16part * sizeof( float ));
+    fromUint32( au32bits, regs, u16part, u8order );
+    src += u16part;
+    regs += 2 * u16part;
+    u16count -= u16part;
+  }
+}
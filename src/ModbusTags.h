@@ -0,0 +1,106 @@
+#ifndef MODBUS_TAGS_H
+#define MODBUS_TAGS_H
+
+/**
+ * @file 		ModbusTags.h
+ *
+ * @description
+ *  Typed data mapping.
+ *  Registers read by a master hold 32 and 64-bit integers, floats and
+ *  strings, in the word and byte order chosen by each vendor. A tag map
+ *  declares the typed points of a device over its data array once; the
+ *  device order profile is given with it, and every point is decoded or
+ *  encoded the same way for every driver. Blocks of 32-bit values are
+ *  converted in a single pass, a loop the compiler turns into byte
+ *  reversal instructions, or vector ones on hosts.
+ *
+ * @defgroup tags Modbus Typed Data Mapping
+ */
+
+#include "ModbusRtu.h"
+
+#define TAG_WORD_SWAP 0x01	//!< low word first
+#define TAG_BYTE_SWAP 0x02	//!< low byte first in each register
+
+/**
+ * @enum TAG_ORDER
+ * @brief
+ * Order profile of a device, named after the bytes of 0xAABBCCDD on the line
+ */
+enum TAG_ORDER {
+  ORDER_ABCD                    = 0,                             //!< Modbus standard: high word first, high byte first
+  ORDER_CDAB                    = TAG_WORD_SWAP,                 //!< low word first
+  ORDER_BADC                    = TAG_BYTE_SWAP,                 //!< low byte first in each register
+  ORDER_DCBA                    = TAG_WORD_SWAP | TAG_BYTE_SWAP  //!< little endian
+};
+
+/**
+ * @enum TAG_TYPE
+ * @brief
+ * Type of a point
+ */
+enum TAG_TYPE {
+  TAG_UINT16                    = 0, //!< 1 register
+  TAG_INT16                     = 1, //!< 1 register
+  TAG_UINT32                    = 2, //!< 2 registers
+  TAG_INT32                     = 3, //!< 2 registers
+  TAG_FLOAT                     = 4, //!< 2 registers, IEEE 754 single
+  TAG_UINT64                    = 5, //!< 4 registers
+  TAG_INT64                     = 6, //!< 4 registers
+  TAG_DOUBLE                    = 7, //!< 4 registers, IEEE 754 double
+  TAG_STRING                    = 8, //!< u8size registers, 2 characters each
+  TAG_BIT                       = 9  //!< bit u8size of a register, e.g. of a FC1 or FC2 read
+};
+
+/**
+ * @struct modbus_tag_t
+ * @brief
+ * Typed point of a data array
+ */
+typedef struct {
+  const char *szName;    /*!< Name of the point */
+  uint16_t u16offset;    /*!< First register of the point in the data array */
+  uint8_t u8type;        /*!< TAG_TYPE */
+  uint8_t u8size;        /*!< TAG_STRING: number of registers, TAG_BIT: bit 0..15, ignored otherwise */
+}
+modbus_tag_t;
+
+/**
+ * @class ModbusTags
+ * @brief
+ * Tag map of a device over a data array, with the order profile of the device
+ */
+class ModbusTags {
+private:
+  const modbus_tag_t *aTags;
+  uint8_t u8tags;
+  uint8_t u8order;
+
+public:
+  ModbusTags( const modbus_tag_t *tags, uint8_t u8tags, uint8_t u8order = ORDER_ABCD );
+  int16_t find( const char *szName ); //!<tag index, -1 if none
+  uint8_t getSize( uint8_t u8tag ); //!<registers of a tag
+  double get( const uint16_t *regs, uint8_t u8tag ); //!<numeric tag as a double
+  void set( uint16_t *regs, uint8_t u8tag, double value ); //!<numeric tag from a double
+  uint8_t getString( const uint16_t *regs, uint8_t u8tag, char *dest, uint8_t u8size ); //!<string tag, returns its length
+  void setString( uint16_t *regs, uint8_t u8tag, const char *src ); //!<string tag, padded with NUL
+  void decode( const uint16_t *regs, double *values ); //!<every numeric tag in one pass
+
+  static uint8_t sizeOf( const modbus_tag_t *tag ); //!<registers of a tag of any map
+  static double getValue( const uint16_t *regs, const modbus_tag_t *tag, uint8_t u8order ); //!<any tag map: numeric tag as a double
+  static void setValue( uint16_t *regs, const modbus_tag_t *tag, double value, uint8_t u8order );
+  static uint8_t getText( const uint16_t *regs, const modbus_tag_t *tag, uint8_t u8order, char *dest, uint8_t u8size ); //!<any tag map: string tag
+  static void setText( uint16_t *regs, const modbus_tag_t *tag, const char *src, uint8_t u8order );
+  static uint32_t getUint32( const uint16_t *regs, uint8_t u8order ); //!<2 registers, exact
+  static void setUint32( uint16_t *regs, uint32_t u32value, uint8_t u8order );
+  static uint64_t getUint64( const uint16_t *regs, uint8_t u8order ); //!<4 registers, exact
+  static void setUint64( uint16_t *regs, uint64_t u64value, uint8_t u8order );
+  static void toUint32( const uint16_t *regs, uint32_t *dest, uint16_t u16count, uint8_t u8order ); //!<block of 2-register values
+  static void fromUint32( const uint32_t *src, uint16_t *regs, uint16_t u16count, uint8_t u8order );
+  static void toFloat( const uint16_t *regs, float *dest, uint16_t u16count, uint8_t u8order ); //!<block of floats
+  static void fromFloat( const float *src, uint16_t *regs, uint16_t u16count, uint8_t u8order );
+  static void toInt32( const uint16_t *regs, int32_t *dest, uint16_t u16count, uint8_t u8order ) { toUint32( regs, (uint32_t *) dest, u16count, u8order ); }
+  static void fromInt32( const int32_t *src, uint16_t *regs, uint16_t u16count, uint8_t u8order ) { fromUint32( (const uint32_t *) src, regs, u16count, u8order ); }
+};
+
+#endif
@@ -0,0 +1,183 @@
+// ModbusTask.cpp
+
+#include "ModbusTask.h"
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a task, ready to run from the start
+ *
+ * @ingroup task
+ */
+ModbusTask::ModbusTask() {
+  u8state = TASK_READY;
+  u16line = 0;
+  next = nullptr;
+  result.u8status = RESULT_OK;
+  result.u8exception = 0;
+  result.u32latency = 0;
+}
+
+uint8_t ModbusTask::getState() {
+  return u8state;
+}
+
+/**
+ * @brief
+ * Run the task again from the start. Ignored while a bus operation
+ * of the task is queued or in flight.
+ *
+ * @ingroup task
+ */
+void ModbusTask::restart() {
+  if (u8state == TASK_QUEUED || u8state == TASK_ACTIVE) return;
+  u16line = 0;
+  u8state = TASK_READY;
+}
+
+/**
+ * @brief
+ * Constructor of a sequencer driving a master
+ *
+ * @param master  Modbus master (u8id = 0) already started with begin()
+ * @ingroup task
+ */
+ModbusSequencer::ModbusSequencer( Modbus *master ) {
+  this->master = master;
+  this->tasks = nullptr;
+  this->active = nullptr;
+  this->served = nullptr;
+}
+
+/**
+ * @brief
+ * Add a task. It must stay in place as long as the sequencer is polled.
+ *
+ * @ingroup task
+ */
+void ModbusSequencer::add( ModbusTask *task ) {
+  task->next = nullptr;
+  ModbusTask **link = &tasks;
+  while (*link != nullptr) link = &(*link)->next;
+  *link = task;
+}
+
+/**
+ * @brief
+ * Drive the master and the tasks: complete the operation in flight, start
+ * the next queued one and resume every task that is not waiting for the bus.
+ * This method must be called only at loop section.
+ *
+ * @return number of tasks not done yet
+ * @ingroup task
+ */
+uint8_t ModbusSequencer::poll() {
+  master->poll(); // completion calls onResult()
+
+  uint8_t u8alive = 0;
+  for (ModbusTask *task = tasks; task != nullptr; task = task->next) {
+    if (task->u8state == TASK_READY) task->u8state = task->run();
+    if (task->u8state != TASK_DONE) u8alive++;
+  }
+
+  if (active == nullptr) startNext();
+  return u8alive;
+}
+
+/**
+ * @brief
+ * Bus operations, to be used inside TASK_AWAIT().
+ * Read data lands in dest, one bit per coil for coils and inputs.
+ *
+ * @ingroup task
+ */
+void ModbusTask::readCoils( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest ) {
+  prepare( u8id, MB_FC_READ_COILS, u16add, u16no, dest );
+}
+
+void ModbusTask::readDiscrete( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest ) {
+  prepare( u8id, MB_FC_READ_DISCRETE_INPUT, u16add, u16no, dest );
+}
+
+void ModbusTask::readHolding( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest ) {
+  prepare( u8id, MB_FC_READ_REGISTERS, u16add, u16no, dest );
+}
+
+void ModbusTask::readInput( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest ) {
+  prepare( u8id, MB_FC_READ_INPUT_REGISTER, u16add, u16no, dest );
+}
+
+void ModbusTask::writeCoil( uint8_t u8id, uint16_t u16add, boolean bValue ) {
+  u16value = bValue ? 1 : 0;
+  prepare( u8id, MB_FC_WRITE_COIL, u16add, 1, &u16value );
+}
+
+void ModbusTask::writeRegister( uint8_t u8id, uint16_t u16add, uint16_t u16value ) {
+  this->u16value = u16value;
+  prepare( u8id, MB_FC_WRITE_REGISTER, u16add, 1, &this->u16value );
+}
+
+void ModbusTask::writeCoils( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *src ) {
+  prepare( u8id, MB_FC_WRITE_MULTIPLE_COILS, u16add, u16no, src );
+}
+
+void ModbusTask::writeMultiple( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *src ) {
+  prepare( u8id, MB_FC_WRITE_MULTIPLE_REGISTERS, u16add, u16no, src );
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+void ModbusTask::prepare( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no, uint16_t *regs ) {
+  telegram.u8id = u8id;
+  telegram.u8fct = u8fct;
+  telegram.u16RegAdd = u16add;
+  telegram.u16CoilsNo = u16no;
+  telegram.au16reg = regs;
+}
+
+/**
+ * @brief
+ * Completion handler of the master: hand the result to the task and
+ * let it resume
+ *
+ * @ingroup task
+ */
+void ModbusSequencer::onResult( const modbus_result_t *result, void *context ) {
+  ModbusSequencer *sequencer = (ModbusSequencer *) context;
+  ModbusTask *task = sequencer->active;
+  task->result = *result;
+  task->u8state = TASK_READY;
+  sequencer->active = nullptr;
+}
+
+/**
+ * @brief
+ * Send the operation of the next queued task, round robin from the last
+ * one served so that no task can starve the others
+ *
+ * @ingroup task
+ */
+void ModbusSequencer::startNext() {
+  if (tasks == nullptr) return;
+
+  ModbusTask *first = (served != nullptr && served->next != nullptr) ? served->next : tasks;
+  ModbusTask *task = first;
+  do {
+    if (task->u8state == TASK_QUEUED) {
+      served = task;
+      active = task;
+      task->u8state = TASK_ACTIVE;
+      if (master->query( task->telegram, onResult, this ) != 0) {
+        task->result.u8status = RESULT_REJECTED;
+        task->result.u8exception = 0;
+        task->result.telegram = task->telegram;
+        task->result.u32latency = 0;
+        task->u8state = TASK_READY;
+        active = nullptr;
+      }
+      return;
+    }
+    task = (task->next != nullptr) ? task->next : tasks;
+  } while (task != first);
+}
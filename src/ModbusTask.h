@@ -0,0 +1,122 @@
+#ifndef MODBUS_TASK_H
+#define MODBUS_TASK_H
+
+/**
+ * @file 		ModbusTask.h
+ *
+ * @description
+ *  Sequential master transactions.
+ *  A ModbusTask is written as straight code: read a block, write another
+ *  one, check it, each bus operation being awaited with TASK_AWAIT(). Tasks
+ *  are stackless: they return to the ModbusSequencer at each wait and
+ *  resume on the line after it, so locals that must survive a wait are
+ *  members of the task. Many tasks share one master and interleave, one
+ *  transaction at a time, without threads and without a stack per task.
+ *
+ *  class Commissioning : public ModbusTask {
+ *    uint16_t au16cfg[ 10 ];
+ *    uint8_t run() {
+ *      TASK_BEGIN();
+ *      TASK_AWAIT( readHolding( 1, 0, 10, au16cfg ));
+ *      if (result.u8status != RESULT_OK) TASK_EXIT();
+ *      TASK_AWAIT( writeMultiple( 1, 100, 10, au16cfg ));
+ *      TASK_END();
+ *    }
+ *  };
+ *
+ * @defgroup task Modbus Master Tasks
+ */
+
+#include "ModbusRtu.h"
+
+/**
+ * @enum TASK_STATES
+ * @brief
+ * Scheduling state of a ModbusTask, also returned by ModbusTask::run()
+ */
+enum TASK_STATES {
+  TASK_READY                    = 0, //!< runs at the next sequencer poll
+  TASK_QUEUED                   = 1, //!< bus operation waiting for the master
+  TASK_ACTIVE                   = 2, //!< bus operation in flight
+  TASK_DONE                     = 3  //!< reached TASK_END() or TASK_EXIT()
+};
+
+/**
+ * Task body delimiters. Nothing but the task code may sit between them,
+ * and switch statements of the task body must not contain waits.
+ */
+#define TASK_BEGIN() switch( u16line ) { case 0:
+#define TASK_END() } u16line = 0; return TASK_DONE
+#define TASK_EXIT() do { u16line = 0; return TASK_DONE; } while (0)
+
+/**
+ * Start a bus operation and resume once it completes, result holding the outcome
+ */
+#define TASK_AWAIT( op ) do { op; u16line = __LINE__; return TASK_QUEUED; case __LINE__:; } while (0)
+
+/**
+ * Give way to the other tasks until a condition holds
+ */
+#define TASK_WAIT_UNTIL( cond ) do { u16line = __LINE__; case __LINE__: if (!(cond)) return TASK_READY; } while (0)
+
+/**
+ * @class ModbusTask
+ * @brief
+ * Sequence of master transactions, run by a ModbusSequencer.
+ * Implement run() between TASK_BEGIN() and TASK_END().
+ */
+class ModbusTask {
+  friend class ModbusSequencer;
+private:
+  uint8_t u8state; //!< TASK_STATES
+  ModbusTask *next; //!< next task of the sequencer
+  uint16_t u16value; //!< data of the single coil and register writes
+
+  void prepare( uint8_t u8id, uint8_t u8fct, uint16_t u16add, uint16_t u16no, uint16_t *regs );
+
+protected:
+  uint16_t u16line; //!< where run() resumes, 0 = from the start
+  modbus_t telegram; //!< current bus operation
+  modbus_result_t result; //!< outcome of the last awaited operation
+
+  virtual uint8_t run() = 0; //!<task body, returns a TASK_STATES
+
+  void readCoils( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest );
+  void readDiscrete( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest );
+  void readHolding( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest );
+  void readInput( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *dest );
+  void writeCoil( uint8_t u8id, uint16_t u16add, boolean bValue );
+  void writeRegister( uint8_t u8id, uint16_t u16add, uint16_t u16value );
+  void writeCoils( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *src );
+  void writeMultiple( uint8_t u8id, uint16_t u16add, uint16_t u16no, uint16_t *src );
+
+public:
+  ModbusTask();
+  virtual ~ModbusTask() {}
+  uint8_t getState(); //!<TASK_STATES
+  void restart(); //!<run again from the start
+};
+
+/**
+ * @class ModbusSequencer
+ * @brief
+ * Runs ModbusTasks on one master, serving their bus operations in turn.
+ * The sequencer owns the master: nobody else should query() it.
+ */
+class ModbusSequencer {
+private:
+  Modbus *master;
+  ModbusTask *tasks; //!< list of the added tasks
+  ModbusTask *active; //!< task whose operation is on the bus
+  ModbusTask *served; //!< last task served, the next queued one goes first
+
+  static void onResult( const modbus_result_t *result, void *context );
+  void startNext();
+
+public:
+  ModbusSequencer( Modbus *master );
+  void add( ModbusTask *task ); //!<task runs from the next poll
+  uint8_t poll(); //!<cyclic poll, returns the number of unfinished tasks
+};
+
+#endif
@@ -0,0 +1,278 @@
+// ModbusTunnel.cpp
+
+#include "ModbusTunnel.h"
+
+/**
+ * Frames longer than the engine buffer are cut to its size, the engine rejects them on their CRC
+ */
+static uint16_t frameSize( uint16_t u16size ) {
+  return (u16size < MAX_BUFFER) ? u16size : MAX_BUFFER;
+}
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Constructor of a TCP tunnel
+ *
+ * @param socket  connection to the device server
+ * @param u8role  TUNNEL_MASTER or TUNNEL_SLAVE, as the engine using the tunnel
+ * @ingroup transport
+ */
+ModbusTcpTunnel::ModbusTcpTunnel( Stream *socket, uint8_t u8role ) {
+  this->socket = socket;
+  this->u8role = u8role;
+  this->engine = nullptr;
+  this->clock = ModbusClock::hardware();
+  this->u16timeOut = MODBUS_TUNNEL_TIMEOUT;
+  this->u32lastByte = 0;
+  clear();
+}
+
+/**
+ * @brief
+ * Set the engine using the tunnel: frames of the function codes it serves
+ * or queries with setHandler() end at the length its handler gives, see
+ * Modbus::frameLength(), instead of at a silence
+ *
+ * @param engine  engine built on this tunnel, nullptr for none
+ * @ingroup transport
+ */
+void ModbusTcpTunnel::setEngine( Modbus *engine ) {
+  this->engine = engine;
+}
+
+/**
+ * @brief
+ * Set the socket silence that ends a frame the header does not size, and
+ * drops a frame received in part, e.g. after a lost segment
+ *
+ * @param u16timeOut  silence (ms), MODBUS_TUNNEL_TIMEOUT by default
+ * @ingroup transport
+ */
+void ModbusTcpTunnel::setTimeOut( uint16_t u16timeOut ) {
+  this->u16timeOut = u16timeOut;
+}
+
+/**
+ * @brief
+ * Set the time source of the tunnel
+ *
+ * @param clock  time source, nullptr restores the device clock
+ * @ingroup transport
+ */
+void ModbusTcpTunnel::setClock( ModbusClock *clock ) {
+  this->clock = (clock != nullptr) ? clock : ModbusClock::hardware();
+}
+
+/**
+ * @brief
+ * Receive from the socket up to the end of the next frame. Nothing is
+ * available until the frame is complete, so the engine never takes half
+ * a frame, whatever the TCP segments look like. After a silence of the
+ * socket, a frame of unknown length is complete, the engine checking its
+ * CRC, and a frame shorter than its header announced is dropped. Once a
+ * frame has been read, the first call says 0, as the silence ending it on
+ * the line, so the next frame is taken at the next poll of the engine.
+ *
+ * @ingroup transport
+ */
+int ModbusTcpTunnel::available() {
+  if (bEnd) {
+    bEnd = false;
+    return 0;
+  }
+  if (u16ready == 0) {
+    uint32_t u32now = clock->millis();
+    while (socket->available() > 0) {
+      au8Frame[ u16size++ ] = socket->read();
+      u32lastByte = u32now;
+
+      uint16_t u16expected = expected();
+      if (u16expected > 0 && u16size >= u16expected) {
+        u16ready = u16size;
+        break;
+      }
+    }
+
+    if (u16ready == 0 && u16size > 0 && u32now - u32lastByte >= u16timeOut) {
+      if (expected() == 0) {
+        u16ready = u16size;
+      } else {
+        clear();
+      }
+    }
+  }
+  return u16ready - u16read;
+}
+
+int ModbusTcpTunnel::read() {
+  if (available() == 0) return -1;
+
+  uint8_t u8byte = au8Frame[ u16read++ ];
+  if (u16read == u16ready) {
+    clear();
+    bEnd = true;
+  }
+  return u8byte;
+}
+
+int ModbusTcpTunnel::peek() {
+  if (bEnd || available() == 0) return -1;
+  return au8Frame[ u16read ];
+}
+
+/**
+ * @brief
+ * Nothing to wait for. The socket flush() is not called, as some
+ * clients discard their received data in flush().
+ *
+ * @ingroup transport
+ */
+void ModbusTcpTunnel::flush() {
+}
+
+size_t ModbusTcpTunnel::write( uint8_t u8byte ) {
+  return write( &u8byte, 1 );
+}
+
+/**
+ * @brief
+ * Send a frame. A master drops what is left of an earlier answer first,
+ * so that a late or broken answer cannot be taken for the next one.
+ *
+ * @ingroup transport
+ */
+size_t ModbusTcpTunnel::write( const uint8_t *buffer, size_t size ) {
+  if (u8role == TUNNEL_MASTER) clear();
+  return socket->write( buffer, size );
+}
+
+void ModbusTcpTunnel::clear() {
+  u16size = u16ready = u16read = 0;
+  bEnd = false;
+}
+
+/**
+ * @brief
+ * Constructor of a UDP tunnel
+ *
+ * @param udp  UDP socket, already started with begin()
+ * @param remote  device server address, datagrams from other hosts are ignored
+ * @param u16port  device server port
+ * @ingroup transport
+ */
+ModbusUdpTunnel::ModbusUdpTunnel( UDP *udp, IPAddress remote, uint16_t u16port ) {
+  this->udp = udp;
+  this->remote = remote;
+  this->u16port = u16port;
+  this->bEnd = false;
+}
+
+/**
+ * @brief
+ * Bytes left of the current datagram. Once it has been read entirely,
+ * the first call says 0, as the silence ending a frame on the line, and
+ * the next one takes the next datagram.
+ *
+ * @ingroup transport
+ */
+int ModbusUdpTunnel::available() {
+  int iSize = udp->available();
+  if (iSize > 0) return iSize;
+  if (bEnd) {
+    bEnd = false;
+    return 0;
+  }
+  while (iSize <= 0) {
+    iSize = udp->parsePacket();
+    if (iSize <= 0) return 0;
+    if (udp->remoteIP() != remote) {
+      while (udp->read() >= 0); // not from the device server
+      iSize = 0;
+    }
+  }
+  return iSize;
+}
+
+int ModbusUdpTunnel::read() {
+  if (available() == 0) return -1;
+
+  int iByte = udp->read();
+  if (udp->available() <= 0) bEnd = true;
+  return iByte;
+}
+
+int ModbusUdpTunnel::peek() {
+  if (bEnd || available() == 0) return -1;
+  return udp->peek();
+}
+
+void ModbusUdpTunnel::flush() {
+}
+
+size_t ModbusUdpTunnel::write( uint8_t u8byte ) {
+  return write( &u8byte, 1 );
+}
+
+/**
+ * @brief
+ * Send a frame as one datagram
+ *
+ * @ingroup transport
+ */
+size_t ModbusUdpTunnel::write( const uint8_t *buffer, size_t size ) {
+  udp->beginPacket( remote, u16port );
+  size_t written = udp->write( buffer, size );
+  udp->endPacket();
+  return written;
+}
+
+/* _____PRIVATE FUNCTIONS_____________________________________________________ */
+
+/**
+ * @brief
+ * Length of the frame being received, from its header, or from the
+ * handler of the engine for the codes registered with setHandler().
+ *
+ * @return frame length CRC included, 0 while the header is incomplete
+ * or the function code is unknown
+ * @ingroup transport
+ */
+uint16_t ModbusTcpTunnel::expected() {
+  if (u16size >= MAX_BUFFER) return u16size; // cut, rejected on its CRC
+  if (u16size < 2) return 0;
+
+  uint8_t u8fct = au8Frame[ FUNC ];
+  if (u8role == TUNNEL_MASTER) {
+    if (u8fct & 0x80) return EXCEPTION_SIZE + CHECKSUM_SIZE;
+    switch( u8fct ) {
+    case MB_FC_READ_COILS:
+    case MB_FC_READ_DISCRETE_INPUT:
+    case MB_FC_READ_REGISTERS:
+    case MB_FC_READ_INPUT_REGISTER:
+      if (u16size < 3) return 0;
+      return frameSize( 3 + au8Frame[ 2 ] + CHECKSUM_SIZE );
+    case MB_FC_WRITE_COIL:
+    case MB_FC_WRITE_REGISTER:
+    case MB_FC_WRITE_MULTIPLE_COILS:
+    case MB_FC_WRITE_MULTIPLE_REGISTERS:
+      return RESPONSE_SIZE + CHECKSUM_SIZE;
+    }
+  } else {
+    switch( u8fct ) {
+    case MB_FC_READ_COILS:
+    case MB_FC_READ_DISCRETE_INPUT:
+    case MB_FC_READ_REGISTERS:
+    case MB_FC_READ_INPUT_REGISTER:
+    case MB_FC_WRITE_COIL:
+    case MB_FC_WRITE_REGISTER:
+      return RESPONSE_SIZE + CHECKSUM_SIZE;
+    case MB_FC_WRITE_MULTIPLE_COILS:
+    case MB_FC_WRITE_MULTIPLE_REGISTERS:
+      if (u16size < BYTE_CNT + 1) return 0;
+      return frameSize( BYTE_CNT + 1 + au8Frame[ BYTE_CNT ] + CHECKSUM_SIZE );
+    }
+  }
+  return (engine != nullptr) ? frameSize( engine->frameLength( au8Frame, u16size )) : 0;
+}
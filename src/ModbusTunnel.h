@@ -0,0 +1,103 @@
+#ifndef MODBUS_TUNNEL_H
+#define MODBUS_TUNNEL_H
+
+/**
+ * @file 		ModbusTunnel.h
+ *
+ * @description
+ *  RTU over TCP and RTU over UDP transports.
+ *  Serial device servers tunnel raw RTU frames, CRC included, over a
+ *  socket. These Streams carry them for a Modbus engine built with
+ *  Modbus(u8id, Stream*), so query(), poll(), calcCRC() and
+ *  validateAnswer() work unchanged. Frames are delimited by the transport
+ *  instead of the T3.5 silence: a UDP datagram is one frame, a TCP stream
+ *  is cut at the length announced by each frame header. Codes the
+ *  header does not size, user ones or unknown, end at a silence of the
+ *  socket unless the setHandler() handler of the engine sizes them, and
+ *  a partly received frame is dropped after that silence. Once a frame is
+ *  read, available() says 0 once, so that the engine never takes two
+ *  frames waiting in the socket for one. Set the engine
+ *  setT35(0) and a time-out that suits the network.
+ *
+ * @defgroup transport Modbus RTU Tunnels
+ */
+
+#include "ModbusRtu.h"
+
+#ifndef MODBUS_TUNNEL_TIMEOUT
+#define MODBUS_TUNNEL_TIMEOUT 100	//!< socket silence ending a TCP frame (ms)
+#endif
+
+/**
+ * @enum TUNNEL_ROLE
+ * @brief
+ * Frames received through the tunnel, to predict their length
+ */
+enum TUNNEL_ROLE {
+  TUNNEL_MASTER                 = 0, //!< the engine is a master and receives answers
+  TUNNEL_SLAVE                  = 1  //!< the engine is a slave and receives requests
+};
+
+/**
+ * @class ModbusTcpTunnel
+ * @brief
+ * RTU frames over a TCP connection, typically a TCPClient
+ */
+class ModbusTcpTunnel : public Stream {
+private:
+  Stream *socket;
+  uint8_t u8role;
+  Modbus *engine; //!< engine whose handlers size user frames, nullptr = none
+  ModbusClock *clock;
+  uint16_t u16timeOut; //!< silence ending a frame (ms)
+  uint32_t u32lastByte; //!< when the last byte was received (ms)
+  uint8_t au8Frame[MAX_BUFFER]; //!< frame being received
+  uint16_t u16size; //!< bytes of au8Frame received
+  uint16_t u16ready; //!< length of the complete frame, 0 while incomplete
+  uint16_t u16read; //!< bytes of the complete frame already read by the engine
+  boolean bEnd; //!< a frame was read entirely, available() says 0 once
+
+  uint16_t expected();
+
+public:
+  ModbusTcpTunnel( Stream *socket, uint8_t u8role = TUNNEL_MASTER );
+  void setEngine( Modbus *engine ); //!<engine using the tunnel, its setHandler() handlers size their frames
+  void setTimeOut( uint16_t u16timeOut ); //!<socket silence ending a frame (ms)
+  void setClock( ModbusClock *clock ); //!<time source, share it with the engine
+
+  int available(); //!<bytes of a complete frame, 0 while it is incomplete or just read
+  int read();
+  int peek();
+  void flush();
+  size_t write( uint8_t u8byte );
+  size_t write( const uint8_t *buffer, size_t size );
+  using Print::write;
+
+  void clear(); //!<drop a partly received frame, e.g. after the socket reconnected
+};
+
+/**
+ * @class ModbusUdpTunnel
+ * @brief
+ * RTU frames over UDP, one datagram per frame
+ */
+class ModbusUdpTunnel : public Stream {
+private:
+  UDP *udp;
+  IPAddress remote; //!< device server address
+  uint16_t u16port; //!< device server port
+  boolean bEnd; //!< a datagram was read entirely, available() says 0 once
+
+public:
+  ModbusUdpTunnel( UDP *udp, IPAddress remote, uint16_t u16port );
+
+  int available(); //!<bytes left of the current datagram, 0 once it was read
+  int read();
+  int peek();
+  void flush();
+  size_t write( uint8_t u8byte );
+  size_t write( const uint8_t *buffer, size_t size );
+  using Print::write;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef MODBUS_CHECK_H
+#define MODBUS_CHECK_H
+
+/**
+ * @file 		check.h
+ *
+ * @description
+ *  Checks of the host tests: each failed CHECK() prints its line and
+ *  counts, and main() returns the count so ctest reports the test failed.
+ */
+
+#include <stdio.h>
+#include "ModbusRtu.h"
+
+static int iFails = 0;
+
+#define CHECK( cond ) do { \
+    if (!(cond)) { \
+      printf( "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #cond ); \
+      iFails++; \
+    } \
+  } while (0)
+
+/**
+ * @brief
+ * Append the Modbus CRC to a frame of u16size bytes
+ *
+ * @return size of the frame with its CRC
+ */
+static inline uint16_t addCrc( uint8_t *frame, uint16_t u16size ) {
+  uint16_t u16crc = 0xFFFF;
+  for (uint16_t i = 0; i < u16size; i++) {
+    u16crc ^= frame[ i ];
+    for (uint8_t j = 0; j < 8; j++) {
+      u16crc = (u16crc & 0x0001) ? (u16crc >> 1) ^ 0xA001 : u16crc >> 1;
+    }
+  }
+  frame[ u16size ] = lowByte( u16crc );
+  frame[ u16size + 1 ] = highByte( u16crc );
+  return u16size + 2;
+}
+
+/**
+ * @brief
+ * Print the outcome of a test
+ *
+ * @return exit code of the test
+ */
+static int checkResult( const char *szName ) {
+  printf( "%s: %d failed\n", szName, iFails );
+  return iFails == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,180 @@
+/**
+ *  Gateway test:
+ *  Modbus TCP clients on loopbacks share a simulated RS485 bus through the
+ *  gateway, on a virtual clock. Answers must echo the transaction and unit
+ *  ids, identical reads must share one bus transaction unless a write came
+ *  in between, links must be served by priority then in turns, a full
+ *  queue must answer exception 6, and a detached client must get nothing.
+ */
+
+#include "ModbusGateway.h"
+#include "ModbusBusSim.h"
+#include "ModbusClock.h"
+#include "check.h"
+
+#define LINKS 3
+
+/**
+ * @struct answer_t
+ * @brief
+ * Answer received by a client, in the order the gateway sent them
+ */
+typedef struct {
+  uint8_t u8link;
+  uint16_t u16tid;
+  uint8_t u8unit;
+  uint8_t u8fct;
+  uint16_t u16value; //!< first register read, value written or exception code
+} answer_t;
+
+ModbusVirtualClock clock;
+ModbusBusSim bus( 115200 );
+ModbusLoopback masterPort, slavePort;
+Modbus master( 0, (Stream *) &masterPort );
+Modbus slave( 1, (Stream *) &slavePort );
+ModbusGateway gateway;
+uint16_t au16regs[ 64 ];
+ModbusLoopback aClients[ LINKS ];
+int8_t ai8links[ LINKS ];
+std::vector<answer_t> answers;
+
+/**
+ * @brief
+ * Send a 5-byte PDU request, FC3 or FC6, from a client
+ */
+static void request( uint8_t u8client, uint16_t u16tid, uint8_t u8unit, uint8_t u8fct, uint16_t u16add, uint16_t u16value ) {
+  uint8_t au8adu[ MBAP_HEADER + 5 ] = { (uint8_t) highByte( u16tid ), (uint8_t) lowByte( u16tid ), 0, 0, 0, 6, u8unit,
+    u8fct, (uint8_t) highByte( u16add ), (uint8_t) lowByte( u16add ), (uint8_t) highByte( u16value ), (uint8_t) lowByte( u16value ) };
+  aClients[ u8client ].inject( au8adu, sizeof( au8adu ));
+}
+
+/**
+ * @brief
+ * Keep the answers the gateway wrote to a client
+ */
+static void collect( uint8_t u8client ) {
+  uint8_t au8adu[ MODBUS_LOOPBACK_SIZE ];
+  uint16_t u16size = aClients[ u8client ].take( au8adu, sizeof( au8adu ));
+  for (uint16_t i = 0; i + MBAP_HEADER + 1 < u16size; i += 6 + word( au8adu[ i + 4 ], au8adu[ i + 5 ] )) {
+    const uint8_t *adu = &au8adu[ i ];
+    answer_t answer = { u8client, word( adu[ 0 ], adu[ 1 ] ), adu[ 6 ], adu[ 7 ], 0 };
+    if (answer.u8fct & 0x80) answer.u16value = adu[ 8 ];
+    else if (answer.u8fct == MB_FC_READ_REGISTERS) answer.u16value = word( adu[ 9 ], adu[ 10 ] );
+    else answer.u16value = word( adu[ 10 ], adu[ 11 ] );
+    answers.push_back( answer );
+  }
+}
+
+/**
+ * @brief
+ * Run the gateway and the bus for 500 ms of simulated time
+ *
+ * @return bus transactions done
+ */
+static uint16_t run() {
+  uint16_t u16start = slave.getInCnt();
+  answers.clear();
+  for (uint16_t i = 0; i < 10000; i++) {
+    gateway.poll();
+    bus.poll();
+    for (uint8_t j = 0; j < LINKS; j++) collect( j );
+    clock.advance( 50 );
+  }
+  return slave.getInCnt() - u16start;
+}
+
+/**
+ * @brief
+ * Position of the answer of a transaction, -1 if it did not come
+ */
+static int16_t find( uint8_t u8client, uint16_t u16tid ) {
+  for (uint16_t i = 0; i < answers.size(); i++) {
+    if (answers[ i ].u8link == u8client && answers[ i ].u16tid == u16tid) return i;
+  }
+  return -1;
+}
+
+int main() {
+  master.setClock( &clock );
+  slave.setClock( &clock );
+  bus.setClock( &clock );
+  master.begin( 115200 );
+  slave.begin( 115200 );
+  master.setTimeOut( 20 );
+  bus.attach( &masterPort );
+  bus.addSlave( &slave, &slavePort, au16regs, 64 );
+  for (uint16_t i = 0; i < 64; i++) au16regs[ i ] = 0x100 + i;
+
+  CHECK( gateway.addBus( &master, 1, 10 ) == 0 );
+  CHECK( (ai8links[ 0 ] = gateway.attach( &aClients[ 0 ], 0 )) == 0 );
+  CHECK( (ai8links[ 1 ] = gateway.attach( &aClients[ 1 ], 1 )) == 1 );
+  CHECK( (ai8links[ 2 ] = gateway.attach( &aClients[ 2 ], 1 )) == 2 );
+
+  // transaction and unit ids come back, a unit without bus is refused
+  request( 1, 0xBEEF, 1, MB_FC_READ_REGISTERS, 5, 1 );
+  request( 1, 0xCAFE, 11, MB_FC_READ_REGISTERS, 5, 1 );
+  CHECK( run() == 1 );
+  CHECK( answers.size() == 2 );
+  CHECK( find( 1, 0xBEEF ) >= 0 && answers[ find( 1, 0xBEEF ) ].u8unit == 1 && answers[ find( 1, 0xBEEF ) ].u16value == 0x105 );
+  CHECK( find( 1, 0xCAFE ) >= 0 && answers[ find( 1, 0xCAFE ) ].u8fct == (MB_FC_READ_REGISTERS | 0x80) );
+  CHECK( find( 1, 0xCAFE ) >= 0 && answers[ find( 1, 0xCAFE ) ].u16value == EXC_GW_PATH );
+
+  // identical reads of two clients share one transaction
+  request( 1, 1, 1, MB_FC_READ_REGISTERS, 7, 2 );
+  request( 2, 2, 1, MB_FC_READ_REGISTERS, 7, 2 );
+  CHECK( run() == 1 );
+  CHECK( gateway.getMerged() == 1 );
+  CHECK( answers.size() == 2 && answers[ 0 ].u16value == 0x107 && answers[ 1 ].u16value == 0x107 );
+
+  // a read after a write to the same unit sees the write
+  request( 1, 10, 1, MB_FC_READ_REGISTERS, 0, 1 );
+  request( 2, 11, 1, MB_FC_WRITE_REGISTER, 0, 0x5555 );
+  request( 2, 12, 1, MB_FC_READ_REGISTERS, 0, 1 );
+  CHECK( run() == 3 );
+  CHECK( gateway.getMerged() == 1 );
+  CHECK( find( 2, 11 ) >= 0 && find( 2, 11 ) < find( 2, 12 ));
+  CHECK( find( 2, 12 ) >= 0 && answers[ find( 2, 12 ) ].u16value == 0x5555 );
+
+  // priority first, then the links of a priority take turns
+  for (uint8_t i = 0; i < 3; i++) {
+    request( 1, 20 + i, 1, MB_FC_READ_REGISTERS, 20 + i, 1 );
+    request( 2, 30 + i, 1, MB_FC_READ_REGISTERS, 30 + i, 1 );
+  }
+  request( 0, 40, 1, MB_FC_READ_REGISTERS, 40, 1 );
+  run();
+  CHECK( answers.size() == 7 && find( 0, 40 ) == 0 );
+  for (uint8_t i = 0; i < 3; i++) {
+    CHECK( find( 1, 20 + i ) >= 0 && find( 2, 30 + i ) >= 0 && (find( 1, 20 + i ) - 1) / 2 == (find( 2, 30 + i ) - 1) / 2 );
+  }
+
+  // a read merged with one of a priority 0 client is served at priority 0
+  for (uint8_t i = 0; i < 3; i++) {
+    request( 1, 50 + i, 1, MB_FC_READ_REGISTERS, 50 + i, 1 );
+    request( 2, 55 + i, 1, MB_FC_READ_REGISTERS, 55 + i, 1 );
+  }
+  request( 1, 60, 1, MB_FC_READ_REGISTERS, 60, 1 );
+  gateway.poll(); // 60 queued behind the older reads of its link, one of them on the bus
+  request( 0, 61, 1, MB_FC_READ_REGISTERS, 60, 1 );
+  CHECK( run() == 7 );
+  CHECK( answers.size() == 8 && find( 0, 61 ) >= 1 && find( 0, 61 ) <= 2 && find( 1, 60 ) >= 1 && find( 1, 60 ) <= 2 );
+
+  // a full queue answers exception 6 at once
+  for (uint8_t i = 0; i <= MODBUS_GW_PENDING; i++) request( 1, 70 + i, 1, MB_FC_READ_REGISTERS, i, 1 );
+  CHECK( run() == MODBUS_GW_PENDING );
+  CHECK( answers.size() == MODBUS_GW_PENDING + 1 && answers[ 0 ].u16tid == 70 + MODBUS_GW_PENDING );
+  CHECK( answers[ 0 ].u8fct == (MB_FC_READ_REGISTERS | 0x80) && answers[ 0 ].u16value == EXC_SLAVE_BUSY );
+
+  // a client that left gets nothing, its reads others wait for are still done
+  request( 1, 80, 1, MB_FC_READ_REGISTERS, 1, 1 );
+  request( 1, 81, 1, MB_FC_READ_REGISTERS, 2, 1 );
+  request( 2, 82, 1, MB_FC_READ_REGISTERS, 3, 1 );
+  request( 0, 83, 1, MB_FC_READ_REGISTERS, 2, 1 );
+  gateway.poll(); // 81 on the bus at the priority of 83
+  gateway.detach( ai8links[ 1 ] );
+  CHECK( run() == 2 );
+  CHECK( answers.size() == 2 && find( 0, 83 ) >= 0 && find( 2, 82 ) >= 0 );
+  CHECK( answers.size() == 2 && answers[ 0 ].u16value == 0x102 && answers[ 1 ].u16value == 0x103 );
+  CHECK( !gateway.isAttached( &aClients[ 1 ] ));
+
+  return checkResult( "gateway_test" );
+}
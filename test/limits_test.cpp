@@ -0,0 +1,221 @@
+/**
+ *  Protocol limits test:
+ *  A master and a slave exchange the largest requests of each function
+ *  code over loopbacks on a virtual clock: 125 registers for FC3/4, 123
+ *  for FC16, 2000 coils for FC1/2, 1968 for FC15, and a 256-byte ADU both
+ *  ways through a user function code. One more than each maximum must be
+ *  refused: by query() on the master, by an exception on the slave, and
+ *  a 257-byte frame as a buffer overflow.
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusLoopback.h"
+#include "ModbusClock.h"
+#include "check.h"
+
+#define MB_FC_ECHO 65 //!< user function code answering its request data
+
+ModbusVirtualClock clock;
+ModbusLoopback masterPort, slavePort;
+Modbus master( 0, (Stream *) &masterPort );
+Modbus slave( 1, (Stream *) &slavePort );
+uint16_t au16regs[ 128 ]; //!< slave map: 2048 coils
+uint16_t au16data[ 128 ]; //!< master data
+modbus_result_t lastResult;
+
+/**
+ * @brief
+ * Completion handler of the master: keeps the result
+ */
+static void onResult( const modbus_result_t *result, void *context ) {
+  lastResult = *result;
+}
+
+/**
+ * @brief
+ * FC65 handler: the master sends telegram.u16CoilsNo bytes, the slave
+ * answers what it received
+ */
+static uint8_t echo( modbus_pdu_t *pdu, void *context ) {
+  switch( pdu->u8stage ) {
+  case FCT_REQUEST:
+    for (uint16_t i = 0; i < pdu->telegram->u16CoilsNo; i++) pdu->pdu[ 1 + i ] = (uint8_t) (i + 1);
+    pdu->u16size = 1 + pdu->telegram->u16CoilsNo;
+    return 0;
+  case FCT_SERVE:
+    return 0; // the request data is the answer
+  case FCT_ANSWER:
+    for (uint16_t i = 1; i < pdu->u16size; i++) {
+      if (pdu->pdu[ i ] != (uint8_t) i) return NO_REPLY;
+    }
+    return (pdu->u16size == 1 + pdu->telegram->u16CoilsNo) ? 0 : NO_REPLY;
+  }
+  return EXC_FUNC_CODE;
+}
+
+/**
+ * @brief
+ * Move bytes between the engines until both are done with a query
+ *
+ * @return bytes of the answer of the slave
+ */
+static uint16_t exchange() {
+  uint8_t au8frame[ 2 * MAX_BUFFER ];
+  uint16_t u16answer = 0;
+  lastResult.u8status = RESULT_TIMEOUT;
+  for (uint8_t i = 0; i < 20; i++) {
+    uint16_t u16size = masterPort.take( au8frame, sizeof( au8frame ));
+    slavePort.inject( au8frame, u16size );
+    slave.poll( au16regs, 128 );
+    u16size = slavePort.take( au8frame, sizeof( au8frame ));
+    u16answer += u16size;
+    masterPort.inject( au8frame, u16size );
+    master.poll();
+    clock.advance( 1000 );
+  }
+  return u16answer;
+}
+
+/**
+ * @brief
+ * Let the slave read what is left on its port
+ */
+static void idle() {
+  for (uint8_t i = 0; i < 10; i++) {
+    slave.poll( au16regs, 128 );
+    clock.advance( 1000 );
+  }
+}
+
+/**
+ * @brief
+ * Send a request straight to the slave, e.g. one query() would refuse
+ *
+ * @return bytes of the answer, its first bytes copied to answer
+ */
+static uint16_t request( uint8_t *frame, uint16_t u16size, uint8_t *answer ) {
+  uint8_t au8frame[ 2 * MAX_BUFFER ];
+  slavePort.inject( frame, u16size );
+  idle();
+  u16size = slavePort.take( au8frame, sizeof( au8frame ));
+  memcpy( answer, au8frame, u16size < 8 ? u16size : 8 );
+  return u16size;
+}
+
+/**
+ * @brief
+ * Query the maximum of a function code, then check one more is refused
+ */
+static void checkQuery( uint8_t u8fct, uint16_t u16max, uint16_t u16answer ) {
+  modbus_t telegram = { 1, u8fct, 0, u16max, au16data };
+  CHECK( master.query( telegram, onResult, nullptr ) == 0 );
+  CHECK( exchange() == u16answer );
+  CHECK( lastResult.u8status == RESULT_OK );
+
+  telegram.u16CoilsNo = u16max + 1;
+  CHECK( master.query( telegram, onResult, nullptr ) == -4 );
+  telegram.u16CoilsNo = 0;
+  CHECK( master.query( telegram, onResult, nullptr ) == -4 );
+}
+
+/**
+ * @brief
+ * Send a read of u16no elements straight to the slave
+ *
+ * @return exception code of the answer, 0 if none
+ */
+static uint8_t readException( uint8_t u8fct, uint16_t u16no ) {
+  uint8_t au8frame[ 8 ] = { 1, u8fct, 0, 0, (uint8_t) highByte( u16no ), (uint8_t) lowByte( u16no ) };
+  uint8_t au8answer[ 8 ];
+  uint16_t u16size = request( au8frame, addCrc( au8frame, 6 ), au8answer );
+  return (u16size == 5 && au8answer[ 1 ] == (u8fct | 0x80)) ? au8answer[ 2 ] : 0;
+}
+
+/**
+ * @brief
+ * Send a write of u16no elements and u8bytes data bytes straight to the slave
+ *
+ * @return bytes of the answer, its exception code or 0 in u8exception
+ */
+static uint16_t writeRequest( uint8_t u8fct, uint16_t u16no, uint8_t u8bytes, uint8_t *u8exception ) {
+  uint8_t au8frame[ MAX_BUFFER + 2 ] = { 1, u8fct, 0, 0, (uint8_t) highByte( u16no ), (uint8_t) lowByte( u16no ), u8bytes };
+  uint8_t au8answer[ 8 ];
+  memset( &au8frame[ 7 ], 0x5A, u8bytes );
+  uint16_t u16size = request( au8frame, addCrc( au8frame, 7 + u8bytes ), au8answer );
+  *u8exception = (u16size == 5 && au8answer[ 1 ] == (u8fct | 0x80)) ? au8answer[ 2 ] : 0;
+  return u16size;
+}
+
+int main() {
+  master.setClock( &clock );
+  slave.setClock( &clock );
+  master.begin( 115200 );
+  slave.begin( 115200 );
+  master.setTimeOut( 100 );
+  CHECK( master.setHandler( MB_FC_ECHO, echo ) == 0 );
+  CHECK( slave.setHandler( MB_FC_ECHO, echo ) == 0 );
+  for (uint16_t i = 0; i < 128; i++) au16regs[ i ] = 0xA000 + i;
+
+  // FC3/FC4: 125 registers, a 255-byte answer
+  checkQuery( MB_FC_READ_REGISTERS, MB_MAX_READ_REGISTERS, 3 + 2 * 125 + 2 );
+  CHECK( au16data[ 0 ] == 0xA000 && au16data[ 124 ] == 0xA000 + 124 );
+  checkQuery( MB_FC_READ_INPUT_REGISTER, MB_MAX_READ_REGISTERS, 3 + 2 * 125 + 2 );
+  CHECK( readException( MB_FC_READ_REGISTERS, 126 ) == EXC_REGS_QUANT );
+  CHECK( readException( MB_FC_READ_INPUT_REGISTER, 126 ) == EXC_REGS_QUANT );
+
+  // FC1/FC2: 2000 coils, a 255-byte answer
+  memset( au16data, 0, sizeof( au16data ));
+  checkQuery( MB_FC_READ_COILS, MB_MAX_READ_COILS, 3 + 250 + 2 );
+  CHECK( au16data[ 0 ] == 0xA000 && au16data[ 124 ] == 0xA000 + 124 );
+  checkQuery( MB_FC_READ_DISCRETE_INPUT, MB_MAX_READ_COILS, 3 + 250 + 2 );
+  CHECK( readException( MB_FC_READ_COILS, 2001 ) == EXC_REGS_QUANT );
+  CHECK( readException( MB_FC_READ_DISCRETE_INPUT, 2001 ) == EXC_REGS_QUANT );
+
+  // FC16: 123 registers, a 255-byte request
+  for (uint16_t i = 0; i < 123; i++) au16data[ i ] = 0xB000 + i;
+  checkQuery( MB_FC_WRITE_MULTIPLE_REGISTERS, MB_MAX_WRITE_REGISTERS, 8 );
+  CHECK( au16regs[ 0 ] == 0xB000 && au16regs[ 122 ] == 0xB000 + 122 && au16regs[ 123 ] == 0xA000 + 123 );
+  uint8_t u8exception;
+  CHECK( writeRequest( MB_FC_WRITE_MULTIPLE_REGISTERS, 124, 248, &u8exception ) == 0 ); // 257 bytes
+  CHECK( slave.getLastError() == (uint8_t) ERR_BUFF_OVERFLOW );
+  idle(); // the byte left over
+  CHECK( writeRequest( MB_FC_WRITE_MULTIPLE_REGISTERS, 124, 246, &u8exception ) == 5 );
+  CHECK( u8exception == EXC_REGS_QUANT );
+
+  // FC15: 1968 coils, a 255-byte request
+  for (uint16_t i = 0; i < 123; i++) au16data[ i ] = 0x5555;
+  checkQuery( MB_FC_WRITE_MULTIPLE_COILS, MB_MAX_WRITE_COILS, 8 );
+  CHECK( au16regs[ 0 ] == 0x5555 && au16regs[ 122 ] == 0x5555 && au16regs[ 123 ] == 0xA000 + 123 );
+  CHECK( writeRequest( MB_FC_WRITE_MULTIPLE_COILS, 1969, 247, &u8exception ) == 5 ); // 256 bytes
+  CHECK( u8exception == EXC_REGS_QUANT );
+
+  // a 256-byte ADU each way: 252 data bytes after the function code
+  modbus_t telegram = { 1, MB_FC_ECHO, 0, 252, au16data };
+  CHECK( master.query( telegram, onResult, nullptr ) == 0 );
+  CHECK( exchange() == MAX_BUFFER );
+  CHECK( lastResult.u8status == RESULT_OK );
+
+  // 257 bytes: the slave does not answer, the master takes no answer
+  uint8_t au8frame[ MAX_BUFFER + 2 ] = { 1, MB_FC_ECHO };
+  uint8_t au8answer[ 8 ];
+  for (uint16_t i = 0; i < 253; i++) au8frame[ 2 + i ] = (uint8_t) (i + 1);
+  CHECK( request( au8frame, addCrc( au8frame, 255 ), au8answer ) == 0 );
+  CHECK( slave.getLastError() == (uint8_t) ERR_BUFF_OVERFLOW );
+  idle();
+
+  telegram.u16CoilsNo = 251;
+  CHECK( master.query( telegram, onResult, nullptr ) == 0 );
+  uint8_t au8request[ MAX_BUFFER ];
+  CHECK( masterPort.take( au8request, sizeof( au8request )) == MAX_BUFFER - 1 );
+  au8frame[ 0 ] = 1;
+  masterPort.inject( au8frame, addCrc( au8frame, 255 ));
+  lastResult.u8status = RESULT_TIMEOUT;
+  for (uint8_t i = 0; i < 200 && master.getState() != COM_IDLE; i++) {
+    master.poll();
+    clock.advance( 1000 );
+  }
+  CHECK( master.getState() == COM_IDLE );
+  CHECK( lastResult.u8status != RESULT_OK );
+
+  return checkResult( "limits_test" );
+}
@@ -0,0 +1,159 @@
+/**
+ *  Sniffer test:
+ *  Streams request and answer frames back to back at 115200 bps into a
+ *  sniffer, one byte per character time on a virtual clock, with the
+ *  shortest silences the line allows between frames. The sniffer is
+ *  polled as a slow loop() would, so frames pile up in its buffer and
+ *  splitFrame() has to cut them again. Every frame must reach the
+ *  capture whole, with a good CRC, in order.
+ */
+
+#include "ModbusRtu.h"
+#include "ModbusLoopback.h"
+#include "ModbusClock.h"
+#include "check.h"
+
+#define BAUD 115200
+#define FRAMES 600
+
+/**
+ * @class CaptureSink
+ * @brief
+ * Keeps what the sniffer writes
+ */
+class CaptureSink : public Print {
+public:
+  std::vector<uint8_t> data;
+  size_t write( uint8_t u8byte ) { data.push_back( u8byte ); return 1; }
+  using Print::write;
+};
+
+/**
+ * @brief
+ * Whether a CRC matches before the end of a frame: splitFrame() cuts
+ * such a frame there, on the line as well. One in 65536 prefixes does.
+ */
+static boolean splitsEarly( const uint8_t *frame, uint16_t u16size ) {
+  uint8_t au8prefix[ MAX_BUFFER + 2 ];
+  for (uint16_t i = 2; i + 2 < u16size; i++) {
+    memcpy( au8prefix, frame, i );
+    addCrc( au8prefix, i );
+    if (au8prefix[ i ] == frame[ i ] && au8prefix[ i + 1 ] == frame[ i + 1 ]) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief
+ * Frame i of the stream: FC3 and FC16 requests, each followed by its
+ * answer, every eighth answer being an exception
+ *
+ * @return size of the frame
+ */
+static uint16_t makeFrame( uint16_t i, uint8_t *frame ) {
+  uint16_t u16pair = i / 2;
+  uint8_t u8id = 1 + u16pair % 247;
+  uint16_t u16regs = 1 + (u16pair * 37) % 123; // up to 123 for FC16
+  boolean bWrite = (u16pair % 3 == 2);
+  uint16_t u16size = 0;
+
+  frame[ u16size++ ] = u8id;
+  if (i % 2 == 1 && u16pair % 8 == 7) {
+    frame[ u16size++ ] = (bWrite ? MB_FC_WRITE_MULTIPLE_REGISTERS : MB_FC_READ_REGISTERS) | 0x80;
+    frame[ u16size++ ] = EXC_ADDR_RANGE;
+    return addCrc( frame, u16size );
+  }
+
+  frame[ u16size++ ] = bWrite ? MB_FC_WRITE_MULTIPLE_REGISTERS : MB_FC_READ_REGISTERS;
+  if (i % 2 == 0 || bWrite) {
+    frame[ u16size++ ] = highByte( u16pair );
+    frame[ u16size++ ] = lowByte( u16pair );
+    frame[ u16size++ ] = highByte( u16regs );
+    frame[ u16size++ ] = lowByte( u16regs );
+  }
+  if ((i % 2 == 0 && bWrite) || (i % 2 == 1 && !bWrite)) {
+    frame[ u16size++ ] = 2 * u16regs;
+    uint16_t u16data = u16size;
+    for (uint16_t j = 0; j < 2 * u16regs; j++) frame[ u16size++ ] = (uint8_t) (i * 7 + j * 13);
+    // data that looks like two frames would not be one on the line either
+    while (splitsEarly( frame, addCrc( frame, u16size ))) frame[ u16data ]++;
+  }
+  return addCrc( frame, u16size );
+}
+
+/**
+ * @brief
+ * Stream the frames into a sniffer polled every u32period us
+ *
+ * @param u32gap  silence between frames (us)
+ */
+static void streamFrames( uint32_t u32period, uint32_t u32gap ) {
+  ModbusVirtualClock clock;
+  ModbusLoopback line;
+  Modbus sniffer( MODBUS_SNIFFER, (Stream *) &line );
+  CaptureSink sink;
+  sniffer.setClock( &clock );
+  sniffer.begin( BAUD );
+  sniffer.setCapture( &sink );
+
+  uint32_t u32char = 11000000UL / BAUD;
+  uint32_t u32next = clock.micros(); // arrival of the next byte
+  uint32_t u32poll = clock.micros() + u32period;
+  uint8_t au8frame[ MAX_BUFFER + 2 ];
+
+  for (uint16_t i = 0; i < FRAMES; i++) {
+    uint16_t u16size = makeFrame( i, au8frame );
+    for (uint16_t j = 0; j < u16size; j++) {
+      while ((int32_t) (u32poll - u32next) <= 0) {
+        clock.advance( u32poll - clock.micros() );
+        sniffer.sniff();
+        u32poll += u32period;
+      }
+      clock.advance( u32next - clock.micros() );
+      line.inject( &au8frame[ j ], 1 );
+      u32next += u32char;
+    }
+    u32next += u32gap;
+  }
+  for (uint8_t i = 0; i < 10; i++) {
+    clock.advance( 1000 );
+    sniffer.sniff();
+  }
+
+  CHECK( line.getDropCnt() == 0 );
+  CHECK( sniffer.getInCnt() == FRAMES );
+  CHECK( sniffer.getErrCnt() == 0 );
+
+  // every record is the frame sent, paired as sent
+  CHECK( sink.data.size() >= 10 && sink.data[ 4 ] == MODBUS_CAPTURE_VERSION );
+  uint32_t u32pos = 10; // capture header
+  uint16_t u16frames = 0;
+  while (u32pos + 7 <= sink.data.size() && u16frames < FRAMES) {
+    uint8_t u8flags = sink.data[ u32pos + 4 ];
+    uint16_t u16record = word( sink.data[ u32pos + 6 ], sink.data[ u32pos + 5 ] );
+    uint16_t u16size = makeFrame( u16frames, au8frame );
+    u32pos += 7;
+    if (u16record != u16size || u32pos + u16record > sink.data.size() ||
+      memcmp( &sink.data[ u32pos ], au8frame, u16size ) != 0) {
+      printf( "period %u gap %u: frame %u differs\n", u32period, u32gap, u16frames );
+      CHECK( false );
+      return;
+    }
+    CHECK( u8flags == ((u16frames % 2 == 0) ? CAPTURE_REQUEST : CAPTURE_RESPONSE) );
+    u32pos += u16record;
+    u16frames++;
+  }
+  CHECK( u16frames == FRAMES );
+  CHECK( u32pos == sink.data.size() );
+}
+
+int main() {
+  const uint32_t au32periods[] = { 100, 1000, 3000, 10000 }; // loop() period (us)
+  const uint32_t au32gaps[] = { 1750, 1000, 350 }; // T3.5 above 19200 bps, then 3.5 characters
+  for (uint8_t i = 0; i < sizeof( au32periods ) / sizeof( au32periods[ 0 ] ); i++) {
+    for (uint8_t j = 0; j < sizeof( au32gaps ) / sizeof( au32gaps[ 0 ] ); j++) {
+      streamFrames( au32periods[ i ], au32gaps[ j ] );
+    }
+  }
+  return checkResult( "sniff_test" );
+}
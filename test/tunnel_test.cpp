@@ -0,0 +1,209 @@
+/**
+ *  Tunnel test:
+ *  A master and a slave talk RTU over TCP through loopbacks standing for
+ *  the sockets, the bytes going across in random chunks, and RTU over UDP
+ *  through the in-memory UDP socket of the host build, on a virtual clock.
+ *  Frames waiting back to back in a socket must be taken one by one,
+ *  datagrams of other hosts ignored, frames the header does not size
+ *  ended by a silence or by their handler, and a partial frame dropped.
+ */
+
+#include "ModbusTunnel.h"
+#include "ModbusLoopback.h"
+#include "ModbusClock.h"
+#include "check.h"
+
+#define MB_FC_VENDOR 66 //!< user function code: byte count then data
+
+ModbusVirtualClock clock;
+uint16_t au16regs[ 40 ];
+
+/**
+ * @brief
+ * FC66 handler of the slave: sizes the request from its byte count and
+ * answers it unchanged
+ */
+static uint8_t vendor( modbus_pdu_t *pdu, void *context ) {
+  switch( pdu->u8stage ) {
+  case FCT_LENGTH:
+    if (pdu->u16room >= 2) pdu->u16size = 2 + pdu->pdu[ 1 ];
+    return 0;
+  case FCT_SERVE:
+    return 0;
+  }
+  return EXC_FUNC_CODE;
+}
+
+/**
+ * @brief
+ * Poll a slave for 10 ms of simulated time
+ */
+static void idle( Modbus *slave ) {
+  for (uint8_t i = 0; i < 10; i++) {
+    slave->poll( au16regs, 40 );
+    clock.advance( 1000 );
+  }
+}
+
+/**
+ * @brief
+ * Queries between a master and a slave over TCP, the bytes moved by
+ * chunks of 1 to 5 at random times
+ */
+static void tcpQueries() {
+  ModbusLoopback masterSocket, slaveSocket;
+  ModbusTcpTunnel masterTunnel( &masterSocket, TUNNEL_MASTER ), slaveTunnel( &slaveSocket, TUNNEL_SLAVE );
+  masterTunnel.setClock( &clock );
+  slaveTunnel.setClock( &clock );
+  Modbus master( 0, (Stream *) &masterTunnel );
+  Modbus slave( 1, (Stream *) &slaveTunnel );
+  master.setClock( &clock );
+  slave.setClock( &clock );
+  master.begin( 115200 );
+  slave.begin( 115200 );
+  master.setT35( 0 );
+  slave.setT35( 0 );
+  master.setTimeOut( 200 );
+
+  for (uint16_t i = 0; i < 40; i++) au16regs[ i ] = i * 7;
+  uint16_t au16data[ 40 ];
+  uint16_t au16write[ 3 ] = { 1, 2, 3 };
+  uint32_t u32seed = 5;
+  uint16_t u16ok = 0;
+  for (uint16_t i = 0; i < 300; i++) {
+    modbus_t telegram = { 1, MB_FC_READ_REGISTERS, (uint16_t) (i % 20), (uint16_t) (1 + i % 20), au16data };
+    if (i % 3 == 2) telegram = { 1, MB_FC_WRITE_MULTIPLE_REGISTERS, 30, 3, au16write };
+    master.query( telegram );
+    for (uint16_t j = 0; j < 1000 && master.getState() != COM_IDLE; j++) {
+      uint8_t au8chunk[ 8 ];
+      u32seed ^= u32seed << 13;
+      u32seed ^= u32seed >> 17;
+      u32seed ^= u32seed << 5;
+      uint16_t u16size = masterSocket.take( au8chunk, 1 + u32seed % 5 );
+      slaveSocket.inject( au8chunk, u16size );
+      u16size = slaveSocket.take( au8chunk, 1 + (u32seed >> 8) % 5 );
+      masterSocket.inject( au8chunk, u16size );
+      slave.poll( au16regs, 40 );
+      master.poll();
+      clock.advance( 300 );
+    }
+    if (master.getLastError() == 0 && (telegram.u8fct == MB_FC_WRITE_MULTIPLE_REGISTERS ||
+      au16data[ 0 ] == telegram.u16RegAdd * 7)) u16ok++;
+  }
+  CHECK( u16ok == 300 );
+  CHECK( au16regs[ 30 ] == 1 && au16regs[ 32 ] == 3 );
+}
+
+/**
+ * @brief
+ * Frames waiting back to back, sized by a handler, of unknown length or
+ * cut, sent to a slave over TCP
+ */
+static void tcpFrames() {
+  ModbusLoopback socket;
+  ModbusTcpTunnel tunnel( &socket, TUNNEL_SLAVE );
+  tunnel.setClock( &clock );
+  Modbus slave( 1, (Stream *) &tunnel );
+  slave.setClock( &clock );
+  slave.begin( 115200 );
+  slave.setT35( 0 );
+  CHECK( slave.setHandler( MB_FC_VENDOR, vendor ) == 0 );
+  tunnel.setEngine( &slave );
+  uint8_t au8answer[ 64 ];
+
+  // two requests in one segment, two answers
+  uint8_t au8frames[ 16 ] = { 1, MB_FC_READ_REGISTERS, 0, 2, 0, 1 };
+  addCrc( au8frames, 6 );
+  au8frames[ 8 ] = 1;
+  au8frames[ 9 ] = MB_FC_WRITE_REGISTER;
+  au8frames[ 10 ] = 0;
+  au8frames[ 11 ] = 3;
+  au8frames[ 12 ] = 0x12;
+  au8frames[ 13 ] = 0x34;
+  socket.inject( au8frames, addCrc( &au8frames[ 8 ], 6 ) + 8 );
+  idle( &slave );
+  CHECK( socket.take( au8answer, sizeof( au8answer )) == 7 + 8 );
+  CHECK( au8answer[ 1 ] == MB_FC_READ_REGISTERS && au8answer[ 7 ] == 1 && au8answer[ 8 ] == MB_FC_WRITE_REGISTER );
+  CHECK( au16regs[ 3 ] == 0x1234 );
+
+  // a user code sized by its handler, answered without waiting for a silence
+  uint8_t au8vendor[ 8 ] = { 1, MB_FC_VENDOR, 3, 9, 9, 9 };
+  socket.inject( au8vendor, addCrc( au8vendor, 6 ));
+  slave.poll( au16regs, 40 );
+  slave.poll( au16regs, 40 );
+  CHECK( socket.take( au8answer, sizeof( au8answer )) == 8 );
+
+  // an unknown code ends at the silence, and is refused
+  uint8_t au8unknown[ 6 ] = { 1, 70, 1, 2 };
+  socket.inject( au8unknown, addCrc( au8unknown, 4 ));
+  idle( &slave );
+  CHECK( socket.take( au8answer, sizeof( au8answer )) == 0 );
+  for (uint8_t i = 0; i < 20; i++) idle( &slave );
+  CHECK( socket.take( au8answer, sizeof( au8answer )) == 5 );
+  CHECK( au8answer[ 1 ] == (70 | 0x80) && au8answer[ 2 ] == EXC_FUNC_CODE );
+
+  // a partial frame is dropped at the silence, the next one is served
+  socket.inject( au8frames, 3 );
+  for (uint8_t i = 0; i < 20; i++) idle( &slave );
+  socket.inject( au8frames, 8 );
+  idle( &slave );
+  CHECK( socket.take( au8answer, sizeof( au8answer )) == 7 );
+}
+
+/**
+ * @brief
+ * Datagrams waiting back to back, some of another host, for a master and
+ * a slave over UDP
+ */
+static void udpFrames() {
+  IPAddress server( 10, 0, 0, 9 ), other( 10, 0, 0, 8 );
+  UDP masterUdp, slaveUdp;
+  ModbusUdpTunnel masterTunnel( &masterUdp, server, 4001 ), slaveTunnel( &slaveUdp, server, 4001 );
+  Modbus master( 0, (Stream *) &masterTunnel );
+  Modbus slave( 1, (Stream *) &slaveTunnel );
+  master.setClock( &clock );
+  slave.setClock( &clock );
+  master.begin( 115200 );
+  slave.begin( 115200 );
+  master.setT35( 0 );
+  slave.setT35( 0 );
+  master.setTimeOut( 200 );
+
+  // two requests and a stray datagram between them, two answers
+  uint8_t au8request[ 8 ] = { 1, MB_FC_READ_REGISTERS, 0, 5, 0, 1 };
+  std::vector<uint8_t> request( au8request, au8request + addCrc( au8request, 6 ));
+  slaveUdp.inq.push_back( { server, request } );
+  slaveUdp.inq.push_back( { other, { 1, 2, 3 } } );
+  slaveUdp.inq.push_back( { server, request } );
+  idle( &slave );
+  CHECK( slaveUdp.sent.size() == 2 );
+  CHECK( slaveUdp.sent.size() == 2 && slaveUdp.sent[ 1 ].size() == 7 && slaveUdp.sent[ 1 ][ 4 ] == 35 );
+
+  // the master ignores a stray datagram and takes the answer
+  uint16_t au16data[ 4 ];
+  modbus_t telegram = { 1, MB_FC_READ_REGISTERS, 4, 4, au16data };
+  uint16_t u16ok = 0;
+  slaveUdp.sent.clear();
+  for (uint16_t i = 0; i < 100; i++) {
+    au16data[ 3 ] = 0;
+    CHECK( master.query( telegram ) == 0 );
+    slaveUdp.inq.push_back( { server, masterUdp.sent.back() } );
+    if (i % 10 == 0) masterUdp.inq.push_back( { other, { 1, 3, 2, 0, 0 } } );
+    for (uint8_t j = 0; j < 50 && master.getState() != COM_IDLE; j++) {
+      slave.poll( au16regs, 40 );
+      for (uint8_t k = 0; k < slaveUdp.sent.size(); k++) masterUdp.inq.push_back( { server, slaveUdp.sent[ k ] } );
+      slaveUdp.sent.clear();
+      master.poll();
+      clock.advance( 300 );
+    }
+    if (master.getLastError() == 0 && au16data[ 3 ] == 7 * 7) u16ok++;
+  }
+  CHECK( u16ok == 100 );
+}
+
+int main() {
+  tcpQueries();
+  tcpFrames();
+  udpFrames();
+  return checkResult( "tunnel_test" );
+}